@@ -0,0 +1,142 @@
+/**
+ * @file    src/bms_monitor.c
+ * @brief   Battery cell summaries and alerts.
+ * @details The receiver hands every frame to the aggregator, see
+ *          can_bms.c. Cell frames are taken and not captured, their
+ *          alerts enter the stream in order with the frames around
+ *          them. The output thread sends the summaries at the set
+ *          period.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include "bms_monitor.h"
+
+typedef struct {
+    const CanRecord *frame;
+    bmsemitcb_t emit;
+} EmitContext;
+
+static CanBms bms;
+static volatile uint32_t bmsPeriodMs;
+
+static MUTEX_DECL(bmsMutex);
+
+static void emit_alert(const CanBmsAlert *alert, void *arg)
+{
+    EmitContext *context = arg;
+    CanRecord record;
+
+    can_bms_alert_to_record(alert, context->frame->timestamp, &record);
+    context->emit(&record);
+}
+
+/*===========================================================================*/
+/* External functions.                                                       */
+/*===========================================================================*/
+
+/**
+ * @brief   Starts with no cells reported.
+ *
+ * @param[in] frames    Cell frames, kept.
+ * @param[in] limits    Limits of each quantity.
+ * @param[in] periodMs  Summary period, zero is none.
+ */
+void bmsMonitorInit(const CanBmsFrame *frames, size_t frameCount,
+                    const CanBmsLimits *limits, uint32_t periodMs)
+{
+    chMtxLock(&bmsMutex);
+    can_bms_init(&bms, frames, frameCount, limits);
+    bmsPeriodMs = periodMs;
+    chMtxUnlock(&bmsMutex);
+}
+
+/**
+ * @brief   Takes a received frame if it carries cells.
+ *
+ * @param[in] emit      Takes the records of the alerts.
+ * @return              False if it is no cell frame, the frame is to be
+ *                      captured.
+ */
+bool bmsMonitorFrame(const CanRecord *record, bmsemitcb_t emit)
+{
+    EmitContext context = {record, emit};
+    bool taken;
+
+    chMtxLock(&bmsMutex);
+    taken = can_bms_frame(&bms, record, emit_alert, &context);
+    chMtxUnlock(&bmsMutex);
+
+    return taken;
+}
+
+/**
+ * @brief   Aggregates of a module.
+ */
+void bmsMonitorGetModule(uint8_t module, uint8_t kind, CanBmsSummary *sp)
+{
+    chMtxLock(&bmsMutex);
+    can_bms_module(&bms, module, kind, sp);
+    chMtxUnlock(&bmsMutex);
+}
+
+/**
+ * @brief   Aggregates of the pack.
+ */
+void bmsMonitorGetPack(uint8_t kind, CanBmsSummary *sp)
+{
+    chMtxLock(&bmsMutex);
+    can_bms_pack(&bms, kind, sp);
+    chMtxUnlock(&bmsMutex);
+}
+
+/**
+ * @brief   Returns the limits of a quantity.
+ */
+void bmsMonitorGetLimits(uint8_t kind, CanBmsLimits *limits)
+{
+    chMtxLock(&bmsMutex);
+    *limits = bms.limits[kind];
+    chMtxUnlock(&bmsMutex);
+}
+
+/**
+ * @brief   Changes the limits of a quantity, cells are checked against
+ *          them from their next value.
+ */
+void bmsMonitorSetLimits(uint8_t kind, const CanBmsLimits *limits)
+{
+    chMtxLock(&bmsMutex);
+    bms.limits[kind] = *limits;
+    chMtxUnlock(&bmsMutex);
+}
+
+/**
+ * @brief   Returns the summary period in milliseconds, zero if stopped.
+ */
+uint32_t bmsMonitorGetPeriod(void)
+{
+    return bmsPeriodMs;
+}
+
+/**
+ * @brief   Changes the summary period, zero stops the summaries.
+ */
+void bmsMonitorSetPeriod(uint32_t ms)
+{
+    bmsPeriodMs = ms;
+}
+
+/**
+ * @brief   Returns the totals.
+ */
+void bmsMonitorGetStats(BmsMonitorStats *stats)
+{
+    chMtxLock(&bmsMutex);
+    stats->frames = bms.frameTotal;
+    stats->alerts = bms.alerts;
+    chMtxUnlock(&bmsMutex);
+}
+
+/** @} */
@@ -0,0 +1,66 @@
+/**
+ * @file    src/bms_monitor.h
+ * @brief   Battery cell summaries and alerts.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _BMS_MONITOR_H_
+#define _BMS_MONITOR_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "targetconf.h"
+#include "can_bms.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Totals since start.
+ */
+typedef struct {
+    uint32_t frames;        /**< Cell frames taken.                        */
+    uint32_t alerts;        /**< Alerts raised, not counting clears.       */
+} BmsMonitorStats;
+
+/**
+ * @brief   Receives the alert records of a cell frame, in the receiver
+ *          thread.
+ */
+typedef void (*bmsemitcb_t)(const CanRecord *record);
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void bmsMonitorInit(const CanBmsFrame *frames, size_t frameCount,
+                      const CanBmsLimits *limits, uint32_t periodMs);
+  bool bmsMonitorFrame(const CanRecord *record, bmsemitcb_t emit);
+  void bmsMonitorGetModule(uint8_t module, uint8_t kind, CanBmsSummary *sp);
+  void bmsMonitorGetPack(uint8_t kind, CanBmsSummary *sp);
+  void bmsMonitorGetLimits(uint8_t kind, CanBmsLimits *limits);
+  void bmsMonitorSetLimits(uint8_t kind, const CanBmsLimits *limits);
+  uint32_t bmsMonitorGetPeriod(void);
+  void bmsMonitorSetPeriod(uint32_t ms);
+  void bmsMonitorGetStats(BmsMonitorStats *stats);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BMS_MONITOR_H_ */
+
+/** @} */
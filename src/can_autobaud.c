@@ -0,0 +1,134 @@
+/**
+ * @file    src/can_autobaud.c
+ * @brief   Bitrate detection in silent mode.
+ * @details The controller is restarted in silent mode at each candidate
+ *          bitrate. Silent, it neither acknowledges nor sends error
+ *          frames, the bus is not disturbed whatever the candidate. A
+ *          wrong bitrate shows up as a bus error (stuff, form or CRC)
+ *          within about one frame time and the next candidate is tried
+ *          at once. @p CAN_AUTOBAUD_FRAMES clean frames confirm a
+ *          candidate, the controller is then restarted in normal mode.
+ *          A candidate that sees nothing is left after
+ *          @p CAN_AUTOBAUD_DWELL, the list is cycled until a bus shows
+ *          up.
+ *          Errors are detected through the last error code of the ESR,
+ *          it is set to the software value 7 at each start and the
+ *          hardware overwrites it with 0 (success) or an error code.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include "can_autobaud.h"
+#include "board_drivers.h"
+#include "timestamp.h"
+
+#define LEC_SOFTWARE                7U
+
+static const uint32_t autobaudRates[] = { CAN_AUTOBAUD_RATES };
+static CanAutobaudStatus autobaudStatus;
+
+/* Frames of the current candidate, passed on only once it is confirmed.*/
+static CANRxFrame heldFrames[CAN_AUTOBAUD_FRAMES];
+static uint32_t heldTimes[CAN_AUTOBAUD_FRAMES];
+
+static uint32_t last_error_code(void)
+{
+    return (CANDRIVER.can->ESR & CAN_ESR_LEC) >> 4;
+}
+
+/*
+ * Listens at one bitrate. Returns true once enough clean frames were
+ * seen, they are held in @p heldFrames. A frame can pass the CRC at a
+ * wrong bitrate, the frames of a rejected candidate are never emitted.
+ */
+static bool try_rate(uint32_t bitrate)
+{
+    systime_t start = chVTGetSystemTime();
+    uint32_t frames = 0;
+
+    if (!BoardCanSetBitrate(bitrate, CAN_SAMPLE_POINT, true))
+        return false;
+    CANDRIVER.can->ESR = LEC_SOFTWARE << 4;
+
+    while (chVTTimeElapsedSinceX(start) < CAN_AUTOBAUD_DWELL)
+    {
+        CANRxFrame rxmsg;
+
+        if (canReceive(&CANDRIVER, CAN_ANY_MAILBOX, &rxmsg, MS2ST(1))
+                == MSG_OK)
+        {
+            heldFrames[frames] = rxmsg;
+            heldTimes[frames] = timestamp_now();
+            if (++frames >= CAN_AUTOBAUD_FRAMES)
+                return true;
+        }
+
+        uint32_t lec = last_error_code();
+        if (lec != 0 && lec != LEC_SOFTWARE)
+        {
+            autobaudStatus.errors++;
+            return false;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief   Finds the bus bitrate, blocks until a bus is found.
+ * @details Called from the receiver thread before it starts reading, the
+ *          frames that confirmed the bitrate are passed to @p emit
+ *          after the controller left silent mode.
+ *
+ * @return  The detected bitrate.
+ */
+uint32_t canAutobaudRun(canautobaudcb_t emit)
+{
+    uint32_t start = timestamp_now();
+    size_t index = 0;
+
+    autobaudStatus.state = CAN_AUTOBAUD_RUNNING;
+    autobaudStatus.tries = 0;
+    autobaudStatus.errors = 0;
+
+    for (;;)
+    {
+        uint32_t bitrate = autobaudRates[index];
+
+        autobaudStatus.tries++;
+        if (try_rate(bitrate))
+        {
+            (void)BoardCanSetBitrate(bitrate, CAN_SAMPLE_POINT, false);
+
+            if (emit != NULL)
+            {
+                for (size_t i = 0; i < CAN_AUTOBAUD_FRAMES; i++)
+                    emit(&heldFrames[i], heldTimes[i]);
+            }
+
+            chSysLock();
+            autobaudStatus.bitrate = bitrate;
+            autobaudStatus.elapsedUs = timestamp_now() - start;
+            autobaudStatus.state = CAN_AUTOBAUD_DONE;
+            chSysUnlock();
+
+            return bitrate;
+        }
+
+        index = (index + 1) % (sizeof(autobaudRates) /
+                sizeof(autobaudRates[0]));
+    }
+}
+
+/**
+ * @brief   Returns the detection result.
+ */
+void canAutobaudGetStatus(CanAutobaudStatus *status)
+{
+    chSysLock();
+    *status = autobaudStatus;
+    chSysUnlock();
+}
+
+/** @} */
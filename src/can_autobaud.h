@@ -0,0 +1,91 @@
+/**
+ * @file    src/can_autobaud.h
+ * @brief   Bitrate detection in silent mode.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _CAN_AUTOBAUD_H_
+#define _CAN_AUTOBAUD_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "targetconf.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Detection state.
+ */
+typedef enum {
+  CAN_AUTOBAUD_IDLE = 0,    /**< Not started.                              */
+  CAN_AUTOBAUD_RUNNING,     /**< Cycling through the candidates.           */
+  CAN_AUTOBAUD_DONE         /**< @p bitrate is set.                        */
+} canautobaudstate_t;
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Candidate bitrates, most likely first.
+ */
+#if !defined(CAN_AUTOBAUD_RATES) || defined(__DOXYGEN__)
+#define CAN_AUTOBAUD_RATES          500000, 250000, 125000, 1000000,        \
+                                    100000, 50000, 83333, 20000, 10000
+#endif
+
+/**
+ * @brief   Time a candidate is kept while the bus shows neither frames
+ *          nor errors.
+ */
+#if !defined(CAN_AUTOBAUD_DWELL) || defined(__DOXYGEN__)
+#define CAN_AUTOBAUD_DWELL          MS2ST(100)
+#endif
+
+/**
+ * @brief   Clean frames in a row that confirm a candidate.
+ */
+#if !defined(CAN_AUTOBAUD_FRAMES) || defined(__DOXYGEN__)
+#define CAN_AUTOBAUD_FRAMES         2
+#endif
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Detection result.
+ */
+typedef struct {
+    canautobaudstate_t state;
+    uint32_t bitrate;       /**< Detected bitrate.                         */
+    uint32_t elapsedUs;     /**< Time from start to detection.             */
+    uint32_t tries;         /**< Candidates tried.                         */
+    uint32_t errors;        /**< Candidates rejected by bus errors.        */
+} CanAutobaudStatus;
+
+/**
+ * @brief   Receives the frames that confirmed the bitrate.
+ */
+typedef void (*canautobaudcb_t)(const CANRxFrame *rxmsg, uint32_t timestamp);
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  uint32_t canAutobaudRun(canautobaudcb_t emit);
+  void canAutobaudGetStatus(CanAutobaudStatus *status);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CAN_AUTOBAUD_H_ */
+
+/** @} */
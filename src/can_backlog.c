@@ -0,0 +1,489 @@
+/**
+ * @file    src/can_backlog.c
+ * @brief   RAM backlog of received frames.
+ * @details Several producers, one consumer. The receiver keeps storing
+ *          frames while no host is connected or the host is slow, echoes
+ *          and decoded messages are stored from their own threads, the
+ *          output thread only removes a frame once it was delivered.
+ *          When the backlog is full the configured policy picks the frame
+ *          to lose. The number of lost frames is attached to the frame that
+ *          follows the gap, so the loss can be reported at its position in
+ *          the stream.
+ *          Frames are stored as @p CanRecord in a pool of slots, gap counts
+ *          and links are kept in separate arrays so the records stay 16
+ *          bytes. One list holds every entry in arrival order, frames that
+ *          may be evicted are also on the list of their class. A class is
+ *          a range of priorities for @p CAN_DROP_PRIORITY and all frames
+ *          for the other policies, so every victim is the head or tail of
+ *          a class list and is found and unlinked in constant time.
+ *          A decoded message is several device records. Its producer
+ *          reserves room for all of them first, evicting as needed, and
+ *          then stores them into the reserved slots, so a message is
+ *          either stored whole or dropped whole. Device records are never
+ *          evicted, a message is never cut afterwards either.
+ *          The backlog is guarded by a mutex, it is never touched from
+ *          interrupts.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include "can_backlog.h"
+
+/*
+ * Priority classes, the top six bits of the arbitration rank: 32 standard
+ * identifiers each.
+ */
+#define BACKLOG_CLASSES             64
+#define BACKLOG_CLASS_SHIFT         24
+
+#define BACKLOG_NONE                0xFFFFU
+#define BACKLOG_PROTECTED           0xFFU
+
+static LGCR_CCM_DATA CanRecord backlog[CAN_BACKLOG_SIZE];
+static LGCR_CCM_DATA uint16_t backlogGap[CAN_BACKLOG_SIZE];
+static uint16_t backlogNext[CAN_BACKLOG_SIZE];
+static uint16_t backlogPrev[CAN_BACKLOG_SIZE];
+static uint16_t classNext[CAN_BACKLOG_SIZE];
+static uint16_t classPrev[CAN_BACKLOG_SIZE];
+static uint16_t classHead[BACKLOG_CLASSES];
+static uint16_t classTail[BACKLOG_CLASSES];
+static uint32_t classMap[BACKLOG_CLASSES / 32];
+static uint16_t backlogHead;
+static uint16_t backlogTail;
+static uint16_t backlogFree;
+static size_t backlogCount;
+static size_t backlogReserved;
+static size_t backlogEvictable;
+static uint16_t backlogLost;
+static uint32_t backlogHeadSequence;
+static CanBacklogPolicy backlogPolicy;
+
+static MUTEX_DECL(backlogMutex);
+static BSEMAPHORE_DECL(backlogData, true);
+
+static CanBacklogStats backlogStats;
+
+static void add_lost(uint16_t *lost, uint32_t n)
+{
+    uint32_t sum = *lost + n;
+
+    *lost = sum < 0xFFFF ? (uint16_t)sum : 0xFFFF;
+}
+
+static bool is_protected(const CanRecord *record)
+{
+    bool extended = CAN_RECORD_IS_EXT(record);
+    uint32_t id = CAN_RECORD_GET_ID(record);
+
+    /* The host waits for every echo of its frames, decoded messages
+       are only useful whole.*/
+    if (CAN_RECORD_IS_DEVICE(record))
+        return true;
+
+    for (size_t i = 0; i < backlogPolicy.protectedCount; i++)
+    {
+        const CanIdRange *range = &backlogPolicy.protectedRanges[i];
+
+        if (range->extended == extended && id >= range->first &&
+            id <= range->last)
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * Class list a record is kept on, BACKLOG_PROTECTED for none.
+ */
+static unsigned class_of(const CanRecord *record)
+{
+    uint32_t cls;
+
+    if (is_protected(record))
+        return BACKLOG_PROTECTED;
+    if (backlogPolicy.policy != CAN_DROP_PRIORITY)
+        return 0;
+
+    cls = can_record_priority(record) >> BACKLOG_CLASS_SHIFT;
+
+    return cls < BACKLOG_CLASSES ? cls : BACKLOG_CLASSES - 1;
+}
+
+/*
+ * Highest non-empty class, BACKLOG_PROTECTED if every class is empty.
+ */
+static unsigned class_top(void)
+{
+    for (unsigned i = BACKLOG_CLASSES / 32; i > 0; i--)
+    {
+        if (classMap[i - 1] != 0)
+            return (i - 1) * 32 + 31 - __builtin_clz(classMap[i - 1]);
+    }
+
+    return BACKLOG_PROTECTED;
+}
+
+static void class_append(uint16_t slot, unsigned cls)
+{
+    if (cls == BACKLOG_PROTECTED)
+        return;
+
+    classNext[slot] = BACKLOG_NONE;
+    classPrev[slot] = classTail[cls];
+    if (classTail[cls] != BACKLOG_NONE)
+        classNext[classTail[cls]] = slot;
+    else
+        classHead[cls] = slot;
+    classTail[cls] = slot;
+    classMap[cls / 32] |= 1U << (cls % 32);
+    backlogEvictable++;
+}
+
+static void class_remove(uint16_t slot, unsigned cls)
+{
+    if (cls == BACKLOG_PROTECTED)
+        return;
+
+    if (classPrev[slot] != BACKLOG_NONE)
+        classNext[classPrev[slot]] = classNext[slot];
+    else
+        classHead[cls] = classNext[slot];
+    if (classNext[slot] != BACKLOG_NONE)
+        classPrev[classNext[slot]] = classPrev[slot];
+    else
+        classTail[cls] = classPrev[slot];
+    if (classHead[cls] == BACKLOG_NONE)
+        classMap[cls / 32] &= ~(1U << (cls % 32));
+    backlogEvictable--;
+}
+
+/*
+ * Sorts every stored entry into the class lists of the current policy.
+ */
+static void classes_rebuild(void)
+{
+    for (unsigned i = 0; i < BACKLOG_CLASSES; i++)
+    {
+        classHead[i] = BACKLOG_NONE;
+        classTail[i] = BACKLOG_NONE;
+    }
+    for (unsigned i = 0; i < BACKLOG_CLASSES / 32; i++)
+        classMap[i] = 0;
+    backlogEvictable = 0;
+
+    for (uint16_t slot = backlogHead; slot != BACKLOG_NONE;
+         slot = backlogNext[slot])
+        class_append(slot, class_of(&backlog[slot]));
+}
+
+/*
+ * Unlinks an entry and returns its slot to the free list.
+ */
+static void unlink_slot(uint16_t slot)
+{
+    class_remove(slot, class_of(&backlog[slot]));
+
+    if (backlogPrev[slot] != BACKLOG_NONE)
+        backlogNext[backlogPrev[slot]] = backlogNext[slot];
+    else
+    {
+        backlogHead = backlogNext[slot];
+        backlogHeadSequence++;
+    }
+    if (backlogNext[slot] != BACKLOG_NONE)
+        backlogPrev[backlogNext[slot]] = backlogPrev[slot];
+    else
+        backlogTail = backlogPrev[slot];
+
+    backlogNext[slot] = backlogFree;
+    backlogFree = slot;
+    backlogCount--;
+}
+
+/*
+ * Picks the stored frame to evict for an arriving frame of class cls.
+ * Returns the slot of the victim, or BACKLOG_NONE if the arriving frame
+ * is dropped.
+ */
+static uint16_t select_victim(unsigned cls, candropdecision_t *decision)
+{
+    bool arrivingProtected = cls == BACKLOG_PROTECTED;
+    uint16_t victim = BACKLOG_NONE;
+
+    switch (backlogPolicy.policy)
+    {
+    case CAN_DROP_OLDEST:
+        *decision = CAN_EVICT_OLDEST;
+        victim = classHead[0];
+        break;
+    case CAN_DROP_PRIORITY:
+    {
+        unsigned top = class_top();
+
+        *decision = CAN_EVICT_PRIORITY;
+        if (top == BACKLOG_PROTECTED)
+            break;
+        /* Within a class the oldest goes first, the arriving frame is
+           the newest of its class.*/
+        if (!arrivingProtected && cls >= top)
+        {
+            *decision = CAN_DROP_ARRIVING;
+            return BACKLOG_NONE;
+        }
+        victim = classHead[top];
+        break;
+    }
+    case CAN_DROP_NEWEST:
+    default:
+        if (!arrivingProtected)
+        {
+            *decision = CAN_DROP_ARRIVING;
+            return BACKLOG_NONE;
+        }
+        *decision = CAN_EVICT_NEWEST;
+        victim = classTail[0];
+        break;
+    }
+
+    if (victim == BACKLOG_NONE)
+    {
+        *decision = arrivingProtected ? CAN_DROP_PROTECTED : CAN_DROP_ARRIVING;
+    }
+
+    return victim;
+}
+
+/*
+ * Evicts an entry and marks the gap, with the gap the entry carried, on
+ * the entry that follows it.
+ */
+static void evict(uint16_t slot)
+{
+    uint32_t lost = backlogGap[slot] + 1U;
+
+    if (backlogNext[slot] != BACKLOG_NONE)
+        add_lost(&backlogGap[backlogNext[slot]], lost);
+    else
+        add_lost(&backlogLost, lost);
+
+    unlink_slot(slot);
+}
+
+/*
+ * Links a record as the newest entry, a free slot must be left.
+ */
+static void store(const CanRecord *record)
+{
+    uint16_t slot = backlogFree;
+
+    backlogFree = backlogNext[slot];
+
+    backlog[slot] = *record;
+    backlogGap[slot] = backlogLost;
+    backlogNext[slot] = BACKLOG_NONE;
+    backlogPrev[slot] = backlogTail;
+    if (backlogTail != BACKLOG_NONE)
+        backlogNext[backlogTail] = slot;
+    else
+        backlogHead = slot;
+    backlogTail = slot;
+    class_append(slot, class_of(record));
+
+    backlogLost = 0;
+    backlogCount++;
+    backlogStats.stored++;
+    if (backlogCount > backlogStats.highWater)
+        backlogStats.highWater = backlogCount;
+}
+
+/**
+ * @brief   Empties the backlog and sets the overload policy.
+ */
+void can_backlog_init(const CanBacklogPolicy *policy)
+{
+    chMtxLock(&backlogMutex);
+    for (size_t i = 0; i < CAN_BACKLOG_SIZE; i++)
+        backlogNext[i] = i + 1 < CAN_BACKLOG_SIZE ? i + 1 : BACKLOG_NONE;
+    backlogFree = 0;
+    backlogHead = BACKLOG_NONE;
+    backlogTail = BACKLOG_NONE;
+    backlogCount = 0;
+    backlogReserved = 0;
+    backlogLost = 0;
+    backlogPolicy = *policy;
+    classes_rebuild();
+    chMtxUnlock(&backlogMutex);
+}
+
+/**
+ * @brief   Changes the overload policy.
+ */
+void can_backlog_set_policy(const CanBacklogPolicy *policy)
+{
+    chMtxLock(&backlogMutex);
+    backlogPolicy = *policy;
+    classes_rebuild();
+    chMtxUnlock(&backlogMutex);
+}
+
+/**
+ * @brief   Stores a received frame.
+ *
+ * @return  false if the arriving frame was dropped.
+ */
+bool can_backlog_push(const CanRecord *record)
+{
+    chMtxLock(&backlogMutex);
+    if (backlogCount + backlogReserved >= CAN_BACKLOG_SIZE)
+    {
+        candropdecision_t decision;
+        uint16_t victim = select_victim(class_of(record), &decision);
+
+        backlogStats.drops[decision]++;
+        backlogStats.lost++;
+
+        if (victim == BACKLOG_NONE)
+        {
+            add_lost(&backlogLost, 1);
+            chMtxUnlock(&backlogMutex);
+            return false;
+        }
+
+        evict(victim);
+    }
+
+    store(record);
+    chMtxUnlock(&backlogMutex);
+
+    chBSemSignal(&backlogData);
+
+    return true;
+}
+
+/**
+ * @brief   Makes room for the records of a decoded message.
+ * @details All or nothing: if @p n slots cannot be had by evicting
+ *          unprotected frames, nothing is evicted and the whole message
+ *          is counted as lost. Otherwise the slots are kept for the
+ *          next @p n calls of @p can_backlog_push_reserved(), other
+ *          producers cannot take them meanwhile.
+ *
+ * @return  false if the message is dropped.
+ */
+bool can_backlog_reserve(size_t n)
+{
+    chMtxLock(&backlogMutex);
+    if (backlogCount + backlogReserved + n >
+        CAN_BACKLOG_SIZE + backlogEvictable)
+    {
+        backlogStats.drops[CAN_DROP_PROTECTED] += n;
+        backlogStats.lost += n;
+        add_lost(&backlogLost, n);
+        chMtxUnlock(&backlogMutex);
+        return false;
+    }
+
+    while (backlogCount + backlogReserved + n > CAN_BACKLOG_SIZE)
+    {
+        candropdecision_t decision;
+
+        evict(select_victim(BACKLOG_PROTECTED, &decision));
+        backlogStats.drops[decision]++;
+        backlogStats.lost++;
+    }
+    backlogReserved += n;
+    chMtxUnlock(&backlogMutex);
+
+    return true;
+}
+
+/**
+ * @brief   Stores a record into a slot reserved by
+ *          @p can_backlog_reserve().
+ */
+void can_backlog_push_reserved(const CanRecord *record)
+{
+    chMtxLock(&backlogMutex);
+    backlogReserved--;
+    store(record);
+    chMtxUnlock(&backlogMutex);
+
+    chBSemSignal(&backlogData);
+}
+
+/**
+ * @brief   Copies the oldest frame without removing it.
+ * @details Waits up to @p timeout for a frame to arrive.
+ *
+ * @return  false on timeout.
+ */
+bool can_backlog_peek(CanBacklogEntry *entry, systime_t timeout)
+{
+    bool found = false;
+
+    chMtxLock(&backlogMutex);
+    if (backlogCount == 0 && timeout != TIME_IMMEDIATE)
+    {
+        chMtxUnlock(&backlogMutex);
+        (void)chBSemWaitTimeout(&backlogData, timeout);
+        chMtxLock(&backlogMutex);
+    }
+    if (backlogCount > 0)
+    {
+        entry->sequence = backlogHeadSequence;
+        entry->lost = backlogGap[backlogHead];
+        entry->record = backlog[backlogHead];
+        found = true;
+    }
+    chMtxUnlock(&backlogMutex);
+
+    return found;
+}
+
+/**
+ * @brief   Removes a frame after it was delivered.
+ * @details Does nothing if the frame was evicted in the meantime.
+ */
+void can_backlog_pop(const CanBacklogEntry *entry)
+{
+    chMtxLock(&backlogMutex);
+    if (backlogCount > 0 && backlogHeadSequence == entry->sequence)
+        unlink_slot(backlogHead);
+    chMtxUnlock(&backlogMutex);
+}
+
+/**
+ * @brief   Returns the number of stored frames.
+ */
+size_t can_backlog_count(void)
+{
+    size_t count;
+
+    chMtxLock(&backlogMutex);
+    count = backlogCount;
+    chMtxUnlock(&backlogMutex);
+
+    return count;
+}
+
+/**
+ * @brief   Ends a wait in @p can_backlog_peek early.
+ * @details For readers that also serve other requests.
+ */
+void can_backlog_wake(void)
+{
+    chBSemSignal(&backlogData);
+}
+
+/**
+ * @brief   Returns a snapshot of the statistics.
+ */
+void can_backlog_get_stats(CanBacklogStats *stats)
+{
+    chMtxLock(&backlogMutex);
+    *stats = backlogStats;
+    chMtxUnlock(&backlogMutex);
+}
+
+/** @} */
@@ -0,0 +1,151 @@
+/**
+ * @file    src/can_backlog.h
+ * @brief   RAM backlog of received frames.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _CAN_BACKLOG_H_
+#define _CAN_BACKLOG_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "targetconf.h"
+
+#include "can_record.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   What to do when a frame arrives and the backlog is full.
+ */
+typedef enum {
+  CAN_DROP_NEWEST = 0,      /**< Drop the arriving frame.                  */
+  CAN_DROP_OLDEST,          /**< Evict the oldest stored frame.            */
+  CAN_DROP_PRIORITY         /**< Evict from the numerically highest IDs,
+                                 32 standard IDs to a class, oldest of the
+                                 class first.                            */
+} candroppolicy_t;
+
+/**
+ * @brief   Drop decisions, used to index the statistics.
+ */
+typedef enum {
+  CAN_DROP_ARRIVING = 0,    /**< The arriving frame was dropped.           */
+  CAN_EVICT_OLDEST,         /**< The oldest unprotected frame was evicted. */
+  CAN_EVICT_NEWEST,         /**< The newest unprotected frame was evicted. */
+  CAN_EVICT_PRIORITY,       /**< A lower priority frame was evicted.       */
+  CAN_DROP_PROTECTED,       /**< Protected frame dropped, backlog holds
+                                 too few unprotected frames to make room,
+                                 counted per record of a message.        */
+  CAN_DROP_DECISIONS
+} candropdecision_t;
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Number of frames the backlog can hold.
+ * @note    Targets set this in targetconf.h according to their RAM.
+ */
+#if !defined(CAN_BACKLOG_SIZE) || defined(__DOXYGEN__)
+#define CAN_BACKLOG_SIZE            128
+#endif
+
+/**
+ * @brief   Overload policy used at startup.
+ */
+#if !defined(CAN_BACKLOG_POLICY) || defined(__DOXYGEN__)
+#define CAN_BACKLOG_POLICY          CAN_DROP_NEWEST
+#endif
+
+/**
+ * @brief   Placement attribute for the backlog storage.
+ */
+#if !defined(LGCR_CCM_DATA) || defined(__DOXYGEN__)
+#define LGCR_CCM_DATA
+#endif
+
+/*===========================================================================*/
+/* Derived constants and error checks.                                       */
+/*===========================================================================*/
+
+#if CAN_BACKLOG_SIZE >= 0xFFFF
+#error "CAN_BACKLOG_SIZE must be below 65535, slots are 16 bit indexes"
+#endif
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   A received frame waiting for the host, as returned by @p peek.
+ */
+typedef struct {
+    uint32_t sequence;      /**< Identifies the entry for @p pop.          */
+    uint16_t lost;          /**< Frames dropped right before this one.     */
+    CanRecord record;
+} CanBacklogEntry;
+
+/**
+ * @brief   Inclusive range of identifiers.
+ */
+typedef struct {
+    uint32_t first;
+    uint32_t last;
+    bool extended;
+} CanIdRange;
+
+/**
+ * @brief   Overload behaviour.
+ * @details Frames inside @p protectedRanges and device records are never
+ *          chosen as victims, whatever the policy.
+ */
+typedef struct {
+    candroppolicy_t policy;
+    const CanIdRange *protectedRanges;
+    size_t protectedCount;
+} CanBacklogPolicy;
+
+/**
+ * @brief   Backlog statistics.
+ */
+typedef struct {
+    uint32_t stored;        /**< Frames accepted into the backlog.         */
+    uint32_t lost;          /**< Frames lost, sum of @p drops.             */
+    uint32_t drops[CAN_DROP_DECISIONS];
+    uint32_t highWater;     /**< Largest fill level seen.                  */
+} CanBacklogStats;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void can_backlog_init(const CanBacklogPolicy *policy);
+  void can_backlog_set_policy(const CanBacklogPolicy *policy);
+  bool can_backlog_push(const CanRecord *record);
+  bool can_backlog_reserve(size_t n);
+  void can_backlog_push_reserved(const CanRecord *record);
+  bool can_backlog_peek(CanBacklogEntry *entry, systime_t timeout);
+  void can_backlog_pop(const CanBacklogEntry *entry);
+  size_t can_backlog_count(void);
+  void can_backlog_wake(void);
+  void can_backlog_get_stats(CanBacklogStats *stats);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CAN_BACKLOG_H_ */
+
+/** @} */
@@ -0,0 +1,115 @@
+/**
+ * @file    src/can_bits.c
+ * @brief   Bus time of frames.
+ * @details Frame lengths in bit times, stuff bits included, from the
+ *          start of frame to the end of the intermission. Bus load and
+ *          frame spacing are computed from them.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include "can_bits.h"
+
+/* Bits from start of frame to the end of the CRC, without data.*/
+#define STUFFED_STD                 34U
+#define STUFFED_EXT                 54U
+
+#define CRC15_POLY                  0x4599U
+
+typedef struct {
+    uint32_t bits;          /* Bits sent, stuff bits included.             */
+    uint16_t crc;
+    uint8_t last;
+    uint8_t run;            /* Equal bits in a row.                        */
+} BitStream;
+
+static void put_bit(BitStream *bs, uint8_t bit, bool crc)
+{
+    if (crc)
+    {
+        uint8_t next = bit ^ (uint8_t)(bs->crc >> 14);
+
+        bs->crc = (uint16_t)((bs->crc << 1) & 0x7FFFU);
+        if ((next & 1U) != 0)
+            bs->crc ^= CRC15_POLY;
+    }
+
+    bs->bits++;
+    if (bs->run != 0 && bit == bs->last)
+        bs->run++;
+    else
+        bs->run = 1;
+    bs->last = bit;
+
+    /* The stuff bit starts the next run.*/
+    if (bs->run == 5)
+    {
+        bs->bits++;
+        bs->last ^= 1U;
+        bs->run = 1;
+    }
+}
+
+static void put_field(BitStream *bs, uint32_t value, unsigned width)
+{
+    while (width-- > 0)
+        put_bit(bs, (uint8_t)((value >> width) & 1U), true);
+}
+
+/**
+ * @brief   Bit times of a frame.
+ * @details The stuff bits depend on identifier, data and CRC, they are
+ *          counted on the frame as it is sent.
+ */
+uint32_t can_bits_frame(const CanRecord *rp)
+{
+    BitStream bs = {0, 0, 0, 0};
+    uint32_t id = CAN_RECORD_GET_ID(rp);
+    bool remote = CAN_RECORD_IS_RTR(rp);
+    uint8_t data[8];
+    uint8_t dlc = can_record_get_data(rp, data);
+
+    put_field(&bs, 0, 1);
+    if (CAN_RECORD_IS_EXT(rp))
+    {
+        put_field(&bs, id >> 18, 11);
+        put_field(&bs, 1, 1);           /* SRR */
+        put_field(&bs, 1, 1);           /* IDE */
+        put_field(&bs, id & 0x3FFFFU, 18);
+        put_field(&bs, remote ? 1 : 0, 1);
+        put_field(&bs, 0, 2);           /* r1, r0 */
+    }
+    else
+    {
+        put_field(&bs, id, 11);
+        put_field(&bs, remote ? 1 : 0, 1);
+        put_field(&bs, 0, 2);           /* IDE, r0 */
+    }
+    put_field(&bs, dlc, 4);
+    if (!remote)
+    {
+        for (uint8_t i = 0; i < dlc; i++)
+            put_field(&bs, data[i], 8);
+    }
+
+    uint16_t crc = bs.crc;
+    for (unsigned i = 15; i-- > 0;)
+        put_bit(&bs, (uint8_t)((crc >> i) & 1U), false);
+
+    return bs.bits + CAN_BITS_TRAILER;
+}
+
+/**
+ * @brief   Bit times of the longest frame of a format, a stuff bit after
+ *          every fourth bit.
+ */
+uint32_t can_bits_max(bool extended, uint8_t dlc)
+{
+    uint32_t stuffed = (extended ? STUFFED_EXT : STUFFED_STD) +
+                       8U * (dlc < 8 ? dlc : 8);
+
+    return stuffed + (stuffed - 1) / 4 + CAN_BITS_TRAILER;
+}
+
+/** @} */
@@ -0,0 +1,58 @@
+/**
+ * @file    src/can_bits.h
+ * @brief   Bus time of frames.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _CAN_BITS_H_
+#define _CAN_BITS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "can_record.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Bits after the CRC: delimiter, acknowledge slot and delimiter,
+ *          end of frame and intermission.
+ */
+#define CAN_BITS_TRAILER            13U
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Derived constants and error checks.                                       */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  uint32_t can_bits_frame(const CanRecord *rp);
+  uint32_t can_bits_max(bool extended, uint8_t dlc);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CAN_BITS_H_ */
+
+/** @} */
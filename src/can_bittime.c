@@ -0,0 +1,127 @@
+/**
+ * @file    src/can_bittime.c
+ * @brief   bxCAN bit timing solver.
+ * @details A bit is 1 + tseg1 + tseg2 time quanta of brp CAN clock
+ *          cycles. Quanta counts that divide the clock exactly are
+ *          preferred, among them the largest one that puts the sample
+ *          point within @p CAN_BITTIME_SP_TOLERANCE, more quanta place it
+ *          more precisely. Bitrates the clock cannot divide exactly (e.g.
+ *          83.3 kbit/s) get the smallest bitrate error, if it is below
+ *          @p CAN_BITTIME_MAX_ERROR_PPM. The sample point is rounded to
+ *          the nearest quantum, SJW is tseg2 up to the bxCAN limit.
+ *          The rule matches the constant expression solver in the header,
+ *          which sets up the default bitrate at compile time.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include "can_bittime.h"
+
+/*
+ * Fills in the segments for @p n quanta, false if they do not fit.
+ */
+static bool segments(uint32_t n, uint16_t samplePoint, CanBitTiming *bt)
+{
+    uint32_t tseg2 = CAN_BITTIME_TSEG2(n, samplePoint);
+    uint32_t tseg1 = n - 1 - tseg2;
+
+    if (tseg2 < 1 || tseg2 > CAN_BITTIME_TSEG2_MAX ||
+        tseg1 < 1 || tseg1 > CAN_BITTIME_TSEG1_MAX)
+        return false;
+
+    bt->tseg1 = (uint8_t)tseg1;
+    bt->tseg2 = (uint8_t)tseg2;
+    bt->sjw = (uint8_t)(tseg2 < CAN_BITTIME_SJW_MAX ?
+            tseg2 : CAN_BITTIME_SJW_MAX);
+    bt->samplePoint = (uint16_t)CAN_BITTIME_SP(n, samplePoint);
+
+    return true;
+}
+
+/**
+ * @brief   Solves the bit timing.
+ *
+ * @param[in] clock         CAN clock in Hz, APB1 on the STM32.
+ * @param[in] bitrate       Requested bitrate in bit/s.
+ * @param[in] samplePoint   Requested sample point in permille.
+ * @return                  false if there is no timing within limits.
+ */
+bool can_bittime_solve(uint32_t clock, uint32_t bitrate,
+                       uint16_t samplePoint, CanBitTiming *bt)
+{
+    CanBitTiming exact;
+    CanBitTiming nearest;
+    bool exactFound = false;
+    uint32_t nearestError = UINT32_MAX;
+
+    if (bitrate == 0 || samplePoint == 0 || samplePoint >= 1000)
+        return false;
+
+    for (uint32_t n = CAN_BITTIME_QUANTA_MAX; n >= CAN_BITTIME_QUANTA_MIN;
+         n--)
+    {
+        CanBitTiming candidate;
+        uint64_t cycles = (uint64_t)bitrate * n;
+        uint32_t brp = (uint32_t)((clock + cycles / 2) / cycles);
+
+        if (brp < 1 || brp > CAN_BITTIME_BRP_MAX ||
+            !segments(n, samplePoint, &candidate))
+            continue;
+
+        candidate.brp = (uint16_t)brp;
+        candidate.bitrate = clock / (brp * n);
+
+        if (clock % (brp * n) == 0 && candidate.bitrate == bitrate)
+        {
+            uint32_t spError = CAN_BITTIME_SP_ERROR(n, samplePoint);
+
+            /* Quanta are tried from the largest, the first close sample
+               point wins, otherwise the first exact bitrate.*/
+            if (spError <= CAN_BITTIME_SP_TOLERANCE)
+            {
+                *bt = candidate;
+                return true;
+            }
+            if (!exactFound)
+            {
+                exactFound = true;
+                exact = candidate;
+            }
+            continue;
+        }
+
+        uint32_t diff = candidate.bitrate > bitrate ?
+                candidate.bitrate - bitrate : bitrate - candidate.bitrate;
+        uint32_t error = (uint32_t)((uint64_t)diff * 1000000U / bitrate);
+
+        if (error < nearestError)
+        {
+            nearestError = error;
+            nearest = candidate;
+        }
+    }
+
+    if (exactFound)
+    {
+        *bt = exact;
+        return true;
+    }
+    if (nearestError <= CAN_BITTIME_MAX_ERROR_PPM)
+    {
+        *bt = nearest;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief   BTR register value, timing fields only.
+ */
+uint32_t can_bittime_btr(const CanBitTiming *bt)
+{
+    return CAN_BITTIME_BTR_FIELDS(bt->brp, bt->tseg1, bt->tseg2, bt->sjw);
+}
+
+/** @} */
@@ -0,0 +1,152 @@
+/**
+ * @file    src/can_bittime.h
+ * @brief   bxCAN bit timing solver.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _CAN_BITTIME_H_
+#define _CAN_BITTIME_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/**
+ * @name    bxCAN limits
+ * @{
+ */
+#define CAN_BITTIME_BRP_MAX         1024
+#define CAN_BITTIME_TSEG1_MAX       16
+#define CAN_BITTIME_TSEG2_MAX       8
+#define CAN_BITTIME_SJW_MAX         4
+#define CAN_BITTIME_QUANTA_MIN      8
+#define CAN_BITTIME_QUANTA_MAX      25
+/** @} */
+
+/**
+ * @brief   Largest bitrate error accepted when no exact solution exists,
+ *          in parts per million.
+ */
+#define CAN_BITTIME_MAX_ERROR_PPM   5000
+
+/**
+ * @brief   Sample point deviation preferred over more quanta, permille.
+ */
+#define CAN_BITTIME_SP_TOLERANCE    20
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Solved bit timing, segments in time quanta.
+ */
+typedef struct {
+    uint16_t brp;           /**< Prescaler, 1 to 1024.                     */
+    uint8_t tseg1;          /**< Propagation and phase 1, 1 to 16.         */
+    uint8_t tseg2;          /**< Phase 2, 1 to 8.                          */
+    uint8_t sjw;            /**< Resynchronization jump width, 1 to 4.     */
+    uint32_t bitrate;       /**< Resulting bitrate.                        */
+    uint16_t samplePoint;   /**< Resulting sample point in permille.       */
+} CanBitTiming;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/**
+ * @name    Constant expression solver
+ * @details Among the quanta counts that divide the clock exactly, picks
+ *          the largest one that puts the sample point within
+ *          @p CAN_BITTIME_SP_TOLERANCE, else the largest one at all. The
+ *          sample point is rounded to the nearest quantum, @p sp is in
+ *          permille. @p CAN_BITTIME_QUANTA() is zero if there is no exact
+ *          solution. Where it exists @p can_bittime_solve() returns the
+ *          same timing.
+ * @{
+ */
+#define CAN_BITTIME_TSEG2(n, sp)    (((n) * (1000 - (sp)) + 500) / 1000)
+
+#define CAN_BITTIME_SP(n, sp)                                               \
+    (((n) - CAN_BITTIME_TSEG2(n, sp)) * 1000 / (n))
+
+#define CAN_BITTIME_SP_ERROR(n, sp)                                         \
+    (CAN_BITTIME_SP(n, sp) > (sp) ? CAN_BITTIME_SP(n, sp) - (sp) :          \
+     (sp) - CAN_BITTIME_SP(n, sp))
+
+#define CAN_BITTIME_FITS(clk, rate, sp, n, tol)                             \
+    ((clk) % ((rate) * (n)) == 0 &&                                         \
+     (clk) / ((rate) * (n)) <= CAN_BITTIME_BRP_MAX &&                       \
+     CAN_BITTIME_TSEG2(n, sp) >= 1 &&                                       \
+     CAN_BITTIME_TSEG2(n, sp) <= CAN_BITTIME_TSEG2_MAX &&                   \
+     (n) - 1 - CAN_BITTIME_TSEG2(n, sp) >= 1 &&                             \
+     (n) - 1 - CAN_BITTIME_TSEG2(n, sp) <= CAN_BITTIME_TSEG1_MAX &&         \
+     CAN_BITTIME_SP_ERROR(n, sp) <= (tol))
+
+#define CAN_BITTIME_SEARCH(clk, rate, sp, tol) ( \
+    CAN_BITTIME_FITS(clk, rate, sp, 25, tol) ? 25 : \
+    CAN_BITTIME_FITS(clk, rate, sp, 24, tol) ? 24 : \
+    CAN_BITTIME_FITS(clk, rate, sp, 23, tol) ? 23 : \
+    CAN_BITTIME_FITS(clk, rate, sp, 22, tol) ? 22 : \
+    CAN_BITTIME_FITS(clk, rate, sp, 21, tol) ? 21 : \
+    CAN_BITTIME_FITS(clk, rate, sp, 20, tol) ? 20 : \
+    CAN_BITTIME_FITS(clk, rate, sp, 19, tol) ? 19 : \
+    CAN_BITTIME_FITS(clk, rate, sp, 18, tol) ? 18 : \
+    CAN_BITTIME_FITS(clk, rate, sp, 17, tol) ? 17 : \
+    CAN_BITTIME_FITS(clk, rate, sp, 16, tol) ? 16 : \
+    CAN_BITTIME_FITS(clk, rate, sp, 15, tol) ? 15 : \
+    CAN_BITTIME_FITS(clk, rate, sp, 14, tol) ? 14 : \
+    CAN_BITTIME_FITS(clk, rate, sp, 13, tol) ? 13 : \
+    CAN_BITTIME_FITS(clk, rate, sp, 12, tol) ? 12 : \
+    CAN_BITTIME_FITS(clk, rate, sp, 11, tol) ? 11 : \
+    CAN_BITTIME_FITS(clk, rate, sp, 10, tol) ? 10 : \
+    CAN_BITTIME_FITS(clk, rate, sp, 9, tol) ? 9 : \
+    CAN_BITTIME_FITS(clk, rate, sp, 8, tol) ? 8 : 0)
+
+#define CAN_BITTIME_QUANTA(clk, rate, sp)                                   \
+    (CAN_BITTIME_SEARCH(clk, rate, sp, CAN_BITTIME_SP_TOLERANCE) != 0 ?     \
+     CAN_BITTIME_SEARCH(clk, rate, sp, CAN_BITTIME_SP_TOLERANCE) :          \
+     CAN_BITTIME_SEARCH(clk, rate, sp, 1000))
+
+#define CAN_BITTIME_SJW(n, sp)                                              \
+    (CAN_BITTIME_TSEG2(n, sp) < CAN_BITTIME_SJW_MAX ?                       \
+     CAN_BITTIME_TSEG2(n, sp) : CAN_BITTIME_SJW_MAX)
+
+#define CAN_BITTIME_BTR_FIELDS(brp, tseg1, tseg2, sjw)                      \
+    ((uint32_t)((brp) - 1) | ((uint32_t)((tseg1) - 1) << 16) |              \
+     ((uint32_t)((tseg2) - 1) << 20) | ((uint32_t)((sjw) - 1) << 24))
+
+/**
+ * @brief   BTR register value, timing fields only.
+ */
+#define CAN_BITTIME_BTR(clk, rate, sp)                                      \
+    CAN_BITTIME_BTR_FIELDS(                                                 \
+        (clk) / ((rate) * CAN_BITTIME_QUANTA(clk, rate, sp)),               \
+        CAN_BITTIME_QUANTA(clk, rate, sp) - 1 -                             \
+            CAN_BITTIME_TSEG2(CAN_BITTIME_QUANTA(clk, rate, sp), sp),       \
+        CAN_BITTIME_TSEG2(CAN_BITTIME_QUANTA(clk, rate, sp), sp),           \
+        CAN_BITTIME_SJW(CAN_BITTIME_QUANTA(clk, rate, sp), sp))
+/** @} */
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  bool can_bittime_solve(uint32_t clock, uint32_t bitrate,
+                         uint16_t samplePoint, CanBitTiming *bt);
+  uint32_t can_bittime_btr(const CanBitTiming *bt);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CAN_BITTIME_H_ */
+
+/** @} */
@@ -0,0 +1,357 @@
+/**
+ * @file    src/can_bms.c
+ * @brief   Cell voltage and temperature aggregation.
+ * @details Battery modules report their cells in multiplexed frames, a
+ *          few cells per frame. The latest value of every cell is kept,
+ *          each frame updates the minimum, maximum, mean and spread of
+ *          its module, the pack figures are combined from the modules.
+ *          A frame costs one pass over the cells of its module and one
+ *          over the modules, whatever the pack size.
+ *          Limits are checked as values arrive. A cell beyond its low or
+ *          high limit, or a spread above its limit, raises an alert at
+ *          once and clears it when back inside by the hysteresis.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include <string.h>
+
+#include "can_bms.h"
+
+static const char *const kindNames[CAN_BMS_KINDS] = {
+    "volt", "temp"
+};
+
+static const char *const conditionNames[CAN_BMS_CONDITIONS] = {
+    "low", "high", "spread"
+};
+
+static int16_t clamp16(int32_t value)
+{
+    if (value > INT16_MAX)
+        return INT16_MAX;
+    if (value < INT16_MIN)
+        return INT16_MIN;
+
+    return (int16_t)value;
+}
+
+static const CanBmsFrame *frame_find(const CanBms *bp, const CanRecord *rp,
+                                     uint8_t *module)
+{
+    uint32_t id = CAN_RECORD_GET_ID(rp);
+
+    for (size_t i = 0; i < bp->frameCount; i++)
+    {
+        const CanBmsFrame *fp = &bp->frames[i];
+
+        if (fp->extended == CAN_RECORD_IS_EXT(rp) && id >= fp->id &&
+            id - fp->id < fp->modules && id - fp->id < CAN_BMS_MODULES)
+        {
+            *module = (uint8_t)(id - fp->id);
+            return fp;
+        }
+    }
+
+    return NULL;
+}
+
+static int16_t value_at(const CanBmsFrame *fp, const uint8_t *data,
+                        size_t position)
+{
+    int32_t raw;
+
+    if (fp->width == 2)
+    {
+        uint16_t word = fp->bigEndian ?
+                (uint16_t)(data[position] << 8 | data[position + 1]) :
+                (uint16_t)(data[position] | data[position + 1] << 8);
+
+        raw = fp->isSigned ? (int16_t)word : (int32_t)word;
+    }
+    else
+        raw = fp->isSigned ? (int8_t)data[position] : data[position];
+
+    return clamp16(raw * fp->factor + fp->offset);
+}
+
+static void alert_raise(CanBms *bp, canbmsalert_t alert, void *arg,
+                        CanBmsAlert *ap)
+{
+    if (!ap->cleared)
+        bp->alerts++;
+    alert(ap, arg);
+}
+
+/*
+ * Checks a flag against a limit with hysteresis, raises the alert on a
+ * change.
+ */
+static void check_limit(CanBms *bp, bool beyond, bool inside, bool *flag,
+                        canbmsalert_t alert, void *arg, CanBmsAlert *ap)
+{
+    if (!*flag && beyond)
+    {
+        *flag = true;
+        ap->cleared = false;
+        alert_raise(bp, alert, arg, ap);
+    }
+    else if (*flag && inside)
+    {
+        *flag = false;
+        ap->cleared = true;
+        alert_raise(bp, alert, arg, ap);
+    }
+}
+
+static void check_cell(CanBms *bp, CanBmsGroup *gp, uint8_t kind,
+                       uint8_t module, uint8_t cell, canbmsalert_t alert,
+                       void *arg)
+{
+    const CanBmsLimits *lp = &bp->limits[kind];
+    int32_t value = gp->values[cell];
+    uint32_t bit = 1U << cell;
+    CanBmsAlert a = {kind, CAN_BMS_HIGH, false, module, cell,
+                     (int16_t)value, lp->high};
+    bool flag = (gp->high & bit) != 0;
+
+    check_limit(bp, value > lp->high, value <= lp->high - lp->hysteresis,
+                &flag, alert, arg, &a);
+    gp->high = flag ? gp->high | bit : gp->high & ~bit;
+
+    a.condition = CAN_BMS_LOW;
+    a.limit = lp->low;
+    flag = (gp->low & bit) != 0;
+    check_limit(bp, value < lp->low, value >= lp->low + lp->hysteresis,
+                &flag, alert, arg, &a);
+    gp->low = flag ? gp->low | bit : gp->low & ~bit;
+}
+
+static void check_spread(CanBms *bp, const CanBmsSummary *sp, uint8_t kind,
+                         uint8_t module, bool *flag, canbmsalert_t alert,
+                         void *arg)
+{
+    const CanBmsLimits *lp = &bp->limits[kind];
+    int32_t spread = sp->cells != 0 ? sp->max - sp->min : 0;
+    CanBmsAlert a = {kind, CAN_BMS_SPREAD, false, module, CAN_BMS_NO_CELL,
+                     clamp16(spread), (int16_t)lp->spread};
+
+    if (lp->spread == 0)
+    {
+        *flag = false;
+        return;
+    }
+    check_limit(bp, spread > lp->spread,
+                spread <= (int32_t)lp->spread - lp->hysteresis, flag, alert,
+                arg, &a);
+}
+
+/*
+ * Aggregates of a module from its cells.
+ */
+static void group_update(CanBmsGroup *gp, uint8_t module)
+{
+    CanBmsSummary *sp = &gp->summary;
+
+    memset(sp, 0, sizeof(*sp));
+    gp->sum = 0;
+    for (uint8_t cell = 0; cell < CAN_BMS_CELLS; cell++)
+    {
+        int16_t value = gp->values[cell];
+
+        if ((gp->seen & (1U << cell)) == 0)
+            continue;
+        if (sp->cells == 0 || value < sp->min)
+        {
+            sp->min = value;
+            sp->minCell = cell;
+        }
+        if (sp->cells == 0 || value > sp->max)
+        {
+            sp->max = value;
+            sp->maxCell = cell;
+        }
+        gp->sum += value;
+        sp->cells++;
+    }
+    sp->minModule = module;
+    sp->maxModule = module;
+    if (sp->cells != 0)
+        sp->mean = (int16_t)(gp->sum / sp->cells);
+}
+
+/**
+ * @brief   Starts with no cells reported.
+ *
+ * @param[in] frames    Cell frames, kept.
+ * @param[in] limits    Limits of each quantity.
+ */
+void can_bms_init(CanBms *bp, const CanBmsFrame *frames, size_t frameCount,
+                  const CanBmsLimits *limits)
+{
+    memset(bp, 0, sizeof(*bp));
+    bp->frames = frames;
+    bp->frameCount = frameCount;
+    memcpy(bp->limits, limits, sizeof(bp->limits));
+}
+
+/**
+ * @brief   Takes the cells of a frame.
+ *
+ * @param[in] alert     Receives the alerts the frame raised or cleared.
+ * @return              False if the frame is no cell frame.
+ */
+bool can_bms_frame(CanBms *bp, const CanRecord *rp, canbmsalert_t alert,
+                   void *arg)
+{
+    const CanBmsFrame *fp;
+    uint8_t module;
+    uint8_t data[8];
+
+    if (CAN_RECORD_IS_RTR(rp) || CAN_RECORD_IS_DEVICE(rp))
+        return false;
+    fp = frame_find(bp, rp, &module);
+    if (fp == NULL)
+        return false;
+
+    uint8_t dlc = can_record_get_data(rp, data);
+    uint32_t group = 0;
+    if (fp->muxByte != CAN_BMS_NO_MUX)
+    {
+        if (fp->muxByte >= dlc)
+            return true;
+        group = data[fp->muxByte];
+    }
+
+    CanBmsGroup *gp = &bp->groups[module][fp->kind];
+    bool updated = false;
+    bp->frameTotal++;
+    for (uint32_t i = 0; i < fp->count; i++)
+    {
+        size_t position = fp->firstByte + i * fp->width;
+        uint32_t cell = group * fp->count + i;
+
+        if (position + fp->width > dlc || cell >= CAN_BMS_CELLS)
+            break;
+        gp->values[cell] = value_at(fp, data, position);
+        gp->seen |= 1U << cell;
+        check_cell(bp, gp, fp->kind, module, (uint8_t)cell, alert, arg);
+        updated = true;
+    }
+    if (!updated)
+        return true;
+
+    group_update(gp, module);
+    check_spread(bp, &gp->summary, fp->kind, module, &gp->spread, alert,
+                 arg);
+
+    CanBmsSummary pack;
+    can_bms_pack(bp, fp->kind, &pack);
+    check_spread(bp, &pack, fp->kind, CAN_BMS_PACK,
+                 &bp->packSpread[fp->kind], alert, arg);
+
+    return true;
+}
+
+/**
+ * @brief   Aggregates of a module.
+ */
+void can_bms_module(const CanBms *bp, uint8_t module, uint8_t kind,
+                    CanBmsSummary *sp)
+{
+    *sp = bp->groups[module][kind].summary;
+}
+
+/**
+ * @brief   Aggregates of the pack, from the modules.
+ */
+void can_bms_pack(const CanBms *bp, uint8_t kind, CanBmsSummary *sp)
+{
+    int32_t sum = 0;
+
+    memset(sp, 0, sizeof(*sp));
+    for (uint8_t module = 0; module < CAN_BMS_MODULES; module++)
+    {
+        const CanBmsGroup *gp = &bp->groups[module][kind];
+        const CanBmsSummary *mp = &gp->summary;
+
+        if (mp->cells == 0)
+            continue;
+        if (sp->cells == 0 || mp->min < sp->min)
+        {
+            sp->min = mp->min;
+            sp->minModule = module;
+            sp->minCell = mp->minCell;
+        }
+        if (sp->cells == 0 || mp->max > sp->max)
+        {
+            sp->max = mp->max;
+            sp->maxModule = module;
+            sp->maxCell = mp->maxCell;
+        }
+        sum += gp->sum;
+        sp->cells += mp->cells;
+    }
+    if (sp->cells != 0)
+        sp->mean = (int16_t)(sum / sp->cells);
+}
+
+/**
+ * @brief   Stores an alert as a record.
+ * @details Data bytes: quantity, condition with bit 7 set when cleared,
+ *          module, cell, value and limit 16 bit little endian.
+ */
+void can_bms_alert_to_record(const CanBmsAlert *ap, uint32_t timestamp,
+                             CanRecord *rp)
+{
+    rp->timestamp = timestamp;
+    rp->id = CAN_RECORD_BMS;
+    rp->data[0] = ap->kind;
+    rp->data[1] = (uint8_t)(ap->condition | (ap->cleared ? 0x80U : 0U));
+    rp->data[2] = ap->module;
+    rp->data[3] = ap->cell;
+    rp->data[4] = (uint8_t)ap->value;
+    rp->data[5] = (uint8_t)((uint16_t)ap->value >> 8);
+    rp->data[6] = (uint8_t)ap->limit;
+    rp->data[7] = (uint8_t)((uint16_t)ap->limit >> 8);
+}
+
+/**
+ * @brief   Restores an alert from a record.
+ *
+ * @return  False if the record is not an alert.
+ */
+bool can_bms_alert_from_record(const CanRecord *rp, CanBmsAlert *ap)
+{
+    if (!CAN_RECORD_IS_BMS(rp))
+        return false;
+
+    ap->kind = rp->data[0];
+    ap->condition = rp->data[1] & 0x7FU;
+    ap->cleared = (rp->data[1] & 0x80U) != 0;
+    ap->module = rp->data[2];
+    ap->cell = rp->data[3];
+    ap->value = (int16_t)(rp->data[4] | rp->data[5] << 8);
+    ap->limit = (int16_t)(rp->data[6] | rp->data[7] << 8);
+
+    return true;
+}
+
+/**
+ * @brief   Short name of a quantity.
+ */
+const char *can_bms_kind_name(uint8_t kind)
+{
+    return kind < CAN_BMS_KINDS ? kindNames[kind] : "?";
+}
+
+/**
+ * @brief   Short name of an alert condition.
+ */
+const char *can_bms_condition_name(uint8_t condition)
+{
+    return condition < CAN_BMS_CONDITIONS ? conditionNames[condition] : "?";
+}
+
+/** @} */
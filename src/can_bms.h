@@ -0,0 +1,207 @@
+/**
+ * @file    src/can_bms.h
+ * @brief   Cell voltage and temperature aggregation.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _CAN_BMS_H_
+#define _CAN_BMS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "can_record.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Cell quantities.
+ */
+typedef enum {
+  CAN_BMS_VOLTAGE = 0,      /**< Millivolts.                               */
+  CAN_BMS_TEMPERATURE,      /**< Tenths of a degree Celsius.               */
+  CAN_BMS_KINDS
+} canbmskind_t;
+
+/**
+ * @brief   Alert conditions.
+ */
+typedef enum {
+  CAN_BMS_LOW = 0,          /**< A cell below the low limit.               */
+  CAN_BMS_HIGH,             /**< A cell above the high limit.              */
+  CAN_BMS_SPREAD,           /**< Highest minus lowest cell above the limit.*/
+  CAN_BMS_CONDITIONS
+} canbmscondition_t;
+
+/**
+ * @brief   Module number of pack alerts, cell number of spread alerts.
+ */
+#define CAN_BMS_PACK                0xFFU
+#define CAN_BMS_NO_CELL             0xFFU
+
+/**
+ * @brief   No multiplexer byte, the values are cells 0 and up.
+ */
+#define CAN_BMS_NO_MUX              0xFFU
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Modules of the pack.
+ * @note    The state is sized by it, set it for all sources alike.
+ */
+#if !defined(CAN_BMS_MODULES) || defined(__DOXYGEN__)
+#define CAN_BMS_MODULES             8
+#endif
+
+/**
+ * @brief   Cells of each quantity per module, up to 32.
+ * @note    The state is sized by it, set it for all sources alike.
+ */
+#if !defined(CAN_BMS_CELLS) || defined(__DOXYGEN__)
+#define CAN_BMS_CELLS               24
+#endif
+
+/*===========================================================================*/
+/* Derived constants and error checks.                                       */
+/*===========================================================================*/
+
+#if CAN_BMS_MODULES < 1 || CAN_BMS_MODULES > 254
+#error "CAN_BMS_MODULES must be 1 to 254"
+#endif
+
+#if CAN_BMS_CELLS < 1 || CAN_BMS_CELLS > 32
+#error "CAN_BMS_CELLS must be 1 to 32"
+#endif
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   A multiplexed cell frame.
+ * @details Module m sends identifier @p id + m. The multiplexer byte
+ *          selects the group of cells in the frame, the values of group g
+ *          are cells g * @p count and up. A value is
+ *          raw * @p factor + @p offset.
+ */
+typedef struct {
+    uint32_t id;            /**< Identifier of module 0.                   */
+    bool extended;
+    uint8_t kind;           /**< @p canbmskind_t.                          */
+    uint8_t modules;        /**< Consecutive identifiers.                  */
+    uint8_t muxByte;        /**< Group index, or @p CAN_BMS_NO_MUX.        */
+    uint8_t firstByte;      /**< First value.                              */
+    uint8_t width;          /**< Bytes per value, 1 or 2.                  */
+    uint8_t count;          /**< Values per frame.                         */
+    bool bigEndian;
+    bool isSigned;
+    int16_t factor;
+    int16_t offset;
+} CanBmsFrame;
+
+/**
+ * @brief   Alert limits of a quantity, in its unit.
+ */
+typedef struct {
+    int16_t low;
+    int16_t high;
+    uint16_t spread;        /**< Zero is no spread alert.                  */
+    uint16_t hysteresis;    /**< Back inside by this much to clear.        */
+} CanBmsLimits;
+
+/**
+ * @brief   A threshold crossing.
+ */
+typedef struct {
+    uint8_t kind;           /**< @p canbmskind_t.                          */
+    uint8_t condition;      /**< @p canbmscondition_t.                     */
+    bool cleared;           /**< Back inside the limit.                    */
+    uint8_t module;         /**< Or @p CAN_BMS_PACK.                       */
+    uint8_t cell;           /**< Or @p CAN_BMS_NO_CELL.                    */
+    int16_t value;          /**< Cell value or spread.                     */
+    int16_t limit;
+} CanBmsAlert;
+
+/**
+ * @brief   Aggregates of a module or of the pack.
+ */
+typedef struct {
+    uint16_t cells;         /**< Cells reported so far.                    */
+    int16_t min;
+    int16_t max;
+    int16_t mean;
+    uint8_t minModule;
+    uint8_t minCell;
+    uint8_t maxModule;
+    uint8_t maxCell;
+} CanBmsSummary;
+
+/**
+ * @brief   Cells of one quantity of one module.
+ */
+typedef struct {
+    int16_t values[CAN_BMS_CELLS];
+    uint32_t seen;          /**< Cells reported, a bit each.               */
+    uint32_t low;           /**< Cells in low alert.                       */
+    uint32_t high;          /**< Cells in high alert.                      */
+    bool spread;            /**< Spread alert.                             */
+    int32_t sum;
+    CanBmsSummary summary;
+} CanBmsGroup;
+
+/**
+ * @brief   Aggregator.
+ */
+typedef struct {
+    const CanBmsFrame *frames;
+    size_t frameCount;
+    CanBmsLimits limits[CAN_BMS_KINDS];
+    CanBmsGroup groups[CAN_BMS_MODULES][CAN_BMS_KINDS];
+    bool packSpread[CAN_BMS_KINDS];
+    uint32_t frameTotal;    /**< Cell frames taken.                        */
+    uint32_t alerts;        /**< Alerts raised.                            */
+} CanBms;
+
+/**
+ * @brief   Receives alerts, while the cell frame is processed.
+ */
+typedef void (*canbmsalert_t)(const CanBmsAlert *alert, void *arg);
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void can_bms_init(CanBms *bp, const CanBmsFrame *frames, size_t frameCount,
+                    const CanBmsLimits *limits);
+  bool can_bms_frame(CanBms *bp, const CanRecord *rp, canbmsalert_t alert,
+                     void *arg);
+  void can_bms_module(const CanBms *bp, uint8_t module, uint8_t kind,
+                      CanBmsSummary *sp);
+  void can_bms_pack(const CanBms *bp, uint8_t kind, CanBmsSummary *sp);
+  void can_bms_alert_to_record(const CanBmsAlert *ap, uint32_t timestamp,
+                               CanRecord *rp);
+  bool can_bms_alert_from_record(const CanRecord *rp, CanBmsAlert *ap);
+  const char *can_bms_kind_name(uint8_t kind);
+  const char *can_bms_condition_name(uint8_t condition);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CAN_BMS_H_ */
+
+/** @} */
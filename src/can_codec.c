@@ -0,0 +1,452 @@
+/**
+ * @file    src/can_codec.c
+ * @brief   Lossless compressed frame stream.
+ * @details Cyclic traffic repeats identifiers, has small time gaps and
+ *          payloads that change little. A frame token is:
+ *          - a tag byte with DLC, RTR and the identifier mode,
+ *          - the time since the previous frame as a varint,
+ *          - either the identifier as a varint, which enters it into the
+ *            dictionary, or its one byte dictionary index,
+ *          - the payload XOR the previous payload of that identifier, as
+ *            a mask byte of the non-zero bytes followed by those bytes.
+ *          An identifier new to the dictionary starts from a zero payload.
+ *          Sync tokens carry the full time and reset both sides, they are
+ *          sent periodically so a decoder can join or recover. Varints
+ *          are little endian base 128.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include <string.h>
+
+#include "can_codec.h"
+
+#define KEY_MASK                    (CAN_RECORD_ID_MASK | CAN_RECORD_EXT)
+#define SYNC_SIZE                   8
+
+/*===========================================================================*/
+/* Shared state.                                                             */
+/*===========================================================================*/
+
+static void state_reset(CanCodecState *state, uint32_t timestamp)
+{
+    state->used = 0;
+    state->next = 0;
+    state->timestamp = timestamp;
+}
+
+static int dict_find(const CanCodecState *state, uint32_t key)
+{
+    for (int i = 0; i < state->used; i++)
+    {
+        if (state->dict[i].key == key)
+            return i;
+    }
+
+    return -1;
+}
+
+/*
+ * New identifiers fill the dictionary, then replace entries round robin.
+ */
+static int dict_insert(CanCodecState *state, uint32_t key)
+{
+    int index = state->next;
+
+    state->dict[index].key = key;
+    memset(state->dict[index].data, 0, 8);
+    if (state->used < CAN_CODEC_DICT_SIZE)
+        state->used++;
+    state->next = (state->next + 1) % CAN_CODEC_DICT_SIZE;
+
+    return index;
+}
+
+/*===========================================================================*/
+/* Encoder.                                                                  */
+/*===========================================================================*/
+
+static size_t put_varint(uint8_t *out, uint32_t value)
+{
+    size_t n = 0;
+
+    while (value >= 0x80)
+    {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+
+    return n;
+}
+
+static size_t put_sync(CanEncoder *enc, uint32_t timestamp, uint8_t *out)
+{
+    out[0] = CAN_CODEC_TAG_SYNC;
+    memcpy(&out[1], CAN_CODEC_SYNC_MAGIC, 3);
+    out[4] = (uint8_t)timestamp;
+    out[5] = (uint8_t)(timestamp >> 8);
+    out[6] = (uint8_t)(timestamp >> 16);
+    out[7] = (uint8_t)(timestamp >> 24);
+
+    state_reset(&enc->state, timestamp);
+    enc->sinceSync = 0;
+    enc->synced = true;
+
+    return SYNC_SIZE;
+}
+
+/**
+ * @brief   Initializes an encoder, the first frame starts with a sync.
+ */
+void can_encoder_init(CanEncoder *enc)
+{
+    state_reset(&enc->state, 0);
+    enc->sinceSync = 0;
+    enc->synced = false;
+}
+
+/**
+ * @brief   Forces a sync before the next frame.
+ * @details Needed after output bytes were lost, the decoder cannot follow
+ *          the stream until the next sync.
+ */
+void can_encoder_reset(CanEncoder *enc)
+{
+    enc->synced = false;
+}
+
+/**
+ * @brief   Encodes a frame.
+ *
+ * @param[out] out      At least @p CAN_CODEC_MAX_FRAME bytes.
+ * @return              Bytes written.
+ */
+size_t can_encoder_frame(CanEncoder *enc, const CanRecord *record,
+                         uint8_t *out)
+{
+    uint8_t data[8];
+    uint8_t dlc = can_record_get_data(record, data);
+    bool remote = CAN_RECORD_IS_RTR(record);
+    uint32_t key = record->id & KEY_MASK;
+    size_t n = 0;
+
+    if (!enc->synced || enc->sinceSync >= CAN_CODEC_SYNC_INTERVAL)
+        n += put_sync(enc, record->timestamp, out);
+    enc->sinceSync++;
+
+    size_t tag = n++;
+    out[tag] = dlc | (remote ? CAN_CODEC_TAG_RTR : 0);
+
+    n += put_varint(&out[n], record->timestamp - enc->state.timestamp);
+    enc->state.timestamp = record->timestamp;
+
+    int index = dict_find(&enc->state, key);
+    if (index < 0)
+    {
+        out[tag] |= CAN_CODEC_TAG_LITERAL;
+        n += put_varint(&out[n], key);
+        index = dict_insert(&enc->state, key);
+    }
+    else
+    {
+        out[n++] = (uint8_t)index;
+    }
+
+    if (remote || dlc == 0)
+        return n;
+
+    uint8_t *prev = enc->state.dict[index].data;
+    size_t mask = n++;
+    out[mask] = 0;
+    for (uint8_t i = 0; i < dlc; i++)
+    {
+        uint8_t x = data[i] ^ prev[i];
+
+        if (x != 0)
+        {
+            out[mask] |= (uint8_t)(1U << i);
+            out[n++] = x;
+        }
+    }
+    memcpy(prev, data, 8);
+
+    return n;
+}
+
+/**
+ * @brief   Encodes a count of frames lost on the device.
+ *
+ * @param[out] out      At least @p CAN_CODEC_MAX_FRAME bytes.
+ */
+size_t can_encoder_lost(CanEncoder *enc, uint32_t count, uint8_t *out)
+{
+    size_t n = 0;
+
+    if (!enc->synced)
+        n += put_sync(enc, enc->state.timestamp, out);
+    out[n++] = CAN_CODEC_TAG_LOST;
+
+    return n + put_varint(&out[n], count);
+}
+
+/**
+ * @brief   Encodes a marker line, without line end.
+ * @details A pending sync goes first, so markers sent right after a
+ *          reset are not skipped by the decoder.
+ *
+ * @param[out] out      At least @p n + @p CAN_CODEC_TEXT_OFFSET bytes,
+ *                      @p n is cut to 255. The text may be placed at
+ *                      @p out + @p CAN_CODEC_TEXT_OFFSET by the caller.
+ */
+size_t can_encoder_text(CanEncoder *enc, const char *text, size_t n,
+                        uint8_t *out)
+{
+    size_t start = enc->synced ? 0 : SYNC_SIZE;
+
+    if (n > 255)
+        n = 255;
+    /* The text may already sit at out + CAN_CODEC_TEXT_OFFSET.*/
+    memmove(&out[start + 2], text, n);
+    if (start != 0)
+        (void)put_sync(enc, enc->state.timestamp, out);
+    out[start] = CAN_CODEC_TAG_TEXT;
+    out[start + 1] = (uint8_t)n;
+
+    return start + n + 2;
+}
+
+/*===========================================================================*/
+/* Decoder.                                                                  */
+/*===========================================================================*/
+
+#define PARSE_MORE                  0
+#define PARSE_ERROR                 -1
+
+/*
+ * Returns the varint length, PARSE_MORE or PARSE_ERROR.
+ */
+static int get_varint(const uint8_t *in, size_t len, uint32_t *value)
+{
+    *value = 0;
+    for (size_t i = 0; i < 5; i++)
+    {
+        if (i >= len)
+            return PARSE_MORE;
+        *value |= (uint32_t)(in[i] & 0x7F) << (7 * i);
+        if ((in[i] & 0x80) == 0)
+            return (int)i + 1;
+    }
+
+    return PARSE_ERROR;
+}
+
+static int parse_sync(CanDecoder *dec, cancodecevent_t *event)
+{
+    size_t len = dec->len;
+    size_t check = len < 4 ? len : 4;
+
+    if (memcmp(&dec->buf[1], CAN_CODEC_SYNC_MAGIC, check - 1) != 0)
+        return PARSE_ERROR;
+    if (len < SYNC_SIZE)
+        return PARSE_MORE;
+
+    uint32_t timestamp = (uint32_t)dec->buf[4] |
+            ((uint32_t)dec->buf[5] << 8) | ((uint32_t)dec->buf[6] << 16) |
+            ((uint32_t)dec->buf[7] << 24);
+    state_reset(&dec->state, timestamp);
+    dec->synced = true;
+    *event = CAN_CODEC_SYNC;
+
+    return SYNC_SIZE;
+}
+
+static int parse_frame(CanDecoder *dec, cancodecevent_t *event)
+{
+    const uint8_t *in = dec->buf;
+    size_t len = dec->len;
+    uint8_t tag = in[0];
+    uint8_t dlc = tag & CAN_CODEC_TAG_DLC;
+    bool remote = (tag & CAN_CODEC_TAG_RTR) != 0;
+    uint32_t delta;
+    uint32_t key;
+    int index;
+    int r;
+    size_t n = 1;
+
+    if ((tag & 0xC0) != 0 || dlc > 8)
+        return PARSE_ERROR;
+
+    r = get_varint(&in[n], len - n, &delta);
+    if (r <= 0)
+        return r;
+    n += (size_t)r;
+
+    if ((tag & CAN_CODEC_TAG_LITERAL) != 0)
+    {
+        r = get_varint(&in[n], len - n, &key);
+        if (r <= 0)
+            return r;
+        if ((key & ~KEY_MASK) != 0)
+            return PARSE_ERROR;
+        n += (size_t)r;
+        index = -1;
+    }
+    else
+    {
+        if (n >= len)
+            return PARSE_MORE;
+        index = in[n++];
+        if (index >= dec->state.used)
+            return PARSE_ERROR;
+        key = dec->state.dict[index].key;
+    }
+
+    uint8_t data[8] = {0};
+    uint8_t mask = 0;
+    if (!remote && dlc > 0)
+    {
+        if (n >= len)
+            return PARSE_MORE;
+        mask = in[n++];
+        if ((mask >> dlc) != 0)
+            return PARSE_ERROR;
+        for (uint8_t i = 0; i < dlc; i++)
+        {
+            if ((mask & (1U << i)) == 0)
+                continue;
+            if (n >= len)
+                return PARSE_MORE;
+            data[i] = in[n++];
+        }
+    }
+
+    /* Token complete, update the state like the encoder did.*/
+    if (index < 0)
+        index = dict_insert(&dec->state, key);
+    if (!remote && dlc > 0)
+    {
+        uint8_t *prev = dec->state.dict[index].data;
+
+        for (uint8_t i = 0; i < 8; i++)
+        {
+            data[i] = i < dlc ? data[i] ^ prev[i] : 0;
+        }
+        memcpy(prev, data, 8);
+    }
+    dec->state.timestamp += delta;
+
+    can_record_set(&dec->record, key & CAN_RECORD_ID_MASK,
+            (key & CAN_RECORD_EXT) != 0, remote, dlc, data,
+            dec->state.timestamp);
+    *event = CAN_CODEC_FRAME;
+
+    return (int)n;
+}
+
+static int parse_token(CanDecoder *dec, cancodecevent_t *event)
+{
+    const uint8_t *in = dec->buf;
+    size_t len = dec->len;
+    int r;
+
+    switch (in[0])
+    {
+    case CAN_CODEC_TAG_SYNC:
+        return parse_sync(dec, event);
+    case CAN_CODEC_TAG_LOST:
+        r = get_varint(&in[1], len - 1, &dec->lost);
+        if (r <= 0)
+            return r;
+        *event = CAN_CODEC_LOST;
+        return r + 1;
+    case CAN_CODEC_TAG_TEXT:
+        if (len < 2 || len < (size_t)in[1] + 2)
+            return PARSE_MORE;
+        memcpy(dec->text, &in[2], in[1]);
+        dec->text[in[1]] = '\0';
+        *event = CAN_CODEC_TEXT;
+        return in[1] + 2;
+    default:
+        return parse_frame(dec, event);
+    }
+}
+
+/*
+ * Drops bytes until the buffer starts like a sync token.
+ */
+static void resync(CanDecoder *dec)
+{
+    while (dec->len > 0)
+    {
+        cancodecevent_t event;
+
+        if (dec->buf[0] == CAN_CODEC_TAG_SYNC &&
+            parse_sync(dec, &event) == PARSE_MORE)
+            return;
+
+        memmove(dec->buf, &dec->buf[1], --dec->len);
+    }
+}
+
+/**
+ * @brief   Initializes a decoder, it waits for the first sync.
+ */
+void can_decoder_init(CanDecoder *dec)
+{
+    state_reset(&dec->state, 0);
+    dec->synced = false;
+    dec->len = 0;
+    dec->errors = 0;
+}
+
+/**
+ * @brief   Feeds one byte of the stream.
+ *
+ * @return  The event completed by this byte. Results are in
+ *          @p record, @p lost or @p text of the decoder.
+ */
+cancodecevent_t can_decoder_feed(CanDecoder *dec, uint8_t byte)
+{
+    cancodecevent_t event = CAN_CODEC_NONE;
+    int r;
+
+    dec->buf[dec->len++] = byte;
+
+    if (!dec->synced)
+    {
+        if (dec->buf[0] != CAN_CODEC_TAG_SYNC)
+        {
+            resync(dec);
+            return CAN_CODEC_NONE;
+        }
+        r = parse_sync(dec, &event);
+    }
+    else
+    {
+        r = parse_token(dec, &event);
+    }
+
+    if (r == PARSE_MORE)
+        return CAN_CODEC_NONE;
+
+    if (r == PARSE_ERROR)
+    {
+        if (dec->synced)
+        {
+            dec->synced = false;
+            dec->errors++;
+            event = CAN_CODEC_ERROR;
+        }
+        memmove(dec->buf, &dec->buf[1], --dec->len);
+        resync(dec);
+        return event;
+    }
+
+    dec->len = 0;
+
+    return event;
+}
+
+/** @} */
@@ -0,0 +1,170 @@
+/**
+ * @file    src/can_codec.h
+ * @brief   Lossless compressed frame stream.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _CAN_CODEC_H_
+#define _CAN_CODEC_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "can_record.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/**
+ * @name    Tag byte
+ * @details Every token starts with a tag. Frame tags carry the DLC in the
+ *          low nibble, DLC values above 8 with no other bit set are
+ *          control tokens.
+ * @{
+ */
+#define CAN_CODEC_TAG_DLC           0x0FU
+#define CAN_CODEC_TAG_RTR           0x10U   /**< Remote frame.             */
+#define CAN_CODEC_TAG_LITERAL       0x20U   /**< Identifier follows.       */
+#define CAN_CODEC_TAG_SYNC          0x0FU   /**< Magic, time, reset state. */
+#define CAN_CODEC_TAG_LOST          0x0EU   /**< Varint count of lost.     */
+#define CAN_CODEC_TAG_TEXT          0x0DU   /**< Length, text line.        */
+/** @} */
+
+/**
+ * @brief   Bytes following a sync tag, before the timestamp.
+ */
+#define CAN_CODEC_SYNC_MAGIC        "LGZ"
+
+/**
+ * @brief   Largest encoded frame, including a sync token.
+ */
+#define CAN_CODEC_MAX_FRAME         (8 + 1 + 5 + 5 + 1 + 8)
+
+/**
+ * @brief   Position of the text in a text token, with a leading sync.
+ */
+#define CAN_CODEC_TEXT_OFFSET       (8 + 2)
+
+/**
+ * @brief   Largest token.
+ */
+#define CAN_CODEC_MAX_TOKEN         (2 + 255)
+
+/**
+ * @brief   Decoder events.
+ */
+typedef enum {
+  CAN_CODEC_NONE = 0,       /**< Token not complete yet.                   */
+  CAN_CODEC_FRAME,          /**< @p record is valid.                       */
+  CAN_CODEC_LOST,           /**< @p lost frames were lost by the device.   */
+  CAN_CODEC_TEXT,           /**< @p text holds a marker line.              */
+  CAN_CODEC_SYNC,           /**< Stream (re)synchronized.                  */
+  CAN_CODEC_ERROR           /**< Invalid data, searching for a sync.       */
+} cancodecevent_t;
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Identifiers remembered by encoder and decoder.
+ */
+#if !defined(CAN_CODEC_DICT_SIZE) || defined(__DOXYGEN__)
+#define CAN_CODEC_DICT_SIZE         64
+#endif
+
+/**
+ * @brief   Frames between sync tokens.
+ * @details Bounds how much a decoder joining late or losing bytes misses.
+ */
+#if !defined(CAN_CODEC_SYNC_INTERVAL) || defined(__DOXYGEN__)
+#define CAN_CODEC_SYNC_INTERVAL     1024
+#endif
+
+/*===========================================================================*/
+/* Derived constants and error checks.                                       */
+/*===========================================================================*/
+
+#if CAN_CODEC_DICT_SIZE > 256
+#error "CAN_CODEC_DICT_SIZE must fit a byte index"
+#endif
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Dictionary entry, the last payload seen for an identifier.
+ */
+typedef struct {
+    uint32_t key;           /**< Identifier and extended flag.             */
+    uint8_t data[8];
+} CanCodecEntry;
+
+/**
+ * @brief   State shared by encoder and decoder.
+ * @details Both sides apply the same updates, so they stay identical as
+ *          long as no byte is lost.
+ */
+typedef struct {
+    CanCodecEntry dict[CAN_CODEC_DICT_SIZE];
+    uint16_t used;
+    uint16_t next;          /**< Slot replaced by the next new identifier. */
+    uint32_t timestamp;     /**< Time of the previous frame.               */
+} CanCodecState;
+
+/**
+ * @brief   Encoder object.
+ */
+typedef struct {
+    CanCodecState state;
+    uint32_t sinceSync;     /**< Frames since the last sync token.         */
+    bool synced;
+} CanEncoder;
+
+/**
+ * @brief   Decoder object.
+ */
+typedef struct {
+    CanCodecState state;
+    bool synced;
+    uint8_t buf[CAN_CODEC_MAX_TOKEN];
+    size_t len;
+    uint32_t errors;        /**< Times synchronization was lost.           */
+    /* Results of the last event.*/
+    CanRecord record;
+    uint32_t lost;
+    char text[256];
+} CanDecoder;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void can_encoder_init(CanEncoder *enc);
+  void can_encoder_reset(CanEncoder *enc);
+  size_t can_encoder_frame(CanEncoder *enc, const CanRecord *record,
+                           uint8_t *out);
+  size_t can_encoder_lost(CanEncoder *enc, uint32_t count, uint8_t *out);
+  size_t can_encoder_text(CanEncoder *enc, const char *text, size_t n,
+                          uint8_t *out);
+  void can_decoder_init(CanDecoder *dec);
+  cancodecevent_t can_decoder_feed(CanDecoder *dec, uint8_t byte);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CAN_CODEC_H_ */
+
+/** @} */
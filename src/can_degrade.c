@@ -0,0 +1,204 @@
+/**
+ * @file    src/can_degrade.c
+ * @brief   Adaptive output degradation.
+ * @details The output stage reports, once per measurement window, how many
+ *          frames arrived, how many it drained from the backlog and how
+ *          many were lost. A backlog above the high water mark that keeps
+ *          growing, or any loss, is a deficit. Sustained deficit escalates
+ *          one mode, a backlog that stays near empty steps one mode back.
+ *          A step down that has to be taken back soon doubles the time
+ *          needed for the next one, so a link just below the bus rate
+ *          does not make the mode flap.
+ *          The caller marks every change in the stream, so the host
+ *          always knows which view of the bus it gets.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include <string.h>
+
+#include "can_degrade.h"
+
+#define HOLD_MAX                    (CAN_DEGRADE_HOLD_WINDOWS * 32)
+
+static const char *const modeNames[CAN_DEGRADE_MODES] = {
+    "full", "compressed", "decimate", "changes"
+};
+
+static void set_mode(CanDegrade *dgp, candegrademode_t mode)
+{
+    dgp->steppedDown = mode < dgp->mode;
+    dgp->mode = mode;
+    dgp->deficit = 0;
+    dgp->quiet = 0;
+    dgp->windows = 0;
+    dgp->suppressed = 0;
+    /* Filtering modes start by sending every identifier once.*/
+    memset(dgp->slots, 0, sizeof(dgp->slots));
+}
+
+static bool escalate(CanDegrade *dgp)
+{
+    candegrademode_t mode = dgp->mode + 1;
+
+    if (mode == CAN_DEGRADE_COMPRESS && !dgp->compress)
+        mode++;
+    if (mode >= CAN_DEGRADE_MODES)
+        return false;
+
+    if (dgp->steppedDown && dgp->windows < dgp->hold)
+        dgp->hold = dgp->hold * 2 < HOLD_MAX ? dgp->hold * 2 : HOLD_MAX;
+    set_mode(dgp, mode);
+
+    return true;
+}
+
+static bool step_down(CanDegrade *dgp)
+{
+    candegrademode_t mode = dgp->mode;
+
+    if (mode == dgp->lowest)
+        return false;
+
+    mode--;
+    if (mode == CAN_DEGRADE_COMPRESS && !dgp->compress)
+        mode--;
+    if (mode < dgp->lowest)
+        mode = dgp->lowest;
+    set_mode(dgp, mode);
+
+    return true;
+}
+
+/**
+ * @brief   Initializes the controller in its lowest mode.
+ *
+ * @param[in] capacity  Backlog size in frames.
+ * @param[in] text      Text output available, otherwise the lowest mode
+ *                      is @p CAN_DEGRADE_COMPRESS.
+ * @param[in] compress  Compressed output available.
+ */
+void can_degrade_init(CanDegrade *dgp, size_t capacity, bool text,
+                      bool compress)
+{
+    dgp->lowest = text ? CAN_DEGRADE_FULL : CAN_DEGRADE_COMPRESS;
+    dgp->compress = compress;
+    dgp->mode = dgp->lowest;
+    dgp->highWater = capacity / 4;
+    dgp->lowWater = capacity / 32;
+    dgp->hold = CAN_DEGRADE_HOLD_WINDOWS;
+    set_mode(dgp, dgp->lowest);
+    dgp->steppedDown = false;
+}
+
+/**
+ * @brief   Accounts one measurement window.
+ *
+ * @param[in] incoming  Frames that arrived at the backlog.
+ * @param[in] drained   Frames taken from the backlog, sent or suppressed.
+ * @param[in] lost      Frames the backlog dropped.
+ * @param[in] backlog   Frames waiting at the end of the window.
+ * @return              True if the mode changed.
+ */
+bool can_degrade_update(CanDegrade *dgp, uint32_t incoming,
+                        uint32_t drained, uint32_t lost, size_t backlog)
+{
+    dgp->windows++;
+
+    if (lost != 0 || (backlog >= dgp->highWater && incoming > drained))
+    {
+        dgp->quiet = 0;
+        /* Losses escalate at once, unless the last change is too recent
+           to have shown an effect.*/
+        if (++dgp->deficit >= CAN_DEGRADE_ESCALATE_WINDOWS ||
+            (lost != 0 && dgp->windows > CAN_DEGRADE_ESCALATE_WINDOWS))
+            return escalate(dgp);
+        return false;
+    }
+
+    dgp->deficit = 0;
+    if (backlog > dgp->lowWater)
+    {
+        dgp->quiet = 0;
+        return false;
+    }
+
+    if (++dgp->quiet < dgp->hold)
+        return false;
+    if (!step_down(dgp))
+    {
+        /* Stable at full output, forget earlier flapping.*/
+        dgp->hold = CAN_DEGRADE_HOLD_WINDOWS;
+        dgp->quiet = 0;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief   Decides whether a frame is sent in the current mode.
+ * @details Untracked identifiers are always sent, when the table is full
+ *          a slot is taken over.
+ */
+bool can_degrade_pass(CanDegrade *dgp, const CanRecord *record)
+{
+    /* Bus events explain the frames around them, echoes are awaited.*/
+    if (dgp->mode < CAN_DEGRADE_DECIMATE || CAN_RECORD_IS_DEVICE(record))
+        return true;
+
+    /* The short frame bit is set in every key, zero marks a free slot.*/
+    uint32_t key = record->id | CAN_RECORD_SHORT;
+    uint32_t hash = (key * 2654435761U) & (CAN_DEGRADE_SLOTS - 1);
+    CanDegradeSlot *slot = &dgp->slots[hash];
+
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        CanDegradeSlot *probe =
+                &dgp->slots[(hash + i) & (CAN_DEGRADE_SLOTS - 1)];
+
+        if (probe->key == key || probe->key == 0)
+        {
+            slot = probe;
+            break;
+        }
+    }
+
+    if (slot->key == key)
+    {
+        uint32_t age = record->timestamp - slot->last;
+
+        if (dgp->mode == CAN_DEGRADE_DECIMATE)
+        {
+            if (age < CAN_DEGRADE_DECIMATE_US)
+            {
+                dgp->suppressed++;
+                return false;
+            }
+        }
+        else if (age < CAN_DEGRADE_REFRESH_US && slot->id == record->id &&
+                 memcmp(slot->data, record->data, 8) == 0)
+        {
+            dgp->suppressed++;
+            return false;
+        }
+    }
+
+    slot->key = key;
+    slot->id = record->id;
+    slot->last = record->timestamp;
+    memcpy(slot->data, record->data, 8);
+
+    return true;
+}
+
+/**
+ * @brief   Name of a mode as used in the stream markers.
+ */
+const char *can_degrade_name(candegrademode_t mode)
+{
+    return mode < CAN_DEGRADE_MODES ? modeNames[mode] : "?";
+}
+
+/** @} */
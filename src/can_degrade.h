@@ -0,0 +1,139 @@
+/**
+ * @file    src/can_degrade.h
+ * @brief   Adaptive output degradation.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _CAN_DEGRADE_H_
+#define _CAN_DEGRADE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "can_record.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Output modes, from full to most degraded.
+ * @details Each mode includes the savings of the ones before it.
+ */
+typedef enum {
+  CAN_DEGRADE_FULL = 0,     /**< Every frame, text lines.                  */
+  CAN_DEGRADE_COMPRESS,     /**< Every frame, compressed stream.           */
+  CAN_DEGRADE_DECIMATE,     /**< Each identifier at most once per interval.*/
+  CAN_DEGRADE_CHANGES,      /**< Changed payloads and periodic refreshes.  */
+  CAN_DEGRADE_MODES
+} candegrademode_t;
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Identifiers tracked by decimation and change detection.
+ * @note    Power of two. Targets set this in targetconf.h.
+ */
+#if !defined(CAN_DEGRADE_SLOTS) || defined(__DOXYGEN__)
+#define CAN_DEGRADE_SLOTS           64
+#endif
+
+/**
+ * @brief   Consecutive deficit windows before escalating.
+ */
+#if !defined(CAN_DEGRADE_ESCALATE_WINDOWS) || defined(__DOXYGEN__)
+#define CAN_DEGRADE_ESCALATE_WINDOWS 3
+#endif
+
+/**
+ * @brief   Quiet windows before stepping down, doubled each time a step
+ *          down had to be taken back, up to 32 times.
+ */
+#if !defined(CAN_DEGRADE_HOLD_WINDOWS) || defined(__DOXYGEN__)
+#define CAN_DEGRADE_HOLD_WINDOWS    20
+#endif
+
+/**
+ * @brief   Minimum time between frames of an identifier when decimating.
+ */
+#if !defined(CAN_DEGRADE_DECIMATE_US) || defined(__DOXYGEN__)
+#define CAN_DEGRADE_DECIMATE_US     100000
+#endif
+
+/**
+ * @brief   Unchanged frames of an identifier are still sent after this
+ *          time in change-only mode, a rolling snapshot of the bus.
+ */
+#if !defined(CAN_DEGRADE_REFRESH_US) || defined(__DOXYGEN__)
+#define CAN_DEGRADE_REFRESH_US      1000000
+#endif
+
+/*===========================================================================*/
+/* Derived constants and error checks.                                       */
+/*===========================================================================*/
+
+#if (CAN_DEGRADE_SLOTS & (CAN_DEGRADE_SLOTS - 1)) != 0
+#error "CAN_DEGRADE_SLOTS must be a power of two"
+#endif
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Last frame sent for an identifier.
+ */
+typedef struct {
+    uint32_t key;           /**< Identifier and flags, zero if unused.     */
+    uint32_t id;            /**< Identifier word of the last frame.        */
+    uint32_t last;          /**< Time the identifier was last sent.        */
+    uint8_t data[8];
+} CanDegradeSlot;
+
+/**
+ * @brief   Degradation controller.
+ */
+typedef struct {
+    candegrademode_t mode;
+    candegrademode_t lowest; /**< @p CAN_DEGRADE_COMPRESS without text.   */
+    bool compress;          /**< Compressed mode available.                */
+    size_t highWater;       /**< Backlog level counted as deficit.         */
+    size_t lowWater;        /**< Backlog level counted as recovered.       */
+    uint32_t deficit;       /**< Consecutive deficit windows.              */
+    uint32_t quiet;         /**< Consecutive quiet windows.                */
+    uint32_t hold;          /**< Quiet windows needed to step down.        */
+    bool steppedDown;       /**< Last change was a step down.              */
+    uint32_t windows;       /**< Windows since the last change.            */
+    uint32_t suppressed;    /**< Frames not sent in the current mode.      */
+    CanDegradeSlot slots[CAN_DEGRADE_SLOTS];
+} CanDegrade;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void can_degrade_init(CanDegrade *dgp, size_t capacity, bool text,
+                        bool compress);
+  bool can_degrade_update(CanDegrade *dgp, uint32_t incoming,
+                          uint32_t drained, uint32_t lost, size_t backlog);
+  bool can_degrade_pass(CanDegrade *dgp, const CanRecord *record);
+  const char *can_degrade_name(candegrademode_t mode);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CAN_DEGRADE_H_ */
+
+/** @} */
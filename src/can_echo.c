@@ -0,0 +1,69 @@
+/**
+ * @file    src/can_echo.c
+ * @brief   Echoes of frames sent for the host.
+ * @details Every frame the host asks to send is answered by exactly one
+ *          echo, carrying the cookie the host tagged it with. Echoes
+ *          travel the pipeline as records, in order with the received
+ *          frames.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include "can_echo.h"
+
+static const char *const statusNames[CAN_ECHO_STATUSES] = {
+    "sent", "full", "invalid", "timeout", "busoff", "error"
+};
+
+/**
+ * @brief   Stores an echo as a record.
+ * @details Data bytes: cookie little endian, status, delay 24 bit little
+ *          endian, saturated.
+ */
+void can_echo_to_record(const CanEcho *ep, uint32_t timestamp, CanRecord *rp)
+{
+    uint32_t delay = ep->delay < CAN_ECHO_DELAY_MAX ? ep->delay :
+                     CAN_ECHO_DELAY_MAX;
+
+    rp->timestamp = timestamp;
+    rp->id = CAN_RECORD_ECHO;
+    rp->data[0] = (uint8_t)ep->cookie;
+    rp->data[1] = (uint8_t)(ep->cookie >> 8);
+    rp->data[2] = (uint8_t)(ep->cookie >> 16);
+    rp->data[3] = (uint8_t)(ep->cookie >> 24);
+    rp->data[4] = ep->status;
+    rp->data[5] = (uint8_t)delay;
+    rp->data[6] = (uint8_t)(delay >> 8);
+    rp->data[7] = (uint8_t)(delay >> 16);
+}
+
+/**
+ * @brief   Restores an echo from a record.
+ *
+ * @return  False if the record is not an echo.
+ */
+bool can_echo_from_record(const CanRecord *rp, CanEcho *ep)
+{
+    if (!CAN_RECORD_IS_ECHO(rp))
+        return false;
+
+    ep->cookie = rp->data[0] | (uint32_t)rp->data[1] << 8 |
+                 (uint32_t)rp->data[2] << 16 | (uint32_t)rp->data[3] << 24;
+    ep->status = rp->data[4] < CAN_ECHO_STATUSES ? rp->data[4] :
+                 CAN_ECHO_ERROR;
+    ep->delay = rp->data[5] | (uint32_t)rp->data[6] << 8 |
+                (uint32_t)rp->data[7] << 16;
+
+    return true;
+}
+
+/**
+ * @brief   Short name of an echo status.
+ */
+const char *can_echo_status_name(uint8_t status)
+{
+    return status < CAN_ECHO_STATUSES ? statusNames[status] : "?";
+}
+
+/** @} */
@@ -0,0 +1,83 @@
+/**
+ * @file    src/can_echo.h
+ * @brief   Echoes of frames sent for the host.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _CAN_ECHO_H_
+#define _CAN_ECHO_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "can_record.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Outcome of a transmit request.
+ */
+typedef enum {
+  CAN_ECHO_SENT = 0,        /**< Acknowledged on the bus.                  */
+  CAN_ECHO_FULL,            /**< Transmit queue full, not queued.          */
+  CAN_ECHO_INVALID,         /**< Identifier or length out of range.        */
+  CAN_ECHO_TIMEOUT,         /**< Not sent in time, aborted.                */
+  CAN_ECHO_BUS_OFF,         /**< Aborted while the controller was bus off. */
+  CAN_ECHO_ERROR,           /**< The controller gave up.                   */
+  CAN_ECHO_STATUSES
+} canechostatus_t;
+
+/**
+ * @brief   Largest delay an echo carries, 24 bits.
+ */
+#define CAN_ECHO_DELAY_MAX          0xFFFFFFU
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Derived constants and error checks.                                       */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   A transmit echo.
+ * @details The record timestamp is the time the frame left the controller,
+ *          or the time it was given up.
+ */
+typedef struct {
+    uint32_t cookie;        /**< Chosen by the host.                       */
+    uint8_t status;         /**< @p canechostatus_t.                       */
+    uint32_t delay;         /**< Microseconds since it was queued.         */
+} CanEcho;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void can_echo_to_record(const CanEcho *ep, uint32_t timestamp,
+                          CanRecord *rp);
+  bool can_echo_from_record(const CanRecord *rp, CanEcho *ep);
+  const char *can_echo_status_name(uint8_t status);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CAN_ECHO_H_ */
+
+/** @} */
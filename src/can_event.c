@@ -0,0 +1,254 @@
+/**
+ * @file    src/can_event.c
+ * @brief   Bus error and bus state events.
+ * @details The receiver thread reads the last error code and the state
+ *          of the controller after an error interrupt or when polling,
+ *          several bus errors in between make one event. It decodes
+ *          them together with the error counters, counts every event and turns the interesting
+ *          ones into records: any change of the bus state or the error
+ *          code, and otherwise one per @p CAN_EVENT_HOLDOFF_US. A record
+ *          tells how many identical events were folded before it.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include <string.h>
+
+#include "can_event.h"
+
+/* bxCAN ESR fields.*/
+#define ESR_EWGF                    (1U << 0)
+#define ESR_EPVF                    (1U << 1)
+#define ESR_BOFF                    (1U << 2)
+#define ESR_TEC_SHIFT               16
+#define ESR_REC_SHIFT               24
+
+/* SocketCAN error frames, linux/can/error.h.*/
+#define CAN_ERR_FLAG                0x20000000U
+#define CAN_ERR_CRTL                0x00000004U
+#define CAN_ERR_PROT                0x00000008U
+#define CAN_ERR_ACK                 0x00000020U
+#define CAN_ERR_BUSOFF              0x00000040U
+#define CAN_ERR_BUSERROR            0x00000080U
+#define CAN_ERR_CNT                 0x00000200U
+#define CAN_ERR_CRTL_RX_OVERFLOW    0x01U
+#define CAN_ERR_CRTL_RX_WARNING     0x04U
+#define CAN_ERR_CRTL_TX_WARNING     0x08U
+#define CAN_ERR_CRTL_RX_PASSIVE     0x10U
+#define CAN_ERR_CRTL_TX_PASSIVE     0x20U
+#define CAN_ERR_CRTL_ACTIVE         0x40U
+#define CAN_ERR_PROT_FORM           0x02U
+#define CAN_ERR_PROT_STUFF          0x04U
+#define CAN_ERR_PROT_BIT0           0x08U
+#define CAN_ERR_PROT_BIT1           0x10U
+#define CAN_ERR_PROT_LOC_CRC_SEQ    0x08U
+#define CAN_ERR_PROT_LOC_ACK        0x19U
+
+static const char *const lecNames[CAN_LEC_CODES] = {
+    "none", "stuff", "form", "ack", "bit1", "bit0", "crc"
+};
+
+static const char *const stateNames[CAN_BUS_STATES] = {
+    "active", "warning", "passive", "busoff"
+};
+
+/**
+ * @brief   Decodes an @p ESR value.
+ *
+ * @param[out] ev       The event, nothing folded.
+ * @param[in] esr       Status and counters, read after the interrupt.
+ * @param[in] lec       Error code seen by the interrupt, the driver clears
+ *                      it in @p ESR.
+ * @param[in] overflow  A receive FIFO overran.
+ */
+void can_event_decode(CanEvent *ev, uint32_t esr, uint8_t lec, bool overflow)
+{
+    ev->lec = lec < CAN_LEC_CODES ? lec : CAN_LEC_NONE;
+    if ((esr & ESR_BOFF) != 0)
+        ev->state = CAN_BUS_OFF;
+    else if ((esr & ESR_EPVF) != 0)
+        ev->state = CAN_BUS_PASSIVE;
+    else if ((esr & ESR_EWGF) != 0)
+        ev->state = CAN_BUS_WARNING;
+    else
+        ev->state = CAN_BUS_ACTIVE;
+    ev->tec = (uint8_t)(esr >> ESR_TEC_SHIFT);
+    ev->rec = (uint8_t)(esr >> ESR_REC_SHIFT);
+    ev->flags = overflow ? CAN_EVENT_OVERFLOW : 0;
+    ev->folded = 0;
+}
+
+/**
+ * @brief   Initializes a tracker, the bus starts error active.
+ */
+void can_event_tracker_init(CanEventTracker *tp)
+{
+    memset(tp, 0, sizeof(*tp));
+}
+
+/**
+ * @brief   Counts an event and decides if it is recorded.
+ * @details An event without error code, overflow or state change is a
+ *          poll that found nothing new, it is not counted.
+ *
+ * @param[in] tp        The tracker.
+ * @param[in,out] ev    The event, @p folded is set if it is recorded.
+ * @param[in] timestamp Time of the event.
+ * @return              True if the event should be recorded.
+ */
+bool can_event_track(CanEventTracker *tp, CanEvent *ev, uint32_t timestamp)
+{
+    CanEventCounters *cp = &tp->counters;
+    bool changed = ev->state != tp->last.state;
+
+    if (ev->lec == CAN_LEC_NONE && ev->flags == 0 && !changed)
+        return false;
+
+    cp->events++;
+    cp->lec[ev->lec]++;
+    if ((ev->flags & CAN_EVENT_OVERFLOW) != 0)
+        cp->overflows++;
+    if (changed)
+        cp->entered[ev->state]++;
+    if (ev->tec > cp->tecMax)
+        cp->tecMax = ev->tec;
+    if (ev->rec > cp->recMax)
+        cp->recMax = ev->rec;
+
+    if (!changed && tp->recorded && ev->lec == tp->last.lec &&
+        ev->flags == tp->last.flags &&
+        timestamp - tp->lastTime < CAN_EVENT_HOLDOFF_US &&
+        tp->folded < UINT16_MAX)
+    {
+        tp->folded++;
+        return false;
+    }
+
+    ev->folded = tp->folded;
+    tp->last = *ev;
+    tp->lastTime = timestamp;
+    tp->folded = 0;
+    tp->recorded = true;
+    cp->recorded++;
+
+    return true;
+}
+
+/**
+ * @brief   Stores an event as a record.
+ * @details Data bytes: error code, state, TEC, REC, flags, folded count
+ *          little endian, zero.
+ */
+void can_event_to_record(const CanEvent *ev, uint32_t timestamp,
+                         CanRecord *rp)
+{
+    rp->timestamp = timestamp;
+    rp->id = CAN_RECORD_EVENT;
+    rp->data[0] = ev->lec;
+    rp->data[1] = ev->state;
+    rp->data[2] = ev->tec;
+    rp->data[3] = ev->rec;
+    rp->data[4] = ev->flags;
+    rp->data[5] = (uint8_t)ev->folded;
+    rp->data[6] = (uint8_t)(ev->folded >> 8);
+    rp->data[7] = 0;
+}
+
+/**
+ * @brief   Restores an event from a record.
+ *
+ * @return  False if the record is not an event.
+ */
+bool can_event_from_record(const CanRecord *rp, CanEvent *ev)
+{
+    if (!CAN_RECORD_IS_EVENT(rp))
+        return false;
+
+    ev->lec = rp->data[0] < CAN_LEC_CODES ? rp->data[0] : CAN_LEC_NONE;
+    ev->state = rp->data[1] < CAN_BUS_STATES ? rp->data[1] : CAN_BUS_ACTIVE;
+    ev->tec = rp->data[2];
+    ev->rec = rp->data[3];
+    ev->flags = rp->data[4];
+    ev->folded = (uint16_t)(rp->data[5] | rp->data[6] << 8);
+
+    return true;
+}
+
+/**
+ * @brief   Builds a SocketCAN error frame.
+ *
+ * @param[in] ev        The event.
+ * @param[out] data     Eight data bytes.
+ * @return              Identifier with @p CAN_ERR_FLAG, the DLC is 8.
+ */
+uint32_t can_event_socketcan(const CanEvent *ev, uint8_t *data)
+{
+    uint32_t id = CAN_ERR_FLAG | CAN_ERR_CNT;
+
+    memset(data, 0, 8);
+    data[6] = ev->tec;
+    data[7] = ev->rec;
+
+    switch (ev->lec)
+    {
+    case CAN_LEC_NONE:
+        break;
+    case CAN_LEC_ACK:
+        id |= CAN_ERR_ACK | CAN_ERR_BUSERROR;
+        data[3] = CAN_ERR_PROT_LOC_ACK;
+        break;
+    default:
+        id |= CAN_ERR_PROT | CAN_ERR_BUSERROR;
+        data[2] = ev->lec == CAN_LEC_STUFF ? CAN_ERR_PROT_STUFF :
+                  ev->lec == CAN_LEC_FORM ? CAN_ERR_PROT_FORM :
+                  ev->lec == CAN_LEC_BIT1 ? CAN_ERR_PROT_BIT1 :
+                  ev->lec == CAN_LEC_BIT0 ? CAN_ERR_PROT_BIT0 : 0;
+        if (ev->lec == CAN_LEC_CRC)
+            data[3] = CAN_ERR_PROT_LOC_CRC_SEQ;
+        break;
+    }
+
+    if (ev->state == CAN_BUS_OFF)
+        id |= CAN_ERR_BUSOFF;
+    if ((ev->flags & CAN_EVENT_OVERFLOW) != 0)
+        data[1] |= CAN_ERR_CRTL_RX_OVERFLOW;
+    if (ev->state == CAN_BUS_PASSIVE)
+    {
+        data[1] |= ev->tec > 127 ? CAN_ERR_CRTL_TX_PASSIVE : 0;
+        data[1] |= ev->rec > 127 ? CAN_ERR_CRTL_RX_PASSIVE : 0;
+    }
+    else if (ev->state == CAN_BUS_WARNING)
+    {
+        data[1] |= ev->tec >= 96 ? CAN_ERR_CRTL_TX_WARNING : 0;
+        data[1] |= ev->rec >= 96 ? CAN_ERR_CRTL_RX_WARNING : 0;
+    }
+    else if (ev->state == CAN_BUS_ACTIVE && ev->lec == CAN_LEC_NONE &&
+             ev->flags == 0)
+    {
+        /* Only a state change is recorded without code or flags.*/
+        data[1] |= CAN_ERR_CRTL_ACTIVE;
+    }
+    if (data[1] != 0)
+        id |= CAN_ERR_CRTL;
+
+    return id;
+}
+
+/**
+ * @brief   Short name of an error code.
+ */
+const char *can_event_lec_name(uint8_t lec)
+{
+    return lec < CAN_LEC_CODES ? lecNames[lec] : "?";
+}
+
+/**
+ * @brief   Short name of a bus state.
+ */
+const char *can_event_state_name(uint8_t state)
+{
+    return state < CAN_BUS_STATES ? stateNames[state] : "?";
+}
+
+/** @} */
@@ -0,0 +1,150 @@
+/**
+ * @file    src/can_event.h
+ * @brief   Bus error and bus state events.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _CAN_EVENT_H_
+#define _CAN_EVENT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "can_record.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Last error codes of the bxCAN @p ESR register.
+ */
+typedef enum {
+  CAN_LEC_NONE = 0,
+  CAN_LEC_STUFF,            /**< Six equal bits in a row.                  */
+  CAN_LEC_FORM,             /**< Fixed format field violated.              */
+  CAN_LEC_ACK,              /**< Transmitted frame not acknowledged.       */
+  CAN_LEC_BIT1,             /**< Sent recessive, read dominant.            */
+  CAN_LEC_BIT0,             /**< Sent dominant, read recessive.            */
+  CAN_LEC_CRC,              /**< CRC mismatch.                             */
+  CAN_LEC_CODES
+} canlec_t;
+
+/**
+ * @brief   Code written by software, replaced by the controller with the
+ *          outcome of the next frame on the bus.
+ */
+#define CAN_LEC_UNSET               7U
+
+/**
+ * @brief   Fault confinement states.
+ */
+typedef enum {
+  CAN_BUS_ACTIVE = 0,       /**< Both counters below 96.                   */
+  CAN_BUS_WARNING,          /**< A counter reached 96.                     */
+  CAN_BUS_PASSIVE,          /**< A counter above 127.                      */
+  CAN_BUS_OFF,              /**< Transmit counter above 255.               */
+  CAN_BUS_STATES
+} canbusstate_t;
+
+/**
+ * @brief   Event flags.
+ */
+#define CAN_EVENT_OVERFLOW          (1U << 0)   /**< Receive FIFO overrun. */
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Identical events within this time are counted, not recorded.
+ * @details A bus without a second node or with a wrong bitrate raises an
+ *          error per frame attempt, thousands per second. Folding them
+ *          keeps the backlog for the frames around the fault.
+ */
+#if !defined(CAN_EVENT_HOLDOFF_US) || defined(__DOXYGEN__)
+#define CAN_EVENT_HOLDOFF_US        100000
+#endif
+
+/*===========================================================================*/
+/* Derived constants and error checks.                                       */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   A decoded bus event.
+ */
+typedef struct {
+    uint8_t lec;            /**< @p canlec_t of the error, if any.         */
+    uint8_t state;          /**< @p canbusstate_t after the event.         */
+    uint8_t tec;            /**< Transmit error counter.                   */
+    uint8_t rec;            /**< Receive error counter.                    */
+    uint8_t flags;          /**< @p CAN_EVENT_* flags.                     */
+    uint16_t folded;        /**< Identical events not recorded before it.  */
+} CanEvent;
+
+/**
+ * @brief   Totals since start.
+ */
+typedef struct {
+    uint32_t events;        /**< Error events seen.                        */
+    uint32_t recorded;      /**< Events that became records.               */
+    uint32_t lec[CAN_LEC_CODES]; /**< Events per error code.               */
+    uint32_t overflows;     /**< Receive FIFO overruns.                    */
+    uint32_t entered[CAN_BUS_STATES]; /**< Changes into each state.        */
+    uint8_t tecMax;
+    uint8_t recMax;
+} CanEventCounters;
+
+/**
+ * @brief   Event tracker, decides which events are recorded.
+ */
+typedef struct {
+    CanEventCounters counters;
+    CanEvent last;          /**< Last recorded event.                      */
+    uint32_t lastTime;
+    uint16_t folded;        /**< Events folded since @p last.              */
+    bool recorded;          /**< @p last is valid.                         */
+} CanEventTracker;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/**
+ * @brief   True while the bus is not error active.
+ * @details The controller only interrupts on the way into a worse state,
+ *          the way back has to be polled.
+ */
+#define CAN_EVENT_DEGRADED(tp)      ((tp)->last.state != CAN_BUS_ACTIVE)
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void can_event_decode(CanEvent *ev, uint32_t esr, uint8_t lec,
+                        bool overflow);
+  void can_event_tracker_init(CanEventTracker *tp);
+  bool can_event_track(CanEventTracker *tp, CanEvent *ev,
+                       uint32_t timestamp);
+  void can_event_to_record(const CanEvent *ev, uint32_t timestamp,
+                           CanRecord *rp);
+  bool can_event_from_record(const CanRecord *rp, CanEvent *ev);
+  uint32_t can_event_socketcan(const CanEvent *ev, uint8_t *data);
+  const char *can_event_lec_name(uint8_t lec);
+  const char *can_event_state_name(uint8_t state);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CAN_EVENT_H_ */
+
+/** @} */
@@ -0,0 +1,44 @@
+/**
+ * @file    src/can_frame.c
+ * @brief   Frames of the CAN driver as records.
+ * @details The pipeline carries records, frames of the driver are
+ *          converted where they are received and where they are sent.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include "can_frame.h"
+
+/**
+ * @brief   Makes the record of a received frame.
+ */
+void canFrameToRecord(const CANRxFrame *rxmsg, uint32_t timestamp,
+                      CanRecord *record)
+{
+    can_record_set(record,
+            rxmsg->IDE == CAN_IDE_EXT ? rxmsg->EID : rxmsg->SID,
+            rxmsg->IDE == CAN_IDE_EXT, rxmsg->RTR == CAN_RTR_REMOTE,
+            rxmsg->DLC, rxmsg->data8, timestamp);
+}
+
+/**
+ * @brief   Makes the frame to send of a record.
+ */
+void canFrameFromRecord(const CanRecord *record, CANTxFrame *txmsg)
+{
+    if (CAN_RECORD_IS_EXT(record))
+    {
+        txmsg->IDE = CAN_IDE_EXT;
+        txmsg->EID = CAN_RECORD_GET_ID(record);
+    }
+    else
+    {
+        txmsg->IDE = CAN_IDE_STD;
+        txmsg->SID = CAN_RECORD_GET_ID(record);
+    }
+    txmsg->RTR = CAN_RECORD_IS_RTR(record) ? CAN_RTR_REMOTE : CAN_RTR_DATA;
+    txmsg->DLC = can_record_get_data(record, txmsg->data8);
+}
+
+/** @} */
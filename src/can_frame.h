@@ -0,0 +1,52 @@
+/**
+ * @file    src/can_frame.h
+ * @brief   Frames of the CAN driver as records.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _CAN_FRAME_H_
+#define _CAN_FRAME_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "can_record.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Derived constants and error checks.                                       */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void canFrameToRecord(const CANRxFrame *rxmsg, uint32_t timestamp,
+                        CanRecord *record);
+  void canFrameFromRecord(const CanRecord *record, CANTxFrame *txmsg);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CAN_FRAME_H_ */
+
+/** @} */
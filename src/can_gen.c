@@ -0,0 +1,140 @@
+/**
+ * @file    src/can_gen.c
+ * @brief   Synthetic traffic for bus stress tests.
+ * @details Makes the frames of the traffic generator and the time each
+ *          one takes from its start to the start of the next. That slot
+ *          is the bit count of the frame, stuff bits included, divided by
+ *          the target load, so the load holds whatever identifiers and
+ *          payloads are drawn. Slots are counted in ticks of the clock
+ *          that spaces the frames, the remainder is carried to the next
+ *          slot and the schedule does not drift.
+ *          Random numbers come from a fixed seed, a run repeats with the
+ *          same settings.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include <string.h>
+
+#include "can_gen.h"
+#include "can_bits.h"
+
+#define RANDOM_SEED                 0x2545F491U
+
+static uint32_t next_random(CanGen *gp)
+{
+    uint32_t x = gp->random;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    gp->random = x;
+
+    return x;
+}
+
+/**
+ * @brief   Checks settings.
+ *
+ * @return  False if the load, identifier range or DLC range is invalid.
+ */
+bool can_gen_check(const CanGenConfig *config)
+{
+    uint32_t limit = config->extended ? CAN_RECORD_ID_MASK : 0x7FFU;
+
+    return config->load <= CAN_GEN_LOAD_FULL &&
+           config->idMode <= CAN_GEN_ID_RANDOM &&
+           config->dataMode <= CAN_GEN_DATA_FIXED &&
+           config->idCount != 0 && config->id <= limit &&
+           config->idCount - 1 <= limit - config->id &&
+           config->dlcMin <= config->dlcMax && config->dlcMax <= 8;
+}
+
+/**
+ * @brief   Starts a run, settings checked by @p can_gen_check.
+ */
+void can_gen_init(CanGen *gp, const CanGenConfig *config)
+{
+    gp->config = *config;
+    gp->count = 0;
+    gp->random = RANDOM_SEED;
+    gp->scale = 0;
+    gp->divisor = 1;
+    gp->remainder = 0;
+}
+
+/**
+ * @brief   Sets the bitrate and the tick rate of the slots.
+ * @details Also after a bitrate change, the schedule starts over.
+ */
+void can_gen_set_clock(CanGen *gp, uint32_t bitrate, uint32_t hz)
+{
+    uint32_t load = gp->config.load != 0 ? gp->config.load : 1;
+
+    gp->scale = (uint64_t)hz * CAN_GEN_LOAD_FULL;
+    gp->divisor = bitrate * load;
+    gp->remainder = 0;
+}
+
+/**
+ * @brief   Makes the next frame.
+ *
+ * @return  Bit times of the frame.
+ */
+uint32_t can_gen_next(CanGen *gp, CanRecord *rp)
+{
+    const CanGenConfig *config = &gp->config;
+    uint32_t id = config->id;
+    uint8_t dlc = config->dlcMin;
+    uint8_t data[8];
+
+    if (config->idMode == CAN_GEN_ID_SEQUENTIAL)
+        id += gp->count % config->idCount;
+    else if (config->idMode == CAN_GEN_ID_RANDOM)
+        id += next_random(gp) % config->idCount;
+
+    if (config->dlcMax != config->dlcMin)
+        dlc += (uint8_t)(next_random(gp) % (config->dlcMax - config->dlcMin + 1U));
+
+    switch (config->dataMode)
+    {
+    case CAN_GEN_DATA_RANDOM:
+    {
+        uint32_t words[2] = {next_random(gp), next_random(gp)};
+
+        memcpy(data, words, sizeof(data));
+        break;
+    }
+    case CAN_GEN_DATA_FIXED:
+        memcpy(data, config->data, sizeof(data));
+        break;
+    case CAN_GEN_DATA_COUNTER:
+    default:
+        memset(data, 0, sizeof(data));
+        for (unsigned i = 0; i < 4; i++)
+            data[i] = (uint8_t)(gp->count >> (8 * i));
+        break;
+    }
+
+    can_record_set(rp, id, config->extended, false, dlc, data, 0);
+    gp->count++;
+
+    return can_bits_frame(rp);
+}
+
+/**
+ * @brief   Ticks from the start of a frame to the start of the next.
+ *
+ * @param[in] bits      Bit times of the frame, from @p can_gen_next.
+ */
+uint32_t can_gen_slot(CanGen *gp, uint32_t bits)
+{
+    uint64_t ticks = bits * gp->scale + gp->remainder;
+
+    gp->remainder = (uint32_t)(ticks % gp->divisor);
+
+    return (uint32_t)(ticks / gp->divisor);
+}
+
+/** @} */
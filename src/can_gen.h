@@ -0,0 +1,108 @@
+/**
+ * @file    src/can_gen.h
+ * @brief   Synthetic traffic for bus stress tests.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _CAN_GEN_H_
+#define _CAN_GEN_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "can_record.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Full bus load in permille, frames back to back.
+ */
+#define CAN_GEN_LOAD_FULL           1000U
+
+/**
+ * @brief   Identifier sequence.
+ */
+typedef enum {
+  CAN_GEN_ID_FIXED = 0,     /**< Always the first identifier.              */
+  CAN_GEN_ID_SEQUENTIAL,    /**< Counting up through the range.            */
+  CAN_GEN_ID_RANDOM         /**< Evenly drawn from the range.              */
+} cangenidmode_t;
+
+/**
+ * @brief   Payload pattern.
+ */
+typedef enum {
+  CAN_GEN_DATA_COUNTER = 0, /**< Frame count, little endian.               */
+  CAN_GEN_DATA_RANDOM,
+  CAN_GEN_DATA_FIXED
+} cangendatamode_t;
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Derived constants and error checks.                                       */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Generator settings.
+ * @details Identifiers are taken from @p id to @p id + @p idCount - 1, the
+ *          DLC is drawn evenly from @p dlcMin to @p dlcMax.
+ */
+typedef struct {
+    uint16_t load;          /**< Target bus load in permille, 0 is off.    */
+    uint8_t idMode;         /**< @p cangenidmode_t.                        */
+    bool extended;
+    uint32_t id;
+    uint32_t idCount;
+    uint8_t dlcMin;
+    uint8_t dlcMax;
+    uint8_t dataMode;       /**< @p cangendatamode_t.                      */
+    uint8_t data[8];        /**< The fixed payload.                        */
+} CanGenConfig;
+
+/**
+ * @brief   Generator state.
+ */
+typedef struct {
+    CanGenConfig config;
+    uint32_t count;         /**< Frames generated.                         */
+    uint32_t random;        /**< xorshift32 state.                         */
+    /* Frame start to frame start, in ticks: bits * scale / divisor.*/
+    uint64_t scale;
+    uint32_t divisor;
+    uint32_t remainder;
+} CanGen;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  bool can_gen_check(const CanGenConfig *config);
+  void can_gen_init(CanGen *gp, const CanGenConfig *config);
+  void can_gen_set_clock(CanGen *gp, uint32_t bitrate, uint32_t hz);
+  uint32_t can_gen_next(CanGen *gp, CanRecord *rp);
+  uint32_t can_gen_slot(CanGen *gp, uint32_t bits);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CAN_GEN_H_ */
+
+/** @} */
@@ -0,0 +1,692 @@
+/**
+ * @file    src/can_isotp.c
+ * @brief   ISO-TP (ISO 15765-2) segmentation and reassembly.
+ * @details Messages of up to 4095 bytes travel as a single frame, or as a
+ *          first frame, consecutive frames and flow control from the
+ *          receiver. Normal and normal fixed addressing are supported,
+ *          the protocol control information is the first data byte.
+ *          Frames on identifiers of the sniffed ranges are reassembled
+ *          passively, each identifier is a session of its own, flow
+ *          control is left to the two ends. On an active channel the
+ *          engine is an end itself: it answers first frames with flow
+ *          control at once and sends messages, consecutive frames spaced
+ *          by the separation time the receiver asked for.
+ *          Only complete messages are reported. A session is given up
+ *          after @p CAN_ISOTP_TIMEOUT_US without the frame it waits for,
+ *          or on a sequence error.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include <string.h>
+
+#include "can_isotp.h"
+
+/* Protocol control information, the high nibble of the first byte.*/
+#define PCI_SINGLE                  0x0U
+#define PCI_FIRST                   0x1U
+#define PCI_CONSECUTIVE             0x2U
+#define PCI_FLOW                    0x3U
+
+/* Flow status.*/
+#define FLOW_CONTINUE               0x0U
+#define FLOW_WAIT                   0x1U
+#define FLOW_OVERFLOW               0x2U
+
+static const char *const resultNames[CAN_ISOTP_RESULTS] = {
+    "done", "timeout", "overflow", "aborted", "busy", "invalid", "failed"
+};
+
+static bool key_valid(uint32_t key)
+{
+    uint32_t id = key & ~CAN_RECORD_EXT;
+
+    return (key & CAN_RECORD_EXT) != 0 ? id <= CAN_RECORD_ID_MASK :
+                                         id <= 0x7FFU;
+}
+
+static bool due(uint32_t now, uint32_t deadline)
+{
+    return (int32_t)(now - deadline) >= 0;
+}
+
+/*
+ * Separation time in microseconds, reserved values are the longest.
+ */
+static uint32_t separation_us(uint8_t stmin)
+{
+    if (stmin <= 0x7FU)
+        return stmin * 1000U;
+    if (stmin >= 0xF1U && stmin <= 0xF9U)
+        return (stmin - 0xF0U) * 100U;
+
+    return 127000U;
+}
+
+static bool in_ranges(const CanIsoTp *ip, uint32_t key)
+{
+    for (size_t i = 0; i < ip->rangeCount; i++)
+    {
+        if (key >= ip->ranges[i].first && key <= ip->ranges[i].last)
+            return true;
+    }
+
+    return false;
+}
+
+static uint8_t channel_of(const CanIsoTp *ip, uint32_t key)
+{
+    for (uint8_t i = 0; i < CAN_ISOTP_CHANNELS; i++)
+    {
+        if (ip->channels[i].open && ip->channels[i].rxKey == key)
+            return i;
+    }
+
+    return CAN_ISOTP_PASSIVE;
+}
+
+static CanIsoTpSession *session_receiving(CanIsoTp *ip, uint32_t key)
+{
+    for (size_t i = 0; i < ip->sessionCount; i++)
+    {
+        CanIsoTpSession *sp = &ip->sessions[i];
+
+        if (sp->state == CAN_ISOTP_RECEIVE && sp->key == key)
+            return sp;
+    }
+
+    return NULL;
+}
+
+static CanIsoTpSession *session_sending(CanIsoTp *ip, uint8_t channel)
+{
+    for (size_t i = 0; i < ip->sessionCount; i++)
+    {
+        CanIsoTpSession *sp = &ip->sessions[i];
+
+        if ((sp->state == CAN_ISOTP_WAIT || sp->state == CAN_ISOTP_SEND) &&
+            sp->channel == channel)
+            return sp;
+    }
+
+    return NULL;
+}
+
+static CanIsoTpSession *session_free(CanIsoTp *ip)
+{
+    for (size_t i = 0; i < ip->sessionCount; i++)
+    {
+        if (ip->sessions[i].state == CAN_ISOTP_IDLE)
+            return &ip->sessions[i];
+    }
+
+    return NULL;
+}
+
+static void send_flow(CanIsoTp *ip, uint8_t channel, uint8_t status,
+                      const CanIsoTpOps *ops, void *arg)
+{
+    uint8_t data[8];
+
+    memset(data, CAN_ISOTP_PADDING, sizeof(data));
+    data[0] = (uint8_t)(PCI_FLOW << 4 | status);
+    data[1] = ip->blockSize;
+    data[2] = ip->stmin;
+    if (!ops->send(ip->channels[channel].txKey, data, arg))
+        ip->stats.flowLost++;
+}
+
+static void finish(CanIsoTpSession *sp, uint8_t result, const CanIsoTpOps *ops,
+                   void *arg)
+{
+    CanIsoTpResult r = {sp->cookie, sp->channel, result};
+
+    sp->state = CAN_ISOTP_IDLE;
+    ops->result(&r, arg);
+}
+
+static void deliver(CanIsoTp *ip, uint32_t key, uint8_t channel,
+                    uint32_t timestamp, const uint8_t *data, uint16_t length,
+                    const CanIsoTpOps *ops, void *arg)
+{
+    CanIsoTpPdu pdu = {key, timestamp, length, channel,
+                       (uint8_t)(ip->stats.pdus & 0x3FU), data};
+
+    ip->stats.pdus++;
+    ops->pdu(&pdu, arg);
+}
+
+static void take_single(CanIsoTp *ip, uint32_t key, uint8_t channel,
+                        uint32_t now, const uint8_t *data, uint8_t dlc,
+                        const CanIsoTpOps *ops, void *arg)
+{
+    uint8_t length = data[0] & 0x0FU;
+    CanIsoTpSession *sp = session_receiving(ip, key);
+
+    /* A single frame ends a reception in progress.*/
+    if (sp != NULL)
+    {
+        sp->state = CAN_ISOTP_IDLE;
+        ip->stats.sequence++;
+    }
+    if (length == 0 || length > dlc - 1U)
+    {
+        ip->stats.invalid++;
+        return;
+    }
+    deliver(ip, key, channel, now, &data[1], length, ops, arg);
+}
+
+static void take_first(CanIsoTp *ip, uint32_t key, uint8_t channel,
+                       uint32_t now, const uint8_t *data, uint8_t dlc,
+                       const CanIsoTpOps *ops, void *arg)
+{
+    uint16_t length = (uint16_t)((data[0] & 0x0FU) << 8 | data[1]);
+    CanIsoTpSession *sp = session_receiving(ip, key);
+
+    if (dlc != 8 || length < 8)
+    {
+        ip->stats.invalid++;
+        return;
+    }
+    /* A new first frame starts the message over.*/
+    if (sp != NULL)
+        sp->state = CAN_ISOTP_IDLE;
+    if (length > ip->bufferSize)
+    {
+        ip->stats.overflows++;
+        if (channel != CAN_ISOTP_PASSIVE)
+            send_flow(ip, channel, FLOW_OVERFLOW, ops, arg);
+        return;
+    }
+    sp = session_free(ip);
+    if (sp == NULL)
+    {
+        ip->stats.noSession++;
+        if (channel != CAN_ISOTP_PASSIVE)
+            send_flow(ip, channel, FLOW_OVERFLOW, ops, arg);
+        return;
+    }
+
+    sp->state = CAN_ISOTP_RECEIVE;
+    sp->channel = channel;
+    sp->sequence = 1;
+    sp->blockLeft = ip->blockSize;
+    sp->length = length;
+    sp->offset = 6;
+    sp->key = key;
+    sp->started = now;
+    sp->deadline = now + CAN_ISOTP_TIMEOUT_US;
+    memcpy(sp->buffer, &data[2], 6);
+    if (channel != CAN_ISOTP_PASSIVE)
+        send_flow(ip, channel, FLOW_CONTINUE, ops, arg);
+}
+
+static void take_consecutive(CanIsoTp *ip, uint32_t key, uint32_t now,
+                             const uint8_t *data, uint8_t dlc,
+                             const CanIsoTpOps *ops, void *arg)
+{
+    CanIsoTpSession *sp = session_receiving(ip, key);
+
+    /* Sniffing started within a message.*/
+    if (sp == NULL)
+        return;
+    if ((data[0] & 0x0FU) != sp->sequence || dlc < 2)
+    {
+        sp->state = CAN_ISOTP_IDLE;
+        ip->stats.sequence++;
+        return;
+    }
+
+    size_t n = sp->length - sp->offset;
+    if (n > dlc - 1U)
+        n = dlc - 1U;
+    memcpy(&sp->buffer[sp->offset], &data[1], n);
+    sp->offset = (uint16_t)(sp->offset + n);
+    sp->sequence = (sp->sequence + 1U) & 0x0FU;
+    sp->deadline = now + CAN_ISOTP_TIMEOUT_US;
+    if (sp->offset == sp->length)
+    {
+        sp->state = CAN_ISOTP_IDLE;
+        deliver(ip, key, sp->channel, sp->started, sp->buffer, sp->length,
+                ops, arg);
+        return;
+    }
+
+    /* The sender waits for flow control after each block.*/
+    if (sp->channel != CAN_ISOTP_PASSIVE && ip->blockSize != 0 &&
+        --sp->blockLeft == 0)
+    {
+        sp->blockLeft = ip->blockSize;
+        send_flow(ip, sp->channel, FLOW_CONTINUE, ops, arg);
+    }
+}
+
+static void take_flow(CanIsoTp *ip, uint8_t channel, uint32_t now,
+                      const uint8_t *data, uint8_t dlc,
+                      const CanIsoTpOps *ops, void *arg)
+{
+    CanIsoTpSession *sp;
+
+    /* Sniffed flow control is left to the two ends.*/
+    if (channel == CAN_ISOTP_PASSIVE)
+        return;
+    sp = session_sending(ip, channel);
+    if (sp == NULL || sp->state != CAN_ISOTP_WAIT)
+        return;
+    if (dlc < 3)
+    {
+        ip->stats.invalid++;
+        return;
+    }
+
+    switch (data[0] & 0x0FU)
+    {
+    case FLOW_CONTINUE:
+        sp->state = CAN_ISOTP_SEND;
+        sp->blockSize = data[1];
+        sp->blockLeft = data[1];
+        sp->separation = separation_us(data[2]);
+        sp->deadline = now;
+        ip->wake = true;
+        break;
+    case FLOW_WAIT:
+        if (++sp->waits > CAN_ISOTP_MAX_WAITS)
+            finish(sp, CAN_ISOTP_ABORTED, ops, arg);
+        else
+            sp->deadline = now + CAN_ISOTP_TIMEOUT_US;
+        break;
+    case FLOW_OVERFLOW:
+        finish(sp, CAN_ISOTP_OVERFLOW, ops, arg);
+        break;
+    default:
+        finish(sp, CAN_ISOTP_ABORTED, ops, arg);
+        break;
+    }
+}
+
+/*
+ * Sends the consecutive frames that are due.
+ */
+static void send_due(CanIsoTp *ip, CanIsoTpSession *sp, uint32_t now,
+                     const CanIsoTpOps *ops, void *arg)
+{
+    while (sp->state == CAN_ISOTP_SEND && due(now, sp->deadline))
+    {
+        uint8_t data[8];
+        size_t n = sp->length - sp->offset;
+
+        if (n > 7)
+            n = 7;
+        memset(data, CAN_ISOTP_PADDING, sizeof(data));
+        data[0] = (uint8_t)(PCI_CONSECUTIVE << 4 | sp->sequence);
+        memcpy(&data[1], &sp->buffer[sp->offset], n);
+        /* Tried again when a mailbox empties.*/
+        if (!ops->send(sp->key, data, arg))
+            return;
+
+        sp->offset = (uint16_t)(sp->offset + n);
+        sp->sequence = (sp->sequence + 1U) & 0x0FU;
+        if (sp->offset == sp->length)
+        {
+            ip->stats.sent++;
+            finish(sp, CAN_ISOTP_DONE, ops, arg);
+            return;
+        }
+        if (sp->blockSize != 0 && --sp->blockLeft == 0)
+        {
+            sp->state = CAN_ISOTP_WAIT;
+            sp->waits = 0;
+            sp->deadline = now + CAN_ISOTP_TIMEOUT_US;
+            return;
+        }
+        sp->deadline = now + sp->separation;
+    }
+}
+
+/**
+ * @brief   Starts with no channel open and every session free.
+ *
+ * @param[in] ranges    Sniffed identifiers, kept.
+ * @param[in] sessions  Sessions, kept.
+ * @param[in] buffers   @p bufferSize bytes for each session, kept.
+ */
+void can_isotp_init(CanIsoTp *ip, const CanIsoTpRange *ranges,
+                    size_t rangeCount, CanIsoTpSession *sessions,
+                    size_t sessionCount, uint8_t *buffers, size_t bufferSize)
+{
+    memset(ip, 0, sizeof(*ip));
+    ip->ranges = ranges;
+    ip->rangeCount = rangeCount;
+    ip->sessions = sessions;
+    ip->sessionCount = sessionCount;
+    ip->bufferSize = bufferSize < CAN_ISOTP_MAX_LENGTH ? bufferSize :
+                                                         CAN_ISOTP_MAX_LENGTH;
+    for (size_t i = 0; i < sessionCount; i++)
+    {
+        memset(&sessions[i], 0, sizeof(sessions[i]));
+        sessions[i].buffer = &buffers[i * bufferSize];
+    }
+}
+
+/**
+ * @brief   Opens an active channel.
+ *
+ * @param[in] rxKey     Identifier received, with @p CAN_RECORD_EXT.
+ * @param[in] txKey     Identifier sent.
+ * @return              False if the channel is open or a key invalid.
+ */
+bool can_isotp_open(CanIsoTp *ip, uint8_t channel, uint32_t rxKey,
+                    uint32_t txKey)
+{
+    CanIsoTpChannel *cp;
+
+    if (channel >= CAN_ISOTP_CHANNELS || ip->channels[channel].open ||
+        !key_valid(rxKey) || !key_valid(txKey) || rxKey == txKey)
+        return false;
+    cp = &ip->channels[channel];
+
+    cp->rxKey = rxKey;
+    cp->txKey = txKey;
+    cp->open = true;
+
+    return true;
+}
+
+/**
+ * @brief   Closes an active channel, its transfers are given up.
+ */
+void can_isotp_close(CanIsoTp *ip, uint8_t channel, const CanIsoTpOps *ops,
+                     void *arg)
+{
+    if (channel >= CAN_ISOTP_CHANNELS)
+        return;
+
+    for (size_t i = 0; i < ip->sessionCount; i++)
+    {
+        CanIsoTpSession *sp = &ip->sessions[i];
+
+        if (sp->state == CAN_ISOTP_IDLE || sp->channel != channel)
+            continue;
+        if (sp->state == CAN_ISOTP_RECEIVE)
+            sp->state = CAN_ISOTP_IDLE;
+        else
+            finish(sp, CAN_ISOTP_ABORTED, ops, arg);
+    }
+    ip->channels[channel].open = false;
+}
+
+/**
+ * @brief   Takes a received frame.
+ *
+ * @return  False if the frame is no ISO-TP frame, neither sniffed nor of
+ *          an active channel.
+ */
+bool can_isotp_frame(CanIsoTp *ip, const CanRecord *rp,
+                     const CanIsoTpOps *ops, void *arg)
+{
+    uint32_t key = CAN_RECORD_GET_ID(rp) |
+                   (CAN_RECORD_IS_EXT(rp) ? CAN_RECORD_EXT : 0U);
+    uint8_t channel;
+    uint8_t data[8];
+    uint8_t dlc;
+
+    if (CAN_RECORD_IS_RTR(rp) || CAN_RECORD_IS_DEVICE(rp))
+        return false;
+    channel = channel_of(ip, key);
+    if (channel == CAN_ISOTP_PASSIVE && !in_ranges(ip, key))
+        return false;
+
+    ip->stats.frames++;
+    dlc = can_record_get_data(rp, data);
+    if (dlc == 0)
+    {
+        ip->stats.invalid++;
+        return true;
+    }
+
+    switch (data[0] >> 4)
+    {
+    case PCI_SINGLE:
+        take_single(ip, key, channel, rp->timestamp, data, dlc, ops, arg);
+        break;
+    case PCI_FIRST:
+        take_first(ip, key, channel, rp->timestamp, data, dlc, ops, arg);
+        break;
+    case PCI_CONSECUTIVE:
+        take_consecutive(ip, key, rp->timestamp, data, dlc, ops, arg);
+        break;
+    case PCI_FLOW:
+        take_flow(ip, channel, rp->timestamp, data, dlc, ops, arg);
+        break;
+    default:
+        ip->stats.invalid++;
+        break;
+    }
+
+    return true;
+}
+
+/**
+ * @brief   Sends a message on an active channel.
+ * @details Every request ends in exactly one result, at once or when the
+ *          last frame went out.
+ *
+ * @param[in] cookie    Returned with the result.
+ * @return              False if the request ended at once.
+ */
+bool can_isotp_send(CanIsoTp *ip, uint8_t channel, uint32_t cookie,
+                    const uint8_t *data, size_t length, uint32_t now,
+                    const CanIsoTpOps *ops, void *arg)
+{
+    CanIsoTpResult result = {cookie, channel, CAN_ISOTP_DONE};
+    CanIsoTpSession *sp;
+    uint8_t frame[8];
+
+    if (channel >= CAN_ISOTP_CHANNELS || !ip->channels[channel].open ||
+        length == 0 || length > ip->bufferSize)
+        result.result = CAN_ISOTP_INVALID;
+    else if (session_sending(ip, channel) != NULL)
+        result.result = CAN_ISOTP_BUSY;
+    if (result.result != CAN_ISOTP_DONE)
+    {
+        ops->result(&result, arg);
+        return false;
+    }
+
+    memset(frame, CAN_ISOTP_PADDING, sizeof(frame));
+    if (length <= 7)
+    {
+        frame[0] = (uint8_t)(PCI_SINGLE << 4 | length);
+        memcpy(&frame[1], data, length);
+        if (ops->send(ip->channels[channel].txKey, frame, arg))
+            ip->stats.sent++;
+        else
+            result.result = CAN_ISOTP_FAILED;
+        ops->result(&result, arg);
+        return false;
+    }
+
+    sp = session_free(ip);
+    if (sp == NULL)
+    {
+        result.result = CAN_ISOTP_BUSY;
+        ops->result(&result, arg);
+        return false;
+    }
+    frame[0] = (uint8_t)(PCI_FIRST << 4 | length >> 8);
+    frame[1] = (uint8_t)length;
+    memcpy(&frame[2], data, 6);
+    if (!ops->send(ip->channels[channel].txKey, frame, arg))
+    {
+        result.result = CAN_ISOTP_FAILED;
+        ops->result(&result, arg);
+        return false;
+    }
+
+    memcpy(sp->buffer, data, length);
+    sp->state = CAN_ISOTP_WAIT;
+    sp->channel = channel;
+    sp->sequence = 1;
+    sp->waits = 0;
+    sp->length = (uint16_t)length;
+    sp->offset = 6;
+    sp->key = ip->channels[channel].txKey;
+    sp->started = now;
+    sp->deadline = now + CAN_ISOTP_TIMEOUT_US;
+    sp->cookie = cookie;
+
+    return true;
+}
+
+/**
+ * @brief   Sends the frames that are due and gives up late sessions.
+ *
+ * @return  Microseconds to the next deadline, or
+ *          @p CAN_ISOTP_NO_DEADLINE.
+ */
+uint32_t can_isotp_poll(CanIsoTp *ip, uint32_t now, const CanIsoTpOps *ops,
+                        void *arg)
+{
+    uint32_t wait = CAN_ISOTP_NO_DEADLINE;
+
+    ip->wake = false;
+    for (size_t i = 0; i < ip->sessionCount; i++)
+    {
+        CanIsoTpSession *sp = &ip->sessions[i];
+
+        if (sp->state == CAN_ISOTP_SEND)
+            send_due(ip, sp, now, ops, arg);
+        else if (sp->state == CAN_ISOTP_RECEIVE && due(now, sp->deadline))
+        {
+            sp->state = CAN_ISOTP_IDLE;
+            ip->stats.timeouts++;
+        }
+        else if (sp->state == CAN_ISOTP_WAIT && due(now, sp->deadline))
+            finish(sp, CAN_ISOTP_TIMEOUT, ops, arg);
+
+        if (sp->state == CAN_ISOTP_IDLE)
+            continue;
+        /* A frame that found no mailbox is due already.*/
+        uint32_t left = due(now, sp->deadline) ? 0 : sp->deadline - now;
+        if (left < wait)
+            wait = left;
+    }
+
+    return wait;
+}
+
+/**
+ * @brief   Sessions in use.
+ */
+size_t can_isotp_active(const CanIsoTp *ip)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < ip->sessionCount; i++)
+    {
+        if (ip->sessions[i].state != CAN_ISOTP_IDLE)
+            count++;
+    }
+
+    return count;
+}
+
+/**
+ * @brief   Stores a message as records.
+ * @details The first data byte is the record type in bits 7..6 and the
+ *          message count in bits 5..0. The start record carries the key
+ *          32 bit, the length 16 bit, both little endian, and the
+ *          channel, the data records follow with seven bytes each.
+ */
+void can_isotp_pdu_to_records(const CanIsoTpPdu *pp, canisotpemit_t emit,
+                              void *arg)
+{
+    CanRecord record;
+    uint8_t tag = pp->counter & 0x3FU;
+
+    record.timestamp = pp->timestamp;
+    record.id = CAN_RECORD_ISOTP;
+    record.data[0] = (uint8_t)(CAN_ISOTP_RECORD_START << 6 | tag);
+    for (unsigned i = 0; i < 4; i++)
+        record.data[1 + i] = (uint8_t)(pp->key >> (8 * i));
+    record.data[5] = (uint8_t)pp->length;
+    record.data[6] = (uint8_t)(pp->length >> 8);
+    record.data[7] = pp->channel;
+    emit(&record, arg);
+
+    record.data[0] = (uint8_t)(CAN_ISOTP_RECORD_DATA << 6 | tag);
+    for (size_t offset = 0; offset < pp->length; offset += 7)
+    {
+        size_t n = pp->length - offset < 7 ? pp->length - offset : 7;
+
+        memset(&record.data[1], 0, 7);
+        memcpy(&record.data[1], &pp->data[offset], n);
+        emit(&record, arg);
+    }
+}
+
+/**
+ * @brief   Stores a transmit result as a record.
+ * @details After the type byte: cookie 32 bit little endian, channel and
+ *          result.
+ */
+void can_isotp_result_to_record(const CanIsoTpResult *rp, uint32_t timestamp,
+                                CanRecord *record)
+{
+    record->timestamp = timestamp;
+    record->id = CAN_RECORD_ISOTP;
+    record->data[0] = (uint8_t)(CAN_ISOTP_RECORD_RESULT << 6);
+    for (unsigned i = 0; i < 4; i++)
+        record->data[1 + i] = (uint8_t)(rp->cookie >> (8 * i));
+    record->data[5] = rp->channel;
+    record->data[6] = rp->result;
+    record->data[7] = 0;
+}
+
+/**
+ * @brief   Restores a record.
+ *
+ * @return  False if the record is no ISO-TP record.
+ */
+bool can_isotp_from_record(const CanRecord *rp, CanIsoTpRecord *out)
+{
+    uint32_t word = 0;
+
+    if (!CAN_RECORD_IS_ISOTP(rp))
+        return false;
+
+    for (unsigned i = 0; i < 4; i++)
+        word |= (uint32_t)rp->data[1 + i] << (8 * i);
+    out->type = rp->data[0] >> 6;
+    out->counter = rp->data[0] & 0x3FU;
+    switch (out->type)
+    {
+    case CAN_ISOTP_RECORD_START:
+        out->key = word;
+        out->length = (uint16_t)(rp->data[5] | rp->data[6] << 8);
+        out->channel = rp->data[7];
+        break;
+    case CAN_ISOTP_RECORD_DATA:
+        memcpy(out->data, &rp->data[1], 7);
+        break;
+    default:
+        out->result.cookie = word;
+        out->result.channel = rp->data[5];
+        out->result.result = rp->data[6];
+        break;
+    }
+
+    return true;
+}
+
+/**
+ * @brief   Short name of a transmit result.
+ */
+const char *can_isotp_result_name(uint8_t result)
+{
+    return result < CAN_ISOTP_RESULTS ? resultNames[result] : "?";
+}
+
+/** @} */
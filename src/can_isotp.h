@@ -0,0 +1,277 @@
+/**
+ * @file    src/can_isotp.h
+ * @brief   ISO-TP (ISO 15765-2) segmentation and reassembly.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _CAN_ISOTP_H_
+#define _CAN_ISOTP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "can_record.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Outcome of a transmit request.
+ */
+typedef enum {
+  CAN_ISOTP_DONE = 0,       /**< All frames sent.                          */
+  CAN_ISOTP_TIMEOUT,        /**< No flow control in time.                  */
+  CAN_ISOTP_OVERFLOW,       /**< The receiver cannot take the length.      */
+  CAN_ISOTP_ABORTED,        /**< Invalid flow control, or too many waits.  */
+  CAN_ISOTP_BUSY,           /**< Channel sending, or no free session.      */
+  CAN_ISOTP_INVALID,        /**< Channel closed or length out of range.    */
+  CAN_ISOTP_FAILED,         /**< No free mailbox for the first frame.      */
+  CAN_ISOTP_RESULTS
+} canisotpresult_t;
+
+/**
+ * @brief   Record types, in the top bits of the first data byte.
+ */
+typedef enum {
+  CAN_ISOTP_RECORD_START = 0,   /**< Identifier and length of a message.  */
+  CAN_ISOTP_RECORD_DATA,        /**< Next seven bytes of the message.      */
+  CAN_ISOTP_RECORD_RESULT       /**< Outcome of a transmit request.        */
+} canisotprecord_t;
+
+/**
+ * @brief   Channel of sniffed messages.
+ */
+#define CAN_ISOTP_PASSIVE           0xFFU
+
+/**
+ * @brief   Longest message of classic CAN.
+ */
+#define CAN_ISOTP_MAX_LENGTH        4095U
+
+/**
+ * @brief   N_Bs and N_Cr, the longest wait for a flow control or the next
+ *          consecutive frame.
+ */
+#define CAN_ISOTP_TIMEOUT_US        1000000U
+
+/**
+ * @brief   Flow control waits accepted before a transmission is given up.
+ */
+#define CAN_ISOTP_MAX_WAITS         10U
+
+/**
+ * @brief   Fill of the unused bytes of frames sent.
+ */
+#define CAN_ISOTP_PADDING           0xCCU
+
+/**
+ * @brief   Returned by @p can_isotp_poll without a deadline.
+ */
+#define CAN_ISOTP_NO_DEADLINE       0xFFFFFFFFU
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Active channels.
+ * @note    The state is sized by it, set it for all sources alike.
+ */
+#if !defined(CAN_ISOTP_CHANNELS) || defined(__DOXYGEN__)
+#define CAN_ISOTP_CHANNELS          4
+#endif
+
+/*===========================================================================*/
+/* Derived constants and error checks.                                       */
+/*===========================================================================*/
+
+#if CAN_ISOTP_CHANNELS < 1 || CAN_ISOTP_CHANNELS > 254
+#error "CAN_ISOTP_CHANNELS must be 1 to 254"
+#endif
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Inclusive range of sniffed identifiers.
+ * @details Keys are identifiers with @p CAN_RECORD_EXT.
+ */
+typedef struct {
+    uint32_t first;
+    uint32_t last;
+} CanIsoTpRange;
+
+/**
+ * @brief   An active channel, the device is one end of the connection.
+ * @details Messages arriving on @p rxKey get flow control on @p txKey,
+ *          messages sent on @p txKey take flow control from @p rxKey.
+ */
+typedef struct {
+    uint32_t rxKey;
+    uint32_t txKey;
+    bool open;
+} CanIsoTpChannel;
+
+/**
+ * @brief   Session states.
+ */
+typedef enum {
+  CAN_ISOTP_IDLE = 0,
+  CAN_ISOTP_RECEIVE,        /**< Consecutive frames to come.               */
+  CAN_ISOTP_WAIT,           /**< Sending, waiting for a flow control.      */
+  CAN_ISOTP_SEND            /**< Sending consecutive frames.               */
+} canisotpstate_t;
+
+/**
+ * @brief   A message in transfer.
+ */
+typedef struct {
+    uint8_t state;          /**< @p canisotpstate_t.                       */
+    uint8_t channel;        /**< Or @p CAN_ISOTP_PASSIVE.                  */
+    uint8_t sequence;       /**< Next sequence number.                     */
+    uint8_t blockSize;      /**< Frames per block, zero is all.            */
+    uint8_t blockLeft;      /**< Frames left in the block.                 */
+    uint8_t waits;          /**< Flow control waits so far.                */
+    uint16_t length;
+    uint16_t offset;        /**< Bytes received or sent.                   */
+    uint32_t key;           /**< Identifier the frames come or go on.      */
+    uint32_t started;       /**< Time of the first frame.                  */
+    uint32_t deadline;      /**< Timeout, or next frame when sending.      */
+    uint32_t separation;    /**< Microseconds between frames sent.         */
+    uint32_t cookie;        /**< Of the transmit request.                  */
+    uint8_t *buffer;
+} CanIsoTpSession;
+
+/**
+ * @brief   A complete message.
+ */
+typedef struct {
+    uint32_t key;           /**< Identifier it came on.                    */
+    uint32_t timestamp;     /**< Time of its first frame.                  */
+    uint16_t length;
+    uint8_t channel;        /**< Or @p CAN_ISOTP_PASSIVE.                  */
+    uint8_t counter;        /**< Message count, ties its records together. */
+    const uint8_t *data;
+} CanIsoTpPdu;
+
+/**
+ * @brief   End of a transmit request.
+ */
+typedef struct {
+    uint32_t cookie;
+    uint8_t channel;
+    uint8_t result;         /**< @p canisotpresult_t.                      */
+} CanIsoTpResult;
+
+/**
+ * @brief   A record restored, the fields of its type are set.
+ */
+typedef struct {
+    uint8_t type;           /**< @p canisotprecord_t.                      */
+    uint8_t counter;        /**< Message count, six bits.                  */
+    uint32_t key;
+    uint16_t length;
+    uint8_t channel;
+    uint8_t data[7];
+    CanIsoTpResult result;
+} CanIsoTpRecord;
+
+/**
+ * @brief   Engine statistics.
+ */
+typedef struct {
+    uint32_t frames;        /**< ISO-TP frames taken.                      */
+    uint32_t pdus;          /**< Messages received complete.               */
+    uint32_t sent;          /**< Messages sent complete.                   */
+    uint32_t timeouts;      /**< Receptions given up.                      */
+    uint32_t sequence;      /**< Receptions lost to a sequence error.      */
+    uint32_t overflows;     /**< Messages longer than a session buffer.    */
+    uint32_t noSession;     /**< Messages with no session free.            */
+    uint32_t invalid;       /**< Malformed frames.                         */
+    uint32_t flowLost;      /**< Flow controls with no mailbox free.       */
+} CanIsoTpStats;
+
+/**
+ * @brief   Callbacks of the engine.
+ */
+typedef struct {
+    /** A message received complete.*/
+    void (*pdu)(const CanIsoTpPdu *pp, void *arg);
+    /** A transmit request ended.*/
+    void (*result)(const CanIsoTpResult *rp, void *arg);
+    /** Sends eight bytes on an identifier, false if no mailbox is free.*/
+    bool (*send)(uint32_t key, const uint8_t *data, void *arg);
+} CanIsoTpOps;
+
+/**
+ * @brief   Engine state.
+ */
+typedef struct {
+    const CanIsoTpRange *ranges;
+    size_t rangeCount;
+    CanIsoTpChannel channels[CAN_ISOTP_CHANNELS];
+    CanIsoTpSession *sessions;
+    size_t sessionCount;
+    size_t bufferSize;      /**< Longest message of a session.             */
+    uint8_t blockSize;      /**< Block size of the flow control sent.      */
+    uint8_t stmin;          /**< Separation time of the flow control sent. */
+    bool wake;              /**< A flow control let a transmission go on.  */
+    CanIsoTpStats stats;
+} CanIsoTp;
+
+/**
+ * @brief   Receives records.
+ */
+typedef void (*canisotpemit_t)(const CanRecord *rp, void *arg);
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/**
+ * @brief   Records of a message of @p length bytes, the start record and
+ *          seven bytes to each data record.
+ */
+#define CAN_ISOTP_RECORDS(length)   (1U + ((length) + 6U) / 7U)
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void can_isotp_init(CanIsoTp *ip, const CanIsoTpRange *ranges,
+                      size_t rangeCount, CanIsoTpSession *sessions,
+                      size_t sessionCount, uint8_t *buffers,
+                      size_t bufferSize);
+  bool can_isotp_open(CanIsoTp *ip, uint8_t channel, uint32_t rxKey,
+                      uint32_t txKey);
+  void can_isotp_close(CanIsoTp *ip, uint8_t channel,
+                       const CanIsoTpOps *ops, void *arg);
+  bool can_isotp_frame(CanIsoTp *ip, const CanRecord *rp,
+                       const CanIsoTpOps *ops, void *arg);
+  bool can_isotp_send(CanIsoTp *ip, uint8_t channel, uint32_t cookie,
+                      const uint8_t *data, size_t length, uint32_t now,
+                      const CanIsoTpOps *ops, void *arg);
+  uint32_t can_isotp_poll(CanIsoTp *ip, uint32_t now, const CanIsoTpOps *ops,
+                          void *arg);
+  size_t can_isotp_active(const CanIsoTp *ip);
+  void can_isotp_pdu_to_records(const CanIsoTpPdu *pp, canisotpemit_t emit,
+                                void *arg);
+  void can_isotp_result_to_record(const CanIsoTpResult *rp,
+                                  uint32_t timestamp, CanRecord *record);
+  bool can_isotp_from_record(const CanRecord *rp, CanIsoTpRecord *out);
+  const char *can_isotp_result_name(uint8_t result);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CAN_ISOTP_H_ */
+
+/** @} */
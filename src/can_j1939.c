@@ -0,0 +1,409 @@
+/**
+ * @file    src/can_j1939.c
+ * @brief   J1939 parameter groups and transport reassembly.
+ * @details A 29 bit identifier holds priority, parameter group number
+ *          (PGN) and source address, PDU1 groups (PF below 240) carry a
+ *          destination address in place of the low PGN byte.
+ *          Messages longer than eight bytes travel with the transport
+ *          protocol: an announcement on TP.CM, broadcast (BAM) or to a
+ *          destination (RTS, answered by CTS), then up to 255 packets of
+ *          seven bytes on TP.DT. Source and destination identify a
+ *          transfer, there is one at a time per pair. Packets are placed
+ *          by their sequence number, resent packets are taken once.
+ *          A complete transfer is reported as one message, the transport
+ *          frames are never passed on. A transfer is given up after
+ *          @p CAN_J1939_TIMEOUT_US without a frame, or on an abort.
+ *          Frames and messages are passed by PGN, an empty pass list
+ *          passes all.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include <string.h>
+
+#include "can_j1939.h"
+
+/* TP.CM control bytes.*/
+#define CM_RTS                      16U
+#define CM_CTS                      17U
+#define CM_END_OF_MESSAGE           19U
+#define CM_BAM                      32U
+#define CM_ABORT                    255U
+
+static CanJ1939Session *session_find(CanJ1939 *jp, uint8_t sa, uint8_t da)
+{
+    for (size_t i = 0; i < jp->sessionCount; i++)
+    {
+        CanJ1939Session *sp = &jp->sessions[i];
+
+        if (sp->active && sp->sa == sa && sp->da == da)
+            return sp;
+    }
+
+    return NULL;
+}
+
+static CanJ1939Session *session_free(CanJ1939 *jp)
+{
+    for (size_t i = 0; i < jp->sessionCount; i++)
+    {
+        if (!jp->sessions[i].active)
+            return &jp->sessions[i];
+    }
+
+    return NULL;
+}
+
+/*
+ * Gives up transfers that went quiet.
+ */
+static void expire(CanJ1939 *jp, uint32_t now)
+{
+    for (size_t i = 0; i < jp->sessionCount; i++)
+    {
+        CanJ1939Session *sp = &jp->sessions[i];
+
+        if (sp->active && now - sp->last > CAN_J1939_TIMEOUT_US)
+        {
+            sp->active = false;
+            jp->stats.timeouts++;
+        }
+    }
+}
+
+static void announce(CanJ1939 *jp, const CanJ1939Id *idp, uint32_t now,
+                     const uint8_t *data)
+{
+    uint16_t length = (uint16_t)(data[1] | data[2] << 8);
+    uint8_t packets = data[3];
+    uint32_t pgn = (data[5] | data[6] << 8 | (uint32_t)data[7] << 16) &
+                   CAN_J1939_PGN_MASK;
+    CanJ1939Session *sp = session_find(jp, idp->sa, idp->da);
+
+    /* A new announcement replaces the transfer of the pair.*/
+    if (sp != NULL)
+        sp->active = false;
+    if (length < 9 || length > CAN_J1939_MAX_LENGTH ||
+        packets != (length + 6U) / 7U)
+    {
+        jp->stats.invalid++;
+        return;
+    }
+    sp = session_free(jp);
+    if (sp == NULL)
+    {
+        jp->stats.noSession++;
+        return;
+    }
+
+    sp->active = true;
+    sp->pass = can_j1939_passes(jp, pgn);
+    sp->priority = idp->priority;
+    sp->sa = idp->sa;
+    sp->da = idp->da;
+    sp->packets = packets;
+    sp->received = 0;
+    sp->length = length;
+    sp->pgn = pgn;
+    sp->started = now;
+    sp->last = now;
+    memset(sp->seen, 0, sizeof(sp->seen));
+}
+
+static void take_cm(CanJ1939 *jp, const CanJ1939Id *idp, uint32_t now,
+                    const uint8_t *data)
+{
+    CanJ1939Session *sp;
+
+    switch (data[0])
+    {
+    case CM_RTS:
+        announce(jp, idp, now, data);
+        break;
+    case CM_BAM:
+        if (idp->da != CAN_J1939_GLOBAL)
+            jp->stats.invalid++;
+        else
+            announce(jp, idp, now, data);
+        break;
+    case CM_CTS:
+    case CM_END_OF_MESSAGE:
+        /* From the destination of the transfer.*/
+        sp = session_find(jp, idp->da, idp->sa);
+        if (sp != NULL)
+            sp->last = now;
+        break;
+    case CM_ABORT:
+        sp = session_find(jp, idp->sa, idp->da);
+        if (sp == NULL)
+            sp = session_find(jp, idp->da, idp->sa);
+        if (sp != NULL)
+        {
+            sp->active = false;
+            jp->stats.aborted++;
+        }
+        break;
+    default:
+        jp->stats.invalid++;
+        break;
+    }
+}
+
+static void take_dt(CanJ1939 *jp, const CanJ1939Id *idp, uint32_t now,
+                    const uint8_t *data, uint8_t dlc, canj1939emit_t emit,
+                    void *arg)
+{
+    CanJ1939Session *sp = session_find(jp, idp->sa, idp->da);
+    uint8_t sequence = data[0];
+
+    /* Packets of a transfer announced before the capture started.*/
+    if (sp == NULL)
+        return;
+    if (sequence == 0 || sequence > sp->packets)
+    {
+        jp->stats.invalid++;
+        return;
+    }
+
+    sp->last = now;
+    uint32_t bit = 1U << (sequence % 32U);
+    if ((sp->seen[sequence / 32U] & bit) != 0)
+        return;
+    sp->seen[sequence / 32U] |= bit;
+    sp->received++;
+    if (sp->pass)
+    {
+        size_t offset = (sequence - 1U) * 7U;
+        size_t n = sp->length - offset < 7U ? sp->length - offset : 7U;
+
+        if (n > dlc - 1U)
+            n = dlc - 1U;
+        memcpy(&sp->buffer[offset], &data[1], n);
+    }
+    if (sp->received < sp->packets)
+        return;
+
+    sp->active = false;
+    if (!sp->pass)
+    {
+        jp->stats.filtered++;
+        return;
+    }
+
+    CanJ1939Message message = {sp->pgn, sp->started, sp->length,
+                               sp->priority, sp->sa, sp->da,
+                               (uint8_t)(jp->stats.messages & 0x3FU),
+                               sp->buffer};
+    jp->stats.messages++;
+    can_j1939_message_to_records(&message, emit, arg);
+}
+
+/**
+ * @brief   Splits an identifier into its fields.
+ */
+void can_j1939_parse(uint32_t id, CanJ1939Id *out)
+{
+    uint32_t pgn = (id >> 8) & CAN_J1939_PGN_MASK;
+
+    out->priority = (uint8_t)((id >> 26) & 7U);
+    out->sa = (uint8_t)id;
+    out->da = CAN_J1939_GLOBAL;
+    if (((pgn >> 8) & 0xFFU) < 240U)
+    {
+        out->da = (uint8_t)pgn;
+        pgn &= ~0xFFU;
+    }
+    out->pgn = pgn;
+}
+
+/**
+ * @brief   Starts with every session free and every group passed.
+ *
+ * @param[in] sessions  Sessions, kept.
+ * @param[in] buffers   @p CAN_J1939_MAX_LENGTH bytes for each session,
+ *                      kept.
+ */
+void can_j1939_init(CanJ1939 *jp, CanJ1939Session *sessions,
+                    size_t sessionCount, uint8_t *buffers)
+{
+    memset(jp, 0, sizeof(*jp));
+    jp->sessions = sessions;
+    jp->sessionCount = sessionCount;
+    for (size_t i = 0; i < sessionCount; i++)
+    {
+        memset(&sessions[i], 0, sizeof(sessions[i]));
+        sessions[i].buffer = &buffers[i * CAN_J1939_MAX_LENGTH];
+    }
+}
+
+/**
+ * @brief   Adds a group to the pass list.
+ *
+ * @return  False if the list is full or the PGN out of range.
+ */
+bool can_j1939_pass(CanJ1939 *jp, uint32_t pgn)
+{
+    if (pgn > CAN_J1939_PGN_MASK)
+        return false;
+    if (can_j1939_passes(jp, pgn) && jp->passCount != 0)
+        return true;
+    if (jp->passCount == CAN_J1939_FILTERS)
+        return false;
+
+    jp->pass[jp->passCount++] = pgn;
+
+    return true;
+}
+
+/**
+ * @brief   Empties the pass list, every group is passed.
+ */
+void can_j1939_pass_all(CanJ1939 *jp)
+{
+    jp->passCount = 0;
+}
+
+/**
+ * @brief   True if a group is passed.
+ */
+bool can_j1939_passes(const CanJ1939 *jp, uint32_t pgn)
+{
+    if (jp->passCount == 0)
+        return true;
+
+    for (size_t i = 0; i < jp->passCount; i++)
+    {
+        if (jp->pass[i] == pgn)
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief   Takes a received frame.
+ * @details Transport frames are taken, a complete transfer goes to
+ *          @p emit as the records of its message.
+ *
+ * @return  False if the frame is to be captured as it is: a standard
+ *          frame, or a group that is passed.
+ */
+bool can_j1939_frame(CanJ1939 *jp, const CanRecord *rp, canj1939emit_t emit,
+                     void *arg)
+{
+    CanJ1939Id id;
+    uint8_t data[8];
+    uint8_t dlc;
+
+    if (!CAN_RECORD_IS_EXT(rp) || CAN_RECORD_IS_RTR(rp))
+        return false;
+
+    jp->stats.frames++;
+    can_j1939_parse(CAN_RECORD_GET_ID(rp), &id);
+    if (id.pgn != CAN_J1939_PGN_TP_CM && id.pgn != CAN_J1939_PGN_TP_DT)
+    {
+        if (can_j1939_passes(jp, id.pgn))
+            return false;
+        jp->stats.filtered++;
+        return true;
+    }
+
+    jp->stats.packets++;
+    dlc = can_record_get_data(rp, data);
+    expire(jp, rp->timestamp);
+    if (id.pgn == CAN_J1939_PGN_TP_CM && dlc == 8)
+        take_cm(jp, &id, rp->timestamp, data);
+    else if (id.pgn == CAN_J1939_PGN_TP_DT && dlc >= 2)
+        take_dt(jp, &id, rp->timestamp, data, dlc, emit, arg);
+    else
+        jp->stats.invalid++;
+
+    return true;
+}
+
+/**
+ * @brief   Transfers in progress.
+ */
+size_t can_j1939_active(const CanJ1939 *jp)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < jp->sessionCount; i++)
+    {
+        if (jp->sessions[i].active)
+            count++;
+    }
+
+    return count;
+}
+
+/**
+ * @brief   Stores a message as records.
+ * @details The first data byte is the record type in bits 7..6 and the
+ *          message count in bits 5..0. The start record carries the PGN
+ *          with the priority in bits 20..18, 24 bit, source and
+ *          destination address and the length 16 bit, little endian,
+ *          the data records follow with seven bytes each.
+ */
+void can_j1939_message_to_records(const CanJ1939Message *mp,
+                                  canj1939emit_t emit, void *arg)
+{
+    CanRecord record;
+    uint8_t tag = mp->counter & 0x3FU;
+    uint32_t word = (mp->pgn & CAN_J1939_PGN_MASK) |
+                    (uint32_t)(mp->priority & 7U) << 18;
+
+    record.timestamp = mp->timestamp;
+    record.id = CAN_RECORD_J1939;
+    record.data[0] = (uint8_t)(CAN_J1939_RECORD_START << 6 | tag);
+    record.data[1] = (uint8_t)word;
+    record.data[2] = (uint8_t)(word >> 8);
+    record.data[3] = (uint8_t)(word >> 16);
+    record.data[4] = mp->sa;
+    record.data[5] = mp->da;
+    record.data[6] = (uint8_t)mp->length;
+    record.data[7] = (uint8_t)(mp->length >> 8);
+    emit(&record, arg);
+
+    record.data[0] = (uint8_t)(CAN_J1939_RECORD_DATA << 6 | tag);
+    for (size_t offset = 0; offset < mp->length; offset += 7)
+    {
+        size_t n = mp->length - offset < 7 ? mp->length - offset : 7;
+
+        memset(&record.data[1], 0, 7);
+        memcpy(&record.data[1], &mp->data[offset], n);
+        emit(&record, arg);
+    }
+}
+
+/**
+ * @brief   Restores a record.
+ *
+ * @return  False if the record is no J1939 record.
+ */
+bool can_j1939_from_record(const CanRecord *rp, CanJ1939Record *out)
+{
+    if (!CAN_RECORD_IS_J1939(rp))
+        return false;
+
+    out->type = rp->data[0] >> 6;
+    out->counter = rp->data[0] & 0x3FU;
+    if (out->type == CAN_J1939_RECORD_START)
+    {
+        uint32_t word = rp->data[1] | rp->data[2] << 8 |
+                        (uint32_t)rp->data[3] << 16;
+
+        out->pgn = word & CAN_J1939_PGN_MASK;
+        out->priority = (uint8_t)((word >> 18) & 7U);
+        out->sa = rp->data[4];
+        out->da = rp->data[5];
+        out->length = (uint16_t)(rp->data[6] | rp->data[7] << 8);
+    }
+    else
+        memcpy(out->data, &rp->data[1], 7);
+
+    return true;
+}
+
+/** @} */
@@ -0,0 +1,198 @@
+/**
+ * @file    src/can_j1939.h
+ * @brief   J1939 parameter groups and transport reassembly.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _CAN_J1939_H_
+#define _CAN_J1939_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "can_record.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Transport protocol connection management and data transfer.
+ */
+#define CAN_J1939_PGN_TP_CM         0xEC00U
+#define CAN_J1939_PGN_TP_DT         0xEB00U
+
+/**
+ * @brief   Largest parameter group number, 18 bits.
+ */
+#define CAN_J1939_PGN_MASK          0x3FFFFU
+
+/**
+ * @brief   Destination of broadcast messages.
+ */
+#define CAN_J1939_GLOBAL            0xFFU
+
+/**
+ * @brief   Longest transfer, 255 packets of seven bytes.
+ */
+#define CAN_J1939_MAX_LENGTH        1785U
+
+/**
+ * @brief   Longest gap between the frames of a transfer, T2 and T3.
+ */
+#define CAN_J1939_TIMEOUT_US        1250000U
+
+/**
+ * @brief   Record types, in the top bits of the first data byte.
+ */
+typedef enum {
+  CAN_J1939_RECORD_START = 0,   /**< Group, addresses and length.          */
+  CAN_J1939_RECORD_DATA         /**< Next seven bytes of the message.      */
+} canj1939record_t;
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Parameter groups of the pass list.
+ * @note    The state is sized by it, set it for all sources alike.
+ */
+#if !defined(CAN_J1939_FILTERS) || defined(__DOXYGEN__)
+#define CAN_J1939_FILTERS           16
+#endif
+
+/*===========================================================================*/
+/* Derived constants and error checks.                                       */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Fields of a 29 bit identifier.
+ */
+typedef struct {
+    uint8_t priority;
+    uint32_t pgn;           /**< Without the destination of PDU1 groups.   */
+    uint8_t sa;             /**< Source address.                           */
+    uint8_t da;             /**< Destination, @p CAN_J1939_GLOBAL for PDU2.*/
+} CanJ1939Id;
+
+/**
+ * @brief   A transfer in progress, BAM or RTS/CTS.
+ */
+typedef struct {
+    bool active;
+    bool pass;              /**< Reported when complete.                   */
+    uint8_t priority;
+    uint8_t sa;
+    uint8_t da;
+    uint8_t packets;        /**< Announced.                                */
+    uint8_t received;       /**< Distinct packets so far.                  */
+    uint16_t length;
+    uint32_t pgn;           /**< Of the message transferred.               */
+    uint32_t started;       /**< Time of the announcement.                 */
+    uint32_t last;          /**< Time of the last frame.                   */
+    uint32_t seen[8];       /**< Packets received, a bit each.             */
+    uint8_t *buffer;
+} CanJ1939Session;
+
+/**
+ * @brief   A reassembled message.
+ */
+typedef struct {
+    uint32_t pgn;
+    uint32_t timestamp;     /**< Time of the announcement.                 */
+    uint16_t length;
+    uint8_t priority;
+    uint8_t sa;
+    uint8_t da;
+    uint8_t counter;        /**< Message count, ties its records together. */
+    const uint8_t *data;
+} CanJ1939Message;
+
+/**
+ * @brief   A record restored, the fields of its type are set.
+ */
+typedef struct {
+    uint8_t type;           /**< @p canj1939record_t.                      */
+    uint8_t counter;        /**< Message count, six bits.                  */
+    uint32_t pgn;
+    uint16_t length;
+    uint8_t priority;
+    uint8_t sa;
+    uint8_t da;
+    uint8_t data[7];
+} CanJ1939Record;
+
+/**
+ * @brief   Statistics.
+ */
+typedef struct {
+    uint32_t frames;        /**< Extended frames seen.                     */
+    uint32_t packets;       /**< Transport frames taken.                   */
+    uint32_t messages;      /**< Transfers reassembled and passed.         */
+    uint32_t filtered;      /**< Frames and transfers not passed.          */
+    uint32_t aborted;       /**< Transfers aborted by an end.              */
+    uint32_t timeouts;      /**< Transfers given up.                       */
+    uint32_t noSession;     /**< Transfers with no session free.           */
+    uint32_t invalid;       /**< Malformed transport frames.               */
+} CanJ1939Stats;
+
+/**
+ * @brief   Decoder state.
+ */
+typedef struct {
+    CanJ1939Session *sessions;
+    size_t sessionCount;
+    uint32_t pass[CAN_J1939_FILTERS];
+    size_t passCount;       /**< Zero passes every group.                  */
+    CanJ1939Stats stats;
+} CanJ1939;
+
+/**
+ * @brief   Receives the records of a message.
+ */
+typedef void (*canj1939emit_t)(const CanRecord *rp, void *arg);
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/**
+ * @brief   Records of a message of @p length bytes, the start record and
+ *          seven bytes to each data record.
+ */
+#define CAN_J1939_RECORDS(length)   (1U + ((length) + 6U) / 7U)
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void can_j1939_parse(uint32_t id, CanJ1939Id *out);
+  void can_j1939_init(CanJ1939 *jp, CanJ1939Session *sessions,
+                      size_t sessionCount, uint8_t *buffers);
+  bool can_j1939_pass(CanJ1939 *jp, uint32_t pgn);
+  void can_j1939_pass_all(CanJ1939 *jp);
+  bool can_j1939_passes(const CanJ1939 *jp, uint32_t pgn);
+  bool can_j1939_frame(CanJ1939 *jp, const CanRecord *rp,
+                       canj1939emit_t emit, void *arg);
+  size_t can_j1939_active(const CanJ1939 *jp);
+  void can_j1939_message_to_records(const CanJ1939Message *mp,
+                                    canj1939emit_t emit, void *arg);
+  bool can_j1939_from_record(const CanRecord *rp, CanJ1939Record *out);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CAN_J1939_H_ */
+
+/** @} */
@@ -0,0 +1,73 @@
+/**
+ * @file    src/can_record.c
+ * @brief   Compact frame record used by the capture pipeline.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include <string.h>
+
+#include "can_record.h"
+
+/**
+ * @brief   Fills a record.
+ * @details Data length codes above 8 are stored as 8, classic CAN never
+ *          carries more data bytes. Standard identifiers of
+ *          device records, from @p CAN_RECORD_EVENT up, are kept so
+ *          decoders can restore them.
+ */
+void can_record_set(CanRecord *rp, uint32_t id, bool extended, bool remote,
+                    uint8_t dlc, const uint8_t *data, uint32_t timestamp)
+{
+    rp->timestamp = timestamp;
+    rp->id = id & (extended ? CAN_RECORD_ID_MASK : 0x7FFU | CAN_RECORD_EVENT);
+    if (extended)
+        rp->id |= CAN_RECORD_EXT;
+    if (remote)
+        rp->id |= CAN_RECORD_RTR;
+
+    memset(rp->data, 0, sizeof(rp->data));
+    if (dlc < 8)
+    {
+        rp->id |= CAN_RECORD_SHORT;
+        if (!remote)
+            memcpy(rp->data, data, dlc);
+        rp->data[7] = dlc;
+    }
+    else if (!remote)
+    {
+        memcpy(rp->data, data, 8);
+    }
+}
+
+/**
+ * @brief   Copies the data bytes, padded with zeros to 8 bytes.
+ *
+ * @return  The data length code.
+ */
+uint8_t can_record_get_data(const CanRecord *rp, uint8_t *data)
+{
+    uint8_t dlc = CAN_RECORD_GET_DLC(rp);
+
+    memcpy(data, rp->data, 8);
+    if (dlc < 8)
+        data[7] = 0;
+
+    return dlc;
+}
+
+/**
+ * @brief   Arbitration rank, lower values win the bus.
+ * @details A standard frame wins over an extended frame with the same
+ *          base identifier.
+ */
+uint32_t can_record_priority(const CanRecord *rp)
+{
+    if (CAN_RECORD_IS_EXT(rp))
+        return (CAN_RECORD_GET_ID(rp) << 1) | 1;
+
+    return CAN_RECORD_GET_ID(rp) << 19;
+}
+
+/** @} */
@@ -0,0 +1,174 @@
+/**
+ * @file    src/can_record.h
+ * @brief   Compact frame record used by the capture pipeline.
+ * @details A received frame is converted to a @p CanRecord right after
+ *          @p canReceive and stays in that form until it is handed to the
+ *          host link. The record is 16 bytes, the HAL frame plus the
+ *          timestamp needed twice that.
+ *          Identifier, frame flags and the short frame marker share one
+ *          word. For frames with less than 8 data bytes the DLC is kept in
+ *          the unused last data byte.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _CAN_RECORD_H_
+#define _CAN_RECORD_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/**
+ * @name    Identifier word layout
+ * @{
+ */
+#define CAN_RECORD_ID_MASK          0x1FFFFFFFU
+#define CAN_RECORD_EXT              (1U << 29)  /**< Extended identifier.  */
+#define CAN_RECORD_RTR              (1U << 30)  /**< Remote frame.         */
+#define CAN_RECORD_SHORT            (1U << 31)  /**< DLC is in data[7].    */
+/** @} */
+
+/**
+ * @brief   Standard identifier of bus event records.
+ * @details Standard identifiers have 11 bits, this one never comes from
+ *          the bus. Events travel the pipeline as records so they stay in
+ *          order with the frames around them, see can_event.h.
+ */
+#define CAN_RECORD_EVENT            0x800U
+
+/**
+ * @brief   Standard identifier of transmit echo records, see can_echo.h.
+ */
+#define CAN_RECORD_ECHO             0x801U
+
+/**
+ * @brief   Standard identifier of decoded signal records, see can_signal.h.
+ */
+#define CAN_RECORD_SIGNAL           0x802U
+
+/**
+ * @brief   Standard identifier of battery alert records, see can_bms.h.
+ */
+#define CAN_RECORD_BMS              0x803U
+
+/**
+ * @brief   Standard identifier of ISO-TP message records, see can_isotp.h.
+ */
+#define CAN_RECORD_ISOTP            0x804U
+
+/**
+ * @brief   Standard identifier of J1939 message records, see can_j1939.h.
+ */
+#define CAN_RECORD_J1939            0x805U
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Derived constants and error checks.                                       */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   A captured frame.
+ */
+typedef struct {
+    uint32_t timestamp;     /**< Reception time in microseconds.           */
+    uint32_t id;            /**< Identifier and @p CAN_RECORD_* flags.     */
+    uint8_t data[8];
+} CanRecord;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/**
+ * @brief   Identifier without flags.
+ */
+#define CAN_RECORD_GET_ID(rp)       ((rp)->id & CAN_RECORD_ID_MASK)
+
+/**
+ * @brief   True for extended identifiers.
+ */
+#define CAN_RECORD_IS_EXT(rp)       (((rp)->id & CAN_RECORD_EXT) != 0)
+
+/**
+ * @brief   True for remote frames.
+ */
+#define CAN_RECORD_IS_RTR(rp)       (((rp)->id & CAN_RECORD_RTR) != 0)
+
+/**
+ * @brief   True for records made by the device, not received from the bus.
+ */
+#define CAN_RECORD_IS_DEVICE(rp)                                            \
+    (((rp)->id & (CAN_RECORD_EXT | CAN_RECORD_EVENT)) == CAN_RECORD_EVENT)
+
+/**
+ * @brief   True for bus event records.
+ */
+#define CAN_RECORD_IS_EVENT(rp)                                             \
+    (((rp)->id & (CAN_RECORD_EXT | CAN_RECORD_ID_MASK)) == CAN_RECORD_EVENT)
+
+/**
+ * @brief   True for transmit echo records.
+ */
+#define CAN_RECORD_IS_ECHO(rp)                                              \
+    (((rp)->id & (CAN_RECORD_EXT | CAN_RECORD_ID_MASK)) == CAN_RECORD_ECHO)
+
+/**
+ * @brief   True for decoded signal records.
+ */
+#define CAN_RECORD_IS_SIGNAL(rp)                                            \
+    (((rp)->id & (CAN_RECORD_EXT | CAN_RECORD_ID_MASK)) == CAN_RECORD_SIGNAL)
+
+/**
+ * @brief   True for battery alert records.
+ */
+#define CAN_RECORD_IS_BMS(rp)                                               \
+    (((rp)->id & (CAN_RECORD_EXT | CAN_RECORD_ID_MASK)) == CAN_RECORD_BMS)
+
+/**
+ * @brief   True for ISO-TP message records.
+ */
+#define CAN_RECORD_IS_ISOTP(rp)                                             \
+    (((rp)->id & (CAN_RECORD_EXT | CAN_RECORD_ID_MASK)) == CAN_RECORD_ISOTP)
+
+/**
+ * @brief   True for J1939 message records.
+ */
+#define CAN_RECORD_IS_J1939(rp)                                             \
+    (((rp)->id & (CAN_RECORD_EXT | CAN_RECORD_ID_MASK)) == CAN_RECORD_J1939)
+
+/**
+ * @brief   Data length code, 0 to 8.
+ */
+#define CAN_RECORD_GET_DLC(rp)                                              \
+    (((rp)->id & CAN_RECORD_SHORT) != 0 ? (rp)->data[7] : 8U)
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void can_record_set(CanRecord *rp, uint32_t id, bool extended, bool remote,
+                      uint8_t dlc, const uint8_t *data, uint32_t timestamp);
+  uint8_t can_record_get_data(const CanRecord *rp, uint8_t *data);
+  uint32_t can_record_priority(const CanRecord *rp);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CAN_RECORD_H_ */
+
+/** @} */
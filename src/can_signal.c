@@ -0,0 +1,341 @@
+/**
+ * @file    src/can_signal.c
+ * @brief   Signal decoding with compiled tables.
+ * @details The host compiles message definitions of a DBC file into a
+ *          table, see tools/candbc. Signal positions are resolved there:
+ *          the eight data bytes are read as one 64 bit word, little or
+ *          big endian, and a signal is a shift and a mask of it, whatever
+ *          its byte order. Scaling is integer, the physical value is
+ *          raw * factor + offset in units of 10^-decimals.
+ *          A frame costs a binary search over the messages and at most
+ *          @p CAN_SIGNAL_PER_MESSAGE constant time signal decodes. A
+ *          value is reported the first time and when its raw value moved
+ *          by the deadband or more since the last report.
+ *          The table is checked as a whole when loaded and used in place.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include <string.h>
+
+#include "can_signal.h"
+
+#define KNOWN_FLAGS                                                         \
+    (CAN_SIGNAL_BIG_ENDIAN | CAN_SIGNAL_SIGNED | CAN_SIGNAL_HIDDEN)
+
+static bool message_valid(const CanSignalMessage *mp, size_t signalCount)
+{
+    uint32_t id = mp->key & ~CAN_RECORD_EXT;
+
+    if ((mp->key & CAN_RECORD_EXT) != 0 ? id > CAN_RECORD_ID_MASK :
+                                          id > 0x7FFU)
+        return false;
+    if (mp->count == 0 || mp->count > CAN_SIGNAL_PER_MESSAGE ||
+        (size_t)mp->first + mp->count > signalCount)
+        return false;
+
+    return mp->mux == CAN_SIGNAL_NO_MUX8 || mp->mux < mp->count;
+}
+
+static bool signal_valid(const CanSignalDef *sp, bool muxed)
+{
+    if (sp->length == 0 || sp->length > 32 || sp->shift + sp->length > 64)
+        return false;
+    if ((sp->flags & ~KNOWN_FLAGS) != 0 || sp->decimals > 9)
+        return false;
+
+    return muxed || sp->mux == CAN_SIGNAL_NO_MUX16;
+}
+
+/*
+ * True if the bytes of the signal were received.
+ */
+static bool signal_present(const CanSignalDef *sp, uint8_t dlc)
+{
+    unsigned last = (sp->shift + sp->length - 1U) / 8U;
+
+    /* In the big endian word byte 0 is the top one.*/
+    if ((sp->flags & CAN_SIGNAL_BIG_ENDIAN) != 0)
+        return 7U - sp->shift / 8U < dlc;
+
+    return last < dlc;
+}
+
+static uint32_t signal_raw(const CanSignalDef *sp, uint64_t little,
+                           uint64_t big)
+{
+    uint64_t word = (sp->flags & CAN_SIGNAL_BIG_ENDIAN) != 0 ? big : little;
+    uint32_t mask = sp->length == 32 ? 0xFFFFFFFFU :
+                    (1U << sp->length) - 1U;
+    uint32_t raw = (uint32_t)(word >> sp->shift) & mask;
+
+    if ((sp->flags & CAN_SIGNAL_SIGNED) != 0 &&
+        (raw & (1U << (sp->length - 1U))) != 0)
+        raw |= ~mask;
+
+    return raw;
+}
+
+static int64_t raw_value(const CanSignalDef *sp, uint32_t raw)
+{
+    return (sp->flags & CAN_SIGNAL_SIGNED) != 0 ? (int64_t)(int32_t)raw :
+                                                  (int64_t)raw;
+}
+
+static int64_t clamp(int64_t value)
+{
+    if (value > CAN_SIGNAL_VALUE_MAX)
+        return CAN_SIGNAL_VALUE_MAX;
+    if (value < -CAN_SIGNAL_VALUE_MAX)
+        return -CAN_SIGNAL_VALUE_MAX;
+
+    return value;
+}
+
+/*
+ * Reports a signal if it moved by the deadband since its last report.
+ */
+static void signal_update(CanSignalTable *tp, size_t index, uint32_t raw,
+                          cansignalemit_t emit, void *arg)
+{
+    const CanSignalDef *sp = &tp->signals[index];
+    CanSignalState *state = &tp->state[index];
+    int64_t value = raw_value(sp, raw);
+
+    if (state->valid)
+    {
+        int64_t delta = value - raw_value(sp, state->raw);
+
+        if (delta < 0)
+            delta = -delta;
+        if (delta == 0 || (uint64_t)delta < sp->deadband)
+        {
+            tp->stats.suppressed++;
+            return;
+        }
+    }
+    state->raw = raw;
+    state->valid = true;
+
+    /* |raw * factor| stays below 2^63.*/
+    CanSignalValue out;
+    out.index = (uint16_t)index;
+    out.decimals = sp->decimals;
+    out.value = clamp(clamp(value * sp->factor) + sp->offset);
+    tp->stats.emitted++;
+    emit(&out, arg);
+}
+
+/**
+ * @brief   Takes a table into use.
+ *
+ * @param[in] table     The table, 4 byte aligned, used in place.
+ * @param[in] state     Decoder state, one per signal.
+ * @return              False if the table is malformed or too large, the
+ *                      decoder is then left empty.
+ */
+bool can_signal_load(CanSignalTable *tp, const void *table, size_t size,
+                     CanSignalState *state, size_t stateCount)
+{
+    const CanSignalHeader *hp = table;
+
+    tp->messageCount = 0;
+    tp->signalCount = 0;
+    if (((uintptr_t)table & 3U) != 0 || size < sizeof(*hp) ||
+        hp->magic[0] != CAN_SIGNAL_MAGIC0 ||
+        hp->magic[1] != CAN_SIGNAL_MAGIC1 ||
+        hp->version != CAN_SIGNAL_VERSION || hp->signals > stateCount ||
+        size != sizeof(*hp) + hp->messages * sizeof(CanSignalMessage) +
+                hp->signals * sizeof(CanSignalDef))
+        return false;
+
+    const CanSignalMessage *messages = (const CanSignalMessage *)(hp + 1);
+    const CanSignalDef *signals =
+            (const CanSignalDef *)(messages + hp->messages);
+
+    for (size_t i = 0; i < hp->messages; i++)
+    {
+        const CanSignalMessage *mp = &messages[i];
+
+        /* Sorted, for the binary search.*/
+        if (!message_valid(mp, hp->signals) ||
+            (i > 0 && mp->key <= messages[i - 1].key))
+            return false;
+        for (size_t j = 0; j < mp->count; j++)
+        {
+            if (!signal_valid(&signals[mp->first + j],
+                              mp->mux != CAN_SIGNAL_NO_MUX8 && j != mp->mux))
+                return false;
+        }
+    }
+
+    tp->messages = messages;
+    tp->signals = signals;
+    tp->messageCount = hp->messages;
+    tp->signalCount = hp->signals;
+    tp->state = state;
+    can_signal_reset(tp);
+
+    return true;
+}
+
+/**
+ * @brief   Forgets the reported values and the statistics, every signal
+ *          is reported again.
+ */
+void can_signal_reset(CanSignalTable *tp)
+{
+    for (size_t i = 0; i < tp->signalCount; i++)
+        tp->state[i].valid = false;
+    memset(&tp->stats, 0, sizeof(tp->stats));
+}
+
+/**
+ * @brief   Decodes a frame, changed values go to @p emit.
+ *
+ * @return  False if the frame is no message of the table.
+ */
+bool can_signal_decode(CanSignalTable *tp, const CanRecord *rp,
+                       cansignalemit_t emit, void *arg)
+{
+    uint32_t key = CAN_RECORD_GET_ID(rp) |
+                   (CAN_RECORD_IS_EXT(rp) ? CAN_RECORD_EXT : 0U);
+    size_t low = 0;
+    size_t high = tp->messageCount;
+
+    tp->stats.frames++;
+    if (CAN_RECORD_IS_RTR(rp) || CAN_RECORD_IS_DEVICE(rp))
+        return false;
+
+    while (low < high)
+    {
+        size_t middle = (low + high) / 2;
+
+        if (tp->messages[middle].key < key)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if (low == tp->messageCount || tp->messages[low].key != key)
+        return false;
+
+    const CanSignalMessage *mp = &tp->messages[low];
+    uint8_t data[8];
+    uint8_t dlc = can_record_get_data(rp, data);
+    uint64_t little = 0;
+    uint64_t big = 0;
+
+    tp->stats.decoded++;
+    for (unsigned i = 0; i < 8; i++)
+    {
+        little |= (uint64_t)data[i] << (8 * i);
+        big |= (uint64_t)data[i] << (56 - 8 * i);
+    }
+
+    /* A multiplexed signal needs its multiplexer in the frame.*/
+    bool muxPresent = false;
+    uint32_t mux = 0;
+    if (mp->mux != CAN_SIGNAL_NO_MUX8)
+    {
+        const CanSignalDef *sp = &tp->signals[mp->first + mp->mux];
+
+        muxPresent = signal_present(sp, dlc);
+        if (muxPresent)
+            mux = signal_raw(sp, little, big);
+    }
+
+    for (size_t i = mp->first; i < (size_t)mp->first + mp->count; i++)
+    {
+        const CanSignalDef *sp = &tp->signals[i];
+
+        if (!signal_present(sp, dlc) ||
+            (sp->mux != CAN_SIGNAL_NO_MUX16 &&
+             (!muxPresent || sp->mux != mux)))
+            continue;
+        if ((sp->flags & CAN_SIGNAL_HIDDEN) == 0)
+            signal_update(tp, i, signal_raw(sp, little, big), emit, arg);
+    }
+
+    return true;
+}
+
+/**
+ * @brief   Stores a value as a record.
+ * @details Data bytes: signal index 16 bit, decimals, value 40 bit, all
+ *          little endian.
+ */
+void can_signal_to_record(const CanSignalValue *vp, uint32_t timestamp,
+                          CanRecord *rp)
+{
+    uint64_t value = (uint64_t)clamp(vp->value);
+
+    rp->timestamp = timestamp;
+    rp->id = CAN_RECORD_SIGNAL;
+    rp->data[0] = (uint8_t)vp->index;
+    rp->data[1] = (uint8_t)(vp->index >> 8);
+    rp->data[2] = vp->decimals;
+    for (unsigned i = 0; i < 5; i++)
+        rp->data[3 + i] = (uint8_t)(value >> (8 * i));
+}
+
+/**
+ * @brief   Restores a value from a record.
+ *
+ * @return  False if the record is not a signal value.
+ */
+bool can_signal_from_record(const CanRecord *rp, CanSignalValue *vp)
+{
+    uint64_t value = 0;
+
+    if (!CAN_RECORD_IS_SIGNAL(rp))
+        return false;
+
+    for (unsigned i = 0; i < 5; i++)
+        value |= (uint64_t)rp->data[3 + i] << (8 * i);
+    if ((value & (UINT64_C(1) << 39)) != 0)
+        value |= ~((UINT64_C(1) << 40) - 1);
+
+    vp->index = (uint16_t)(rp->data[0] | rp->data[1] << 8);
+    vp->decimals = rp->data[2];
+    vp->value = (int64_t)value;
+
+    return true;
+}
+
+/**
+ * @brief   Formats a value as a decimal number.
+ *
+ * @param[out] text     At least @p CAN_SIGNAL_TEXT_SIZE bytes.
+ * @return              Characters written, without the terminator.
+ */
+size_t can_signal_format(const CanSignalValue *vp, char *text)
+{
+    char digits[CAN_SIGNAL_TEXT_SIZE];
+    size_t count = 0;
+    size_t n = 0;
+    uint64_t value = vp->value < 0 ? (uint64_t)-vp->value :
+                                     (uint64_t)vp->value;
+    unsigned decimals = vp->decimals < 9 ? vp->decimals : 9;
+
+    /* Least significant first, at least one digit before the point.*/
+    do
+    {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0 || count <= decimals);
+
+    if (vp->value < 0)
+        text[n++] = '-';
+    while (count > 0)
+    {
+        if (count == decimals)
+            text[n++] = '.';
+        text[n++] = digits[--count];
+    }
+    text[n] = '\0';
+
+    return n;
+}
+
+/** @} */
@@ -0,0 +1,187 @@
+/**
+ * @file    src/can_signal.h
+ * @brief   Signal decoding with compiled tables.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _CAN_SIGNAL_H_
+#define _CAN_SIGNAL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "can_record.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   First bytes of a table.
+ */
+#define CAN_SIGNAL_MAGIC0           'S'
+#define CAN_SIGNAL_MAGIC1           'G'
+
+/**
+ * @brief   Table format version.
+ */
+#define CAN_SIGNAL_VERSION          1U
+
+/**
+ * @brief   Most signals of a message, bounds the decode time of a frame.
+ */
+#define CAN_SIGNAL_PER_MESSAGE      16U
+
+/**
+ * @brief   No multiplexer, in @p mux of messages and signals.
+ */
+#define CAN_SIGNAL_NO_MUX8          0xFFU
+#define CAN_SIGNAL_NO_MUX16         0xFFFFU
+
+/**
+ * @name    Signal flags
+ * @{
+ */
+#define CAN_SIGNAL_BIG_ENDIAN       (1U << 0)   /**< Motorola byte order.  */
+#define CAN_SIGNAL_SIGNED           (1U << 1)   /**< Two's complement.     */
+#define CAN_SIGNAL_HIDDEN           (1U << 2)   /**< Multiplexer only.     */
+/** @} */
+
+/**
+ * @brief   Largest value a signal record carries, 40 bits.
+ */
+#define CAN_SIGNAL_VALUE_MAX        ((INT64_C(1) << 39) - 1)
+
+/**
+ * @brief   Longest formatted value, with sign, point and terminator.
+ */
+#define CAN_SIGNAL_TEXT_SIZE        24
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Derived constants and error checks.                                       */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Table header.
+ * @details A table is the header, the messages sorted by key and the
+ *          signals, all little endian. It is used in place, the buffer
+ *          must be 4 byte aligned.
+ */
+typedef struct {
+    uint8_t magic[2];
+    uint8_t version;
+    uint8_t messages;
+    uint16_t signals;
+    uint16_t reserved;
+} CanSignalHeader;
+
+/**
+ * @brief   A message of the table.
+ */
+typedef struct {
+    uint32_t key;           /**< Identifier with @p CAN_RECORD_EXT.        */
+    uint16_t first;         /**< Index of its first signal.                */
+    uint8_t count;          /**< Signals, up to @p CAN_SIGNAL_PER_MESSAGE. */
+    uint8_t mux;            /**< Multiplexer signal within the message.    */
+} CanSignalMessage;
+
+/**
+ * @brief   A signal of the table.
+ * @details The physical value is raw * factor + offset in units of
+ *          10^-decimals, the host picks the decimals that make factor
+ *          and offset integers.
+ */
+typedef struct {
+    uint8_t shift;          /**< Lowest bit in the 64 bit payload word.    */
+    uint8_t length;         /**< Bits, 1 to 32.                            */
+    uint8_t flags;          /**< @p CAN_SIGNAL_* flags.                    */
+    uint8_t decimals;
+    int32_t factor;
+    int32_t offset;
+    uint32_t deadband;      /**< Raw change that is reported, 0 is any.    */
+    uint16_t mux;           /**< Multiplexer value it is sent with.        */
+    uint16_t reserved;
+} CanSignalDef;
+
+/**
+ * @brief   Last reported raw value of a signal.
+ */
+typedef struct {
+    uint32_t raw;
+    bool valid;
+} CanSignalState;
+
+/**
+ * @brief   A signal value to report.
+ */
+typedef struct {
+    uint16_t index;         /**< Signal in the table.                      */
+    uint8_t decimals;
+    int64_t value;          /**< In units of 10^-decimals.                 */
+} CanSignalValue;
+
+/**
+ * @brief   Decoder statistics.
+ */
+typedef struct {
+    uint32_t frames;        /**< Frames seen.                              */
+    uint32_t decoded;       /**< Frames of a message in the table.         */
+    uint32_t emitted;       /**< Values reported.                          */
+    uint32_t suppressed;    /**< Values within the deadband.               */
+} CanSignalStats;
+
+/**
+ * @brief   A loaded table.
+ */
+typedef struct {
+    const CanSignalMessage *messages;
+    const CanSignalDef *signals;
+    size_t messageCount;
+    size_t signalCount;
+    CanSignalState *state;  /**< One per signal.                           */
+    CanSignalStats stats;
+} CanSignalTable;
+
+/**
+ * @brief   Receives the values of a frame.
+ */
+typedef void (*cansignalemit_t)(const CanSignalValue *value, void *arg);
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  bool can_signal_load(CanSignalTable *tp, const void *table, size_t size,
+                       CanSignalState *state, size_t stateCount);
+  void can_signal_reset(CanSignalTable *tp);
+  bool can_signal_decode(CanSignalTable *tp, const CanRecord *rp,
+                         cansignalemit_t emit, void *arg);
+  void can_signal_to_record(const CanSignalValue *vp, uint32_t timestamp,
+                            CanRecord *rp);
+  bool can_signal_from_record(const CanRecord *rp, CanSignalValue *vp);
+  size_t can_signal_format(const CanSignalValue *vp, char *text);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CAN_SIGNAL_H_ */
+
+/** @} */
@@ -0,0 +1,150 @@
+/**
+ * @file    src/can_snapshot.c
+ * @brief   Latest-value table of received frames.
+ * @details The receiver overwrites the entry of each identifier with the
+ *          latest frame and counts the updates. The output thread walks
+ *          the table at a fixed rate and sends every entry, or only the
+ *          updated ones, so the output bandwidth is bounded by the table
+ *          size and the rate, whatever the bus load.
+ *          Entries are copied out one at a time, the receiver is never
+ *          held up by a slow host link. An entry is only marked as sent
+ *          once it was delivered, an update arriving in between keeps it
+ *          pending for the next snapshot.
+ *          Identifiers are hashed with linear probing. Entries are never
+ *          removed, identifiers that do not fit are counted as overflow.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include "can_snapshot.h"
+
+typedef struct {
+    uint32_t key;           /**< Identifier and flags, zero if unused.     */
+    uint16_t updates;
+    CanRecord record;
+} SnapshotSlot;
+
+static LGCR_CCM_DATA SnapshotSlot snapshot[CAN_SNAPSHOT_SIZE];
+static CanSnapshotStats snapshotStats;
+
+static MUTEX_DECL(snapshotMutex);
+
+/*
+ * Returns the slot of the key, a free slot for a new key or NULL when the
+ * table is full.
+ */
+static SnapshotSlot *slot_find(uint32_t key)
+{
+    uint32_t hash = (key * 2654435761U) & (CAN_SNAPSHOT_SIZE - 1);
+
+    for (uint32_t i = 0; i < CAN_SNAPSHOT_SIZE; i++)
+    {
+        SnapshotSlot *slot = &snapshot[(hash + i) & (CAN_SNAPSHOT_SIZE - 1)];
+
+        if (slot->key == key || slot->key == 0)
+            return slot;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief   Empties the table.
+ */
+void can_snapshot_init(void)
+{
+    chMtxLock(&snapshotMutex);
+    for (size_t i = 0; i < CAN_SNAPSHOT_SIZE; i++)
+    {
+        snapshot[i].key = 0;
+    }
+    snapshotStats.ids = 0;
+    snapshotStats.frames = 0;
+    snapshotStats.overflow = 0;
+    chMtxUnlock(&snapshotMutex);
+}
+
+/**
+ * @brief   Stores a received frame as the latest of its identifier.
+ */
+void can_snapshot_update(const CanRecord *record)
+{
+    /* The short frame bit is set in every key, zero marks a free slot.*/
+    uint32_t key = record->id | CAN_RECORD_SHORT;
+
+    chMtxLock(&snapshotMutex);
+    snapshotStats.frames++;
+    SnapshotSlot *slot = slot_find(key);
+    if (slot == NULL)
+    {
+        snapshotStats.overflow++;
+    }
+    else
+    {
+        if (slot->key == 0)
+        {
+            slot->key = key;
+            slot->updates = 0;
+            snapshotStats.ids++;
+        }
+        slot->record = *record;
+        if (slot->updates < 0xFFFF)
+            slot->updates++;
+    }
+    chMtxUnlock(&snapshotMutex);
+}
+
+/**
+ * @brief   Copies the next entry at or after @p start.
+ *
+ * @param[in] all       Return every entry, otherwise only updated ones.
+ * @return              false when the end of the table was reached.
+ */
+bool can_snapshot_next(size_t start, bool all, CanSnapshotEntry *entry)
+{
+    bool found = false;
+
+    chMtxLock(&snapshotMutex);
+    for (size_t i = start; i < CAN_SNAPSHOT_SIZE; i++)
+    {
+        const SnapshotSlot *slot = &snapshot[i];
+
+        if (slot->key == 0 || (!all && slot->updates == 0))
+            continue;
+
+        entry->index = i;
+        entry->updates = slot->updates;
+        entry->record = slot->record;
+        found = true;
+        break;
+    }
+    chMtxUnlock(&snapshotMutex);
+
+    return found;
+}
+
+/**
+ * @brief   Marks an entry as delivered.
+ * @details Updates received after it was copied stay pending.
+ */
+void can_snapshot_sent(const CanSnapshotEntry *entry)
+{
+    chMtxLock(&snapshotMutex);
+    SnapshotSlot *slot = &snapshot[entry->index];
+    slot->updates = slot->updates > entry->updates
+            ? slot->updates - entry->updates : 0;
+    chMtxUnlock(&snapshotMutex);
+}
+
+/**
+ * @brief   Returns a snapshot of the statistics.
+ */
+void can_snapshot_get_stats(CanSnapshotStats *stats)
+{
+    chMtxLock(&snapshotMutex);
+    *stats = snapshotStats;
+    chMtxUnlock(&snapshotMutex);
+}
+
+/** @} */
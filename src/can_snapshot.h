@@ -0,0 +1,82 @@
+/**
+ * @file    src/can_snapshot.h
+ * @brief   Latest-value table of received frames.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _CAN_SNAPSHOT_H_
+#define _CAN_SNAPSHOT_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "targetconf.h"
+
+#include "can_record.h"
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Identifiers the table can hold.
+ * @note    Power of two. Targets set this in targetconf.h.
+ */
+#if !defined(CAN_SNAPSHOT_SIZE) || defined(__DOXYGEN__)
+#define CAN_SNAPSHOT_SIZE           64
+#endif
+
+/*===========================================================================*/
+/* Derived constants and error checks.                                       */
+/*===========================================================================*/
+
+#if (CAN_SNAPSHOT_SIZE & (CAN_SNAPSHOT_SIZE - 1)) != 0
+#error "CAN_SNAPSHOT_SIZE must be a power of two"
+#endif
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   A table entry, as returned by @p next.
+ */
+typedef struct {
+    size_t index;           /**< Identifies the entry for @p sent.         */
+    uint16_t updates;       /**< Frames received since it was last sent.   */
+    CanRecord record;       /**< Latest frame of the identifier.           */
+} CanSnapshotEntry;
+
+/**
+ * @brief   Table statistics.
+ */
+typedef struct {
+    uint32_t ids;           /**< Identifiers in the table.                 */
+    uint32_t frames;        /**< Frames received.                          */
+    uint32_t overflow;      /**< Frames of identifiers that did not fit.   */
+} CanSnapshotStats;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void can_snapshot_init(void);
+  void can_snapshot_update(const CanRecord *record);
+  bool can_snapshot_next(size_t start, bool all, CanSnapshotEntry *entry);
+  void can_snapshot_sent(const CanSnapshotEntry *entry);
+  void can_snapshot_get_stats(CanSnapshotStats *stats);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CAN_SNAPSHOT_H_ */
+
+/** @} */
@@ -0,0 +1,189 @@
+/**
+ * @file    src/can_trigger.c
+ * @brief   Pre/post trigger capture.
+ * @details Works like the trigger of a logic analyzer. While armed, every
+ *          frame goes into a circular history at full bus rate and nothing
+ *          is forwarded. When a frame or an error event matches, the last
+ *          @p preFrames of the history are moved into the backlog, followed
+ *          by the trigger frame and @p postFrames further frames. The
+ *          window then drains at whatever speed the host link allows and
+ *          the engine ignores traffic until it is re-armed.
+ *          Frames and errors are fed from the receiver thread only.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include "can_trigger.h"
+#include "can_backlog.h"
+
+static CanTriggerConfig triggerConfig;
+static CanTriggerStatus triggerStatus;
+
+static CanRecord history[CAN_TRIGGER_HISTORY_SIZE];
+static size_t historyHead;
+static size_t historyCount;
+
+static bool frame_matches(const CanRecord *record)
+{
+    if ((triggerConfig.conditions & CAN_TRIGGER_ON_FRAME) == 0 ||
+        CAN_RECORD_IS_DEVICE(record))
+        return false;
+
+    if (CAN_RECORD_IS_EXT(record) != triggerConfig.extended)
+        return false;
+
+    if (((CAN_RECORD_GET_ID(record) ^ triggerConfig.id)
+            & triggerConfig.idMask) != 0)
+        return false;
+
+    uint8_t data[8];
+    uint8_t dlc = can_record_get_data(record, data);
+
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        if (triggerConfig.dataMask[i] == 0)
+            continue;
+        if (i >= dlc ||
+            ((data[i] ^ triggerConfig.data[i]) & triggerConfig.dataMask[i])
+                != 0)
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Moves the pre-trigger history into the backlog and starts the
+ * post-trigger phase.
+ */
+static void fire(uint32_t timestamp)
+{
+    size_t pre = historyCount < triggerConfig.preFrames ?
+            historyCount : triggerConfig.preFrames;
+    size_t first = (historyHead + CAN_TRIGGER_HISTORY_SIZE - pre)
+            % CAN_TRIGGER_HISTORY_SIZE;
+
+    for (size_t i = 0; i < pre; i++)
+    {
+        (void)can_backlog_push(&history[(first + i) % CAN_TRIGGER_HISTORY_SIZE]);
+    }
+
+    chSysLock();
+    triggerStatus.state = triggerConfig.postFrames > 0 ?
+            CAN_TRIGGER_FIRED : CAN_TRIGGER_DONE;
+    triggerStatus.triggerTime = timestamp;
+    triggerStatus.preFrames = (uint16_t)pre;
+    triggerStatus.postFrames = 0;
+    if (triggerStatus.state == CAN_TRIGGER_DONE)
+        triggerStatus.windows++;
+    chSysUnlock();
+}
+
+/**
+ * @brief   Sets the configuration and arms the trigger.
+ */
+void can_trigger_init(const CanTriggerConfig *config)
+{
+    chSysLock();
+    triggerConfig = *config;
+    if (triggerConfig.preFrames > CAN_TRIGGER_HISTORY_SIZE)
+        triggerConfig.preFrames = CAN_TRIGGER_HISTORY_SIZE;
+    /* A window larger than the backlog would evict its own frames.*/
+    if (triggerConfig.preFrames >= CAN_BACKLOG_SIZE)
+        triggerConfig.preFrames = CAN_BACKLOG_SIZE - 1;
+    size_t postMax = CAN_BACKLOG_SIZE - 1 - triggerConfig.preFrames;
+    if (triggerConfig.postFrames > postMax)
+        triggerConfig.postFrames = (uint16_t)postMax;
+    historyHead = 0;
+    historyCount = 0;
+    triggerStatus.state = CAN_TRIGGER_ARMED;
+    chSysUnlock();
+}
+
+/**
+ * @brief   Feeds a received frame.
+ */
+void can_trigger_frame(const CanRecord *record)
+{
+    chSysLock();
+    cantriggerstate_t state = triggerStatus.state;
+    if (state == CAN_TRIGGER_DONE)
+        triggerStatus.ignored++;
+    chSysUnlock();
+
+    switch (state)
+    {
+    case CAN_TRIGGER_ARMED:
+        if (frame_matches(record))
+        {
+            fire(record->timestamp);
+            (void)can_backlog_push(record);
+            break;
+        }
+        history[historyHead] = *record;
+        historyHead = (historyHead + 1) % CAN_TRIGGER_HISTORY_SIZE;
+        if (historyCount < CAN_TRIGGER_HISTORY_SIZE)
+            historyCount++;
+        break;
+    case CAN_TRIGGER_FIRED:
+        (void)can_backlog_push(record);
+        chSysLock();
+        if (++triggerStatus.postFrames >= triggerConfig.postFrames)
+        {
+            triggerStatus.state = CAN_TRIGGER_DONE;
+            triggerStatus.windows++;
+        }
+        chSysUnlock();
+        break;
+    case CAN_TRIGGER_DONE:
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief   Feeds a CAN driver error event.
+ */
+void can_trigger_error(uint32_t flags, uint32_t timestamp)
+{
+    if ((triggerConfig.conditions & CAN_TRIGGER_ON_ERROR) == 0 ||
+        (flags & triggerConfig.errorMask) == 0)
+        return;
+
+    chSysLock();
+    cantriggerstate_t state = triggerStatus.state;
+    chSysUnlock();
+
+    if (state == CAN_TRIGGER_ARMED)
+        fire(timestamp);
+}
+
+/**
+ * @brief   Arms the trigger again after a window was delivered.
+ * @details The history starts empty, frames of the previous window are
+ *          not reused as pre-trigger frames.
+ */
+void can_trigger_rearm(void)
+{
+    chSysLock();
+    if (triggerStatus.state == CAN_TRIGGER_DONE)
+    {
+        historyHead = 0;
+        historyCount = 0;
+        triggerStatus.state = CAN_TRIGGER_ARMED;
+    }
+    chSysUnlock();
+}
+
+/**
+ * @brief   Returns a snapshot of the status.
+ */
+void can_trigger_get_status(CanTriggerStatus *status)
+{
+    chSysLock();
+    *status = triggerStatus;
+    chSysUnlock();
+}
+
+/** @} */
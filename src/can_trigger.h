@@ -0,0 +1,139 @@
+/**
+ * @file    src/can_trigger.h
+ * @brief   Pre/post trigger capture.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _CAN_TRIGGER_H_
+#define _CAN_TRIGGER_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "targetconf.h"
+
+#include "can_backlog.h"
+#include "can_record.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/**
+ * @name    Trigger conditions
+ * @{
+ */
+#define CAN_TRIGGER_ON_FRAME        (1U << 0)   /**< ID and payload match. */
+#define CAN_TRIGGER_ON_ERROR        (1U << 1)   /**< Error event flags.    */
+/** @} */
+
+/**
+ * @brief   Trigger engine state.
+ */
+typedef enum {
+  CAN_TRIGGER_ARMED = 0,    /**< Filling the pre-trigger history.          */
+  CAN_TRIGGER_FIRED,        /**< Recording post-trigger frames.            */
+  CAN_TRIGGER_DONE          /**< Window complete, waiting for re-arm.      */
+} cantriggerstate_t;
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Frames kept before the trigger.
+ */
+#if !defined(CAN_TRIGGER_HISTORY_SIZE) || defined(__DOXYGEN__)
+#define CAN_TRIGGER_HISTORY_SIZE    128
+#endif
+
+/**
+ * @brief   Frames of the window before the trigger.
+ * @note    @p CAN_TRIGGER_CONFIG takes its @p preFrames from here.
+ */
+#if !defined(CAN_TRIGGER_PRE_FRAMES) || defined(__DOXYGEN__)
+#define CAN_TRIGGER_PRE_FRAMES      32
+#endif
+
+/**
+ * @brief   Frames of the window after the trigger.
+ * @note    @p CAN_TRIGGER_CONFIG takes its @p postFrames from here.
+ */
+#if !defined(CAN_TRIGGER_POST_FRAMES) || defined(__DOXYGEN__)
+#define CAN_TRIGGER_POST_FRAMES     32
+#endif
+
+/*===========================================================================*/
+/* Derived constants and error checks.                                       */
+/*===========================================================================*/
+
+#if CAN_TRIGGER_PRE_FRAMES > CAN_TRIGGER_HISTORY_SIZE
+#error "CAN_TRIGGER_PRE_FRAMES exceeds CAN_TRIGGER_HISTORY_SIZE"
+#endif
+
+#if CAN_TRIGGER_PRE_FRAMES + 1 + CAN_TRIGGER_POST_FRAMES > CAN_BACKLOG_SIZE
+#error "trigger window does not fit CAN_BACKLOG_SIZE"
+#endif
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Trigger configuration.
+ * @details A frame matches when its identifier equals @p id in all bits of
+ *          @p idMask, it has the same frame format and every payload byte
+ *          equals @p data in the bits of @p dataMask. Bytes beyond the DLC
+ *          only match a zero mask.
+ *          An error event matches when its flags share a bit with
+ *          @p errorMask.
+ */
+typedef struct {
+    uint8_t conditions;     /**< @p CAN_TRIGGER_ON_* bits.                 */
+    bool extended;
+    uint32_t id;
+    uint32_t idMask;
+    uint8_t data[8];
+    uint8_t dataMask[8];
+    uint32_t errorMask;     /**< CAN driver @p error_event flags.          */
+    uint16_t preFrames;     /**< At most @p CAN_TRIGGER_HISTORY_SIZE.      */
+    uint16_t postFrames;    /**< With @p preFrames and the trigger frame at
+                                 most @p CAN_BACKLOG_SIZE.                 */
+} CanTriggerConfig;
+
+/**
+ * @brief   Trigger status.
+ */
+typedef struct {
+    cantriggerstate_t state;
+    uint32_t windows;       /**< Windows completed since start.            */
+    uint32_t triggerTime;   /**< Time of the last trigger in microseconds. */
+    uint16_t preFrames;     /**< History frames in the current window.     */
+    uint16_t postFrames;    /**< Post-trigger frames recorded so far.      */
+    uint32_t ignored;       /**< Frames seen while waiting for re-arm.     */
+} CanTriggerStatus;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void can_trigger_init(const CanTriggerConfig *config);
+  void can_trigger_frame(const CanRecord *record);
+  void can_trigger_error(uint32_t flags, uint32_t timestamp);
+  void can_trigger_rearm(void);
+  void can_trigger_get_status(CanTriggerStatus *status);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CAN_TRIGGER_H_ */
+
+/** @} */
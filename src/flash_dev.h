@@ -0,0 +1,80 @@
+/**
+ * @file    src/flash_dev.h
+ * @brief   Flash device interface.
+ * @details NOR flash as seen by the flash log: erase by sector, program
+ *          words that are still erased, read anything. Implemented for
+ *          the internal STM32 flash and by a RAM emulation for host tests.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _FLASH_DEV_H_
+#define _FLASH_DEV_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Value of an erased byte.
+ */
+#define FLASH_DEV_ERASED            0xFFU
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Derived constants and error checks.                                       */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+typedef struct FlashDevice FlashDevice;
+
+/**
+ * @brief   A flash region.
+ * @details Offsets are relative to the start of the region. Programming
+ *          works on 32-bit words, @p offset and @p n must be multiples of 4.
+ */
+struct FlashDevice {
+    uint32_t size;          /**< Region size in bytes.                     */
+    uint32_t sectorSize;    /**< Erase unit in bytes.                      */
+    bool (*erase)(const FlashDevice *fdp, uint32_t offset);
+    bool (*program)(const FlashDevice *fdp, uint32_t offset,
+                    const void *data, size_t n);
+    void (*read)(const FlashDevice *fdp, uint32_t offset, void *data,
+                 size_t n);
+};
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/**
+ * @brief   Erases the sector containing @p offset.
+ */
+#define flashErase(fdp, offset)     ((fdp)->erase(fdp, offset))
+
+/**
+ * @brief   Programs erased words.
+ */
+#define flashProgram(fdp, offset, data, n)                                  \
+    ((fdp)->program(fdp, offset, data, n))
+
+/**
+ * @brief   Reads from the region.
+ */
+#define flashRead(fdp, offset, data, n)                                     \
+    ((fdp)->read(fdp, offset, data, n))
+
+#endif /* _FLASH_DEV_H_ */
+
+/** @} */
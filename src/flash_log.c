@@ -0,0 +1,342 @@
+/**
+ * @file    src/flash_log.c
+ * @brief   Circular frame log in flash.
+ * @details The region is a ring of pages. Pages are programmed in order,
+ *          each one with a header carrying a sequence number, so the
+ *          newest page is found again after a reset. A sector is erased
+ *          before the ring enters it, which drops the oldest pages and
+ *          wears all sectors evenly. The erase is a call of its own,
+ *          @p flash_log_write waits for it, so the caller can pick a moment
+ *          when the stall does no harm.
+ *          Records are collected in two RAM page buffers. The producer
+ *          only copies into the buffer that is filling, a full buffer is
+ *          programmed later by the caller of @p flash_log_write, so flash
+ *          operations never run in the producer's context.
+ *          Clearing the log programs a marker into every page header
+ *          instead of erasing, the sectors are erased as the ring reaches
+ *          them.
+ *          Appending and sealing have to be serialized by the caller, all
+ *          other functions must not run concurrently with each other.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include <string.h>
+
+#include "flash_log.h"
+
+static bool page_header(const FlashLog *flp, uint32_t page,
+                        FlashLogHeader *header)
+{
+    flashRead(flp->dev, page * FLASH_LOG_PAGE_SIZE, header, sizeof(*header));
+
+    return header->magic == FLASH_LOG_MAGIC &&
+           header->count <= FLASH_LOG_PAGE_RECORDS;
+}
+
+/*
+ * True for a programmed page whose records still count.
+ */
+static bool page_live(const FlashLog *flp, uint32_t page,
+                      FlashLogHeader *header)
+{
+    return page_header(flp, page, header) && header->discarded != 0;
+}
+
+static bool page_erased(const FlashLog *flp, uint32_t page)
+{
+    uint32_t chunk[8];
+
+    for (uint32_t offset = 0; offset < FLASH_LOG_PAGE_SIZE;
+         offset += sizeof(chunk))
+    {
+        flashRead(flp->dev, page * FLASH_LOG_PAGE_SIZE + offset, chunk,
+                sizeof(chunk));
+        for (size_t i = 0; i < sizeof(chunk) / sizeof(chunk[0]); i++)
+        {
+            if (chunk[i] != 0xFFFFFFFFU)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Erases the sector starting at @p page and forgets its records.
+ */
+static bool erase_sector(FlashLog *flp, uint32_t page)
+{
+    uint32_t pagesPerSector = flp->dev->sectorSize / FLASH_LOG_PAGE_SIZE;
+
+    for (uint32_t i = 0; i < pagesPerSector; i++)
+    {
+        FlashLogHeader header;
+
+        if (page_live(flp, page + i, &header))
+            flp->records -= header.count;
+    }
+
+    flp->erases++;
+    if (!flashErase(flp->dev, page * FLASH_LOG_PAGE_SIZE))
+    {
+        flp->errors++;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief   Opens the log on @p fdp.
+ * @details Scans the page headers for the newest page, writing continues
+ *          after it. A page that is neither valid nor erased, e.g. after a
+ *          reset during programming, makes the log skip to the next sector.
+ */
+void flash_log_init(FlashLog *flp, const FlashDevice *fdp)
+{
+    uint32_t newest = 0;
+    bool found = false;
+
+    flp->dev = fdp;
+    flp->pageCount = fdp->size / FLASH_LOG_PAGE_SIZE;
+    flp->records = 0;
+    flp->sequence = 0;
+    flp->state[0] = FLASH_LOG_FREE;
+    flp->state[1] = FLASH_LOG_FREE;
+    flp->fill = 0;
+    flp->write = 0;
+    flp->pagesWritten = 0;
+    flp->erases = 0;
+    flp->dropped = 0;
+    flp->errors = 0;
+
+    for (uint32_t page = 0; page < flp->pageCount; page++)
+    {
+        FlashLogHeader header;
+
+        if (!page_header(flp, page, &header))
+            continue;
+
+        if (header.discarded != 0)
+            flp->records += header.count;
+        if (!found || (int32_t)(header.sequence - flp->sequence) >= 0)
+        {
+            newest = page;
+            flp->sequence = header.sequence;
+            found = true;
+        }
+    }
+
+    if (found)
+    {
+        flp->head = (newest + 1) % flp->pageCount;
+        flp->sequence++;
+    }
+    else
+    {
+        flp->head = 0;
+    }
+
+    uint32_t pagesPerSector = fdp->sectorSize / FLASH_LOG_PAGE_SIZE;
+    if ((flp->head % pagesPerSector) != 0 && !page_erased(flp, flp->head))
+    {
+        flp->head = (flp->head - flp->head % pagesPerSector + pagesPerSector)
+                % flp->pageCount;
+    }
+    /* Inside a sector the pages after the head are known to be erased.*/
+    flp->sectorReady = (flp->head % pagesPerSector) != 0;
+}
+
+/**
+ * @brief   Adds a record to the current page buffer.
+ *
+ * @return  true if the buffer became full and can be written.
+ */
+bool flash_log_append(FlashLog *flp, const CanRecord *record)
+{
+    FlashLogPage *page = &flp->buffer[flp->fill];
+
+    if (flp->state[flp->fill] != FLASH_LOG_FILLING)
+    {
+        if (flp->state[flp->fill] != FLASH_LOG_FREE)
+        {
+            flp->dropped++;
+            return false;
+        }
+        page->header.count = 0;
+        flp->state[flp->fill] = FLASH_LOG_FILLING;
+    }
+
+    page->records[page->header.count++] = *record;
+    if (page->header.count < FLASH_LOG_PAGE_RECORDS)
+        return false;
+
+    flp->state[flp->fill] = FLASH_LOG_READY;
+    flp->fill ^= 1;
+
+    return true;
+}
+
+/**
+ * @brief   Closes a partially filled page buffer so it gets written.
+ *
+ * @return  true if there was something to write.
+ */
+bool flash_log_seal(FlashLog *flp)
+{
+    if (flp->state[flp->fill] != FLASH_LOG_FILLING ||
+        flp->buffer[flp->fill].header.count == 0)
+        return false;
+
+    flp->state[flp->fill] = FLASH_LOG_READY;
+    flp->fill ^= 1;
+
+    return true;
+}
+
+/**
+ * @brief   True if the sector the ring enters next has to be erased.
+ * @details @p flash_log_write programs nothing until it is.
+ */
+bool flash_log_erase_pending(const FlashLog *flp)
+{
+    uint32_t pagesPerSector = flp->dev->sectorSize / FLASH_LOG_PAGE_SIZE;
+
+    return (flp->head % pagesPerSector) == 0 && !flp->sectorReady;
+}
+
+/**
+ * @brief   Erases the sector the ring enters next.
+ * @details The flash is busy for a whole sector erase.
+ *
+ * @return  false if no erase was pending.
+ */
+bool flash_log_erase(FlashLog *flp)
+{
+    if (!flash_log_erase_pending(flp))
+        return false;
+
+    /* A failed sector is not retried forever, programming it fails.*/
+    (void)erase_sector(flp, flp->head);
+    flp->sectorReady = true;
+
+    return true;
+}
+
+/**
+ * @brief   Programs the oldest ready page buffer.
+ *
+ * @return  false if no buffer was ready or an erase is pending.
+ */
+bool flash_log_write(FlashLog *flp)
+{
+    FlashLogPage *page = &flp->buffer[flp->write];
+    uint32_t pagesPerSector = flp->dev->sectorSize / FLASH_LOG_PAGE_SIZE;
+
+    if (flp->state[flp->write] != FLASH_LOG_READY ||
+        flash_log_erase_pending(flp))
+        return false;
+
+    page->header.magic = FLASH_LOG_MAGIC;
+    page->header.sequence = flp->sequence;
+    page->header.discarded = 0xFFFFFFFFU;
+
+    /* Unused records stay erased. The magic goes in last, a page cut
+       short by a reset is not taken for a valid one.*/
+    uint32_t offset = flp->head * FLASH_LOG_PAGE_SIZE;
+    const uint8_t *bytes = (const uint8_t *)page;
+    size_t magicSize = sizeof(page->header.magic);
+
+    if (flashProgram(flp->dev, offset + magicSize, bytes + magicSize,
+            sizeof(FlashLogHeader) - magicSize
+            + page->header.count * sizeof(CanRecord)) &&
+        flashProgram(flp->dev, offset, &page->header.magic, magicSize))
+    {
+        flp->records += page->header.count;
+        flp->pagesWritten++;
+    }
+    else
+    {
+        flp->errors++;
+    }
+
+    /* A failed page is skipped, it is not retried forever.*/
+    flp->head = (flp->head + 1) % flp->pageCount;
+    flp->sequence++;
+    if ((flp->head % pagesPerSector) == 0)
+        flp->sectorReady = false;
+
+    flp->state[flp->write] = FLASH_LOG_FREE;
+    flp->write ^= 1;
+
+    return true;
+}
+
+/**
+ * @brief   Discards all records in flash.
+ * @details Programs one word per page, nothing is erased. Records still in
+ *          the page buffers are kept.
+ */
+void flash_log_clear(FlashLog *flp)
+{
+    static const uint32_t discarded = 0;
+
+    for (uint32_t page = 0; page < flp->pageCount; page++)
+    {
+        FlashLogHeader header;
+
+        if (!page_live(flp, page, &header))
+            continue;
+
+        if (!flashProgram(flp->dev, page * FLASH_LOG_PAGE_SIZE
+                + offsetof(FlashLogHeader, discarded), &discarded,
+                sizeof(discarded)))
+            flp->errors++;
+    }
+    flp->records = 0;
+}
+
+/**
+ * @brief   Positions @p cursor at the oldest record.
+ */
+void flash_log_cursor_init(const FlashLog *flp, FlashLogCursor *cursor)
+{
+    cursor->page = flp->head;
+    cursor->visited = 0;
+    cursor->index = 0;
+}
+
+/**
+ * @brief   Reads the next record.
+ *
+ * @return  false after the newest record.
+ */
+bool flash_log_read(const FlashLog *flp, FlashLogCursor *cursor,
+                    CanRecord *record)
+{
+    while (cursor->visited < flp->pageCount)
+    {
+        FlashLogHeader header;
+
+        if (page_live(flp, cursor->page, &header) &&
+            cursor->index < header.count)
+        {
+            flashRead(flp->dev, cursor->page * FLASH_LOG_PAGE_SIZE
+                    + sizeof(FlashLogHeader)
+                    + cursor->index * sizeof(CanRecord),
+                    record, sizeof(*record));
+            cursor->index++;
+            return true;
+        }
+
+        cursor->page = (cursor->page + 1) % flp->pageCount;
+        cursor->visited++;
+        cursor->index = 0;
+    }
+
+    return false;
+}
+
+/** @} */
@@ -0,0 +1,134 @@
+/**
+ * @file    src/flash_log.h
+ * @brief   Circular frame log in flash.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _FLASH_LOG_H_
+#define _FLASH_LOG_H_
+
+#include "flash_dev.h"
+#include "can_record.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Marks a programmed log page.
+ */
+#define FLASH_LOG_MAGIC             0x31474F4CU
+
+/**
+ * @brief   Write buffer states.
+ */
+typedef enum {
+  FLASH_LOG_FREE = 0,       /**< Unused.                                   */
+  FLASH_LOG_FILLING,        /**< Receiving records.                        */
+  FLASH_LOG_READY           /**< Waiting to be programmed.                 */
+} flashlogbuf_t;
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Log page size, the unit of programming.
+ * @note    Must divide the sector size of the device.
+ */
+#if !defined(FLASH_LOG_PAGE_SIZE) || defined(__DOXYGEN__)
+#define FLASH_LOG_PAGE_SIZE         1024
+#endif
+
+/*===========================================================================*/
+/* Derived constants and error checks.                                       */
+/*===========================================================================*/
+
+/**
+ * @brief   Records in one page, after the page header.
+ */
+#define FLASH_LOG_PAGE_RECORDS                                              \
+    ((FLASH_LOG_PAGE_SIZE - sizeof(FlashLogHeader)) / sizeof(CanRecord))
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Header at the start of every programmed page.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;      /**< Increments with every page written.       */
+    uint32_t count;         /**< Valid records in the page.                */
+    uint32_t discarded;     /**< Left erased, programmed to zero when the
+                                 log is cleared.                         */
+} FlashLogHeader;
+
+/**
+ * @brief   A page as it is programmed.
+ */
+typedef struct {
+    FlashLogHeader header;
+    CanRecord records[FLASH_LOG_PAGE_RECORDS];
+} FlashLogPage;
+
+/**
+ * @brief   Flash log object.
+ */
+typedef struct {
+    const FlashDevice *dev;
+    uint32_t pageCount;
+    uint32_t head;          /**< Next page to program.                     */
+    bool sectorReady;       /**< The sector @p head starts was erased.     */
+    uint32_t sequence;      /**< Sequence number of the next page.         */
+    uint32_t records;       /**< Records stored in flash.                  */
+    FlashLogPage buffer[2];
+    volatile flashlogbuf_t state[2];
+    uint8_t fill;           /**< Buffer taking records.                    */
+    uint8_t write;          /**< Buffer to program next.                   */
+    uint32_t pagesWritten;
+    uint32_t erases;
+    uint32_t dropped;       /**< Records lost, both buffers were busy.     */
+    uint32_t errors;        /**< Failed erase or program operations.       */
+} FlashLog;
+
+/**
+ * @brief   Read position, oldest record first.
+ */
+typedef struct {
+    uint32_t page;
+    uint32_t visited;
+    uint32_t index;
+} FlashLogCursor;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void flash_log_init(FlashLog *flp, const FlashDevice *fdp);
+  bool flash_log_append(FlashLog *flp, const CanRecord *record);
+  bool flash_log_seal(FlashLog *flp);
+  bool flash_log_erase_pending(const FlashLog *flp);
+  bool flash_log_erase(FlashLog *flp);
+  bool flash_log_write(FlashLog *flp);
+  void flash_log_clear(FlashLog *flp);
+  void flash_log_cursor_init(const FlashLog *flp, FlashLogCursor *cursor);
+  bool flash_log_read(const FlashLog *flp, FlashLogCursor *cursor,
+                      CanRecord *record);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FLASH_LOG_H_ */
+
+/** @} */
@@ -0,0 +1,258 @@
+/**
+ * @file    src/flash_logger.c
+ * @brief   Unattended capture into the internal flash.
+ * @details The receiver feeds every frame. Frames passing the filters and
+ *          the per identifier decimation are copied into the RAM page
+ *          buffer of the flash log, the "flashlog" thread programs full
+ *          pages. The receiver never waits for the flash.
+ *          Frames arriving while the flash is busy are held in RAM, see
+ *          flash_stm32.c. A sector erase is only started when the frame
+ *          rate measured over @p FLASH_LOG_ERASE_WINDOW fills less than
+ *          the hold during @p FLASH_LOG_ERASE_US. Under heavier traffic
+ *          the log waits and drops records instead of live frames.
+ *          The flash region is set by @p FLASH_LOG_BASE, @p FLASH_LOG_SIZE,
+ *          @p FLASH_LOG_SECTOR_SIZE and @p FLASH_LOG_FIRST_SECTOR in
+ *          targetconf.h.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include "flash_logger.h"
+#include "flash_stm32.h"
+
+typedef struct {
+    uint32_t key;           /**< Identifier word, zero if unused.          */
+    uint32_t last;          /**< Time the identifier was last logged.      */
+} DecimationSlot;
+
+static const FlashLogFilter logFilters[] = { FLASH_LOG_FILTERS };
+
+static FlashStm32 logDevice;
+static FlashLog flashLog;
+
+static MUTEX_DECL(flashLogMutex);
+static BSEMAPHORE_DECL(flashLogReady, true);
+
+static LGCR_CCM_DATA DecimationSlot decimation[FLASH_LOG_DECIMATION_SLOTS];
+static uint32_t offered;
+static uint32_t logged;
+static uint32_t decimated;
+
+/*
+ * Returns false if the identifier was logged less than @p interval ago.
+ */
+static bool decimation_pass(const CanRecord *record, uint32_t interval)
+{
+    /* The short frame bit is set in every key, zero marks a free slot.*/
+    uint32_t key = (record->id & ~CAN_RECORD_SHORT) | CAN_RECORD_SHORT;
+    uint32_t hash = (key * 2654435761U) % FLASH_LOG_DECIMATION_SLOTS;
+    DecimationSlot *slot = &decimation[hash];
+
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        DecimationSlot *probe =
+                &decimation[(hash + i) % FLASH_LOG_DECIMATION_SLOTS];
+
+        if (probe->key == key || probe->key == 0)
+        {
+            slot = probe;
+            break;
+        }
+    }
+
+    if (slot->key == key && record->timestamp - slot->last < interval)
+        return false;
+
+    /* A full probe sequence evicts the first slot.*/
+    slot->key = key;
+    slot->last = record->timestamp;
+
+    return true;
+}
+
+static const FlashLogFilter *filter_match(const CanRecord *record)
+{
+    for (size_t i = 0; i < sizeof(logFilters) / sizeof(logFilters[0]); i++)
+    {
+        const FlashLogFilter *filter = &logFilters[i];
+
+        if (filter->extended == CAN_RECORD_IS_EXT(record) &&
+            ((CAN_RECORD_GET_ID(record) ^ filter->id) & filter->mask) == 0)
+            return filter;
+    }
+
+    return NULL;
+}
+
+/*
+ * True if the frames offered over @p elapsed ticks, continued for a whole
+ * erase, fit the hold.
+ */
+static bool erase_fits(uint32_t frames, systime_t elapsed)
+{
+    return (uint64_t)frames * FLASH_LOG_ERASE_US <=
+           (uint64_t)ST2US(elapsed) * FLASH_STM32_HOLD_FRAMES;
+}
+
+static LGCR_CCM_DATA THD_WORKING_AREA(flashLoggerWa, 256);
+static THD_FUNCTION(flashLogger, arg)
+{
+    (void) arg;
+    chRegSetThreadName("flashlog");
+
+    systime_t synced = chVTGetSystemTime();
+    systime_t windowStart = synced;
+    uint32_t windowOffered = offered;
+
+    while (!chThdShouldTerminateX())
+    {
+        bool erasePending;
+
+        chMtxLock(&flashLogMutex);
+        erasePending = flash_log_erase_pending(&flashLog);
+        chMtxUnlock(&flashLogMutex);
+
+        if (chBSemWaitTimeout(&flashLogReady, erasePending ?
+                FLASH_LOG_ERASE_WINDOW : FLASH_LOG_SYNC_INTERVAL) == MSG_OK)
+        {
+            synced = chVTGetSystemTime();
+        }
+        else if (chVTTimeElapsedSinceX(synced) >= FLASH_LOG_SYNC_INTERVAL)
+        {
+            chSysLock();
+            (void)flash_log_seal(&flashLog);
+            chSysUnlock();
+            synced = chVTGetSystemTime();
+        }
+
+        chMtxLock(&flashLogMutex);
+        systime_t elapsed = chVTTimeElapsedSinceX(windowStart);
+        if (elapsed >= FLASH_LOG_ERASE_WINDOW)
+        {
+            if (flash_log_erase_pending(&flashLog) &&
+                erase_fits(offered - windowOffered, elapsed))
+                (void)flash_log_erase(&flashLog);
+            windowStart = chVTGetSystemTime();
+            windowOffered = offered;
+        }
+        while (flash_log_write(&flashLog))
+            ;
+        chMtxUnlock(&flashLogMutex);
+    }
+}
+
+/**
+ * @brief   Opens the log and starts the writer thread.
+ */
+void flashLoggerStart(tprio_t prio)
+{
+    flash_stm32_init(&logDevice, FLASH_LOG_BASE, FLASH_LOG_SIZE,
+            FLASH_LOG_SECTOR_SIZE, FLASH_LOG_FIRST_SECTOR, CANDRIVER.can);
+    flash_log_init(&flashLog, &logDevice.dev);
+    /* The slots may be in CCM, which is not cleared at startup.*/
+    for (size_t i = 0; i < FLASH_LOG_DECIMATION_SLOTS; i++)
+        decimation[i].key = 0;
+
+    chThdCreateStatic(flashLoggerWa, sizeof(flashLoggerWa), prio,
+            flashLogger, NULL);
+}
+
+/**
+ * @brief   Offers a received frame to the log.
+ */
+void flashLoggerFeed(const CanRecord *record)
+{
+    const FlashLogFilter *filter = filter_match(record);
+    bool full;
+
+    offered++;
+    if (filter == NULL)
+        return;
+
+    if (filter->intervalUs != 0 &&
+        !decimation_pass(record, filter->intervalUs))
+    {
+        decimated++;
+        return;
+    }
+
+    chSysLock();
+    full = flash_log_append(&flashLog, record);
+    logged++;
+    if (full)
+        chBSemSignalI(&flashLogReady);
+    chSchRescheduleS();
+    chSysUnlock();
+}
+
+/**
+ * @brief   Returns the oldest frame received while the flash was busy.
+ * @details The receiver takes these ahead of the controller's FIFOs,
+ *          @p ageUs is the time since reception.
+ *
+ * @return  false if no frame is held.
+ */
+bool flashLoggerTakeHeld(CANRxFrame *frame, uint32_t *ageUs)
+{
+    return flash_stm32_take(&logDevice, frame, ageUs);
+}
+
+/**
+ * @brief   Passes all stored records to @p emit, oldest first.
+ * @details Stops early if @p emit returns false.
+ *
+ * @return  Number of records emitted.
+ */
+uint32_t flashLoggerDump(bool (*emit)(const CanRecord *record, void *arg),
+                         void *arg)
+{
+    FlashLogCursor cursor;
+    CanRecord record;
+    uint32_t count = 0;
+
+    chMtxLock(&flashLogMutex);
+    flash_log_cursor_init(&flashLog, &cursor);
+    while (flash_log_read(&flashLog, &cursor, &record))
+    {
+        if (!emit(&record, arg))
+            break;
+        count++;
+    }
+    chMtxUnlock(&flashLogMutex);
+
+    return count;
+}
+
+/**
+ * @brief   Discards the records in flash.
+ * @details Marks the pages, the sectors are erased later by the writer.
+ */
+void flashLoggerClear(void)
+{
+    chMtxLock(&flashLogMutex);
+    flash_log_clear(&flashLog);
+    chMtxUnlock(&flashLogMutex);
+}
+
+/**
+ * @brief   Returns a snapshot of the statistics.
+ */
+void flashLoggerGetStats(FlashLoggerStats *stats)
+{
+    chMtxLock(&flashLogMutex);
+    chSysLock();
+    stats->records = flashLog.records;
+    stats->logged = logged;
+    stats->decimated = decimated;
+    stats->dropped = flashLog.dropped;
+    stats->pagesWritten = flashLog.pagesWritten;
+    stats->erases = flashLog.erases;
+    stats->errors = flashLog.errors;
+    stats->held = logDevice.held;
+    stats->holdLost = logDevice.holdLost;
+    chSysUnlock();
+    chMtxUnlock(&flashLogMutex);
+}
+
+/** @} */
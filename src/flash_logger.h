@@ -0,0 +1,106 @@
+/**
+ * @file    src/flash_logger.h
+ * @brief   Unattended capture into the internal flash.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _FLASH_LOGGER_H_
+#define _FLASH_LOGGER_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "targetconf.h"
+
+#include "can_record.h"
+#include "flash_log.h"
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   A partially filled page is written after this time without a
+ *          full page.
+ * @note    Every write of a partial page costs a whole page of the ring,
+ *          short intervals wear the flash faster.
+ */
+#if !defined(FLASH_LOG_SYNC_INTERVAL) || defined(__DOXYGEN__)
+#define FLASH_LOG_SYNC_INTERVAL     S2ST(60)
+#endif
+
+/**
+ * @brief   Longest sector erase of the log region in microseconds.
+ */
+#if !defined(FLASH_LOG_ERASE_US) || defined(__DOXYGEN__)
+#define FLASH_LOG_ERASE_US          40000
+#endif
+
+/**
+ * @brief   Period over which the frame rate is measured before an erase.
+ */
+#if !defined(FLASH_LOG_ERASE_WINDOW) || defined(__DOXYGEN__)
+#define FLASH_LOG_ERASE_WINDOW      MS2ST(100)
+#endif
+
+/**
+ * @brief   Identifiers tracked for decimation.
+ */
+#if !defined(FLASH_LOG_DECIMATION_SLOTS) || defined(__DOXYGEN__)
+#define FLASH_LOG_DECIMATION_SLOTS  64
+#endif
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Selects frames for the log.
+ * @details A frame is logged if it matches a filter. With a non-zero
+ *          @p intervalUs, each identifier matching the filter is logged at
+ *          most once per interval.
+ */
+typedef struct {
+    uint32_t id;
+    uint32_t mask;
+    bool extended;
+    uint32_t intervalUs;
+} FlashLogFilter;
+
+/**
+ * @brief   Flash logger statistics.
+ */
+typedef struct {
+    uint32_t records;       /**< Records stored in flash.                  */
+    uint32_t logged;        /**< Frames accepted since start.              */
+    uint32_t decimated;     /**< Frames skipped by decimation.             */
+    uint32_t dropped;       /**< Frames lost, the writer was behind.       */
+    uint32_t pagesWritten;
+    uint32_t erases;
+    uint32_t errors;
+    uint32_t held;          /**< Frames received while the flash was busy. */
+    uint32_t holdLost;      /**< Of these, frames lost.                    */
+} FlashLoggerStats;
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void flashLoggerStart(tprio_t prio);
+  void flashLoggerFeed(const CanRecord *record);
+  bool flashLoggerTakeHeld(CANRxFrame *frame, uint32_t *ageUs);
+  uint32_t flashLoggerDump(bool (*emit)(const CanRecord *record, void *arg),
+                           void *arg);
+  void flashLoggerClear(void);
+  void flashLoggerGetStats(FlashLoggerStats *stats);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FLASH_LOGGER_H_ */
+
+/** @} */
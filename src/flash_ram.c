@@ -0,0 +1,76 @@
+/**
+ * @file    src/flash_ram.c
+ * @brief   RAM emulation of a flash device.
+ * @details Behaves like NOR flash: programming can only clear bits, a
+ *          word that is not erased cannot be programmed to a different
+ *          value. The memory starts out in an unknown state, like a
+ *          fresh device it has to be erased before use.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include <string.h>
+
+#include "flash_ram.h"
+
+static bool ram_erase(const FlashDevice *fdp, uint32_t offset)
+{
+    FlashRam *frp = (FlashRam *)fdp;
+
+    if (offset >= fdp->size)
+        return false;
+
+    offset -= offset % fdp->sectorSize;
+    memset(&frp->mem[offset], FLASH_DEV_ERASED, fdp->sectorSize);
+    frp->erases++;
+
+    return true;
+}
+
+static bool ram_program(const FlashDevice *fdp, uint32_t offset,
+                        const void *data, size_t n)
+{
+    FlashRam *frp = (FlashRam *)fdp;
+    const uint8_t *src = data;
+
+    if ((offset % 4) != 0 || (n % 4) != 0 || offset + n > fdp->size)
+        return false;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if ((frp->mem[offset + i] & src[i]) != src[i])
+            return false;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        frp->mem[offset + i] &= src[i];
+    }
+    frp->programs++;
+
+    return true;
+}
+
+static void ram_read(const FlashDevice *fdp, uint32_t offset, void *data,
+                     size_t n)
+{
+    memcpy(data, &((FlashRam *)fdp)->mem[offset], n);
+}
+
+/**
+ * @brief   Sets up an emulated flash of @p size bytes in @p mem.
+ */
+void flash_ram_init(FlashRam *frp, uint8_t *mem, uint32_t size,
+                    uint32_t sectorSize)
+{
+    frp->dev.size = size;
+    frp->dev.sectorSize = sectorSize;
+    frp->dev.erase = ram_erase;
+    frp->dev.program = ram_program;
+    frp->dev.read = ram_read;
+    frp->mem = mem;
+    frp->erases = 0;
+    frp->programs = 0;
+}
+
+/** @} */
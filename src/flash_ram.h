@@ -0,0 +1,43 @@
+/**
+ * @file    src/flash_ram.h
+ * @brief   RAM emulation of a flash device.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _FLASH_RAM_H_
+#define _FLASH_RAM_H_
+
+#include "flash_dev.h"
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Emulated flash, backed by a caller supplied buffer.
+ */
+typedef struct {
+    FlashDevice dev;
+    uint8_t *mem;
+    uint32_t erases;        /**< Sector erases performed.                  */
+    uint32_t programs;      /**< Program calls performed.                  */
+} FlashRam;
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void flash_ram_init(FlashRam *frp, uint8_t *mem, uint32_t size,
+                      uint32_t sectorSize);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FLASH_RAM_H_ */
+
+/** @} */
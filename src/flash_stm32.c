@@ -0,0 +1,263 @@
+/**
+ * @file    src/flash_stm32.c
+ * @brief   Internal flash of the STM32F1 and STM32F4.
+ * @details Register level erase and program, only called from the low
+ *          priority flash log thread. The CPU stalls on code fetches while
+ *          the flash is busy, a sector erase takes up to 2 s on the F4.
+ *          The wait for the flash therefore runs from RAM with the system
+ *          locked, so nothing is fetched from flash, and moves frames out
+ *          of the CAN receive FIFOs into a RAM hold while it polls. The
+ *          receiver takes them from there afterwards. Other interrupts
+ *          are held off until the flash is idle again.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include <string.h>
+
+#include "flash_stm32.h"
+#include "timestamp.h"
+
+/*
+ * Runs from RAM, the ChibiOS linker rules place .ramtext in .data.
+ */
+#define FLASH_RAMFUNC                                                       \
+    __attribute__((section(".ramtext"), noinline, long_call))
+
+#define FLASH_KEY1                  0x45670123U
+#define FLASH_KEY2                  0xCDEF89ABU
+
+#if defined(STM32F1XX)
+#define FLASH_SR_ERRORS             (FLASH_SR_PGERR | FLASH_SR_WRPRTERR)
+#elif defined(STM32F4XX)
+#define FLASH_SR_ERRORS             (FLASH_SR_PGSERR | FLASH_SR_PGPERR |    \
+                                     FLASH_SR_PGAERR | FLASH_SR_WRPERR)
+#else
+#error "flash_stm32 supports STM32F1 and STM32F4 only"
+#endif
+
+static void flash_unlock(void)
+{
+    if ((FLASH->CR & FLASH_CR_LOCK) != 0)
+    {
+        FLASH->KEYR = FLASH_KEY1;
+        FLASH->KEYR = FLASH_KEY2;
+    }
+}
+
+static void flash_lock(void)
+{
+    FLASH->CR |= FLASH_CR_LOCK;
+}
+
+/*
+ * Waits for the current operation, returns false on a reported error.
+ * Called with the system locked, touches nothing in flash.
+ */
+FLASH_RAMFUNC static bool flash_wait(FlashStm32 *fsp)
+{
+    CAN_TypeDef *can = fsp->can;
+
+    while ((FLASH->SR & FLASH_SR_BSY) != 0)
+    {
+        if (can == NULL)
+            continue;
+
+        for (uint32_t fifo = 0; fifo < 2; fifo++)
+        {
+            volatile uint32_t *rfr = fifo == 0 ? &can->RF0R : &can->RF1R;
+
+            if ((*rfr & CAN_RF0R_FMP0) == 0)
+                continue;
+
+            if (fsp->holdCount < FLASH_STM32_HOLD_FRAMES)
+            {
+                uint32_t slot = fsp->holdHead + fsp->holdCount;
+                FlashStm32Held *hp;
+
+                if (slot >= FLASH_STM32_HOLD_FRAMES)
+                    slot -= FLASH_STM32_HOLD_FRAMES;
+                hp = &fsp->hold[slot];
+                hp->rir = can->sFIFOMailBox[fifo].RIR;
+                hp->rdtr = can->sFIFOMailBox[fifo].RDTR;
+                hp->rdlr = can->sFIFOMailBox[fifo].RDLR;
+                hp->rdhr = can->sFIFOMailBox[fifo].RDHR;
+                hp->cycles = DWT->CYCCNT;
+                fsp->holdCount++;
+                fsp->held++;
+            }
+            else
+            {
+                fsp->holdLost++;
+            }
+            /* Release the mailbox. Like the driver's receive, interrupts
+               are enabled again once the FIFO is empty.*/
+            *rfr = CAN_RF0R_RFOM0;
+            if ((*rfr & CAN_RF0R_FMP0) == 0)
+                can->IER |= fifo == 0 ? CAN_IER_FMPIE0 : CAN_IER_FMPIE1;
+        }
+    }
+
+    if ((FLASH->SR & FLASH_SR_ERRORS) != 0)
+    {
+        FLASH->SR = FLASH_SR_ERRORS;
+        return false;
+    }
+
+    return true;
+}
+
+static bool stm32_erase(const FlashDevice *fdp, uint32_t offset)
+{
+    FlashStm32 *fsp = (FlashStm32 *)fdp;
+    bool ok;
+
+    if (offset >= fdp->size)
+        return false;
+
+    chSysLock();
+    flash_unlock();
+    (void)flash_wait(fsp);
+#if defined(STM32F1XX)
+    FLASH->CR |= FLASH_CR_PER;
+    FLASH->AR = fsp->base + offset - offset % fdp->sectorSize;
+    FLASH->CR |= FLASH_CR_STRT;
+    ok = flash_wait(fsp);
+    FLASH->CR &= ~FLASH_CR_PER;
+#else
+    uint32_t sector = fsp->firstSector + offset / fdp->sectorSize;
+
+    FLASH->CR &= ~(FLASH_CR_SNB | FLASH_CR_PSIZE);
+    FLASH->CR |= FLASH_CR_SER | (sector << 3) | FLASH_CR_PSIZE_1;
+    FLASH->CR |= FLASH_CR_STRT;
+    ok = flash_wait(fsp);
+    FLASH->CR &= ~(FLASH_CR_SER | FLASH_CR_SNB);
+#endif
+    flash_lock();
+    chSysUnlock();
+
+    return ok;
+}
+
+static bool stm32_program(const FlashDevice *fdp, uint32_t offset,
+                          const void *data, size_t n)
+{
+    FlashStm32 *fsp = (FlashStm32 *)fdp;
+    const uint8_t *src = data;
+    bool ok = true;
+
+    if ((offset % 4) != 0 || (n % 4) != 0 || offset + n > fdp->size)
+        return false;
+
+    /* The lock is taken per word, a word programs in tens of
+       microseconds.*/
+    chSysLock();
+    flash_unlock();
+    (void)flash_wait(fsp);
+    chSysUnlock();
+#if defined(STM32F1XX)
+    /* The F1 programs half words.*/
+    FLASH->CR |= FLASH_CR_PG;
+    for (size_t i = 0; i < n && ok; i += 2)
+    {
+        uint16_t half;
+
+        memcpy(&half, &src[i], 2);
+        chSysLock();
+        *(volatile uint16_t *)(fsp->base + offset + i) = half;
+        ok = flash_wait(fsp);
+        chSysUnlock();
+    }
+    FLASH->CR &= ~FLASH_CR_PG;
+#else
+    FLASH->CR &= ~FLASH_CR_PSIZE;
+    FLASH->CR |= FLASH_CR_PG | FLASH_CR_PSIZE_1;
+    for (size_t i = 0; i < n && ok; i += 4)
+    {
+        uint32_t word;
+
+        memcpy(&word, &src[i], 4);
+        chSysLock();
+        *(volatile uint32_t *)(fsp->base + offset + i) = word;
+        ok = flash_wait(fsp);
+        chSysUnlock();
+    }
+    FLASH->CR &= ~FLASH_CR_PG;
+#endif
+    flash_lock();
+
+    return ok;
+}
+
+static void stm32_read(const FlashDevice *fdp, uint32_t offset, void *data,
+                       size_t n)
+{
+    const FlashStm32 *fsp = (const FlashStm32 *)fdp;
+
+    memcpy(data, (const void *)(fsp->base + offset), n);
+}
+
+/**
+ * @brief   Sets up a region of the internal flash.
+ * @details The receive FIFOs of @p can are drained while the flash is
+ *          busy, @p can may be NULL.
+ */
+void flash_stm32_init(FlashStm32 *fsp, uint32_t base, uint32_t size,
+                      uint32_t sectorSize, uint32_t firstSector,
+                      CAN_TypeDef *can)
+{
+    fsp->dev.size = size;
+    fsp->dev.sectorSize = sectorSize;
+    fsp->dev.erase = stm32_erase;
+    fsp->dev.program = stm32_program;
+    fsp->dev.read = stm32_read;
+    fsp->base = base;
+    fsp->firstSector = firstSector;
+    fsp->can = can;
+    fsp->holdHead = 0;
+    fsp->holdCount = 0;
+    fsp->held = 0;
+    fsp->holdLost = 0;
+}
+
+/**
+ * @brief   Returns the oldest frame drained while the flash was busy.
+ * @details @p ageUs is set to the time since its reception.
+ *
+ * @return  false if no frame is held.
+ */
+bool flash_stm32_take(FlashStm32 *fsp, CANRxFrame *frame, uint32_t *ageUs)
+{
+    FlashStm32Held held;
+
+    chSysLock();
+    if (fsp->holdCount == 0)
+    {
+        chSysUnlock();
+        return false;
+    }
+    held = fsp->hold[fsp->holdHead];
+    fsp->holdHead = (fsp->holdHead + 1) % FLASH_STM32_HOLD_FRAMES;
+    fsp->holdCount--;
+    *ageUs = (uint32_t)(chSysGetRealtimeCounterX() - held.cycles)
+            / TIMESTAMP_CYCLES_PER_US;
+    chSysUnlock();
+
+    /* Same decoding as the CAN driver.*/
+    frame->data32[0] = held.rdlr;
+    frame->data32[1] = held.rdhr;
+    frame->RTR = (held.rir & CAN_RI0R_RTR) >> 1;
+    frame->IDE = (held.rir & CAN_RI0R_IDE) >> 2;
+    if (frame->IDE)
+        frame->EID = held.rir >> 3;
+    else
+        frame->SID = held.rir >> 21;
+    frame->DLC = held.rdtr & CAN_RDT0R_DLC;
+    frame->FMI = (uint8_t)(held.rdtr >> 8);
+    frame->TIME = (uint16_t)(held.rdtr >> 16);
+
+    return true;
+}
+
+/** @} */
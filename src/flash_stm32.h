@@ -0,0 +1,81 @@
+/**
+ * @file    src/flash_stm32.h
+ * @brief   Internal flash of the STM32F1 and STM32F4.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _FLASH_STM32_H_
+#define _FLASH_STM32_H_
+
+#include "ch.h"
+#include "hal.h"
+
+#include "flash_dev.h"
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Frames taken off the CAN controller while the flash is busy.
+ */
+#if !defined(FLASH_STM32_HOLD_FRAMES) || defined(__DOXYGEN__)
+#define FLASH_STM32_HOLD_FRAMES     32
+#endif
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   A frame as read from a receive FIFO mailbox.
+ */
+typedef struct {
+    uint32_t rir;
+    uint32_t rdtr;
+    uint32_t rdlr;
+    uint32_t rdhr;
+    uint32_t cycles;        /**< Realtime counter at reception.            */
+} FlashStm32Held;
+
+/**
+ * @brief   A region of the internal flash.
+ * @details On the F1 sectors are the 1 KB (or 2 KB) pages. On the F4 the
+ *          region must consist of equally sized sectors, @p firstSector is
+ *          the number of the sector at @p base.
+ *          While the flash is busy the receive FIFOs of @p can are moved
+ *          into @p hold, @p flash_stm32_take() returns the frames.
+ */
+typedef struct {
+    FlashDevice dev;
+    uint32_t base;
+    uint32_t firstSector;
+    CAN_TypeDef *can;       /**< Drained while busy, NULL for none.        */
+    FlashStm32Held hold[FLASH_STM32_HOLD_FRAMES];
+    uint16_t holdHead;
+    uint16_t holdCount;
+    uint32_t held;          /**< Frames taken while the flash was busy.    */
+    uint32_t holdLost;      /**< Frames lost, the hold was full.           */
+} FlashStm32;
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void flash_stm32_init(FlashStm32 *fsp, uint32_t base, uint32_t size,
+                        uint32_t sectorSize, uint32_t firstSector,
+                        CAN_TypeDef *can);
+  bool flash_stm32_take(FlashStm32 *fsp, CANRxFrame *frame,
+                        uint32_t *ageUs);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FLASH_STM32_H_ */
+
+/** @} */
@@ -0,0 +1,606 @@
+/**
+ * @file    src/gs_usb.c
+ * @brief   gs_usb (candleLight) protocol core.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include "gs_usb.h"
+
+#include <string.h>
+
+#define USB_DESC_TYPE_DEVICE            1
+#define USB_DESC_TYPE_CONFIGURATION     2
+#define USB_DESC_TYPE_STRING            3
+#define USB_DESC_TYPE_INTERFACE         4
+#define USB_DESC_TYPE_ENDPOINT          5
+
+#define USB_REQ_TYPE_MASK               0x7F
+#define USB_REQ_VENDOR_INTERFACE        0x41
+#define USB_REQ_DIR_IN                  0x80
+
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void in_kickI(GsUsb *gsp)
+{
+    if (gsp->in_busy || gsp->in_count == 0)
+    {
+        return;
+    }
+
+    const GsHostFrame *frame = &gsp->in_queue[gsp->in_head];
+    size_t n = gs_usb_frame_pack(gsp->in_buf, frame,
+            (gsp->mode_flags & GS_CAN_MODE_HW_TIMESTAMP) != 0);
+    bool echo = frame->echo_id != GS_HOST_FRAME_ECHO_RX;
+
+    gsp->in_head = (uint16_t)((gsp->in_head + 1) % GS_USB_IN_QUEUE_SIZE);
+    gsp->in_count--;
+    gsp->in_busy = true;
+    gsp->config->ep_start_in(gsp->config->arg, gsp->in_buf, n);
+
+    /* The echo left the queue, its slot takes the next host frame.*/
+    if (echo && gsp->tx_held > 0)
+    {
+        gsp->tx_held--;
+        gs_usb_tx_resumeI(gsp);
+    }
+}
+
+/*
+ * Hands the received host frame to the controller if an echo slot is
+ * free for it.
+ */
+static bool tx_takeI(GsUsb *gsp)
+{
+    const GsUsbConfig *cfg = gsp->config;
+
+    if (gsp->tx_held >= GS_USB_ECHO_RESERVE ||
+        !cfg->can_transmit(cfg->arg, &gsp->tx_frame))
+    {
+        return false;
+    }
+
+    gsp->tx_held++;
+    gsp->tx_frames++;
+
+    return true;
+}
+
+static GsHostFrame *in_allocI(GsUsb *gsp)
+{
+    uint16_t tail = (uint16_t)((gsp->in_head + gsp->in_count) %
+            GS_USB_IN_QUEUE_SIZE);
+
+    gsp->in_count++;
+    return &gsp->in_queue[tail];
+}
+
+static void out_armI(GsUsb *gsp)
+{
+    if (gsp->out_armed || gsp->tx_pending)
+    {
+        return;
+    }
+
+    gsp->out_armed = true;
+    gsp->config->ep_start_out(gsp->config->arg, gsp->out_buf,
+            sizeof(gsp->out_buf));
+}
+
+static void channel_resetI(GsUsb *gsp)
+{
+    if (gsp->state == GS_USB_STARTED)
+    {
+        gsp->config->can_reset(gsp->config->arg);
+    }
+
+    gsp->state = GS_USB_RESET;
+    gsp->in_count = 0;
+    gsp->overflow_pending = false;
+    gsp->tx_pending = false;
+    gsp->tx_held = 0;
+}
+
+/**
+ * @brief   Writes the device descriptor.
+ *
+ * @return  Descriptor size, 0 if @p size is too small.
+ */
+size_t gs_usb_device_descriptor(uint8_t *buf, size_t size)
+{
+    if (size < GS_USB_DEVICE_DESC_SIZE)
+    {
+        return 0;
+    }
+
+    buf[0] = GS_USB_DEVICE_DESC_SIZE;
+    buf[1] = USB_DESC_TYPE_DEVICE;
+    put16(&buf[2], 0x0200);             /* bcdUSB.                          */
+    buf[4] = 0x00;                      /* bDeviceClass (per interface).    */
+    buf[5] = 0x00;                      /* bDeviceSubClass.                 */
+    buf[6] = 0x00;                      /* bDeviceProtocol.                 */
+    buf[7] = GS_USB_EP_SIZE;            /* bMaxPacketSize.                  */
+    put16(&buf[8], GS_USB_VENDOR_ID);
+    put16(&buf[10], GS_USB_PRODUCT_ID);
+    put16(&buf[12], 0x0000);            /* bcdDevice.                       */
+    buf[14] = 1;                        /* iManufacturer.                   */
+    buf[15] = 2;                        /* iProduct.                        */
+    buf[16] = 3;                        /* iSerialNumber.                   */
+    buf[17] = 1;                        /* bNumConfigurations.              */
+
+    return GS_USB_DEVICE_DESC_SIZE;
+}
+
+/**
+ * @brief   Writes the configuration descriptor tree.
+ * @details One vendor specific interface with a bulk IN and a bulk OUT
+ *          endpoint.
+ *
+ * @return  Descriptor size, 0 if @p size is too small.
+ */
+size_t gs_usb_config_descriptor(uint8_t *buf, size_t size)
+{
+    if (size < GS_USB_CONFIG_DESC_SIZE)
+    {
+        return 0;
+    }
+
+    /* Configuration Descriptor.*/
+    buf[0] = 9;
+    buf[1] = USB_DESC_TYPE_CONFIGURATION;
+    put16(&buf[2], GS_USB_CONFIG_DESC_SIZE);
+    buf[4] = 1;                         /* bNumInterfaces.                  */
+    buf[5] = 1;                         /* bConfigurationValue.             */
+    buf[6] = 0;                         /* iConfiguration.                  */
+    buf[7] = 0x80;                      /* bmAttributes (bus powered).      */
+    buf[8] = 50;                        /* bMaxPower (100mA).               */
+
+    /* Interface Descriptor.*/
+    buf[9] = 9;
+    buf[10] = USB_DESC_TYPE_INTERFACE;
+    buf[11] = 0;                        /* bInterfaceNumber.                */
+    buf[12] = 0;                        /* bAlternateSetting.               */
+    buf[13] = 2;                        /* bNumEndpoints.                   */
+    buf[14] = 0xFF;                     /* bInterfaceClass (vendor).        */
+    buf[15] = 0xFF;                     /* bInterfaceSubClass.              */
+    buf[16] = 0xFF;                     /* bInterfaceProtocol.              */
+    buf[17] = 0;                        /* iInterface.                      */
+
+    /* Bulk IN Endpoint Descriptor.*/
+    buf[18] = 7;
+    buf[19] = USB_DESC_TYPE_ENDPOINT;
+    buf[20] = GS_USB_EP_IN | 0x80;
+    buf[21] = 0x02;                     /* bmAttributes (Bulk).             */
+    put16(&buf[22], GS_USB_EP_SIZE);
+    buf[24] = 0;                        /* bInterval.                       */
+
+    /* Bulk OUT Endpoint Descriptor.*/
+    buf[25] = 7;
+    buf[26] = USB_DESC_TYPE_ENDPOINT;
+    buf[27] = GS_USB_EP_OUT;
+    buf[28] = 0x02;                     /* bmAttributes (Bulk).             */
+    put16(&buf[29], GS_USB_EP_SIZE);
+    buf[31] = 0;                        /* bInterval.                       */
+
+    return GS_USB_CONFIG_DESC_SIZE;
+}
+
+/**
+ * @brief   Writes a string descriptor from an ASCII string.
+ *
+ * @return  Descriptor size, 0 if @p size is too small.
+ */
+size_t gs_usb_string_descriptor(uint8_t *buf, size_t size, const char *str)
+{
+    size_t len = strlen(str);
+    size_t n = 2 + 2 * len;
+
+    if (n > 255 || size < n)
+    {
+        return 0;
+    }
+
+    buf[0] = (uint8_t)n;
+    buf[1] = USB_DESC_TYPE_STRING;
+    for (size_t i = 0; i < len; i++)
+    {
+        buf[2 + 2 * i] = (uint8_t)str[i];
+        buf[3 + 2 * i] = 0;
+    }
+
+    return n;
+}
+
+/**
+ * @brief   Serializes a frame into its little endian wire format.
+ *
+ * @return  Number of bytes written.
+ */
+size_t gs_usb_frame_pack(uint8_t *buf, const GsHostFrame *frame,
+                         bool timestamp)
+{
+    put32(&buf[0], frame->echo_id);
+    put32(&buf[4], frame->can_id);
+    buf[8] = frame->can_dlc;
+    buf[9] = frame->channel;
+    buf[10] = frame->flags;
+    buf[11] = frame->reserved;
+    memcpy(&buf[12], frame->data, 8);
+
+    if (!timestamp)
+    {
+        return GS_HOST_FRAME_SIZE;
+    }
+
+    put32(&buf[20], frame->timestamp_us);
+    return GS_HOST_FRAME_SIZE_TS;
+}
+
+/**
+ * @brief   Parses a frame from its wire format.
+ *
+ * @return  false if the buffer is too short or the frame is malformed.
+ */
+bool gs_usb_frame_unpack(GsHostFrame *frame, const uint8_t *buf, size_t n)
+{
+    if (n < GS_HOST_FRAME_SIZE)
+    {
+        return false;
+    }
+
+    frame->echo_id = get32(&buf[0]);
+    frame->can_id = get32(&buf[4]);
+    frame->can_dlc = buf[8];
+    frame->channel = buf[9];
+    frame->flags = buf[10];
+    frame->reserved = buf[11];
+    memcpy(frame->data, &buf[12], 8);
+    frame->timestamp_us = n >= GS_HOST_FRAME_SIZE_TS ? get32(&buf[20]) : 0;
+
+    return frame->can_dlc <= 8 && frame->channel == 0;
+}
+
+/**
+ * @brief   Initializes the protocol state.
+ */
+void gs_usb_init(GsUsb *gsp, const GsUsbConfig *config)
+{
+    memset(gsp, 0, sizeof(*gsp));
+    gsp->config = config;
+    gsp->state = GS_USB_RESET;
+}
+
+/**
+ * @brief   The host selected the configuration, endpoints are usable.
+ *
+ * @iclass
+ */
+void gs_usb_configuredI(GsUsb *gsp)
+{
+    channel_resetI(gsp);
+    gsp->in_busy = false;
+    gsp->out_armed = false;
+    out_armI(gsp);
+}
+
+/**
+ * @brief   The bus was reset, suspended or unconfigured.
+ *
+ * @iclass
+ */
+void gs_usb_disconnectedI(GsUsb *gsp)
+{
+    channel_resetI(gsp);
+    gsp->in_busy = false;
+    gsp->out_armed = false;
+}
+
+/**
+ * @brief   Handles the setup stage of a control request.
+ *
+ * @param[in] setup     the 8 byte setup packet
+ * @param[out] buf      buffer for the data stage
+ * @param[out] n        length of the data stage
+ * @return              What the endpoint layer has to do with @p buf.
+ *
+ * @iclass
+ */
+gsusbctrl_t gs_usb_control_setupI(GsUsb *gsp, const uint8_t *setup,
+                                  uint8_t **buf, size_t *n)
+{
+    const GsUsbConfig *cfg = gsp->config;
+    uint16_t wValue = (uint16_t)(setup[2] | (setup[3] << 8));
+    uint16_t wLength = (uint16_t)(setup[6] | (setup[7] << 8));
+    size_t len;
+
+    if ((setup[0] & USB_REQ_TYPE_MASK) != USB_REQ_VENDOR_INTERFACE)
+    {
+        return GS_USB_CTRL_UNHANDLED;
+    }
+
+    /* wValue is the channel of the per-channel requests, only channel 0
+       exists. Host format and device config are not per channel, the
+       kernel sends them with wValue 1.*/
+    if (setup[1] != GS_USB_BREQ_HOST_FORMAT &&
+        setup[1] != GS_USB_BREQ_DEVICE_CONFIG && wValue != 0)
+    {
+        return GS_USB_CTRL_UNHANDLED;
+    }
+
+    gsp->ctrl_request = setup[1];
+    memset(gsp->ctrl_buf, 0, sizeof(gsp->ctrl_buf));
+
+    if ((setup[0] & USB_REQ_DIR_IN) == 0)
+    {
+        switch (setup[1])
+        {
+        case GS_USB_BREQ_HOST_FORMAT:
+        case GS_USB_BREQ_BERR:
+        case GS_USB_BREQ_IDENTIFY:
+            len = 4;
+            break;
+        case GS_USB_BREQ_MODE:
+            len = 8;
+            break;
+        case GS_USB_BREQ_BITTIMING:
+            len = 20;
+            break;
+        default:
+            return GS_USB_CTRL_UNHANDLED;
+        }
+        *buf = gsp->ctrl_buf;
+        *n = wLength < len ? wLength : len;
+        return GS_USB_CTRL_OUT;
+    }
+
+    switch (setup[1])
+    {
+    case GS_USB_BREQ_BT_CONST:
+        put32(&gsp->ctrl_buf[0], GS_CAN_FEATURES);
+        put32(&gsp->ctrl_buf[4], cfg->bt_const->fclk_can);
+        put32(&gsp->ctrl_buf[8], cfg->bt_const->tseg1_min);
+        put32(&gsp->ctrl_buf[12], cfg->bt_const->tseg1_max);
+        put32(&gsp->ctrl_buf[16], cfg->bt_const->tseg2_min);
+        put32(&gsp->ctrl_buf[20], cfg->bt_const->tseg2_max);
+        put32(&gsp->ctrl_buf[24], cfg->bt_const->sjw_max);
+        put32(&gsp->ctrl_buf[28], cfg->bt_const->brp_min);
+        put32(&gsp->ctrl_buf[32], cfg->bt_const->brp_max);
+        put32(&gsp->ctrl_buf[36], cfg->bt_const->brp_inc);
+        len = 40;
+        break;
+    case GS_USB_BREQ_DEVICE_CONFIG:
+        /* reserved1..3 and icount (channels - 1) stay zero.*/
+        put32(&gsp->ctrl_buf[4], cfg->sw_version);
+        put32(&gsp->ctrl_buf[8], cfg->hw_version);
+        len = 12;
+        break;
+    case GS_USB_BREQ_TIMESTAMP:
+        put32(&gsp->ctrl_buf[0], cfg->timestamp(cfg->arg));
+        len = 4;
+        break;
+    case GS_USB_BREQ_GET_STATE:
+        if (cfg->get_state != NULL)
+        {
+            uint32_t state, rxerr, txerr;
+            cfg->get_state(cfg->arg, &state, &rxerr, &txerr);
+            put32(&gsp->ctrl_buf[0], state);
+            put32(&gsp->ctrl_buf[4], rxerr);
+            put32(&gsp->ctrl_buf[8], txerr);
+        }
+        len = 12;
+        break;
+    default:
+        return GS_USB_CTRL_UNHANDLED;
+    }
+
+    *buf = gsp->ctrl_buf;
+    *n = wLength < len ? wLength : len;
+    return GS_USB_CTRL_IN;
+}
+
+/**
+ * @brief   The data stage of a host to device request has completed.
+ *
+ * @iclass
+ */
+void gs_usb_control_completeI(GsUsb *gsp)
+{
+    const GsUsbConfig *cfg = gsp->config;
+    const uint8_t *p = gsp->ctrl_buf;
+
+    switch (gsp->ctrl_request)
+    {
+    case GS_USB_BREQ_BITTIMING:
+        gsp->bittiming.prop_seg = get32(&p[0]);
+        gsp->bittiming.phase_seg1 = get32(&p[4]);
+        gsp->bittiming.phase_seg2 = get32(&p[8]);
+        gsp->bittiming.sjw = get32(&p[12]);
+        gsp->bittiming.brp = get32(&p[16]);
+        break;
+    case GS_USB_BREQ_MODE:
+        if (get32(&p[0]) == GS_CAN_MODE_START)
+        {
+            uint32_t flags = get32(&p[4]) & GS_CAN_FEATURES;
+
+            channel_resetI(gsp);
+            if (cfg->can_start(cfg->arg, &gsp->bittiming, flags))
+            {
+                gsp->mode_flags = flags;
+                gsp->state = GS_USB_STARTED;
+            }
+        }
+        else
+        {
+            channel_resetI(gsp);
+        }
+        out_armI(gsp);
+        break;
+    case GS_USB_BREQ_IDENTIFY:
+        if (cfg->identify != NULL)
+        {
+            cfg->identify(cfg->arg, get32(&p[0]) != 0);
+        }
+        break;
+    default:
+        /* Host format and error reporting need no action.*/
+        break;
+    }
+}
+
+/**
+ * @brief   Queues a received CAN frame for the host.
+ *
+ * @param[in] can_id    identifier with @p GS_CAN_*_FLAG bits
+ * @return              false if the channel is stopped or the queue is full.
+ *
+ * @iclass
+ */
+bool gs_usb_post_rxI(GsUsb *gsp, uint32_t can_id, uint8_t dlc,
+                     const uint8_t *data, uint32_t timestamp)
+{
+    if (gsp->state != GS_USB_STARTED)
+    {
+        return false;
+    }
+
+    if (gsp->in_count >= GS_USB_IN_QUEUE_SIZE - GS_USB_ECHO_RESERVE)
+    {
+        gsp->rx_overflows++;
+        gsp->overflow_pending = true;
+        return false;
+    }
+
+    GsHostFrame *frame = in_allocI(gsp);
+    frame->echo_id = GS_HOST_FRAME_ECHO_RX;
+    frame->can_id = can_id;
+    frame->can_dlc = dlc;
+    frame->channel = 0;
+    frame->flags = gsp->overflow_pending ? GS_CAN_FLAG_OVERFLOW : 0;
+    frame->reserved = 0;
+    memcpy(frame->data, data, 8);
+    frame->timestamp_us = timestamp;
+
+    gsp->overflow_pending = false;
+    gsp->rx_frames++;
+    in_kickI(gsp);
+
+    return true;
+}
+
+/**
+ * @brief   Reports the end of a host frame back to the host.
+ * @details The echo is what frees the echo id on the host, a frame that
+ *          failed is echoed as well, after an error frame that tells why.
+ *          The error frame may be dropped like a received frame, the echo
+ *          has its slot reserved since the frame was taken.
+ *
+ * @param[in] timestamp end of the transmission
+ * @param[in] error     zero if the frame was sent, else the SocketCAN
+ *                      error class, @p GS_CAN_ERR_*
+ * @return              false if the channel was reset meanwhile.
+ *
+ * @iclass
+ */
+bool gs_usb_post_echoI(GsUsb *gsp, const GsHostFrame *frame,
+                       uint32_t timestamp, uint32_t error)
+{
+    if (gsp->state != GS_USB_STARTED || gsp->in_count >= GS_USB_IN_QUEUE_SIZE)
+    {
+        return false;
+    }
+
+    if (error != 0)
+    {
+        uint8_t data[8] = {0};
+
+        if ((error & GS_CAN_ERR_PROT) != 0)
+            data[2] = GS_CAN_ERR_PROT_TX;
+        gsp->tx_errors++;
+        (void)gs_usb_post_rxI(gsp, GS_CAN_ERR_FLAG | error, 8, data,
+                              timestamp);
+    }
+
+    GsHostFrame *echo = in_allocI(gsp);
+    *echo = *frame;
+    echo->timestamp_us = timestamp;
+
+    gsp->tx_echoes++;
+    in_kickI(gsp);
+
+    return true;
+}
+
+/**
+ * @brief   The IN endpoint finished a transfer.
+ *
+ * @iclass
+ */
+void gs_usb_in_completeI(GsUsb *gsp)
+{
+    gsp->in_busy = false;
+    in_kickI(gsp);
+}
+
+/**
+ * @brief   The OUT endpoint received @p n bytes.
+ * @details The frame is handed to @p can_transmit. If no transmit or echo
+ *          slot is free the endpoint stays disarmed, so the host is
+ *          throttled by NAKs until @p gs_usb_tx_resumeI() is called.
+ *          Echo slots free themselves as the echoes are sent.
+ *
+ * @iclass
+ */
+void gs_usb_out_completeI(GsUsb *gsp, size_t n)
+{
+    gsp->out_armed = false;
+
+    if (gsp->state == GS_USB_STARTED &&
+        gs_usb_frame_unpack(&gsp->tx_frame, gsp->out_buf, n) &&
+        !tx_takeI(gsp))
+    {
+        gsp->tx_pending = true;
+    }
+
+    out_armI(gsp);
+}
+
+/**
+ * @brief   A transmit slot became free.
+ *
+ * @iclass
+ */
+void gs_usb_tx_resumeI(GsUsb *gsp)
+{
+    if (!gsp->tx_pending)
+    {
+        return;
+    }
+
+    if (gsp->state != GS_USB_STARTED || tx_takeI(gsp))
+    {
+        gsp->tx_pending = false;
+    }
+
+    out_armI(gsp);
+}
+
+/** @} */
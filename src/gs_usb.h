@@ -0,0 +1,321 @@
+/**
+ * @file    src/gs_usb.h
+ * @brief   gs_usb (candleLight) protocol core.
+ * @details Implements the device side of the protocol spoken by the Linux
+ *          @p gs_usb driver: descriptor generation, the vendor control
+ *          requests, the channel state machine and the bulk frame queue.
+ *          The USB endpoint layer and the CAN controller are reached
+ *          through @p GsUsbConfig.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _GS_USB_H_
+#define _GS_USB_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/**
+ * @name    USB identification
+ * @details VID/PID pair of the candleLight firmware, matched by the
+ *          Linux @p gs_usb driver.
+ * @{
+ */
+#define GS_USB_VENDOR_ID                0x1D50
+#define GS_USB_PRODUCT_ID               0x606F
+/** @} */
+
+/**
+ * @name    Endpoints
+ * @{
+ */
+#define GS_USB_EP_IN                    1
+#define GS_USB_EP_OUT                   2
+#define GS_USB_EP_SIZE                  64
+/** @} */
+
+/**
+ * @name    Vendor control requests
+ * @{
+ */
+#define GS_USB_BREQ_HOST_FORMAT         0
+#define GS_USB_BREQ_BITTIMING           1
+#define GS_USB_BREQ_MODE                2
+#define GS_USB_BREQ_BERR                3
+#define GS_USB_BREQ_BT_CONST            4
+#define GS_USB_BREQ_DEVICE_CONFIG       5
+#define GS_USB_BREQ_TIMESTAMP           6
+#define GS_USB_BREQ_IDENTIFY            7
+#define GS_USB_BREQ_GET_STATE           14
+/** @} */
+
+/**
+ * @name    Channel modes
+ * @{
+ */
+#define GS_CAN_MODE_RESET               0
+#define GS_CAN_MODE_START               1
+/** @} */
+
+/**
+ * @name    Mode flags and features
+ * @{
+ */
+#define GS_CAN_MODE_LISTEN_ONLY         (1U << 0)
+#define GS_CAN_MODE_LOOP_BACK           (1U << 1)
+#define GS_CAN_MODE_TRIPLE_SAMPLE       (1U << 2)
+#define GS_CAN_MODE_ONE_SHOT            (1U << 3)
+#define GS_CAN_MODE_HW_TIMESTAMP        (1U << 4)
+#define GS_CAN_MODE_IDENTIFY            (1U << 5)
+
+#define GS_CAN_FEATURES                 (GS_CAN_MODE_LISTEN_ONLY |          \
+                                         GS_CAN_MODE_LOOP_BACK |            \
+                                         GS_CAN_MODE_ONE_SHOT |             \
+                                         GS_CAN_MODE_HW_TIMESTAMP)
+/** @} */
+
+/**
+ * @name    Frame fields
+ * @{
+ */
+#define GS_CAN_EFF_FLAG                 0x80000000U
+#define GS_CAN_RTR_FLAG                 0x40000000U
+#define GS_CAN_ERR_FLAG                 0x20000000U
+#define GS_CAN_EFF_MASK                 0x1FFFFFFFU
+#define GS_CAN_SFF_MASK                 0x000007FFU
+
+#define GS_CAN_FLAG_OVERFLOW            (1U << 0)
+
+#define GS_CAN_ERR_TX_TIMEOUT           0x00000001U
+#define GS_CAN_ERR_PROT                 0x00000008U
+#define GS_CAN_ERR_BUSOFF               0x00000040U
+#define GS_CAN_ERR_PROT_TX              0x80U
+
+#define GS_HOST_FRAME_ECHO_RX           0xFFFFFFFFU
+/** @} */
+
+/**
+ * @name    Wire sizes
+ * @{
+ */
+#define GS_HOST_FRAME_SIZE              20
+#define GS_HOST_FRAME_SIZE_TS           24
+#define GS_HOST_CONFIG_BYTE_ORDER       0x0000BEEFU
+/** @} */
+
+/**
+ * @name    Descriptor sizes
+ * @{
+ */
+#define GS_USB_DEVICE_DESC_SIZE         18
+#define GS_USB_CONFIG_DESC_SIZE         32
+/** @} */
+
+/**
+ * @brief   Results of @p gs_usb_control_setupI().
+ */
+typedef enum {
+  GS_USB_CTRL_UNHANDLED = 0,        /**< Not a gs_usb request, stall.      */
+  GS_USB_CTRL_IN,                   /**< Send the returned buffer.         */
+  GS_USB_CTRL_OUT                   /**< Receive into the returned buffer. */
+} gsusbctrl_t;
+
+/**
+ * @brief   Channel states.
+ */
+typedef enum {
+  GS_USB_RESET = 0,
+  GS_USB_STARTED
+} gsusbstate_t;
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Depth of the device to host frame queue.
+ */
+#if !defined(GS_USB_IN_QUEUE_SIZE) || defined(__DOXYGEN__)
+#define GS_USB_IN_QUEUE_SIZE            32
+#endif
+
+/**
+ * @brief   Queue slots only usable by TX echo frames.
+ * @details The host keeps a bounded number of echo ids in flight, a lost
+ *          echo stalls its transmit queue. Each host frame taken holds a
+ *          slot until its echo is on the way, so at most this many frames
+ *          are in the device and every echo finds room. Received frames
+ *          are dropped before echoes are.
+ */
+#if !defined(GS_USB_ECHO_RESERVE) || defined(__DOXYGEN__)
+#define GS_USB_ECHO_RESERVE             8
+#endif
+
+/*===========================================================================*/
+/* Derived constants and error checks.                                       */
+/*===========================================================================*/
+
+#if GS_USB_ECHO_RESERVE >= GS_USB_IN_QUEUE_SIZE
+#error "GS_USB_ECHO_RESERVE must be smaller than GS_USB_IN_QUEUE_SIZE"
+#endif
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   A frame as exchanged over the bulk endpoints.
+ * @note    Kept in native layout, @p gs_usb_frame_pack() and
+ *          @p gs_usb_frame_unpack() handle the little endian wire format.
+ */
+typedef struct {
+    uint32_t echo_id;
+    uint32_t can_id;
+    uint8_t can_dlc;
+    uint8_t channel;
+    uint8_t flags;
+    uint8_t reserved;
+    uint8_t data[8];
+    uint32_t timestamp_us;
+} GsHostFrame;
+
+/**
+ * @brief   Bit timing as requested by the host.
+ */
+typedef struct {
+    uint32_t prop_seg;
+    uint32_t phase_seg1;
+    uint32_t phase_seg2;
+    uint32_t sjw;
+    uint32_t brp;
+} GsDeviceBittiming;
+
+/**
+ * @brief   Bit timing limits of the CAN controller.
+ */
+typedef struct {
+    uint32_t fclk_can;
+    uint32_t tseg1_min;
+    uint32_t tseg1_max;
+    uint32_t tseg2_min;
+    uint32_t tseg2_max;
+    uint32_t sjw_max;
+    uint32_t brp_min;
+    uint32_t brp_max;
+    uint32_t brp_inc;
+} GsDeviceBtConst;
+
+/**
+ * @brief   Bindings of the protocol core.
+ * @note    All callbacks are invoked from the same context as the core
+ *          function that triggers them, usually with the system locked.
+ *          They must not block.
+ */
+typedef struct {
+    void *arg;
+    /** Arms the IN endpoint with @p n bytes from @p buf.*/
+    void (*ep_start_in)(void *arg, const uint8_t *buf, size_t n);
+    /** Arms the OUT endpoint to receive up to @p n bytes into @p buf.*/
+    void (*ep_start_out)(void *arg, uint8_t *buf, size_t n);
+    /** Starts the controller with the given timing and mode flags.*/
+    bool (*can_start)(void *arg, const GsDeviceBittiming *bt, uint32_t flags);
+    /** Returns the controller to reset state.*/
+    void (*can_reset)(void *arg);
+    /** Queues a host frame for transmission, false if no slot is free.*/
+    bool (*can_transmit)(void *arg, const GsHostFrame *frame);
+    /** Returns the current timestamp in microseconds.*/
+    uint32_t (*timestamp)(void *arg);
+    /** Optional, turns the identify indication on or off.*/
+    void (*identify)(void *arg, bool on);
+    /** Optional, fills state, rx and tx error counters.*/
+    void (*get_state)(void *arg, uint32_t *state, uint32_t *rxerr,
+                      uint32_t *txerr);
+    const GsDeviceBtConst *bt_const;
+    uint32_t sw_version;
+    uint32_t hw_version;
+} GsUsbConfig;
+
+/**
+ * @brief   gs_usb protocol state.
+ */
+typedef struct {
+    const GsUsbConfig *config;
+    gsusbstate_t state;
+    uint32_t mode_flags;
+    GsDeviceBittiming bittiming;
+    /* Control transfers.*/
+    uint8_t ctrl_request;
+    uint8_t ctrl_buf[40];
+    /* Device to host queue.*/
+    GsHostFrame in_queue[GS_USB_IN_QUEUE_SIZE];
+    uint16_t in_head;
+    uint16_t in_count;
+    bool in_busy;
+    bool overflow_pending;
+    uint8_t in_buf[GS_HOST_FRAME_SIZE_TS];
+    /* Host to device.*/
+    uint8_t out_buf[GS_USB_EP_SIZE];
+    bool out_armed;
+    bool tx_pending;
+    uint16_t tx_held;                   /**< Echo slots held, see
+                                             @p GS_USB_ECHO_RESERVE.       */
+    GsHostFrame tx_frame;
+    /* Statistics.*/
+    uint32_t rx_frames;
+    uint32_t rx_overflows;
+    uint32_t tx_frames;
+    uint32_t tx_echoes;
+    uint32_t tx_errors;
+} GsUsb;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/**
+ * @brief   Size of a bulk frame in the current mode.
+ */
+#define gs_usb_frame_size(gsp)                                              \
+    (((gsp)->mode_flags & GS_CAN_MODE_HW_TIMESTAMP) != 0 ?                  \
+     GS_HOST_FRAME_SIZE_TS : GS_HOST_FRAME_SIZE)
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  size_t gs_usb_device_descriptor(uint8_t *buf, size_t size);
+  size_t gs_usb_config_descriptor(uint8_t *buf, size_t size);
+  size_t gs_usb_string_descriptor(uint8_t *buf, size_t size, const char *str);
+  size_t gs_usb_frame_pack(uint8_t *buf, const GsHostFrame *frame,
+                           bool timestamp);
+  bool gs_usb_frame_unpack(GsHostFrame *frame, const uint8_t *buf, size_t n);
+  void gs_usb_init(GsUsb *gsp, const GsUsbConfig *config);
+  void gs_usb_configuredI(GsUsb *gsp);
+  void gs_usb_disconnectedI(GsUsb *gsp);
+  gsusbctrl_t gs_usb_control_setupI(GsUsb *gsp, const uint8_t *setup,
+                                    uint8_t **buf, size_t *n);
+  void gs_usb_control_completeI(GsUsb *gsp);
+  bool gs_usb_post_rxI(GsUsb *gsp, uint32_t can_id, uint8_t dlc,
+                       const uint8_t *data, uint32_t timestamp);
+  bool gs_usb_post_echoI(GsUsb *gsp, const GsHostFrame *frame,
+                         uint32_t timestamp, uint32_t error);
+  void gs_usb_in_completeI(GsUsb *gsp);
+  void gs_usb_out_completeI(GsUsb *gsp, size_t n);
+  void gs_usb_tx_resumeI(GsUsb *gsp);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _GS_USB_H_ */
+
+/** @} */
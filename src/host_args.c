@@ -0,0 +1,170 @@
+/**
+ * @file    src/host_args.c
+ * @brief   Arguments of the host commands.
+ * @details Numbers are decimal, or hexadecimal with 0x, and must fit 32
+ *          bits. Data bytes are given as one hex string. The binary form
+ *          of a command arrives as the same text, see host_command.c.
+ *          The simulated device of canbench parses with these functions
+ *          as well.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_args.h"
+#include "can_record.h"
+
+static int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+
+    return -1;
+}
+
+/**
+ * @brief   Splits a line in place at blanks.
+ *
+ * @param[in] max       Size of @p argv.
+ * @return              The word count, -1 if there are more than @p max.
+ */
+int host_args_split(char *line, char *argv[], int max)
+{
+    int argc = 0;
+    char *p = line;
+
+    while (true)
+    {
+        while (*p == ' ' || *p == '\t')
+            *p++ = '\0';
+        if (*p == '\0')
+            return argc;
+        if (argc >= max)
+            return -1;
+        argv[argc++] = p;
+        while (*p != '\0' && *p != ' ' && *p != '\t')
+            p++;
+    }
+}
+
+/**
+ * @brief   An unsigned number, false if it does not fit 32 bits.
+ */
+bool host_args_u32(const char *s, uint32_t *value)
+{
+    unsigned long word;
+    char *end;
+
+    if (s[0] == '\0' || s[0] == '-')
+        return false;
+    errno = 0;
+    word = strtoul(s, &end, 0);
+    if (errno == ERANGE || word > UINT32_MAX)
+        return false;
+    *value = (uint32_t)word;
+
+    return *end == '\0';
+}
+
+/**
+ * @brief   A signed number, the binary form sends it as a 32 bit two's
+ *          complement.
+ */
+bool host_args_i32(const char *s, int32_t *value)
+{
+    uint32_t word;
+    long number;
+    char *end;
+
+    if (s[0] != '-')
+    {
+        if (!host_args_u32(s, &word))
+            return false;
+        *value = (int32_t)word;
+        return true;
+    }
+    errno = 0;
+    number = strtol(s, &end, 0);
+    if (errno == ERANGE || number < INT32_MIN)
+        return false;
+    *value = (int32_t)number;
+
+    return s[1] != '\0' && *end == '\0';
+}
+
+/**
+ * @brief   @p on or @p off, or a number, zero is off.
+ */
+bool host_args_switch(const char *s, bool *on)
+{
+    uint32_t value;
+
+    if (strcmp(s, "on") == 0)
+        value = 1;
+    else if (strcmp(s, "off") == 0)
+        value = 0;
+    else if (!host_args_u32(s, &value))
+        return false;
+    *on = value != 0;
+
+    return true;
+}
+
+/**
+ * @brief   Up to eight data bytes as a hex string.
+ */
+bool host_args_hex(const char *s, uint8_t *data, uint8_t *length)
+{
+    size_t n = strlen(s);
+
+    if (n % 2 != 0 || n > 16)
+        return false;
+    for (size_t i = 0; i < n; i += 2)
+    {
+        int high = hex_digit(s[i]);
+        int low = hex_digit(s[i + 1]);
+
+        if (high < 0 || low < 0)
+            return false;
+        data[i / 2] = (uint8_t)(high << 4 | low);
+    }
+    *length = (uint8_t)(n / 2);
+
+    return true;
+}
+
+/**
+ * @brief   Arguments of the send command, after its name.
+ * @details <cookie> <id> [<data>] [ext], the identifier carries
+ *          @p CAN_RECORD_EXT for @p ext. Identifier and length are
+ *          checked when the frame is queued.
+ *
+ * @return  False on a usage error.
+ */
+bool host_args_send(int argc, char *argv[], uint32_t *cookie,
+                    uint32_t *id, uint8_t *data, uint8_t *dlc)
+{
+    bool extended = argc > 0 && strcmp(argv[argc - 1], "ext") == 0;
+
+    if (extended)
+        argc--;
+    *dlc = 0;
+    if (argc < 2 || argc > 3 || !host_args_u32(argv[0], cookie) ||
+        !host_args_u32(argv[1], id) ||
+        (argc == 3 && !host_args_hex(argv[2], data, dlc)))
+        return false;
+    if (extended)
+        *id |= CAN_RECORD_EXT;
+
+    return true;
+}
+
+/** @} */
@@ -0,0 +1,35 @@
+/**
+ * @file    src/host_args.h
+ * @brief   Arguments of the host commands.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _HOST_ARGS_H_
+#define _HOST_ARGS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  int host_args_split(char *line, char *argv[], int max);
+  bool host_args_u32(const char *s, uint32_t *value);
+  bool host_args_i32(const char *s, int32_t *value);
+  bool host_args_switch(const char *s, bool *on);
+  bool host_args_hex(const char *s, uint8_t *data, uint8_t *length);
+  bool host_args_send(int argc, char *argv[], uint32_t *cookie,
+                      uint32_t *id, uint8_t *data, uint8_t *dlc);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HOST_ARGS_H_ */
+
+/** @} */
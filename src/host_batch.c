@@ -0,0 +1,160 @@
+/**
+ * @file    src/host_batch.c
+ * @brief   Batches of frames sent by the host.
+ * @details After the start byte a batch carries
+ *
+ *              sequence count frames checksum
+ *
+ *          A frame is a cookie and an identifier word, both 32 bit little
+ *          endian, the DLC and the data bytes, none for a remote frame.
+ *          The checksum makes the sum of all bytes after the start byte
+ *          zero, modulo 256. The parser takes one byte at a time, the
+ *          device reads with a timeout between bytes.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include "host_batch.h"
+#include "can_record.h"
+
+enum {
+  STATE_SEQUENCE = 0,
+  STATE_COUNT,
+  STATE_COOKIE,
+  STATE_ID,
+  STATE_DLC,
+  STATE_DATA,
+  STATE_CHECKSUM
+};
+
+static uint8_t data_length(const HostBatchFrame *frame)
+{
+    return (frame->id & CAN_RECORD_RTR) != 0 ? 0 : frame->dlc;
+}
+
+/* Moves to the next frame, or to the checksum after the last one.*/
+static void next_frame(HostBatch *bp)
+{
+    bp->index++;
+    bp->state = bp->index < bp->count ? STATE_COOKIE : STATE_CHECKSUM;
+}
+
+/**
+ * @brief   Starts a batch, after its start byte.
+ */
+void host_batch_init(HostBatch *bp)
+{
+    bp->state = STATE_SEQUENCE;
+    bp->sum = 0;
+    bp->position = 0;
+    bp->count = 0;
+    bp->index = 0;
+}
+
+/**
+ * @brief   Takes the next byte.
+ *
+ * @return  @p HOST_BATCH_DONE once the checksum matched, the frames are
+ *          in @p frames.
+ */
+hostbatchresult_t host_batch_feed(HostBatch *bp, uint8_t b)
+{
+    HostBatchFrame *frame = &bp->frames[bp->index];
+
+    bp->sum += b;
+    switch (bp->state)
+    {
+    case STATE_SEQUENCE:
+        bp->sequence = b;
+        bp->state = STATE_COUNT;
+        break;
+    case STATE_COUNT:
+        if (b == 0 || b > HOST_BATCH_FRAMES)
+            return HOST_BATCH_ERROR;
+        bp->count = b;
+        bp->state = STATE_COOKIE;
+        break;
+    case STATE_COOKIE:
+        if (bp->position == 0)
+            frame->cookie = 0;
+        frame->cookie |= (uint32_t)b << (8 * bp->position);
+        if (++bp->position == 4)
+        {
+            bp->position = 0;
+            bp->state = STATE_ID;
+        }
+        break;
+    case STATE_ID:
+        if (bp->position == 0)
+            frame->id = 0;
+        frame->id |= (uint32_t)b << (8 * bp->position);
+        if (++bp->position == 4)
+        {
+            bp->position = 0;
+            bp->state = STATE_DLC;
+        }
+        break;
+    case STATE_DLC:
+        if (b > 8)
+            return HOST_BATCH_ERROR;
+        frame->dlc = b;
+        if (data_length(frame) != 0)
+            bp->state = STATE_DATA;
+        else
+            next_frame(bp);
+        break;
+    case STATE_DATA:
+        frame->data[bp->position] = b;
+        if (++bp->position == data_length(frame))
+        {
+            bp->position = 0;
+            next_frame(bp);
+        }
+        break;
+    case STATE_CHECKSUM:
+    default:
+        return bp->sum == 0 ? HOST_BATCH_DONE : HOST_BATCH_ERROR;
+    }
+
+    return HOST_BATCH_MORE;
+}
+
+/**
+ * @brief   Builds a batch, for host tools.
+ *
+ * @param[out] out      At least @p HOST_BATCH_MAX_SIZE bytes.
+ * @return              Bytes written, zero if @p count is out of range.
+ */
+size_t host_batch_encode(uint8_t sequence, const HostBatchFrame *frames,
+                         size_t count, uint8_t *out)
+{
+    size_t n = 0;
+    uint8_t sum = 0;
+
+    if (count == 0 || count > HOST_BATCH_FRAMES)
+        return 0;
+
+    out[n++] = HOST_BATCH_START;
+    out[n++] = sequence;
+    out[n++] = (uint8_t)count;
+    for (size_t i = 0; i < count; i++)
+    {
+        const HostBatchFrame *frame = &frames[i];
+
+        for (unsigned shift = 0; shift < 32; shift += 8)
+            out[n++] = (uint8_t)(frame->cookie >> shift);
+        for (unsigned shift = 0; shift < 32; shift += 8)
+            out[n++] = (uint8_t)(frame->id >> shift);
+        out[n++] = frame->dlc;
+        for (uint8_t j = 0; j < data_length(frame); j++)
+            out[n++] = frame->data[j];
+    }
+    for (size_t i = 1; i < n; i++)
+        sum += out[i];
+    out[n++] = (uint8_t)-sum;
+
+    return n;
+}
+
+/** @} */
@@ -0,0 +1,100 @@
+/**
+ * @file    src/host_batch.h
+ * @brief   Batches of frames sent by the host.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _HOST_BATCH_H_
+#define _HOST_BATCH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   First byte of a batch.
+ */
+#define HOST_BATCH_START            0x02U
+
+/**
+ * @brief   Most frames in a batch.
+ */
+#define HOST_BATCH_FRAMES           16
+
+/**
+ * @brief   Longest batch, start byte and checksum included.
+ */
+#define HOST_BATCH_MAX_SIZE         (4 + HOST_BATCH_FRAMES * 17)
+
+/**
+ * @brief   Parser results.
+ */
+typedef enum {
+  HOST_BATCH_MORE = 0,      /**< Batch incomplete.                         */
+  HOST_BATCH_DONE,          /**< Batch complete and valid.                 */
+  HOST_BATCH_ERROR          /**< Malformed batch, the rest is not read.    */
+} hostbatchresult_t;
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Derived constants and error checks.                                       */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   A frame of a batch.
+ */
+typedef struct {
+    uint32_t cookie;        /**< Returned with the echo.                   */
+    uint32_t id;            /**< With @p CAN_RECORD_EXT and _RTR flags.    */
+    uint8_t dlc;
+    uint8_t data[8];
+} HostBatchFrame;
+
+/**
+ * @brief   Batch parser.
+ */
+typedef struct {
+    uint8_t state;
+    uint8_t sum;
+    uint8_t position;       /**< Byte within the current field.           */
+    uint8_t sequence;
+    size_t count;
+    size_t index;           /**< Frame being read.                         */
+    HostBatchFrame frames[HOST_BATCH_FRAMES];
+} HostBatch;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void host_batch_init(HostBatch *bp);
+  hostbatchresult_t host_batch_feed(HostBatch *bp, uint8_t b);
+  size_t host_batch_encode(uint8_t sequence, const HostBatchFrame *frames,
+                           size_t count, uint8_t *out);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HOST_BATCH_H_ */
+
+/** @} */
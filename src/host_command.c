@@ -0,0 +1,1491 @@
+/**
+ * @file    src/host_command.c
+ * @brief   Command channel on the host link.
+ * @details Commands arrive on the input side of the serial link, which the
+ *          capture stream leaves unused. A low priority thread reads them
+ *          either as text lines, edited by the line reader of the ChibiOS
+ *          shell, or as binary packets:
+ *
+ *              0x01 length sequence opcode arguments checksum
+ *
+ *          @p length counts sequence, opcode and the arguments, which are
+ *          32 bit little endian. The checksum makes the sum of all bytes
+ *          after 0x01 zero, modulo 256. Opcode n is the n-th command of
+ *          the table, counting from 1.
+ *          Both forms run the same shell command table. The output of a
+ *          command and its acknowledge are queued for the output thread,
+ *          they enter the stream between two records.
+ *          Settings are staged and handed to the output thread as a
+ *          whole, it applies them between two records with at most one
+ *          controller restart. A setting given outside of begin/apply is
+ *          applied on its own. The acknowledge carries the time from the
+ *          last byte of the command, through parsing and execution, to
+ *          the end of the apply.
+ *          Frames to send come in batches, see host_batch.c and
+ *          host_tx.c. The batch is checked as a whole before any frame is
+ *          queued.
+ *          Settings of the traffic generator are not staged, they take
+ *          effect at once, nor are signal tables, cell limits, ISO-TP
+ *          channels and the J1939 pass list.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include <string.h>
+
+#include "chprintf.h"
+#include "shell.h"
+
+#include "host_command.h"
+#include "host_args.h"
+#include "can_backlog.h"
+#include "can_bittime.h"
+#include "timestamp.h"
+#if LGCR_USE_HOST_TX
+#include "host_tx.h"
+#include "host_batch.h"
+#endif
+#if LGCR_USE_GENERATOR
+#include "traffic_gen.h"
+#endif
+#if LGCR_USE_SIGNALS
+#include "signal_decoder.h"
+#endif
+#if LGCR_USE_BMS
+#include "bms_monitor.h"
+#endif
+#if LGCR_USE_ISOTP
+#include "isotp_engine.h"
+#endif
+#if LGCR_USE_J1939
+#include "j1939_decoder.h"
+#endif
+
+/*
+ * Sequential stream handed to the shell line reader and to the commands.
+ * Reads come from the host link, written lines become replies. The echo
+ * of the line reader is discarded.
+ */
+typedef struct {
+    const struct BaseSequentialStreamVMT *vmt;
+    BaseChannel *channel;
+    bool pushedBack;
+    uint8_t pushback;
+    bool discard;
+    char line[HOST_COMMAND_REPLY_SIZE];
+    size_t length;
+} CommandStream;
+
+static CommandStream commandStream;
+
+static MUTEX_DECL(replyMutex);
+static SEMAPHORE_DECL(replyFree, HOST_COMMAND_REPLIES);
+static char replies[HOST_COMMAND_REPLIES][HOST_COMMAND_REPLY_SIZE];
+static size_t replyHead;
+static size_t replyCount;
+
+/*
+ * Apply handshake. Once the output thread took the settings it finishes
+ * the apply, the command thread only gives up while they are pending.
+ */
+typedef enum {
+  APPLY_IDLE = 0,
+  APPLY_PENDING,            /* Waiting for the output thread.            */
+  APPLY_TAKEN,              /* Being applied, @p stagedConfig is in use. */
+  APPLY_DONE                /* @p applyOk is the result.                 */
+} applystate_t;
+
+static MUTEX_DECL(configMutex);
+static BSEMAPHORE_DECL(applyDone, true);
+static HostConfig currentConfig;
+static HostConfig stagedConfig;
+static applystate_t applyState;
+static bool applyOk;
+
+/* Command state, only used by the command thread.*/
+static bool staging;
+static bool configChanged;
+static bool applyRequested;
+static const char *commandError;
+
+#if LGCR_USE_HOST_TX
+static HostBatch batch;
+#endif
+
+/*===========================================================================*/
+/* Replies.                                                                  */
+/*===========================================================================*/
+
+static void reply_post(const char *line)
+{
+    (void)chSemWait(&replyFree);
+    chMtxLock(&replyMutex);
+    char *slot = replies[(replyHead + replyCount) % HOST_COMMAND_REPLIES];
+    strncpy(slot, line, HOST_COMMAND_REPLY_SIZE - 1);
+    slot[HOST_COMMAND_REPLY_SIZE - 1] = '\0';
+    replyCount++;
+    chMtxUnlock(&replyMutex);
+
+    /* The output thread may be waiting for frames.*/
+    can_backlog_wake();
+}
+
+static void reply_flush(CommandStream *csp)
+{
+    char line[HOST_COMMAND_REPLY_SIZE];
+
+    if (csp->length == 0)
+        return;
+
+    csp->line[csp->length] = '\0';
+    csp->length = 0;
+    if (csp->line[0] == '#')
+        reply_post(csp->line);
+    else
+    {
+        chsnprintf(line, sizeof(line), "# %s", csp->line);
+        reply_post(line);
+    }
+}
+
+/*===========================================================================*/
+/* Command stream.                                                           */
+/*===========================================================================*/
+
+static msg_t stream_put(void *ip, uint8_t b)
+{
+    CommandStream *csp = ip;
+
+    if (csp->discard)
+        return MSG_OK;
+
+    if (b == '\n')
+        reply_flush(csp);
+    else if (b != '\r')
+    {
+        if (csp->length >= sizeof(csp->line) - 1)
+            reply_flush(csp);
+        csp->line[csp->length++] = (char)b;
+    }
+
+    return MSG_OK;
+}
+
+static size_t stream_write(void *ip, const uint8_t *bp, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        (void)stream_put(ip, bp[i]);
+
+    return n;
+}
+
+/*
+ * Next input byte. A line feed ends a line like a carriage return, the
+ * empty line of a CR LF pair is ignored.
+ */
+static msg_t stream_get(void *ip)
+{
+    CommandStream *csp = ip;
+
+    if (csp->pushedBack)
+    {
+        csp->pushedBack = false;
+        return csp->pushback;
+    }
+
+    while (true)
+    {
+        msg_t c = chnGetTimeout(csp->channel, TIME_INFINITE);
+
+        if (c >= 0)
+            return c == '\n' ? '\r' : c;
+
+        /* The link is down.*/
+        chThdSleepMilliseconds(10);
+    }
+}
+
+static size_t stream_read(void *ip, uint8_t *bp, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        bp[i] = (uint8_t)stream_get(ip);
+
+    return n;
+}
+
+static const struct BaseSequentialStreamVMT streamVmt = {
+    stream_write, stream_read, stream_put, stream_get
+};
+
+/*===========================================================================*/
+/* Settings.                                                                 */
+/*===========================================================================*/
+
+/*
+ * Starts a new set of changes from the applied settings.
+ */
+static void config_stage(void)
+{
+    chMtxLock(&configMutex);
+    /* Bitrate detection may have changed the bitrate.*/
+    currentConfig.bitrate = BoardCanGetBitrate();
+    stagedConfig = currentConfig;
+    chMtxUnlock(&configMutex);
+}
+
+/*
+ * Hands the staged settings to the output thread and waits for it.
+ */
+static bool config_apply(void)
+{
+    bool ok;
+
+    chBSemReset(&applyDone, true);
+    chMtxLock(&configMutex);
+    applyState = APPLY_PENDING;
+    chMtxUnlock(&configMutex);
+    can_backlog_wake();
+
+    (void)chBSemWaitTimeout(&applyDone, HOST_COMMAND_APPLY_TIMEOUT);
+
+    chMtxLock(&configMutex);
+    if (applyState == APPLY_PENDING)
+    {
+        /* No host reading, the settings are left as they were.*/
+        applyState = APPLY_IDLE;
+        chMtxUnlock(&configMutex);
+        commandError = "timeout";
+        return false;
+    }
+    while (applyState == APPLY_TAKEN)
+    {
+        /* The output thread holds the settings, it is not abandoned.*/
+        chMtxUnlock(&configMutex);
+        (void)chBSemWait(&applyDone);
+        chMtxLock(&configMutex);
+    }
+    ok = applyOk;
+    applyState = APPLY_IDLE;
+    chMtxUnlock(&configMutex);
+
+    if (!ok)
+        commandError = "rejected";
+
+    return ok;
+}
+
+#if LGCR_USE_BMS
+/*
+ * A cell quantity by name or by number.
+ */
+static bool parse_bms_kind(const char *s, uint8_t *kind)
+{
+    uint32_t value;
+
+    for (uint8_t i = 0; i < CAN_BMS_KINDS; i++)
+    {
+        if (strcmp(s, can_bms_kind_name(i)) == 0)
+        {
+            *kind = i;
+            return true;
+        }
+    }
+    if (!host_args_u32(s, &value) || value >= CAN_BMS_KINDS)
+        return false;
+    *kind = (uint8_t)value;
+
+    return true;
+}
+#endif
+
+#if LGCR_USE_GENERATOR
+static const char *const genIdModes[] = {"fixed", "seq", "random"};
+static const char *const genDataModes[] = {"counter", "random", "fixed"};
+
+/*
+ * A mode by name or by number, the number is the binary form.
+ */
+static bool parse_mode(const char *s, const char *const names[],
+                       uint32_t count, uint8_t *mode)
+{
+    uint32_t value;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (strcmp(s, names[i]) == 0)
+        {
+            *mode = (uint8_t)i;
+            return true;
+        }
+    }
+    if (!host_args_u32(s, &value) || value >= count)
+        return false;
+    *mode = (uint8_t)value;
+
+    return true;
+}
+
+/*
+ * Generator settings take effect at once, a running generator starts
+ * over with them.
+ */
+static void gen_set(const CanGenConfig *config)
+{
+    if (!trafficGenSet(config))
+        commandError = "range";
+}
+#endif
+
+static void print_config(BaseSequentialStream *chp, const char *name,
+                         const HostConfig *config)
+{
+    chprintf(chp, "%s bitrate=%lu sp=%u loopback=%s output=%s heartbeat=%lums filters=%lu\n",
+             name, config->bitrate, config->samplePoint,
+             config->loopback ? "on" : "off",
+             config->compressed ? "compressed" : "text", config->heartbeatMs,
+             config->filterCount);
+    for (uint32_t i = 0; i < config->filterCount; i++)
+    {
+        const BoardCanFilter *filter = &config->filters[i];
+
+        chprintf(chp, "%s filter %lu id=%lx mask=%lx %s\n", name, i,
+                 filter->id, filter->mask, filter->extended ? "ext" : "std");
+    }
+}
+
+/*===========================================================================*/
+/* Commands.                                                                 */
+/*===========================================================================*/
+
+static void cmd_bitrate(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    uint32_t bitrate;
+    uint32_t samplePoint = stagedConfig.samplePoint;
+    CanBitTiming bt;
+
+    (void)chp;
+    if (argc < 1 || argc > 2 || !host_args_u32(argv[0], &bitrate) ||
+        (argc == 2 && !host_args_u32(argv[1], &samplePoint)))
+    {
+        commandError = "usage";
+        return;
+    }
+    if (samplePoint >= 1000 ||
+        !can_bittime_solve(STM32_PCLK1, bitrate, samplePoint, &bt))
+    {
+        commandError = "unsupported";
+        return;
+    }
+
+    stagedConfig.bitrate = bitrate;
+    stagedConfig.samplePoint = (uint16_t)samplePoint;
+    configChanged = true;
+}
+
+static void cmd_filter(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    uint32_t id;
+    uint32_t mask;
+    uint32_t extended = 0;
+
+    (void)chp;
+    if (argc < 2 || argc > 3 || !host_args_u32(argv[0], &id) ||
+        !host_args_u32(argv[1], &mask) ||
+        (argc == 3 && strcmp(argv[2], "ext") != 0 &&
+         !host_args_u32(argv[2], &extended)))
+    {
+        commandError = "usage";
+        return;
+    }
+    if (argc == 3 && strcmp(argv[2], "ext") == 0)
+        extended = 1;
+
+    uint32_t limit = extended != 0 ? 0x1FFFFFFFU : 0x7FFU;
+    if (id > limit || mask > limit)
+    {
+        commandError = "range";
+        return;
+    }
+    if (stagedConfig.filterCount >= BOARD_CAN_FILTERS)
+    {
+        commandError = "full";
+        return;
+    }
+
+    BoardCanFilter *filter = &stagedConfig.filters[stagedConfig.filterCount++];
+    filter->id = id;
+    filter->mask = mask;
+    filter->extended = extended != 0;
+    configChanged = true;
+}
+
+static void cmd_nofilter(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    (void)chp;
+    (void)argv;
+    if (argc != 0)
+    {
+        commandError = "usage";
+        return;
+    }
+
+    stagedConfig.filterCount = 0;
+    configChanged = true;
+}
+
+static void cmd_output(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    uint32_t compressed = 0;
+
+    (void)chp;
+    if (argc != 1 || (strcmp(argv[0], "text") != 0 &&
+                      strcmp(argv[0], "compressed") != 0 &&
+                      !host_args_u32(argv[0], &compressed)))
+    {
+        commandError = "usage";
+        return;
+    }
+    if (strcmp(argv[0], "compressed") == 0)
+        compressed = 1;
+
+#if LGCR_USE_COMPRESS && !LGCR_USE_ADAPTIVE
+    stagedConfig.compressed = compressed != 0;
+    configChanged = true;
+#else
+    /* Without compression, or chosen by the adaptive output.*/
+    (void)compressed;
+    commandError = "unavailable";
+#endif
+}
+
+static void cmd_heartbeat(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    uint32_t ms;
+
+    (void)chp;
+    if (argc != 1 || !host_args_u32(argv[0], &ms))
+    {
+        commandError = "usage";
+        return;
+    }
+    if (ms != 0 && ms < 10)
+    {
+        commandError = "range";
+        return;
+    }
+
+    stagedConfig.heartbeatMs = ms;
+    configChanged = true;
+}
+
+static void cmd_begin(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    (void)chp;
+    (void)argc;
+    (void)argv;
+
+    /* A second begin drops the changes of the first.*/
+    config_stage();
+    staging = true;
+}
+
+static void cmd_apply(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    (void)chp;
+    (void)argc;
+    (void)argv;
+
+    staging = false;
+    applyRequested = true;
+}
+
+static void cmd_abort(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    (void)chp;
+    (void)argc;
+    (void)argv;
+
+    staging = false;
+}
+
+static void cmd_status(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    HostConfig config;
+
+    (void)argc;
+    (void)argv;
+
+    chMtxLock(&configMutex);
+    config = currentConfig;
+    chMtxUnlock(&configMutex);
+    config.bitrate = BoardCanGetBitrate();
+
+    print_config(chp, "config", &config);
+    if (staging)
+        print_config(chp, "staged", &stagedConfig);
+
+#if LGCR_USE_HOST_TX
+    HostTxStats stats;
+
+    hostTxGetStats(&stats);
+    chprintf(chp, "tx queued=%lu sent=%lu failed=%lu rejected=%lu pending=%lu window=%u\n",
+             stats.queued, stats.sent, stats.failed, stats.rejected,
+             stats.pending, HOST_TX_QUEUE_SIZE);
+#endif
+
+#if LGCR_USE_GENERATOR
+    CanGenConfig gen;
+    TrafficGenStats genStats;
+
+    trafficGenGetConfig(&gen);
+    trafficGenGetStats(&genStats);
+    chprintf(chp, "gen load=%u id=%s %lx count=%lu %s dlc=%u-%u data=%s frames=%lu late=%lu\n",
+             gen.load, genIdModes[gen.idMode], gen.id, gen.idCount,
+             gen.extended ? "ext" : "std", gen.dlcMin, gen.dlcMax,
+             genDataModes[gen.dataMode], genStats.frames, genStats.late);
+#endif
+
+#if LGCR_USE_SIGNALS
+    SignalDecoderStats signals;
+
+    signalDecoderGetStats(&signals);
+    chprintf(chp, "signals %s bytes=%lu messages=%lu signals=%lu\n",
+             signals.loaded ? "loaded" : "none", signals.size,
+             signals.messages, signals.signals);
+    chprintf(chp, "signals frames=%lu decoded=%lu emitted=%lu suppressed=%lu\n",
+             signals.totals.frames, signals.totals.decoded,
+             signals.totals.emitted, signals.totals.suppressed);
+#endif
+
+#if LGCR_USE_BMS
+    BmsMonitorStats bms;
+
+    bmsMonitorGetStats(&bms);
+    chprintf(chp, "bms rate=%lu frames=%lu alerts=%lu\n",
+             bmsMonitorGetPeriod(), bms.frames, bms.alerts);
+    for (uint8_t kind = 0; kind < CAN_BMS_KINDS; kind++)
+    {
+        CanBmsLimits limits;
+
+        bmsMonitorGetLimits(kind, &limits);
+        chprintf(chp, "bms %s low=%d high=%d spread=%u hysteresis=%u\n",
+                 can_bms_kind_name(kind), limits.low, limits.high,
+                 limits.spread, limits.hysteresis);
+    }
+#endif
+
+#if LGCR_USE_ISOTP
+    IsotpEngineStats isotp;
+
+    isotpEngineGetStats(&isotp);
+    chprintf(chp, "isotp active=%lu/%u frames=%lu pdus=%lu sent=%lu\n",
+             isotp.active, ISOTP_SESSIONS, isotp.totals.frames,
+             isotp.totals.pdus, isotp.totals.sent);
+    chprintf(chp, "isotp timeouts=%lu sequence=%lu overflows=%lu nosession=%lu\n",
+             isotp.totals.timeouts, isotp.totals.sequence,
+             isotp.totals.overflows, isotp.totals.noSession);
+    chprintf(chp, "isotp invalid=%lu flowlost=%lu dropped=%lu\n",
+             isotp.totals.invalid, isotp.totals.flowLost, isotp.dropped);
+    for (uint8_t i = 0; i < CAN_ISOTP_CHANNELS; i++)
+    {
+        CanIsoTpChannel channel;
+
+        if (isotpEngineGetChannel(i, &channel) && channel.open)
+            chprintf(chp, "isotp channel %u rx=%lx tx=%lx %s\n", i,
+                     channel.rxKey & CAN_RECORD_ID_MASK,
+                     channel.txKey & CAN_RECORD_ID_MASK,
+                     (channel.rxKey & CAN_RECORD_EXT) != 0 ? "ext" : "std");
+    }
+#endif
+
+#if LGCR_USE_J1939
+    J1939DecoderStats j1939;
+    uint32_t pgns[CAN_J1939_FILTERS];
+    size_t pgnCount = j1939DecoderGetPass(pgns, CAN_J1939_FILTERS);
+
+    j1939DecoderGetStats(&j1939);
+    chprintf(chp, "j1939 active=%lu/%u frames=%lu packets=%lu messages=%lu\n",
+             j1939.active, J1939_SESSIONS, j1939.totals.frames,
+             j1939.totals.packets, j1939.totals.messages);
+    chprintf(chp, "j1939 filtered=%lu aborted=%lu timeouts=%lu nosession=%lu\n",
+             j1939.totals.filtered, j1939.totals.aborted,
+             j1939.totals.timeouts, j1939.totals.noSession);
+    chprintf(chp, "j1939 invalid=%lu dropped=%lu pass=%s\n",
+             j1939.totals.invalid, j1939.dropped,
+             pgnCount == 0 ? "all" : "list");
+    for (size_t i = 0; i < pgnCount; i += 8)
+    {
+        chprintf(chp, "j1939 pass");
+        for (size_t k = i; k < pgnCount && k < i + 8; k++)
+            chprintf(chp, " %05lx", pgns[k]);
+        chprintf(chp, "\n");
+    }
+#endif
+}
+
+static void cmd_loopback(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    bool loopback;
+
+    (void)chp;
+    if (argc != 1 || !host_args_switch(argv[0], &loopback))
+    {
+        commandError = "usage";
+        return;
+    }
+
+    stagedConfig.loopback = loopback;
+    configChanged = true;
+}
+
+/*
+ * The echo of the frame tells why it was rejected.
+ */
+static void cmd_send(BaseSequentialStream *chp, int argc, char *argv[])
+{
+#if LGCR_USE_HOST_TX
+    uint32_t cookie;
+    uint32_t id;
+    uint8_t data[8];
+    uint8_t dlc;
+
+    (void)chp;
+    if (!host_args_send(argc, argv, &cookie, &id, data, &dlc))
+    {
+        commandError = "usage";
+        return;
+    }
+
+    if (!hostTxSubmit(cookie, id, dlc, data))
+        commandError = "rejected";
+#else
+    (void)chp;
+    (void)argc;
+    (void)argv;
+    commandError = "unavailable";
+#endif
+}
+
+static void cmd_gen(BaseSequentialStream *chp, int argc, char *argv[])
+{
+#if LGCR_USE_GENERATOR
+    CanGenConfig config;
+    uint32_t load;
+
+    (void)chp;
+    if (argc != 1 || !host_args_u32(argv[0], &load))
+    {
+        commandError = "usage";
+        return;
+    }
+    if (load > CAN_GEN_LOAD_FULL)
+    {
+        commandError = "range";
+        return;
+    }
+
+    trafficGenGetConfig(&config);
+    config.load = (uint16_t)load;
+    gen_set(&config);
+#else
+    (void)chp;
+    (void)argc;
+    (void)argv;
+    commandError = "unavailable";
+#endif
+}
+
+static void cmd_genid(BaseSequentialStream *chp, int argc, char *argv[])
+{
+#if LGCR_USE_GENERATOR
+    CanGenConfig config;
+    uint32_t id;
+    uint32_t count = 1;
+    uint32_t extended = 0;
+
+    (void)chp;
+    trafficGenGetConfig(&config);
+    /* The binary form gives count and a fourth argument of 1.*/
+    if (argc == 4 || (argc == 3 && strcmp(argv[2], "ext") == 0))
+    {
+        if (strcmp(argv[argc - 1], "ext") == 0)
+            extended = 1;
+        else if (!host_args_u32(argv[argc - 1], &extended))
+        {
+            commandError = "usage";
+            return;
+        }
+        argc--;
+    }
+    if (argc < 2 || argc > 3 ||
+        !parse_mode(argv[0], genIdModes, 3, &config.idMode) ||
+        !host_args_u32(argv[1], &id) ||
+        (argc == 3 && !host_args_u32(argv[2], &count)))
+    {
+        commandError = "usage";
+        return;
+    }
+
+    config.id = id;
+    config.idCount = count;
+    config.extended = extended != 0;
+    gen_set(&config);
+#else
+    (void)chp;
+    (void)argc;
+    (void)argv;
+    commandError = "unavailable";
+#endif
+}
+
+static void cmd_gendlc(BaseSequentialStream *chp, int argc, char *argv[])
+{
+#if LGCR_USE_GENERATOR
+    CanGenConfig config;
+    uint32_t dlcMin;
+    uint32_t dlcMax;
+
+    (void)chp;
+    if (argc < 1 || argc > 2 || !host_args_u32(argv[0], &dlcMin) ||
+        !host_args_u32(argv[argc - 1], &dlcMax))
+    {
+        commandError = "usage";
+        return;
+    }
+    if (dlcMax > 8 || dlcMin > dlcMax)
+    {
+        commandError = "range";
+        return;
+    }
+
+    trafficGenGetConfig(&config);
+    config.dlcMin = (uint8_t)dlcMin;
+    config.dlcMax = (uint8_t)dlcMax;
+    gen_set(&config);
+#else
+    (void)chp;
+    (void)argc;
+    (void)argv;
+    commandError = "unavailable";
+#endif
+}
+
+/*
+ * The binary form gives the fixed payload as two words, bytes 0..3 and
+ * 4..7.
+ */
+static void cmd_gendata(BaseSequentialStream *chp, int argc, char *argv[])
+{
+#if LGCR_USE_GENERATOR
+    CanGenConfig config;
+    uint8_t length = 0;
+    uint32_t words[2];
+
+    (void)chp;
+    trafficGenGetConfig(&config);
+    if (argc < 1 || argc > 3 ||
+        !parse_mode(argv[0], genDataModes, 3, &config.dataMode) ||
+        (argc == 2 && !host_args_hex(argv[1], config.data, &length)) ||
+        (argc == 3 && (!host_args_u32(argv[1], &words[0]) ||
+                       !host_args_u32(argv[2], &words[1]))))
+    {
+        commandError = "usage";
+        return;
+    }
+    if (argc == 2)
+        memset(&config.data[length], 0, sizeof(config.data) - length);
+    else if (argc == 3)
+    {
+        for (size_t i = 0; i < 8; i++)
+            config.data[i] = (uint8_t)(words[i / 4] >> (8 * (i % 4)));
+    }
+
+    gen_set(&config);
+#else
+    (void)chp;
+    (void)argc;
+    (void)argv;
+    commandError = "unavailable";
+#endif
+}
+
+/*
+ * A piece of a signal table, up to three words little endian, at the
+ * offset of the bytes written before.
+ */
+static void cmd_sigload(BaseSequentialStream *chp, int argc, char *argv[])
+{
+#if LGCR_USE_SIGNALS
+    uint32_t offset;
+    uint32_t word;
+    uint8_t data[4 * (HOST_COMMAND_MAX_ARGS - 1)];
+    size_t n = 0;
+
+    (void)chp;
+    if (argc < 2 || argc > HOST_COMMAND_MAX_ARGS ||
+        !host_args_u32(argv[0], &offset))
+    {
+        commandError = "usage";
+        return;
+    }
+    for (int i = 1; i < argc; i++)
+    {
+        if (!host_args_u32(argv[i], &word))
+        {
+            commandError = "usage";
+            return;
+        }
+        for (unsigned shift = 0; shift < 32; shift += 8)
+            data[n++] = (uint8_t)(word >> shift);
+    }
+
+    if (!signalDecoderLoad(offset, data, n))
+        commandError = "range";
+#else
+    (void)chp;
+    (void)argc;
+    (void)argv;
+    commandError = "unavailable";
+#endif
+}
+
+static void cmd_sigcommit(BaseSequentialStream *chp, int argc, char *argv[])
+{
+#if LGCR_USE_SIGNALS
+    uint32_t size;
+    uint32_t sum;
+
+    (void)chp;
+    if (argc != 2 || !host_args_u32(argv[0], &size) ||
+        !host_args_u32(argv[1], &sum))
+    {
+        commandError = "usage";
+        return;
+    }
+
+    if (!signalDecoderCommit(size, sum))
+        commandError = "rejected";
+#else
+    (void)chp;
+    (void)argc;
+    (void)argv;
+    commandError = "unavailable";
+#endif
+}
+
+static void cmd_bmsrate(BaseSequentialStream *chp, int argc, char *argv[])
+{
+#if LGCR_USE_BMS
+    uint32_t ms;
+
+    (void)chp;
+    if (argc != 1 || !host_args_u32(argv[0], &ms))
+    {
+        commandError = "usage";
+        return;
+    }
+    if (ms != 0 && ms < 10)
+    {
+        commandError = "range";
+        return;
+    }
+
+    bmsMonitorSetPeriod(ms);
+#else
+    (void)chp;
+    (void)argc;
+    (void)argv;
+    commandError = "unavailable";
+#endif
+}
+
+/*
+ * Limits of a quantity in its unit, the spread is kept when not given.
+ */
+static void cmd_bmslimit(BaseSequentialStream *chp, int argc, char *argv[])
+{
+#if LGCR_USE_BMS
+    CanBmsLimits limits;
+    uint8_t kind;
+    int32_t low;
+    int32_t high;
+    uint32_t spread;
+
+    (void)chp;
+    if (argc < 3 || argc > 4 || !parse_bms_kind(argv[0], &kind) ||
+        !host_args_i32(argv[1], &low) || !host_args_i32(argv[2], &high) ||
+        (argc == 4 && !host_args_u32(argv[3], &spread)))
+    {
+        commandError = "usage";
+        return;
+    }
+
+    bmsMonitorGetLimits(kind, &limits);
+    if (argc == 3)
+        spread = limits.spread;
+    if (low < INT16_MIN || high > INT16_MAX || low >= high ||
+        spread > UINT16_MAX)
+    {
+        commandError = "range";
+        return;
+    }
+
+    limits.low = (int16_t)low;
+    limits.high = (int16_t)high;
+    limits.spread = (uint16_t)spread;
+    bmsMonitorSetLimits(kind, &limits);
+#else
+    (void)chp;
+    (void)argc;
+    (void)argv;
+    commandError = "unavailable";
+#endif
+}
+
+/*
+ * Opens an active ISO-TP channel, or closes it with the channel alone.
+ */
+static void cmd_tpchan(BaseSequentialStream *chp, int argc, char *argv[])
+{
+#if LGCR_USE_ISOTP
+    uint32_t channel;
+    uint32_t rxId;
+    uint32_t txId;
+    uint32_t extended = 0;
+
+    (void)chp;
+    if ((argc != 1 && argc != 3 && argc != 4) ||
+        !host_args_u32(argv[0], &channel) ||
+        (argc >= 3 && (!host_args_u32(argv[1], &rxId) ||
+                       !host_args_u32(argv[2], &txId))) ||
+        (argc == 4 && strcmp(argv[3], "ext") != 0 &&
+         !host_args_u32(argv[3], &extended)))
+    {
+        commandError = "usage";
+        return;
+    }
+    if (channel >= CAN_ISOTP_CHANNELS)
+    {
+        commandError = "range";
+        return;
+    }
+
+    isotpEngineClose((uint8_t)channel);
+    if (argc == 1)
+        return;
+    if (argc == 4 && strcmp(argv[3], "ext") == 0)
+        extended = 1;
+    if (extended != 0)
+    {
+        rxId |= CAN_RECORD_EXT;
+        txId |= CAN_RECORD_EXT;
+    }
+    if (!isotpEngineOpen((uint8_t)channel, rxId, txId))
+        commandError = "range";
+#else
+    (void)chp;
+    (void)argc;
+    (void)argv;
+    commandError = "unavailable";
+#endif
+}
+
+/*
+ * A piece of an ISO-TP message, up to three words little endian, at the
+ * offset of the bytes written before.
+ */
+static void cmd_tpload(BaseSequentialStream *chp, int argc, char *argv[])
+{
+#if LGCR_USE_ISOTP
+    uint32_t offset;
+    uint32_t word;
+    uint8_t data[4 * (HOST_COMMAND_MAX_ARGS - 1)];
+    size_t n = 0;
+
+    (void)chp;
+    if (argc < 2 || argc > HOST_COMMAND_MAX_ARGS ||
+        !host_args_u32(argv[0], &offset))
+    {
+        commandError = "usage";
+        return;
+    }
+    for (int i = 1; i < argc; i++)
+    {
+        if (!host_args_u32(argv[i], &word))
+        {
+            commandError = "usage";
+            return;
+        }
+        for (unsigned shift = 0; shift < 32; shift += 8)
+            data[n++] = (uint8_t)(word >> shift);
+    }
+
+    if (!isotpEngineLoad(offset, data, n))
+        commandError = "range";
+#else
+    (void)chp;
+    (void)argc;
+    (void)argv;
+    commandError = "unavailable";
+#endif
+}
+
+/*
+ * Sends the message written, the result comes as a record.
+ */
+static void cmd_tpsend(BaseSequentialStream *chp, int argc, char *argv[])
+{
+#if LGCR_USE_ISOTP
+    uint32_t cookie;
+    uint32_t channel;
+    uint32_t length;
+
+    (void)chp;
+    if (argc != 3 || !host_args_u32(argv[0], &cookie) ||
+        !host_args_u32(argv[1], &channel) || !host_args_u32(argv[2], &length))
+    {
+        commandError = "usage";
+        return;
+    }
+    if (channel >= CAN_ISOTP_CHANNELS)
+    {
+        commandError = "range";
+        return;
+    }
+
+    isotpEngineSend(cookie, (uint8_t)channel, length);
+#else
+    (void)chp;
+    (void)argc;
+    (void)argv;
+    commandError = "unavailable";
+#endif
+}
+
+/*
+ * Adds groups to the pass list, the first one stops passing all others.
+ */
+static void cmd_pgnpass(BaseSequentialStream *chp, int argc, char *argv[])
+{
+#if LGCR_USE_J1939
+    uint32_t pgns[HOST_COMMAND_MAX_ARGS];
+
+    (void)chp;
+    if (argc < 1)
+    {
+        commandError = "usage";
+        return;
+    }
+    for (int i = 0; i < argc; i++)
+    {
+        if (!host_args_u32(argv[i], &pgns[i]))
+        {
+            commandError = "usage";
+            return;
+        }
+        if (pgns[i] > CAN_J1939_PGN_MASK)
+        {
+            commandError = "range";
+            return;
+        }
+    }
+
+    for (int i = 0; i < argc; i++)
+    {
+        if (!j1939DecoderPass(pgns[i]))
+            commandError = "rejected";
+    }
+#else
+    (void)chp;
+    (void)argc;
+    (void)argv;
+    commandError = "unavailable";
+#endif
+}
+
+static void cmd_pgnall(BaseSequentialStream *chp, int argc, char *argv[])
+{
+#if LGCR_USE_J1939
+    (void)chp;
+    (void)argv;
+    if (argc != 0)
+    {
+        commandError = "usage";
+        return;
+    }
+
+    j1939DecoderPassAll();
+#else
+    (void)chp;
+    (void)argc;
+    (void)argv;
+    commandError = "unavailable";
+#endif
+}
+
+static void cmd_help(BaseSequentialStream *chp, int argc, char *argv[]);
+
+/*
+ * Binary opcodes are the table positions, new commands go to the end.
+ */
+static const ShellCommand commands[] = {
+    {"bitrate", cmd_bitrate},
+    {"filter", cmd_filter},
+    {"nofilter", cmd_nofilter},
+    {"output", cmd_output},
+    {"heartbeat", cmd_heartbeat},
+    {"begin", cmd_begin},
+    {"apply", cmd_apply},
+    {"abort", cmd_abort},
+    {"status", cmd_status},
+    {"help", cmd_help},
+    {"send", cmd_send},
+    {"loopback", cmd_loopback},
+    {"gen", cmd_gen},
+    {"genid", cmd_genid},
+    {"gendlc", cmd_gendlc},
+    {"gendata", cmd_gendata},
+    {"sigload", cmd_sigload},
+    {"sigcommit", cmd_sigcommit},
+    {"bmsrate", cmd_bmsrate},
+    {"bmslimit", cmd_bmslimit},
+    {"tpchan", cmd_tpchan},
+    {"tpload", cmd_tpload},
+    {"tpsend", cmd_tpsend},
+    {"pgnpass", cmd_pgnpass},
+    {"pgnall", cmd_pgnall},
+    {NULL, NULL}
+};
+
+static const char *const commandUsage[] = {
+    "<bit/s> [sample point permille]",
+    "<id> <mask> [ext]",
+    "",
+    "text|compressed",
+    "<ms>, 0 is off",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "<cookie> <id> [hex data] [ext]",
+    "on|off",
+    "<load permille>, 0 is off",
+    "fixed|seq|random <id> [count] [ext]",
+    "<min> [max]",
+    "counter|random|fixed [hex data]",
+    "<offset> <word> [word] [word]",
+    "<size> <byte sum>, 0 0 is no table",
+    "<ms>, 0 is off",
+    "volt|temp <low> <high> [spread]",
+    "<channel> [<rx id> <tx id> [ext]]",
+    "<offset> <word> [word] [word]",
+    "<cookie> <channel> <length>",
+    "<pgn> [pgn] [pgn] [pgn]",
+    ""
+};
+
+#define COMMAND_COUNT   (sizeof(commands) / sizeof(commands[0]) - 1)
+
+static void cmd_help(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    for (size_t i = 0; i < COMMAND_COUNT; i++)
+        chprintf(chp, "help %u %s%s%s\n", (unsigned)(i + 1),
+                 commands[i].sc_name, commandUsage[i][0] != '\0' ? " " : "",
+                 commandUsage[i]);
+}
+
+/*===========================================================================*/
+/* Command thread.                                                           */
+/*===========================================================================*/
+
+/*
+ * Reads the rest of a binary command and turns it into a text line.
+ */
+static bool read_packet(BaseChannel *chp, char *line, size_t size,
+                        uint32_t *sequence)
+{
+    uint8_t packet[2 + 4 * HOST_COMMAND_MAX_ARGS + 1];
+    msg_t c = chnGetTimeout(chp, HOST_COMMAND_BYTE_TIMEOUT);
+
+    if (c < 2 || c > 2 + 4 * HOST_COMMAND_MAX_ARGS || (c - 2) % 4 != 0)
+        return false;
+
+    size_t length = (size_t)c;
+    uint8_t sum = (uint8_t)length;
+    for (size_t i = 0; i <= length; i++)
+    {
+        c = chnGetTimeout(chp, HOST_COMMAND_BYTE_TIMEOUT);
+        if (c < 0)
+            return false;
+        packet[i] = (uint8_t)c;
+        sum += packet[i];
+    }
+    if (sum != 0)
+        return false;
+
+    *sequence = packet[0];
+    uint8_t opcode = packet[1];
+    int n;
+    if (opcode >= 1 && opcode <= COMMAND_COUNT)
+        n = chsnprintf(line, size, "%s", commands[opcode - 1].sc_name);
+    else
+        n = chsnprintf(line, size, "op%u", opcode);
+
+    for (size_t i = 2; i < length; i += 4)
+    {
+        uint32_t value = packet[i] | (uint32_t)packet[i + 1] << 8 |
+                         (uint32_t)packet[i + 2] << 16 |
+                         (uint32_t)packet[i + 3] << 24;
+
+        n += chsnprintf(line + n, size - n, " %lu", value);
+    }
+
+    return true;
+}
+
+#if LGCR_USE_HOST_TX
+/*
+ * Reads the rest of a batch.
+ */
+static bool read_batch(BaseChannel *chp)
+{
+    hostbatchresult_t result = HOST_BATCH_MORE;
+
+    host_batch_init(&batch);
+    while (result == HOST_BATCH_MORE)
+    {
+        msg_t c = chnGetTimeout(chp, HOST_COMMAND_BYTE_TIMEOUT);
+
+        if (c < 0)
+            return false;
+        result = host_batch_feed(&batch, (uint8_t)c);
+    }
+
+    return result == HOST_BATCH_DONE;
+}
+
+/*
+ * Queues a batch, the echoes follow in the capture stream.
+ */
+static void run_batch(BaseChannel *chp)
+{
+    char line[HOST_COMMAND_REPLY_SIZE];
+    size_t queued = 0;
+
+    if (!read_batch(chp))
+    {
+        reply_post("# ack - - error packet");
+        return;
+    }
+
+    for (size_t i = 0; i < batch.count; i++)
+    {
+        const HostBatchFrame *frame = &batch.frames[i];
+
+        if (hostTxSubmit(frame->cookie, frame->id, frame->dlc, frame->data))
+            queued++;
+    }
+
+    chsnprintf(line, sizeof(line), "# ack %u send ok frames=%u queued=%u",
+               batch.sequence, (unsigned)batch.count, (unsigned)queued);
+    reply_post(line);
+}
+#endif
+
+static void execute(uint32_t sequence, int argc, char *argv[],
+                    uint32_t received)
+{
+    const ShellCommand *scp = commands;
+    char line[HOST_COMMAND_REPLY_SIZE];
+
+    commandError = NULL;
+    configChanged = false;
+    applyRequested = false;
+
+    while (scp->sc_name != NULL && strcmp(scp->sc_name, argv[0]) != 0)
+        scp++;
+
+    if (scp->sc_name == NULL)
+        commandError = "unknown";
+    else if (argc < 0)
+        commandError = "usage";
+    else
+    {
+        /* Outside of begin/apply a change stands alone.*/
+        if (!staging)
+            config_stage();
+        scp->sc_function((BaseSequentialStream *)&commandStream, argc - 1,
+                         &argv[1]);
+        reply_flush(&commandStream);
+    }
+
+    bool apply = commandError == NULL &&
+                 (applyRequested || (configChanged && !staging));
+    if (apply)
+        (void)config_apply();
+
+    if (commandError != NULL)
+        chsnprintf(line, sizeof(line), "# ack %lu %s error %s", sequence,
+                   argv[0], commandError);
+    else
+        chsnprintf(line, sizeof(line), "# ack %lu %s %s apply=%luus",
+                   sequence, argv[0],
+                   configChanged && staging ? "staged" : "ok",
+                   timestamp_now() - received);
+    reply_post(line);
+}
+
+static LGCR_CCM_DATA THD_WORKING_AREA(hostCommandWa, 768);
+static THD_FUNCTION(hostCommand, arg)
+{
+    char line[HOST_COMMAND_LINE_SIZE];
+    char *argv[HOST_COMMAND_MAX_ARGS + 1];
+    uint32_t textSequence = 0;
+
+    (void)arg;
+    chRegSetThreadName("command");
+
+    while (!chThdShouldTerminateX())
+    {
+        uint32_t sequence = 0;
+        bool text = false;
+        msg_t c = stream_get(&commandStream);
+
+        if (c == HOST_COMMAND_SOH)
+        {
+            if (!read_packet(commandStream.channel, line, sizeof(line),
+                             &sequence))
+            {
+                reply_post("# ack - - error packet");
+                continue;
+            }
+        }
+#if LGCR_USE_HOST_TX
+        else if (c == HOST_BATCH_START)
+        {
+            run_batch(commandStream.channel);
+            continue;
+        }
+#endif
+        else
+        {
+            commandStream.pushback = (uint8_t)c;
+            commandStream.pushedBack = true;
+            commandStream.discard = true;
+            bool reset = shellGetLine((BaseSequentialStream *)&commandStream,
+                                      line, sizeof(line));
+            commandStream.discard = false;
+            if (reset)
+                continue;
+            text = true;
+        }
+
+        /* The acknowledge counts parsing and execution too.*/
+        uint32_t received = timestamp_now();
+        int argc = host_args_split(line, argv, HOST_COMMAND_MAX_ARGS + 1);
+        if (argc == 0)
+            continue;
+        if (text)
+            sequence = textSequence++;
+        execute(sequence, argc, argv, received);
+    }
+}
+
+/*===========================================================================*/
+/* External functions.                                                       */
+/*===========================================================================*/
+
+/**
+ * @brief   Starts the command thread.
+ *
+ * @param[in] chp       Serial channel of the host link.
+ * @param[in] config    Settings in effect.
+ * @param[in] prio      Thread priority, below the receiver.
+ */
+void hostCommandStart(BaseChannel *chp, const HostConfig *config,
+                      tprio_t prio)
+{
+    commandStream.vmt = &streamVmt;
+    commandStream.channel = chp;
+    currentConfig = *config;
+
+    chThdCreateStatic(hostCommandWa, sizeof(hostCommandWa), prio,
+                      hostCommand, NULL);
+}
+
+/**
+ * @brief   Returns settings waiting to be applied.
+ * @details Called by the output thread between two records. It applies
+ *          the difference and must report with @p hostCommandApplied,
+ *          the command waits for it once the settings are taken.
+ *
+ * @param[out] current  The settings in effect.
+ * @param[out] next     The settings to apply.
+ * @return              True if settings are waiting.
+ */
+bool hostCommandGetApply(HostConfig *current, HostConfig *next)
+{
+    bool pending;
+
+    chMtxLock(&configMutex);
+    pending = applyState == APPLY_PENDING;
+    if (pending)
+    {
+        *current = currentConfig;
+        *next = stagedConfig;
+        applyState = APPLY_TAKEN;
+    }
+    chMtxUnlock(&configMutex);
+
+    return pending;
+}
+
+/**
+ * @brief   Reports the end of an apply.
+ *
+ * @param[in] ok        False if nothing was changed.
+ */
+void hostCommandApplied(bool ok)
+{
+    chMtxLock(&configMutex);
+    if (ok)
+        currentConfig = stagedConfig;
+    applyState = APPLY_DONE;
+    applyOk = ok;
+    chMtxUnlock(&configMutex);
+
+    chBSemSignal(&applyDone);
+}
+
+/**
+ * @brief   Takes the next reply line, without line end.
+ *
+ * @return  False if there is none.
+ */
+bool hostCommandGetReply(char *line, size_t size)
+{
+    bool found = false;
+
+    chMtxLock(&replyMutex);
+    if (replyCount > 0)
+    {
+        strncpy(line, replies[replyHead], size - 1);
+        line[size - 1] = '\0';
+        replyHead = (replyHead + 1) % HOST_COMMAND_REPLIES;
+        replyCount--;
+        found = true;
+    }
+    chMtxUnlock(&replyMutex);
+
+    if (found)
+        chSemSignal(&replyFree);
+
+    return found;
+}
+
+/** @} */
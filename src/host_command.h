@@ -0,0 +1,106 @@
+/**
+ * @file    src/host_command.h
+ * @brief   Command channel on the host link.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _HOST_COMMAND_H_
+#define _HOST_COMMAND_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "targetconf.h"
+#include "board_drivers.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   First byte of a binary command.
+ */
+#define HOST_COMMAND_SOH            0x01U
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Longest text command.
+ */
+#if !defined(HOST_COMMAND_LINE_SIZE) || defined(__DOXYGEN__)
+#define HOST_COMMAND_LINE_SIZE      80
+#endif
+
+/**
+ * @brief   Arguments of a command.
+ */
+#if !defined(HOST_COMMAND_MAX_ARGS) || defined(__DOXYGEN__)
+#define HOST_COMMAND_MAX_ARGS       4
+#endif
+
+/**
+ * @brief   Reply lines waiting for the output thread, and their size.
+ */
+#if !defined(HOST_COMMAND_REPLIES) || defined(__DOXYGEN__)
+#define HOST_COMMAND_REPLIES        4
+#endif
+
+#if !defined(HOST_COMMAND_REPLY_SIZE) || defined(__DOXYGEN__)
+#define HOST_COMMAND_REPLY_SIZE     96
+#endif
+
+/**
+ * @brief   Longest gap between the bytes of a binary command.
+ */
+#if !defined(HOST_COMMAND_BYTE_TIMEOUT) || defined(__DOXYGEN__)
+#define HOST_COMMAND_BYTE_TIMEOUT   MS2ST(100)
+#endif
+
+/**
+ * @brief   Time the output thread has to take settings to apply.
+ * @details Settings taken are always applied to the end, the command
+ *          waits for that.
+ */
+#if !defined(HOST_COMMAND_APPLY_TIMEOUT) || defined(__DOXYGEN__)
+#define HOST_COMMAND_APPLY_TIMEOUT  MS2ST(1000)
+#endif
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Settings changed by commands.
+ */
+typedef struct {
+    uint32_t bitrate;
+    uint16_t samplePoint;   /**< Permille of the bit time.                 */
+    bool loopback;          /**< Frames sent are received as well.         */
+    bool compressed;        /**< Compressed output stream.                 */
+    uint32_t heartbeatMs;   /**< Heartbeat frame period, zero is off.      */
+    uint32_t filterCount;   /**< Zero accepts every frame.                 */
+    BoardCanFilter filters[BOARD_CAN_FILTERS];
+} HostConfig;
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void hostCommandStart(BaseChannel *chp, const HostConfig *config,
+                        tprio_t prio);
+  bool hostCommandGetApply(HostConfig *current, HostConfig *next);
+  void hostCommandApplied(bool ok);
+  bool hostCommandGetReply(char *line, size_t size);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HOST_COMMAND_H_ */
+
+/** @} */
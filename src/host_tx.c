@@ -0,0 +1,297 @@
+/**
+ * @file    src/host_tx.c
+ * @brief   Frames sent for the host.
+ * @details The command thread queues the frames of the host, this thread
+ *          keeps the transmit mailboxes filled from the queue. The
+ *          controller sends in request order (TXFP), so the frames leave
+ *          in the order the host gave them.
+ *          The transmit interrupt wakes the thread when a mailbox empties,
+ *          the echo of the frame takes the time of that wake-up: the end
+ *          of the frame on the bus, late by the interrupt and wake-up
+ *          latency only. It is the clock of the received frames.
+ *          A frame not sent within @p HOST_TX_TIMEOUT_US of queueing is
+ *          aborted. Every frame submitted gets exactly one echo.
+ *          The serial link has no flow control of its own, the host sends
+ *          within credits: a window of @p HOST_TX_QUEUE_SIZE frames between
+ *          submission and the end of transmission. Frames given back are
+ *          reported to the output thread as a running count, which enters
+ *          the stream ahead of the backlog, unlike the echoes. Queue and
+ *          credits are host_tx_queue.c, run with the system locked.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include <string.h>
+
+#include "host_tx.h"
+#include "can_frame.h"
+#include "can_echo.h"
+#include "timestamp.h"
+
+#define EVT_TX_DONE                 EVENT_MASK(0)
+#define EVT_TX_QUEUED               EVENT_MASK(1)
+
+/* txempty_event flags, the low half marks mailboxes that sent their frame.*/
+#define MAILBOX_SENT(m)             (1U << (m))
+
+/* Mailbox state, only used by the transmit thread.*/
+typedef struct {
+    bool busy;
+    bool aborted;
+    uint32_t order;         /* Request order, echoes follow it.            */
+    uint32_t cookie;
+    uint32_t queued;
+} TxMailbox;
+
+static hosttxemitcb_t txEmit;
+static thread_t *txThread;
+
+static HostTxQueue txQueue;
+
+static TxMailbox mailboxes[CAN_TX_MAILBOXES];
+static uint32_t txOrder;
+
+static void echo(uint32_t cookie, canechostatus_t status, uint32_t queued,
+                 uint32_t now)
+{
+    CanEcho ep = {cookie, (uint8_t)status, now - queued};
+    CanRecord record;
+
+    can_echo_to_record(&ep, now, &record);
+    txEmit(&record);
+
+    chSysLock();
+    host_tx_queue_done(&txQueue, status);
+    chSysUnlock();
+}
+
+/*
+ * Echoes the frames of the mailboxes that emptied, oldest request first.
+ */
+static void tx_complete(eventflags_t flags, uint32_t now)
+{
+    uint32_t tsr = CANDRIVER.can->TSR;
+
+    while (true)
+    {
+        TxMailbox *done = NULL;
+        size_t m = 0;
+
+        for (size_t i = 0; i < CAN_TX_MAILBOXES; i++)
+        {
+            TxMailbox *mbp = &mailboxes[i];
+
+            if (mbp->busy && (tsr & (CAN_TSR_TME0 << i)) != 0 &&
+                (done == NULL || mbp->order - done->order > 0x80000000U))
+            {
+                done = mbp;
+                m = i;
+            }
+        }
+        if (done == NULL)
+            return;
+
+        /* Automatic retransmission only ends in success or an abort.*/
+        canechostatus_t status = CAN_ECHO_SENT;
+        if (done->aborted && (flags & MAILBOX_SENT(m)) == 0)
+            status = (CANDRIVER.can->ESR & CAN_ESR_BOFF) != 0 ?
+                     CAN_ECHO_BUS_OFF : CAN_ECHO_TIMEOUT;
+        done->busy = false;
+        echo(done->cookie, status, done->queued, now);
+    }
+}
+
+/*
+ * Aborts mailboxes holding a frame past its time, the abort shows as an
+ * empty mailbox.
+ */
+static void tx_expire(uint32_t now)
+{
+    for (size_t i = 0; i < CAN_TX_MAILBOXES; i++)
+    {
+        TxMailbox *mbp = &mailboxes[i];
+
+        if (mbp->busy && !mbp->aborted &&
+            now - mbp->queued >= HOST_TX_TIMEOUT_US)
+        {
+            mbp->aborted = true;
+            CANDRIVER.can->TSR = CAN_TSR_ABRQ0 << (8 * i);
+        }
+    }
+}
+
+/*
+ * Moves queued frames into the free mailboxes. A mailbox taken by the
+ * heartbeat is skipped.
+ */
+static void tx_fill(uint32_t now)
+{
+    for (size_t i = 0; i < CAN_TX_MAILBOXES; i++)
+    {
+        TxMailbox *mbp = &mailboxes[i];
+        HostTxEntry entry;
+        CANTxFrame txf;
+
+        if (mbp->busy)
+            continue;
+
+        while (true)
+        {
+            chSysLock();
+            const HostTxEntry *head = host_tx_queue_peek(&txQueue);
+            if (head == NULL)
+            {
+                chSysUnlock();
+                return;
+            }
+            entry = *head;
+            chSysUnlock();
+
+            if (now - entry.frame.timestamp < HOST_TX_TIMEOUT_US)
+                break;
+
+            /* Waited for a mailbox too long.*/
+            chSysLock();
+            host_tx_queue_pop(&txQueue);
+            chSysUnlock();
+            echo(entry.cookie, CAN_ECHO_TIMEOUT, entry.frame.timestamp, now);
+        }
+
+        canFrameFromRecord(&entry.frame, &txf);
+        if (canTransmit(&CANDRIVER, (canmbx_t)(i + 1), &txf,
+                        TIME_IMMEDIATE) != MSG_OK)
+            continue;
+
+        mbp->busy = true;
+        mbp->aborted = false;
+        mbp->order = txOrder++;
+        mbp->cookie = entry.cookie;
+        mbp->queued = entry.frame.timestamp;
+
+        chSysLock();
+        host_tx_queue_pop(&txQueue);
+        chSysUnlock();
+    }
+}
+
+static bool tx_busy(void)
+{
+    for (size_t i = 0; i < CAN_TX_MAILBOXES; i++)
+    {
+        if (mailboxes[i].busy)
+            return true;
+    }
+
+    return false;
+}
+
+static LGCR_CCM_DATA THD_WORKING_AREA(hostTxWa, 256);
+static THD_FUNCTION(hostTx, arg)
+{
+    event_listener_t el;
+
+    (void)arg;
+    chRegSetThreadName("host_tx");
+
+    chEvtRegister(&CANDRIVER.txempty_event, &el, 0);
+    while (!chThdShouldTerminateX())
+    {
+        /* Frames in a mailbox are checked for their time, and a mailbox
+           the heartbeat had taken may be free again.*/
+        eventmask_t events = chEvtWaitAnyTimeout(ALL_EVENTS,
+                tx_busy() || txQueue.count != 0 ? MS2ST(10) :
+                TIME_INFINITE);
+        uint32_t now = timestamp_now();
+        eventflags_t flags = 0;
+
+        if ((events & EVT_TX_DONE) != 0)
+            flags = chEvtGetAndClearFlags(&el);
+        tx_complete(flags, now);
+        tx_expire(now);
+        tx_fill(now);
+    }
+    chEvtUnregister(&CANDRIVER.txempty_event, &el);
+}
+
+/*===========================================================================*/
+/* External functions.                                                       */
+/*===========================================================================*/
+
+/**
+ * @brief   Starts the transmit thread.
+ *
+ * @param[in] prio      Thread priority, above the receiver keeps the echo
+ *                      times close to the bus.
+ * @param[in] emit      Receives the echoes.
+ */
+void hostTxStart(tprio_t prio, hosttxemitcb_t emit)
+{
+    txEmit = emit;
+    host_tx_queue_init(&txQueue, HOST_TX_QUEUE_SIZE, HOST_TX_CREDIT_STEP);
+    txThread = chThdCreateStatic(hostTxWa, sizeof(hostTxWa), prio, hostTx,
+                                 NULL);
+}
+
+/**
+ * @brief   Queues a frame for the bus.
+ * @details A frame that is not queued is echoed at once.
+ *
+ * @param[in] cookie    Returned with the echo.
+ * @param[in] id        Identifier with @p CAN_RECORD_EXT and
+ *                      @p CAN_RECORD_RTR flags.
+ * @param[in] dlc       Data length code, 0 to 8.
+ * @param[in] data      The data bytes.
+ * @return              True if the frame was queued.
+ */
+bool hostTxSubmit(uint32_t cookie, uint32_t id, uint8_t dlc,
+                  const uint8_t *data)
+{
+    uint32_t now = timestamp_now();
+    canechostatus_t status;
+
+    chSysLock();
+    if (!host_tx_queue_push(&txQueue, cookie, id, dlc, data, now, &status))
+    {
+        chSysUnlock();
+        echo(cookie, status, now, now);
+        return false;
+    }
+    chEvtSignalI(txThread, EVT_TX_QUEUED);
+    chSchRescheduleS();
+    chSysUnlock();
+
+    return true;
+}
+
+/**
+ * @brief   Returns the totals.
+ */
+void hostTxGetStats(HostTxStats *stats)
+{
+    chSysLock();
+    host_tx_queue_stats(&txQueue, stats);
+    chSysUnlock();
+}
+
+/**
+ * @brief   Decides if returned credits are reported.
+ * @details Credits are reported in steps of @p HOST_TX_CREDIT_STEP, and
+ *          at once when nothing is pending any more.
+ *
+ * @param[out] credit   The report.
+ * @param[in] always    Report even without change, on connect.
+ * @return              True if the report is due.
+ */
+bool hostTxGetCredit(HostTxCredit *credit, bool always)
+{
+    bool due;
+
+    chSysLock();
+    due = host_tx_queue_credit(&txQueue, credit, always);
+    chSysUnlock();
+
+    return due;
+}
+
+/** @} */
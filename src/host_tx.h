@@ -0,0 +1,69 @@
+/**
+ * @file    src/host_tx.h
+ * @brief   Frames sent for the host.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _HOST_TX_H_
+#define _HOST_TX_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "targetconf.h"
+#include "host_tx_queue.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Credits returned before they are reported.
+ * @details The frames still pending keep the bus busy until the report.
+ */
+#if !defined(HOST_TX_CREDIT_STEP) || defined(__DOXYGEN__)
+#define HOST_TX_CREDIT_STEP         (HOST_TX_QUEUE_SIZE / 4)
+#endif
+
+/**
+ * @brief   A frame not on the bus this long after it was queued is given
+ *          up, in microseconds.
+ */
+#if !defined(HOST_TX_TIMEOUT_US) || defined(__DOXYGEN__)
+#define HOST_TX_TIMEOUT_US          1000000
+#endif
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Receives the echo records, from the transmit thread and from
+ *          the thread submitting frames.
+ */
+typedef void (*hosttxemitcb_t)(const CanRecord *record);
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void hostTxStart(tprio_t prio, hosttxemitcb_t emit);
+  bool hostTxSubmit(uint32_t cookie, uint32_t id, uint8_t dlc,
+                    const uint8_t *data);
+  void hostTxGetStats(HostTxStats *stats);
+  bool hostTxGetCredit(HostTxCredit *credit, bool always);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HOST_TX_H_ */
+
+/** @} */
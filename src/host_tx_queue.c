@@ -0,0 +1,154 @@
+/**
+ * @file    src/host_tx_queue.c
+ * @brief   Queue and credits of the frames sent for the host.
+ * @details A frame is pending from submission until its echo. Frames
+ *          taken for the bus leave the queue but stay pending, the host
+ *          may have at most @p window frames pending. Frames refused
+ *          (invalid or over the window) are never pending, they are
+ *          echoed at once.
+ *          Returned credits are reported in steps of @p creditStep, and
+ *          at once when nothing is pending any more, so a host waiting
+ *          for its last frames is not held up.
+ *          host_tx.c runs the queue on the controller, canbench's
+ *          simulated device on its simulated bus.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include "host_tx_queue.h"
+
+/**
+ * @brief   Initializes an empty queue.
+ *
+ * @param[in] window        Credits, up to @p HOST_TX_QUEUE_SIZE.
+ * @param[in] creditStep    Credits returned before they are reported.
+ */
+void host_tx_queue_init(HostTxQueue *qp, uint32_t window,
+                        uint32_t creditStep)
+{
+    qp->head = 0;
+    qp->count = 0;
+    qp->window = window < HOST_TX_QUEUE_SIZE ? window : HOST_TX_QUEUE_SIZE;
+    qp->creditStep = creditStep;
+    qp->creditReported = 0;
+    qp->stats.queued = 0;
+    qp->stats.sent = 0;
+    qp->stats.failed = 0;
+    qp->stats.rejected = 0;
+    qp->stats.pending = 0;
+}
+
+/**
+ * @brief   Queues a frame.
+ *
+ * @param[in] id        Identifier with @p CAN_RECORD_EXT and
+ *                      @p CAN_RECORD_RTR flags.
+ * @param[in] dlc       Data length code, 0 to 8.
+ * @param[in] now       Time of submission, the frame's timestamp.
+ * @param[out] status   Why the frame was refused, the status of its echo.
+ * @return              True if the frame was queued.
+ */
+bool host_tx_queue_push(HostTxQueue *qp, uint32_t cookie, uint32_t id,
+                        uint8_t dlc, const uint8_t *data, uint32_t now,
+                        canechostatus_t *status)
+{
+    bool extended = (id & CAN_RECORD_EXT) != 0;
+    uint32_t limit = extended ? CAN_RECORD_ID_MASK : 0x7FFU;
+
+    if ((id & CAN_RECORD_ID_MASK) > limit || dlc > 8 ||
+        (id & CAN_RECORD_SHORT) != 0)
+    {
+        *status = CAN_ECHO_INVALID;
+        return false;
+    }
+    if (host_tx_queue_pending(qp) >= qp->window)
+    {
+        *status = CAN_ECHO_FULL;
+        return false;
+    }
+
+    HostTxEntry *entry = &qp->entries[(qp->head + qp->count) %
+                                      HOST_TX_QUEUE_SIZE];
+    entry->cookie = cookie;
+    can_record_set(&entry->frame, id & CAN_RECORD_ID_MASK, extended,
+                   (id & CAN_RECORD_RTR) != 0, dlc, data, now);
+    qp->count++;
+    qp->stats.queued++;
+
+    return true;
+}
+
+/**
+ * @brief   The oldest frame, NULL if the queue is empty.
+ */
+const HostTxEntry *host_tx_queue_peek(const HostTxQueue *qp)
+{
+    return qp->count > 0 ? &qp->entries[qp->head] : NULL;
+}
+
+/**
+ * @brief   Removes the oldest frame, it stays pending until its echo.
+ */
+void host_tx_queue_pop(HostTxQueue *qp)
+{
+    qp->head = (qp->head + 1) % HOST_TX_QUEUE_SIZE;
+    qp->count--;
+}
+
+/**
+ * @brief   Counts an echo, every frame submitted gets one.
+ */
+void host_tx_queue_done(HostTxQueue *qp, canechostatus_t status)
+{
+    if (status == CAN_ECHO_SENT)
+        qp->stats.sent++;
+    else if (status == CAN_ECHO_FULL || status == CAN_ECHO_INVALID)
+        qp->stats.rejected++;
+    else
+        qp->stats.failed++;
+}
+
+/**
+ * @brief   Frames queued or on their way to the bus.
+ */
+uint32_t host_tx_queue_pending(const HostTxQueue *qp)
+{
+    return qp->stats.queued - qp->stats.sent - qp->stats.failed;
+}
+
+/**
+ * @brief   Returns the totals.
+ */
+void host_tx_queue_stats(const HostTxQueue *qp, HostTxStats *stats)
+{
+    *stats = qp->stats;
+    stats->pending = host_tx_queue_pending(qp);
+}
+
+/**
+ * @brief   Decides if returned credits are reported.
+ *
+ * @param[out] credit   The report.
+ * @param[in] always    Report even without change, on connect.
+ * @return              True if the report is due.
+ */
+bool host_tx_queue_credit(HostTxQueue *qp, HostTxCredit *credit,
+                          bool always)
+{
+    uint32_t pending = host_tx_queue_pending(qp);
+
+    credit->returned = qp->stats.sent + qp->stats.failed +
+                       qp->stats.rejected;
+    credit->free = qp->window - pending;
+
+    uint32_t step = credit->returned - qp->creditReported;
+    if (!always && (step == 0 || (step < qp->creditStep && pending != 0)))
+        return false;
+
+    qp->creditReported = credit->returned;
+
+    return true;
+}
+
+/** @} */
@@ -0,0 +1,102 @@
+/**
+ * @file    src/host_tx_queue.h
+ * @brief   Queue and credits of the frames sent for the host.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _HOST_TX_QUEUE_H_
+#define _HOST_TX_QUEUE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "can_echo.h"
+#include "can_record.h"
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Frames waiting for a transmit mailbox.
+ * @details Also the largest credit window, frames the host may have in
+ *          the device from submission until they left the controller.
+ */
+#if !defined(HOST_TX_QUEUE_SIZE) || defined(__DOXYGEN__)
+#define HOST_TX_QUEUE_SIZE          32
+#endif
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Totals since start.
+ */
+typedef struct {
+    uint32_t queued;        /**< Frames accepted.                          */
+    uint32_t sent;          /**< Frames acknowledged on the bus.           */
+    uint32_t failed;        /**< Frames given up after they were queued.   */
+    uint32_t rejected;      /**< Frames not queued, full or invalid.       */
+    uint32_t pending;       /**< Frames queued or in a mailbox now.        */
+} HostTxStats;
+
+/**
+ * @brief   Credit report.
+ */
+typedef struct {
+    uint32_t returned;      /**< Frames done with since start, any outcome.*/
+    uint32_t free;          /**< Credits the device can take now.          */
+} HostTxCredit;
+
+/**
+ * @brief   A queued frame.
+ */
+typedef struct {
+    uint32_t cookie;
+    CanRecord frame;        /**< Timestamp: time it was queued.            */
+} HostTxEntry;
+
+/**
+ * @brief   Queue state.
+ * @note    Not locked, the caller serializes.
+ */
+typedef struct {
+    HostTxEntry entries[HOST_TX_QUEUE_SIZE];
+    size_t head;
+    size_t count;           /**< Frames not taken for the bus yet.         */
+    uint32_t window;        /**< Credits, frames pending at most.          */
+    uint32_t creditStep;
+    uint32_t creditReported;
+    HostTxStats stats;
+} HostTxQueue;
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void host_tx_queue_init(HostTxQueue *qp, uint32_t window,
+                          uint32_t creditStep);
+  bool host_tx_queue_push(HostTxQueue *qp, uint32_t cookie, uint32_t id,
+                          uint8_t dlc, const uint8_t *data, uint32_t now,
+                          canechostatus_t *status);
+  const HostTxEntry *host_tx_queue_peek(const HostTxQueue *qp);
+  void host_tx_queue_pop(HostTxQueue *qp);
+  void host_tx_queue_done(HostTxQueue *qp, canechostatus_t status);
+  uint32_t host_tx_queue_pending(const HostTxQueue *qp);
+  void host_tx_queue_stats(const HostTxQueue *qp, HostTxStats *stats);
+  bool host_tx_queue_credit(HostTxQueue *qp, HostTxCredit *credit,
+                            bool always);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HOST_TX_QUEUE_H_ */
+
+/** @} */
@@ -0,0 +1,301 @@
+/**
+ * @file    src/isotp_engine.c
+ * @brief   ISO-TP sessions on the bus.
+ * @details The receiver hands every frame to the engine, see can_isotp.c.
+ *          Frames of sniffed identifiers and of active channels are taken
+ *          and not captured, complete messages enter the stream as
+ *          records in order with the frames around them. Flow control is
+ *          sent from the receiver thread, right when the first frame or
+ *          the last frame of a block arrives.
+ *          This thread sends the consecutive frames of the messages of
+ *          the host, spaced by the separation time the receiver asked
+ *          for, and gives up sessions past their time. It wakes at the
+ *          next deadline, on a flow control and when a mailbox empties.
+ *          The host writes a message in pieces, in order, then sends it
+ *          on a channel. Every send ends in one result record, it skips
+ *          the trigger like the transmit echoes.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include <string.h>
+
+#include "isotp_engine.h"
+#include "can_frame.h"
+#include "timestamp.h"
+
+#define EVT_TX_DONE                 EVENT_MASK(0)
+#define EVT_WAKE                    EVENT_MASK(1)
+
+typedef struct {
+    uint32_t timestamp;
+    isotpreservecb_t reserve;
+    isotpemitcb_t emit;
+} EmitContext;
+
+static CanIsoTp engine;
+static CanIsoTpSession sessions[ISOTP_SESSIONS];
+static uint8_t sessionBuffers[ISOTP_SESSIONS][ISOTP_PDU_SIZE];
+
+static isotpemitcb_t resultEmit;
+static thread_t *engineThread;
+static uint32_t engineDropped;
+
+/* Message of the host, bytes written since the first piece.*/
+static uint8_t loadBuffer[ISOTP_PDU_SIZE];
+static uint32_t loadSize;
+
+static MUTEX_DECL(engineMutex);
+
+static void emit_record(const CanRecord *record, void *arg)
+{
+    EmitContext *context = arg;
+
+    context->emit(record);
+}
+
+static void emit_pdu(const CanIsoTpPdu *pdu, void *arg)
+{
+    EmitContext *context = arg;
+
+    /* A message is captured whole or not at all.*/
+    if (!context->reserve(CAN_ISOTP_RECORDS(pdu->length)))
+    {
+        engineDropped++;
+        return;
+    }
+    can_isotp_pdu_to_records(pdu, emit_record, arg);
+}
+
+static void emit_result(const CanIsoTpResult *result, void *arg)
+{
+    EmitContext *context = arg;
+    CanRecord record;
+
+    can_isotp_result_to_record(result, context->timestamp, &record);
+    resultEmit(&record);
+}
+
+static bool send_frame(uint32_t key, const uint8_t *data, void *arg)
+{
+    CanRecord record;
+    CANTxFrame txf;
+
+    (void)arg;
+    can_record_set(&record, key & CAN_RECORD_ID_MASK,
+                   (key & CAN_RECORD_EXT) != 0, false, 8, data, 0);
+    canFrameFromRecord(&record, &txf);
+
+    return canTransmit(&CANDRIVER, CAN_ANY_MAILBOX, &txf,
+                       TIME_IMMEDIATE) == MSG_OK;
+}
+
+static const CanIsoTpOps engineOps = {emit_pdu, emit_result, send_frame};
+
+/*
+ * Ticks to wait for a deadline. A frame that found no mailbox waits a
+ * tick at most, long waits are converted in milliseconds against
+ * overflow.
+ */
+static systime_t wait_ticks(uint32_t us)
+{
+    if (us == CAN_ISOTP_NO_DEADLINE)
+        return TIME_INFINITE;
+    if (us < 1000000U / CH_CFG_ST_FREQUENCY)
+        return (systime_t)1;
+    if (us >= 100000U)
+        return MS2ST((us + 999U) / 1000U);
+
+    return US2ST(us);
+}
+
+static LGCR_CCM_DATA THD_WORKING_AREA(isotpEngineWa, 256);
+static THD_FUNCTION(isotpEngine, arg)
+{
+    event_listener_t el;
+
+    (void)arg;
+    chRegSetThreadName("isotp");
+
+    chEvtRegister(&CANDRIVER.txempty_event, &el, 0);
+    while (!chThdShouldTerminateX())
+    {
+        EmitContext context = {timestamp_now(), NULL, NULL};
+        uint32_t wait;
+
+        chMtxLock(&engineMutex);
+        wait = can_isotp_poll(&engine, context.timestamp, &engineOps,
+                              &context);
+        chMtxUnlock(&engineMutex);
+
+        eventmask_t events = chEvtWaitAnyTimeout(ALL_EVENTS,
+                                                 wait_ticks(wait));
+        if ((events & EVT_TX_DONE) != 0)
+            (void)chEvtGetAndClearFlags(&el);
+    }
+    chEvtUnregister(&CANDRIVER.txempty_event, &el);
+}
+
+/*===========================================================================*/
+/* External functions.                                                       */
+/*===========================================================================*/
+
+/**
+ * @brief   Starts the engine thread.
+ *
+ * @param[in] prio      Thread priority.
+ * @param[in] ranges    Sniffed identifiers, kept.
+ * @param[in] emit      Receives the results of the messages sent.
+ */
+void isotpEngineStart(tprio_t prio, const CanIsoTpRange *ranges,
+                      size_t rangeCount, isotpemitcb_t emit)
+{
+    chMtxLock(&engineMutex);
+    can_isotp_init(&engine, ranges, rangeCount, sessions, ISOTP_SESSIONS,
+                   &sessionBuffers[0][0], ISOTP_PDU_SIZE);
+    engine.blockSize = ISOTP_BLOCK_SIZE;
+    engine.stmin = ISOTP_STMIN;
+    chMtxUnlock(&engineMutex);
+
+    resultEmit = emit;
+    engineThread = chThdCreateStatic(isotpEngineWa, sizeof(isotpEngineWa),
+                                     prio, isotpEngine, NULL);
+}
+
+/**
+ * @brief   Takes a received frame if it is an ISO-TP frame.
+ *
+ * @param[in] reserve   Makes room for the records of a message completed.
+ * @param[in] emit      Takes the records of a message completed.
+ * @return              False if the frame is to be captured.
+ */
+bool isotpEngineFrame(const CanRecord *record, isotpreservecb_t reserve,
+                      isotpemitcb_t emit)
+{
+    EmitContext context = {record->timestamp, reserve, emit};
+    bool taken;
+    bool wake;
+
+    chMtxLock(&engineMutex);
+    taken = can_isotp_frame(&engine, record, &engineOps, &context);
+    wake = engine.wake;
+    chMtxUnlock(&engineMutex);
+
+    /* A flow control let a message of the host go on.*/
+    if (wake)
+        chEvtSignal(engineThread, EVT_WAKE);
+
+    return taken;
+}
+
+/**
+ * @brief   Opens an active channel.
+ *
+ * @param[in] rxKey     Identifier received, with @p CAN_RECORD_EXT.
+ * @param[in] txKey     Identifier sent.
+ * @return              False if the channel is open or out of range.
+ */
+bool isotpEngineOpen(uint8_t channel, uint32_t rxKey, uint32_t txKey)
+{
+    bool ok;
+
+    chMtxLock(&engineMutex);
+    ok = can_isotp_open(&engine, channel, rxKey, txKey);
+    chMtxUnlock(&engineMutex);
+
+    return ok;
+}
+
+/**
+ * @brief   Closes an active channel, a message in transfer is given up.
+ */
+void isotpEngineClose(uint8_t channel)
+{
+    EmitContext context = {timestamp_now(), NULL, NULL};
+
+    chMtxLock(&engineMutex);
+    can_isotp_close(&engine, channel, &engineOps, &context);
+    chMtxUnlock(&engineMutex);
+}
+
+/**
+ * @brief   Returns a channel.
+ *
+ * @return  False if it is out of range.
+ */
+bool isotpEngineGetChannel(uint8_t channel, CanIsoTpChannel *cp)
+{
+    if (channel >= CAN_ISOTP_CHANNELS)
+        return false;
+
+    chMtxLock(&engineMutex);
+    *cp = engine.channels[channel];
+    chMtxUnlock(&engineMutex);
+
+    return true;
+}
+
+/**
+ * @brief   Writes a piece of a message to send.
+ *
+ * @param[in] offset    Bytes written before, zero starts a new message.
+ * @return              False if the piece is out of order or does not fit.
+ */
+bool isotpEngineLoad(uint32_t offset, const uint8_t *data, size_t n)
+{
+    bool ok;
+
+    chMtxLock(&engineMutex);
+    if (offset == 0)
+        loadSize = 0;
+    ok = offset == loadSize && n <= ISOTP_PDU_SIZE - offset;
+    if (ok)
+    {
+        memcpy(&loadBuffer[offset], data, n);
+        loadSize += n;
+    }
+    chMtxUnlock(&engineMutex);
+
+    return ok;
+}
+
+/**
+ * @brief   Sends the first @p length bytes written on a channel.
+ * @details The result record follows at once or when the last frame went
+ *          out.
+ */
+void isotpEngineSend(uint32_t cookie, uint8_t channel, uint32_t length)
+{
+    EmitContext context = {timestamp_now(), NULL, NULL};
+    bool started = false;
+
+    chMtxLock(&engineMutex);
+    if (length <= loadSize)
+        started = can_isotp_send(&engine, channel, cookie, loadBuffer, length,
+                                 context.timestamp, &engineOps, &context);
+    else
+    {
+        CanIsoTpResult result = {cookie, channel, CAN_ISOTP_INVALID};
+
+        emit_result(&result, &context);
+    }
+    chMtxUnlock(&engineMutex);
+
+    if (started)
+        chEvtSignal(engineThread, EVT_WAKE);
+}
+
+/**
+ * @brief   Returns the totals.
+ */
+void isotpEngineGetStats(IsotpEngineStats *stats)
+{
+    chMtxLock(&engineMutex);
+    stats->active = (uint32_t)can_isotp_active(&engine);
+    stats->dropped = engineDropped;
+    stats->totals = engine.stats;
+    chMtxUnlock(&engineMutex);
+}
+
+/** @} */
@@ -0,0 +1,111 @@
+/**
+ * @file    src/isotp_engine.h
+ * @brief   ISO-TP sessions on the bus.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _ISOTP_ENGINE_H_
+#define _ISOTP_ENGINE_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "targetconf.h"
+#include "can_isotp.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Messages in transfer at the same time.
+ */
+#if !defined(ISOTP_SESSIONS) || defined(__DOXYGEN__)
+#define ISOTP_SESSIONS              8
+#endif
+
+/**
+ * @brief   Longest message in bytes, each session and the transmit
+ *          buffer take as much.
+ */
+#if !defined(ISOTP_PDU_SIZE) || defined(__DOXYGEN__)
+#define ISOTP_PDU_SIZE              512
+#endif
+
+/**
+ * @brief   Block size of the flow control sent, zero is no limit.
+ */
+#if !defined(ISOTP_BLOCK_SIZE) || defined(__DOXYGEN__)
+#define ISOTP_BLOCK_SIZE            0
+#endif
+
+/**
+ * @brief   Separation time of the flow control sent, ISO 15765-2 coding.
+ */
+#if !defined(ISOTP_STMIN) || defined(__DOXYGEN__)
+#define ISOTP_STMIN                 0
+#endif
+
+/*===========================================================================*/
+/* Derived constants and error checks.                                       */
+/*===========================================================================*/
+
+#if ISOTP_PDU_SIZE < 8 || ISOTP_PDU_SIZE > 4095
+#error "ISOTP_PDU_SIZE must be 8 to 4095"
+#endif
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Sessions in use and totals since start.
+ */
+typedef struct {
+    uint32_t active;
+    uint32_t dropped;       /**< Messages with no room to be captured.     */
+    CanIsoTpStats totals;
+} IsotpEngineStats;
+
+/**
+ * @brief   Receives message and result records.
+ */
+typedef void (*isotpemitcb_t)(const CanRecord *record);
+
+/**
+ * @brief   Makes room for the @p count records of a message, all of them
+ *          or none.
+ *
+ * @return  False if the message is to be dropped.
+ */
+typedef bool (*isotpreservecb_t)(size_t count);
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void isotpEngineStart(tprio_t prio, const CanIsoTpRange *ranges,
+                        size_t rangeCount, isotpemitcb_t emit);
+  bool isotpEngineFrame(const CanRecord *record, isotpreservecb_t reserve,
+                        isotpemitcb_t emit);
+  bool isotpEngineOpen(uint8_t channel, uint32_t rxKey, uint32_t txKey);
+  void isotpEngineClose(uint8_t channel);
+  bool isotpEngineGetChannel(uint8_t channel, CanIsoTpChannel *cp);
+  bool isotpEngineLoad(uint32_t offset, const uint8_t *data, size_t n);
+  void isotpEngineSend(uint32_t cookie, uint8_t channel, uint32_t length);
+  void isotpEngineGetStats(IsotpEngineStats *stats);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _ISOTP_ENGINE_H_ */
+
+/** @} */
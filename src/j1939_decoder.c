@@ -0,0 +1,146 @@
+/**
+ * @file    src/j1939_decoder.c
+ * @brief   J1939 transport reassembly and PGN filter.
+ * @details The receiver hands every frame to the decoder, see
+ *          can_j1939.c. Transport frames are taken and not captured, a
+ *          complete transfer enters the stream as one message in order
+ *          with the frames around it. Other extended frames are captured
+ *          if their group is passed.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include "j1939_decoder.h"
+
+typedef struct {
+    j1939reservecb_t reserve;
+    j1939emitcb_t emit;
+    bool dropping;          /**< The records of the message are skipped.   */
+} EmitContext;
+
+static CanJ1939 j1939;
+static CanJ1939Session sessions[J1939_SESSIONS];
+static uint8_t buffers[J1939_SESSIONS * CAN_J1939_MAX_LENGTH];
+static uint32_t decoderDropped;
+
+static MUTEX_DECL(j1939Mutex);
+
+static void emit_record(const CanRecord *record, void *arg)
+{
+    EmitContext *context = arg;
+    CanJ1939Record j1939Record;
+
+    /* A message is captured whole or not at all, room for all of its
+       records is made before the start record that carries the length.*/
+    if (can_j1939_from_record(record, &j1939Record) &&
+        j1939Record.type == CAN_J1939_RECORD_START)
+    {
+        context->dropping =
+            !context->reserve(CAN_J1939_RECORDS(j1939Record.length));
+        if (context->dropping)
+            decoderDropped++;
+    }
+    if (!context->dropping)
+        context->emit(record);
+}
+
+/*===========================================================================*/
+/* External functions.                                                       */
+/*===========================================================================*/
+
+/**
+ * @brief   Starts with no transfers and the given groups passed.
+ *
+ * @param[in] pgns      Groups passed, none passes every group.
+ */
+void j1939DecoderInit(const uint32_t *pgns, size_t pgnCount)
+{
+    chMtxLock(&j1939Mutex);
+    can_j1939_init(&j1939, sessions, J1939_SESSIONS, buffers);
+    for (size_t i = 0; i < pgnCount; i++)
+        can_j1939_pass(&j1939, pgns[i]);
+    chMtxUnlock(&j1939Mutex);
+}
+
+/**
+ * @brief   Takes a received frame if it is a transport frame or its group
+ *          is not passed.
+ *
+ * @param[in] reserve   Makes room for the records of a message the frame
+ *                      completed.
+ * @param[in] emit      Takes the records of a message the frame completed.
+ * @return              False if the frame is to be captured.
+ */
+bool j1939DecoderFrame(const CanRecord *record, j1939reservecb_t reserve,
+                       j1939emitcb_t emit)
+{
+    EmitContext context = {reserve, emit, false};
+    bool taken;
+
+    chMtxLock(&j1939Mutex);
+    taken = can_j1939_frame(&j1939, record, emit_record, &context);
+    chMtxUnlock(&j1939Mutex);
+
+    return taken;
+}
+
+/**
+ * @brief   Adds a group to the pass list, other groups are no longer
+ *          passed.
+ *
+ * @return  False if the list is full or the PGN out of range.
+ */
+bool j1939DecoderPass(uint32_t pgn)
+{
+    bool done;
+
+    chMtxLock(&j1939Mutex);
+    done = can_j1939_pass(&j1939, pgn);
+    chMtxUnlock(&j1939Mutex);
+
+    return done;
+}
+
+/**
+ * @brief   Passes every group again.
+ */
+void j1939DecoderPassAll(void)
+{
+    chMtxLock(&j1939Mutex);
+    can_j1939_pass_all(&j1939);
+    chMtxUnlock(&j1939Mutex);
+}
+
+/**
+ * @brief   Copies the pass list.
+ *
+ * @return  Groups copied, zero if every group is passed.
+ */
+size_t j1939DecoderGetPass(uint32_t *pgns, size_t max)
+{
+    size_t n;
+
+    chMtxLock(&j1939Mutex);
+    n = j1939.passCount < max ? j1939.passCount : max;
+    for (size_t i = 0; i < n; i++)
+        pgns[i] = j1939.pass[i];
+    chMtxUnlock(&j1939Mutex);
+
+    return n;
+}
+
+/**
+ * @brief   Returns the sessions in use and the totals.
+ */
+void j1939DecoderGetStats(J1939DecoderStats *stats)
+{
+    chMtxLock(&j1939Mutex);
+    stats->active = can_j1939_active(&j1939);
+    stats->passCount = j1939.passCount;
+    stats->dropped = decoderDropped;
+    stats->totals = j1939.stats;
+    chMtxUnlock(&j1939Mutex);
+}
+
+/** @} */
@@ -0,0 +1,88 @@
+/**
+ * @file    src/j1939_decoder.h
+ * @brief   J1939 transport reassembly and PGN filter.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _J1939_DECODER_H_
+#define _J1939_DECODER_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "targetconf.h"
+#include "can_j1939.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Transfers in progress at the same time, each session takes
+ *          @p CAN_J1939_MAX_LENGTH bytes.
+ */
+#if !defined(J1939_SESSIONS) || defined(__DOXYGEN__)
+#define J1939_SESSIONS              4
+#endif
+
+/*===========================================================================*/
+/* Derived constants and error checks.                                       */
+/*===========================================================================*/
+
+#if J1939_SESSIONS < 1
+#error "J1939_SESSIONS must be at least 1"
+#endif
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Sessions in use, groups passed and totals since start.
+ */
+typedef struct {
+    uint32_t active;
+    uint32_t passCount;     /**< Zero passes every group.                  */
+    uint32_t dropped;       /**< Messages with no room to be captured.     */
+    CanJ1939Stats totals;
+} J1939DecoderStats;
+
+/**
+ * @brief   Receives the records of a message, in the receiver thread.
+ */
+typedef void (*j1939emitcb_t)(const CanRecord *record);
+
+/**
+ * @brief   Makes room for the @p count records of a message, all of them
+ *          or none.
+ *
+ * @return  False if the message is to be dropped.
+ */
+typedef bool (*j1939reservecb_t)(size_t count);
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void j1939DecoderInit(const uint32_t *pgns, size_t pgnCount);
+  bool j1939DecoderFrame(const CanRecord *record, j1939reservecb_t reserve,
+                         j1939emitcb_t emit);
+  bool j1939DecoderPass(uint32_t pgn);
+  void j1939DecoderPassAll(void);
+  size_t j1939DecoderGetPass(uint32_t *pgns, size_t max);
+  void j1939DecoderGetStats(J1939DecoderStats *stats);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _J1939_DECODER_H_ */
+
+/** @} */
@@ -8,10 +8,104 @@
 #include "targetconf.h"
 
 #include "chprintf.h"
+#include "memstreams.h"
 
+#include <stdarg.h>
 #include <stdlib.h>
 
 #include "mod_led.h"
+#include "timestamp.h"
+#include "can_record.h"
+#include "can_frame.h"
+#include "can_backlog.h"
+
+#if LGCR_USE_GSUSB
+#include "usbcfg_gsusb.h"
+#endif
+#if LGCR_USE_UART_DMA
+#include "uart_stream.h"
+#endif
+#if LGCR_USE_TRIGGER
+#include "can_trigger.h"
+#endif
+#if LGCR_USE_FLASH_LOG
+#include "flash_logger.h"
+#endif
+#if LGCR_USE_COMPRESS
+#include "can_codec.h"
+#endif
+#if LGCR_USE_ADAPTIVE && !LGCR_USE_GSUSB
+#include "can_degrade.h"
+#endif
+#if LGCR_USE_SNAPSHOT
+#include "can_snapshot.h"
+#endif
+#if LGCR_USE_AUTOBAUD
+#include "can_autobaud.h"
+#endif
+#if LGCR_USE_BUS_EVENTS
+#include "can_event.h"
+#endif
+#if LGCR_USE_COMMANDS
+#include "host_command.h"
+#endif
+#if LGCR_USE_HOST_TX
+#include "host_tx.h"
+#include "can_echo.h"
+#endif
+#if LGCR_USE_GENERATOR
+#include "traffic_gen.h"
+#endif
+#if LGCR_USE_SIGNALS
+#include "signal_decoder.h"
+#endif
+#if LGCR_USE_BMS
+#include "bms_monitor.h"
+#endif
+#if LGCR_USE_ISOTP
+#include "isotp_engine.h"
+#endif
+#if LGCR_USE_J1939
+#include "j1939_decoder.h"
+#endif
+
+#if LGCR_USE_SNAPSHOT && (LGCR_USE_TRIGGER || LGCR_USE_ADAPTIVE)
+#error "snapshot output replaces the stream, no trigger or adaptive output"
+#endif
+#if LGCR_USE_AUTOBAUD && LGCR_USE_GSUSB
+#error "with gs_usb the host sets the bitrate"
+#endif
+#if LGCR_USE_COMMANDS && (LGCR_USE_GSUSB || LGCR_USE_UART_DMA)
+#error "commands are read from the serial channel of the host link"
+#endif
+#if LGCR_USE_HOST_TX && (!LGCR_USE_COMMANDS || LGCR_USE_SNAPSHOT)
+#error "host frames come with the commands, their echoes need the stream"
+#endif
+#if LGCR_USE_GENERATOR && LGCR_USE_GSUSB
+#error "the generator is reported in the stream"
+#endif
+#if LGCR_USE_SIGNALS && (!LGCR_USE_COMMANDS || LGCR_USE_SNAPSHOT)
+#error "signal tables come with the commands, their values need the stream"
+#endif
+#if LGCR_USE_BMS && (LGCR_USE_GSUSB || LGCR_USE_SNAPSHOT)
+#error "cell summaries and alerts are reported in the stream"
+#endif
+#if LGCR_USE_ISOTP && (LGCR_USE_GSUSB || LGCR_USE_SNAPSHOT)
+#error "ISO-TP messages are reported in the stream"
+#endif
+#if LGCR_USE_ISOTP
+#if CAN_ISOTP_RECORDS(ISOTP_PDU_SIZE) > CAN_BACKLOG_SIZE
+#error "the longest ISO-TP message does not fit CAN_BACKLOG_SIZE"
+#endif
+#endif
+#if LGCR_USE_J1939 && (LGCR_USE_GSUSB || LGCR_USE_SNAPSHOT)
+#error "J1939 messages are reported in the stream"
+#endif
+#if LGCR_USE_J1939
+#if CAN_J1939_RECORDS(CAN_J1939_MAX_LENGTH) > CAN_BACKLOG_SIZE
+#error "the longest J1939 transfer does not fit CAN_BACKLOG_SIZE"
+#endif
+#endif
 
 ModLED LED_BMS_HEARTBEAT;
 ModLED LED_CAN_RX;
@@ -21,43 +115,963 @@ ModLED LED_BOARDHEARTBEAT;
 
 #define USE_WDG FALSE
 
-//Declare Messagepool for at least 5 msg
-static CANRxFrame CANRxFrameBuffer[10];
-static MEMORYPOOL_DECL(canRXMessagesPool, sizeof(CANRxFrame), NULL);
+#define HEARTBEAT_PERIOD_MS 20000
+
+// changed by the output thread when commands are applied
+static volatile uint32_t heartbeatPeriodMs = HEARTBEAT_PERIOD_MS;
+
+/*
+ * Boot timing, microseconds since kernel start.
+ */
+static uint32_t bootCaptureReadyUs;
+static uint32_t bootFirstFrameUs;
+static bool bootFirstFrameSeen;
+
+/*
+ * Backlog overload behaviour, see targetconf.h.
+ */
+#if defined(CAN_BACKLOG_PROTECTED_IDS)
+static const CanIdRange backlogProtected[] = { CAN_BACKLOG_PROTECTED_IDS };
+#endif
+
+#if LGCR_USE_TRIGGER
+static const CanTriggerConfig triggerConfig = CAN_TRIGGER_CONFIG;
+#endif
+
+#if LGCR_USE_BUS_EVENTS
+// written by the receiver, counters read by the output thread
+static CanEventTracker busEvents;
+#endif
+
+#if LGCR_USE_GENERATOR
+static const CanGenConfig trafficGenConfig = TRAFFIC_GEN_CONFIG;
+#endif
+
+#if LGCR_USE_BMS
+static const CanBmsFrame bmsFrames[] = { BMS_CELL_FRAMES };
+static const CanBmsLimits bmsLimits[CAN_BMS_KINDS] = BMS_LIMITS;
+#endif
+
+#if LGCR_USE_ISOTP
+static const CanIsoTpRange isotpRanges[] = { ISOTP_RANGES };
+#endif
+
+#if LGCR_USE_J1939 && defined(J1939_PASS_PGNS)
+static const uint32_t j1939Pass[] = { J1939_PASS_PGNS };
+#endif
+
+static const CanBacklogPolicy backlogPolicy = {
+    CAN_BACKLOG_POLICY,
+#if defined(CAN_BACKLOG_PROTECTED_IDS)
+    backlogProtected,
+    sizeof(backlogProtected) / sizeof(backlogProtected[0])
+#else
+    NULL,
+    0
+#endif
+};
+
+#if !LGCR_USE_GSUSB
+#if LGCR_USE_COMPRESS
+static CanEncoder outputEncoder;
+// with adaptive output the stream starts as text
+static bool outputCompressed = !LGCR_USE_ADAPTIVE;
+#endif
+#if LGCR_USE_ADAPTIVE
+// the CCM is taken by the backlog
+static CanDegrade outputDegrade;
+#endif
+
+/*
+ * Writes formatted output to the host link.
+ */
+static size_t output_write(const uint8_t *buf, size_t n)
+{
+#if LGCR_USE_UART_DMA
+    size_t written = uart_stream_write(buf, n, MS2ST(100));
+#else
+    size_t written = chnWriteTimeout((BaseChannel* )&SERIALDRIVER, buf, n,
+            MS2ST(100));
+#endif
+
+#if LGCR_USE_COMPRESS
+    // a cut token leaves the decoder out of step until the next sync
+    if (written != n)
+        can_encoder_reset(&outputEncoder);
+#endif
+
+    return written;
+}
+
+/*
+ * Writes a marker line. In compressed mode the line is sent as a text
+ * token, without the line end.
+ */
+static void output_printf(char *buf, size_t size, const char *fmt, ...)
+{
+    va_list ap;
+    MemoryStream ms;
+
+#if LGCR_USE_COMPRESS
+    char *text = buf + CAN_CODEC_TEXT_OFFSET;
+    msObjectInit(&ms, (uint8_t* )text, size - CAN_CODEC_TEXT_OFFSET, 0);
+#else
+    char *text = buf;
+    msObjectInit(&ms, (uint8_t* )text, size, 0);
+#endif
+    va_start(ap, fmt);
+    chvprintf((BaseSequentialStream* )&ms, fmt, ap);
+    va_end(ap);
+
+#if LGCR_USE_COMPRESS
+    if (outputCompressed)
+    {
+        size_t n = ms.eos;
+        while (n > 0 && (text[n - 1] == '\r' || text[n - 1] == '\n'))
+            n--;
+        output_write((uint8_t* )buf,
+                can_encoder_text(&outputEncoder, text, n, (uint8_t* )buf));
+        return;
+    }
+#endif
+    output_write((uint8_t* )text, ms.eos);
+}
+
+/*
+ * Writes a line formatted by chsnprintf. A line longer than the buffer is
+ * sent cut, with its line end. A line the host link did not take in full
+ * is ended where it was cut and not delivered, the entry is sent again.
+ */
+static bool output_line(char *buf, size_t size, int bytes)
+{
+    size_t n = bytes > 0 ? (size_t)bytes : 0;
+
+    if (n >= size)
+    {
+        n = size - 1;
+        buf[n - 2] = '\r';
+        buf[n - 1] = '\n';
+    }
+
+    size_t written = output_write((uint8_t* )buf, n);
+    if (written == n)
+        return true;
+    if (written != 0)
+        output_write((const uint8_t* )"\r\n", 2);
+
+    return false;
+}
+
+/*
+ * Writes one frame, as a line or as a compressed token.
+ */
+static bool output_record(const CanRecord *record, char *buf, size_t size)
+{
+#if LGCR_USE_COMPRESS
+    if (outputCompressed)
+    {
+        size_t n = can_encoder_frame(&outputEncoder, record, (uint8_t* )buf);
+        return output_write((uint8_t* )buf, n) == n;
+    }
+#endif
+
+#if LGCR_USE_BUS_EVENTS
+    CanEvent event;
+
+    if (can_event_from_record(record, &event))
+    {
+        int bytes = chsnprintf(buf, size,
+                "# error @%lu lec=%s state=%s tec=%u rec=%u folded=%u%s\r\n",
+                record->timestamp, can_event_lec_name(event.lec),
+                can_event_state_name(event.state), event.tec, event.rec,
+                event.folded,
+                (event.flags & CAN_EVENT_OVERFLOW) != 0 ? " overflow" : "");
+
+        return output_line(buf, size, bytes);
+    }
+#endif
+#if LGCR_USE_HOST_TX
+    CanEcho echo;
+
+    if (can_echo_from_record(record, &echo))
+    {
+        int bytes = chsnprintf(buf, size, "# echo %lu @%lu %s delay=%luus\r\n",
+                echo.cookie, record->timestamp,
+                can_echo_status_name(echo.status), echo.delay);
+
+        return output_line(buf, size, bytes);
+    }
+#endif
+#if LGCR_USE_SIGNALS
+    CanSignalValue value;
+
+    if (can_signal_from_record(record, &value))
+    {
+        char text[CAN_SIGNAL_TEXT_SIZE];
+
+        (void) can_signal_format(&value, text);
+        int bytes = chsnprintf(buf, size, "# sig %u %s @%lu\r\n",
+                value.index, text, record->timestamp);
+
+        return output_line(buf, size, bytes);
+    }
+#endif
+#if LGCR_USE_BMS
+    CanBmsAlert alert;
+
+    if (can_bms_alert_from_record(record, &alert))
+    {
+        char where[16];
+
+        if (alert.module == CAN_BMS_PACK)
+            chsnprintf(where, sizeof(where), "pack");
+        else if (alert.cell == CAN_BMS_NO_CELL)
+            chsnprintf(where, sizeof(where), "m%u", alert.module);
+        else
+            chsnprintf(where, sizeof(where), "m%uc%u", alert.module,
+                    alert.cell);
+        int bytes = chsnprintf(buf, size,
+                "# bms %s %s %s %s %d limit=%d @%lu\r\n",
+                alert.cleared ? "clear" : "alert",
+                can_bms_kind_name(alert.kind),
+                can_bms_condition_name(alert.condition), where, alert.value,
+                alert.limit, record->timestamp);
+
+        return output_line(buf, size, bytes);
+    }
+#endif
+#if LGCR_USE_ISOTP
+    CanIsoTpRecord isotp;
+
+    if (can_isotp_from_record(record, &isotp))
+    {
+        char channel[8];
+        int bytes;
+
+        if (isotp.type == CAN_ISOTP_RECORD_START)
+        {
+            if (isotp.channel == CAN_ISOTP_PASSIVE)
+                chsnprintf(channel, sizeof(channel), "sniffed");
+            else
+                chsnprintf(channel, sizeof(channel), "ch=%u", isotp.channel);
+            bytes = chsnprintf(buf, size,
+                    "# isotp %u %lx %s len=%u %s @%lu\r\n",
+                    isotp.counter, isotp.key & CAN_RECORD_ID_MASK,
+                    (isotp.key & CAN_RECORD_EXT) != 0 ? "ext" : "std",
+                    isotp.length, channel, record->timestamp);
+        }
+        else if (isotp.type == CAN_ISOTP_RECORD_DATA)
+            bytes = chsnprintf(buf, size,
+                    "# isotp %u data %02x%02x%02x%02x%02x%02x%02x\r\n",
+                    isotp.counter, isotp.data[0], isotp.data[1],
+                    isotp.data[2], isotp.data[3], isotp.data[4],
+                    isotp.data[5], isotp.data[6]);
+        else
+            bytes = chsnprintf(buf, size,
+                    "# isotp sent %lu ch=%u %s @%lu\r\n",
+                    isotp.result.cookie, isotp.result.channel,
+                    can_isotp_result_name(isotp.result.result),
+                    record->timestamp);
+
+        return output_line(buf, size, bytes);
+    }
+#endif
+#if LGCR_USE_J1939
+    CanJ1939Record j1939;
+
+    if (can_j1939_from_record(record, &j1939))
+    {
+        int bytes;
+
+        if (j1939.type == CAN_J1939_RECORD_START)
+            bytes = chsnprintf(buf, size,
+                    "# j1939 %u pgn=%05lx pri=%u sa=%02x da=%02x len=%u @%lu\r\n",
+                    j1939.counter, j1939.pgn, j1939.priority, j1939.sa,
+                    j1939.da, j1939.length, record->timestamp);
+        else
+            bytes = chsnprintf(buf, size,
+                    "# j1939 %u data %02x%02x%02x%02x%02x%02x%02x\r\n",
+                    j1939.counter, j1939.data[0], j1939.data[1],
+                    j1939.data[2], j1939.data[3], j1939.data[4],
+                    j1939.data[5], j1939.data[6]);
+
+        return output_line(buf, size, bytes);
+    }
+#endif
+
+    uint32_t data32[2];
+
+    (void) can_record_get_data(record, (uint8_t* )data32);
+    int bytes = chsnprintf(buf, size,
+            "%08lx: %08lx %08lx @%lu\r\n", CAN_RECORD_GET_ID(record),
+            data32[0], data32[1], record->timestamp);
+
+    // write buffer to host stream
+    return output_line(buf, size, bytes);
+}
+#endif
+
+#if LGCR_USE_FLASH_LOG && !LGCR_USE_GSUSB
+typedef struct {
+    char *buf;
+    size_t size;
+} FlashDumpBuffer;
+
+static bool flash_dump_emit(const CanRecord *record, void *arg)
+{
+    FlashDumpBuffer *dump = arg;
+
+    return output_record(record, dump->buf, dump->size);
+}
+
+/*
+ * Sends the flash log ahead of the backlog, it is only erased if the host
+ * took all of it.
+ */
+static void output_flash_log(char *buf, size_t size)
+{
+    FlashLoggerStats stats;
+    FlashDumpBuffer dump = {buf, size};
+
+    flashLoggerGetStats(&stats);
+    if (stats.records == 0)
+        return;
+
+    output_printf(buf, size, "# flashlog begin records=%lu\r\n",
+            stats.records);
+    uint32_t sent = flashLoggerDump(flash_dump_emit, &dump);
+    output_printf(buf, size, "# flashlog end records=%lu\r\n", sent);
+
+#if FLASH_LOG_CLEAR_ON_DUMP
+    if (sent == stats.records)
+    {
+        flashLoggerClear();
+        output_printf(buf, size, "# flashlog cleared\r\n");
+    }
+#endif
+}
+#endif
+
+/*
+ * Delivers a backlog entry to the host.
+ * Returns false if the host did not take it, the entry is retried later.
+ */
+static bool output_frame(CanBacklogEntry *entry, char *buf, size_t size)
+{
+    const CanRecord *record = &entry->record;
+
+#if LGCR_USE_GSUSB
+    (void) buf;
+    (void) size;
+
+    // hand frame to the gs_usb bulk queue, a loss sets the overflow flag
+    return gsusbPostRx(record, entry->lost != 0);
+#else
+    if (entry->lost != 0)
+    {
+#if LGCR_USE_COMPRESS
+        if (outputCompressed)
+            output_write((uint8_t* )buf,
+                    can_encoder_lost(&outputEncoder, entry->lost,
+                            (uint8_t* )buf));
+        else
+#endif
+            output_printf(buf, size, "# lost %u\r\n", entry->lost);
+        entry->lost = 0;
+    }
+
+#if LGCR_USE_ADAPTIVE
+    // a frame left out by the current mode counts as delivered
+    if (!can_degrade_pass(&outputDegrade, record))
+        return true;
+#endif
+
+    return output_record(record, buf, size);
+#endif
+}
+
+#if LGCR_USE_BUS_EVENTS && !LGCR_USE_GSUSB
+/*
+ * Reports the bus event counters if they changed since the last report.
+ * Returns the event count reported.
+ */
+static uint32_t output_bus_counters(char *buf, size_t size, uint32_t reported,
+                                    bool always)
+{
+    CanEventCounters counters;
+    uint8_t state;
+
+    chSysLock();
+    counters = busEvents.counters;
+    state = busEvents.last.state;
+    chSysUnlock();
+
+    if (counters.events == reported && !always)
+        return reported;
+
+    // split so each line fits the print buffer with every counter at ten
+    // digits, less the codec offset in compressed output
+    output_printf(buf, size,
+            "# errors events=%lu recorded=%lu overflow=%lu\r\n",
+            counters.events, counters.recorded, counters.overflows);
+    output_printf(buf, size,
+            "# errors stuff=%lu form=%lu ack=%lu bit1=%lu bit0=%lu crc=%lu\r\n",
+            counters.lec[CAN_LEC_STUFF], counters.lec[CAN_LEC_FORM],
+            counters.lec[CAN_LEC_ACK], counters.lec[CAN_LEC_BIT1],
+            counters.lec[CAN_LEC_BIT0], counters.lec[CAN_LEC_CRC]);
+    output_printf(buf, size, "# busstate %s tec_max=%u rec_max=%u\r\n",
+            can_event_state_name(state), counters.tecMax, counters.recMax);
+    output_printf(buf, size,
+            "# busstate warning=%lu passive=%lu busoff=%lu active=%lu\r\n",
+            counters.entered[CAN_BUS_WARNING],
+            counters.entered[CAN_BUS_PASSIVE], counters.entered[CAN_BUS_OFF],
+            counters.entered[CAN_BUS_ACTIVE]);
+
+    return counters.events;
+}
+#endif
+
+#if LGCR_USE_COMMANDS
+static HostConfig commandCurrent;
+static HostConfig commandNext;
+static char commandReply[HOST_COMMAND_REPLY_SIZE];
+
+static bool filters_equal(const HostConfig *a, const HostConfig *b)
+{
+    if (a->filterCount != b->filterCount)
+        return false;
+
+    for (uint32_t i = 0; i < a->filterCount; i++)
+    {
+        if (a->filters[i].id != b->filters[i].id ||
+            a->filters[i].mask != b->filters[i].mask ||
+            a->filters[i].extended != b->filters[i].extended)
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Applies settings staged by commands, between two records. The
+ * controller is only restarted if its settings changed.
+ */
+static bool output_apply(const HostConfig *current, const HostConfig *next,
+                         char *buf, size_t size)
+{
+    if (next->bitrate != BoardCanGetBitrate() ||
+        next->samplePoint != current->samplePoint ||
+        next->loopback != current->loopback ||
+        !filters_equal(current, next))
+    {
+        if (!BoardCanConfigure(next->bitrate, next->samplePoint,
+                next->loopback, next->filters, next->filterCount))
+            return false;
+    }
+
+#if LGCR_USE_COMPRESS && !LGCR_USE_ADAPTIVE
+    if (next->compressed != outputCompressed)
+    {
+        // the marker goes out in the old format, as with adaptive output
+        output_printf(buf, size, "# mode %s\r\n",
+                next->compressed ? "compressed" : "full");
+        outputCompressed = next->compressed;
+        can_encoder_reset(&outputEncoder);
+    }
+#else
+    (void) buf;
+    (void) size;
+#endif
+
+    heartbeatPeriodMs = next->heartbeatMs;
+
+    return true;
+}
+
+/*
+ * Applies waiting settings and forwards command replies.
+ */
+static void output_commands(char *buf, size_t size)
+{
+    if (hostCommandGetApply(&commandCurrent, &commandNext))
+        hostCommandApplied(
+                output_apply(&commandCurrent, &commandNext, buf, size));
+
+    while (hostCommandGetReply(commandReply, sizeof(commandReply)))
+        output_printf(buf, size, "%s\r\n", commandReply);
+}
+#endif
+
+#if LGCR_USE_HOST_TX
+/*
+ * Reports the transmit credits given back. The report skips the backlog,
+ * the host can send again while the echoes are still queued.
+ */
+static void output_credit(char *buf, size_t size, bool always)
+{
+    HostTxCredit credit;
+
+    if (hostTxGetCredit(&credit, always))
+        output_printf(buf, size, "# credit returned=%lu free=%lu window=%u\r\n",
+                credit.returned, credit.free, HOST_TX_QUEUE_SIZE);
+}
+#endif
+
+#if LGCR_USE_GENERATOR
+#define GENERATOR_REPORT_MS 1000
+
+/*
+ * Reports the generator while it runs, rates over the time since the
+ * last report. The load counts bit times, stuff bits included.
+ */
+static void output_generator(char *buf, size_t size, TrafficGenStats *last,
+                             uint32_t *lastTime)
+{
+    TrafficGenStats stats;
+    uint32_t now = timestamp_now();
+
+    trafficGenGetStats(&stats);
+    if (!stats.running && !last->running)
+        return;
+    if (stats.start != last->start)
+    {
+        // a new run counts from its start
+        last->frames = 0;
+        last->bits = 0;
+        *lastTime = stats.start;
+    }
+
+    uint32_t elapsed = now - *lastTime;
+    uint32_t fps = 0;
+    uint32_t load = 0;
+    if (elapsed != 0)
+    {
+        fps = (uint32_t) ((uint64_t) (stats.frames - last->frames) * 1000000U
+                / elapsed);
+        load = (uint32_t) ((stats.bits - last->bits) * 1000000000U
+                / ((uint64_t) elapsed * BoardCanGetBitrate()));
+    }
+    output_printf(buf, size,
+            "# gen %s frames=%lu fps=%lu load=%lu target=%u late=%lu\r\n",
+            stats.running ? "running" : "stopped", stats.frames, fps, load,
+            stats.load, stats.late);
+
+    *last = stats;
+    *lastTime = now;
+}
+#endif
+
+#if LGCR_USE_BMS
+/*
+ * Summary of one quantity, nothing until a cell reported.
+ */
+static void output_bms_kind(const char *where, uint8_t kind,
+                            const CanBmsSummary *sp, char *buf, size_t size)
+{
+    if (sp->cells == 0)
+        return;
+
+    output_printf(buf, size,
+            "# bms %s %s %d/%d/%d spread=%d min=m%uc%u max=m%uc%u cells=%u\r\n",
+            where, can_bms_kind_name(kind), sp->min, sp->mean, sp->max,
+            sp->max - sp->min, sp->minModule, sp->minCell, sp->maxModule,
+            sp->maxCell, sp->cells);
+}
+
+/*
+ * Sends the pack summary followed by the modules, min/mean/max of each
+ * quantity.
+ */
+static void output_bms(char *buf, size_t size)
+{
+    CanBmsSummary summary;
+    char where[8];
+
+    for (uint8_t kind = 0; kind < CAN_BMS_KINDS; kind++)
+    {
+        bmsMonitorGetPack(kind, &summary);
+        output_bms_kind("pack", kind, &summary, buf, size);
+    }
+    for (uint8_t module = 0; module < CAN_BMS_MODULES; module++)
+    {
+        chsnprintf(where, sizeof(where), "m%u", module);
+        for (uint8_t kind = 0; kind < CAN_BMS_KINDS; kind++)
+        {
+            bmsMonitorGetModule(module, kind, &summary);
+            output_bms_kind(where, kind, &summary, buf, size);
+        }
+    }
+}
+#endif
+
+#if LGCR_USE_ADAPTIVE && !LGCR_USE_GSUSB
+#define OUTPUT_WINDOW_MS 100
 
-//set up Mailbox
-static msg_t canRXMailboxQueue[10];
-static MAILBOX_DECL(canRX, canRXMailboxQueue, 10);
+/*
+ * Output rate measurement window, see can_degrade.c.
+ */
+typedef struct {
+    systime_t start;
+    uint32_t arrived;       // backlog counters at the window start
+    uint32_t lost;
+    uint32_t drained;       // frames taken from the backlog
+} OutputWindow;
 
-static THD_WORKING_AREA(mailboxProcessWa, 512);
-static THD_FUNCTION(mailboxProcess, arg)
+static uint32_t backlog_arrived(const CanBacklogStats *stats)
 {
+    return stats->stored + stats->drops[CAN_DROP_ARRIVING]
+            + stats->drops[CAN_DROP_PROTECTED];
+}
+
+static void output_window_start(OutputWindow *window)
+{
+    CanBacklogStats stats;
+
+    can_backlog_get_stats(&stats);
+    window->start = chVTGetSystemTime();
+    window->arrived = backlog_arrived(&stats);
+    window->lost = stats.lost;
+    window->drained = 0;
+}
+
+/*
+ * Closes a measurement window. A mode change is marked in the stream in
+ * the format of the mode being left, then the format switches.
+ */
+static void output_adapt(OutputWindow *window, char *buf, size_t size)
+{
+    CanBacklogStats stats;
+    size_t backlog = can_backlog_count();
+    uint32_t ms = ST2MS(chVTTimeElapsedSinceX(window->start));
+    uint32_t suppressed = outputDegrade.suppressed;
+
+    can_backlog_get_stats(&stats);
+    uint32_t incoming = backlog_arrived(&stats) - window->arrived;
+    uint32_t lost = stats.lost - window->lost;
+    uint32_t drained = window->drained;
+    output_window_start(window);
+
+    if (!can_degrade_update(&outputDegrade, incoming, drained, lost, backlog))
+        return;
+
+    if (ms == 0)
+        ms = 1;
+    output_printf(buf, size,
+            "# mode %s in=%lu out=%lu lost=%lu backlog=%u suppressed=%lu\r\n",
+            can_degrade_name(outputDegrade.mode), incoming * 1000 / ms,
+            drained * 1000 / ms, lost, (unsigned) backlog, suppressed);
 
+#if LGCR_USE_COMPRESS
+    bool compressed = outputDegrade.mode != CAN_DEGRADE_FULL;
+    if (compressed != outputCompressed)
+    {
+        outputCompressed = compressed;
+        can_encoder_reset(&outputEncoder);
+    }
+#endif
+}
+#endif
+
+#if LGCR_USE_SNAPSHOT
+/*
+ * Sends the latest-value table, every CAN_SNAPSHOT_FULL_EVERY-th time in
+ * full, otherwise the entries updated since the last snapshot. An entry
+ * the host did not take stays pending.
+ */
+static void output_snapshot(uint32_t sequence, char *buf, size_t size)
+{
+    CanSnapshotEntry entry;
+    size_t index = 0;
+    uint32_t sent = 0;
+    uint32_t frames = 0;
+    bool all = CAN_SNAPSHOT_FULL_EVERY != 0 &&
+            sequence % CAN_SNAPSHOT_FULL_EVERY == 0;
+
+#if LGCR_USE_GSUSB
+    (void) buf;
+    (void) size;
+#else
+    CanSnapshotStats stats;
+    can_snapshot_get_stats(&stats);
+    output_printf(buf, size,
+            "# snapshot %lu @%lu ids=%lu full=%u overflow=%lu\r\n",
+            sequence, timestamp_now(), stats.ids, all ? 1 : 0,
+            stats.overflow);
+#endif
+
+    while (can_snapshot_next(index, all, &entry))
+    {
+#if LGCR_USE_GSUSB
+        if (!gsusbPostRx(&entry.record, false))
+            break;
+#else
+        if (!output_record(&entry.record, buf, size))
+            break;
+#endif
+        can_snapshot_sent(&entry);
+        index = entry.index + 1;
+        sent++;
+        frames += entry.updates;
+    }
+
+#if !LGCR_USE_GSUSB
+    output_printf(buf, size, "# snapshot end sent=%lu frames=%lu\r\n",
+            sent, frames);
+#endif
+}
+#endif
+
+/*
+ * Forwards the backlog to the host. Frames stay in the backlog while no
+ * host is connected or the host does not keep up, on connect they are
+ * replayed in order before live traffic.
+ */
+static LGCR_CCM_DATA THD_WORKING_AREA(outputProcessWa, 512);
+static THD_FUNCTION(outputProcess, arg)
+{
     (void) arg;
-    char printBuffer[256];
-    chRegSetThreadName("mailbox");
-    size_t bytesWritten = 0;
+    char printBuffer[128];
+    CanBacklogEntry entry;
+    bool entryPending = false;
+    bool connected = false;
+#if !LGCR_USE_GSUSB
+    bool bootReported = false;
+#endif
+#if LGCR_USE_UART_DMA
+    systime_t lastReport = chVTGetSystemTime();
+#endif
+#if LGCR_USE_TRIGGER
+    CanTriggerStatus trigger;
+    uint32_t triggerWindows = 0;
+    bool triggerReported = false;
+#endif
+#if LGCR_USE_ADAPTIVE && !LGCR_USE_GSUSB
+    OutputWindow window;
+#endif
+#if LGCR_USE_SNAPSHOT
+    systime_t snapshotTime = chVTGetSystemTime();
+    uint32_t snapshotSequence = 0;
+#endif
+#if LGCR_USE_AUTOBAUD
+    bool autobaudReported = false;
+#endif
+#if LGCR_USE_BUS_EVENTS && !LGCR_USE_GSUSB
+    systime_t busReportTime = chVTGetSystemTime();
+    uint32_t busReported = 0;
+#endif
+#if LGCR_USE_GENERATOR
+    systime_t genReportTime = chVTGetSystemTime();
+    TrafficGenStats genReported = {false, 0, 0, 0, 0, 0};
+    uint32_t genReportedUs = 0;
+#endif
+#if LGCR_USE_BMS
+    systime_t bmsReportTime = chVTGetSystemTime();
+#endif
+    chRegSetThreadName("output");
+
     while (!chThdShouldTerminateX())
     {
-        msg_t pbuf;
+        if (!BoardHostConnected())
+        {
+            connected = false;
+            chThdSleepMilliseconds(10);
+            continue;
+        }
 
-        /* Processing the event.*/
-        while (chMBFetch(&canRX, (msg_t *) &pbuf, TIME_IMMEDIATE) == MSG_OK )
+        if (!connected)
         {
-            CANRxFrame* prxmsg = (CANRxFrame*) pbuf;
+            connected = true;
+#if !LGCR_USE_GSUSB
+#if LGCR_USE_COMPRESS
+            can_encoder_reset(&outputEncoder);
+#endif
+            if (!bootReported)
+            {
+                bootReported = true;
+                if (bootFirstFrameSeen)
+                    output_printf(printBuffer, sizeof(printBuffer),
+                            "# boot capture_ready=%luus first_frame=%luus\r\n",
+                            bootCaptureReadyUs, bootFirstFrameUs);
+                else
+                    output_printf(printBuffer, sizeof(printBuffer),
+                            "# boot capture_ready=%luus first_frame=none\r\n",
+                            bootCaptureReadyUs);
+            }
+
+#if LGCR_USE_FLASH_LOG
+            output_flash_log(printBuffer, sizeof(printBuffer));
+#endif
+
+            CanBacklogStats stats;
+            can_backlog_get_stats(&stats);
+            output_printf(printBuffer, sizeof(printBuffer),
+                    "# connected backlog=%u stored=%lu lost=%lu\r\n",
+                    (unsigned) can_backlog_count(), stats.stored, stats.lost);
+            output_printf(printBuffer, sizeof(printBuffer),
+                    "# drops arriving=%lu oldest=%lu newest=%lu priority=%lu protected=%lu\r\n",
+                    stats.drops[CAN_DROP_ARRIVING],
+                    stats.drops[CAN_EVICT_OLDEST],
+                    stats.drops[CAN_EVICT_NEWEST],
+                    stats.drops[CAN_EVICT_PRIORITY],
+                    stats.drops[CAN_DROP_PROTECTED]);
+            output_printf(printBuffer, sizeof(printBuffer),
+                    "# can bitrate=%lu\r\n", BoardCanGetBitrate());
+#if LGCR_USE_BUS_EVENTS
+            busReported = output_bus_counters(printBuffer,
+                    sizeof(printBuffer), busReported, true);
+#endif
+#if LGCR_USE_HOST_TX
+            output_credit(printBuffer, sizeof(printBuffer), true);
+#endif
+#if LGCR_USE_ADAPTIVE
+            output_printf(printBuffer, sizeof(printBuffer), "# mode %s\r\n",
+                    can_degrade_name(outputDegrade.mode));
+            // losses while disconnected are no link deficit
+            output_window_start(&window);
+#endif
+#endif
+        }
+
+#if LGCR_USE_AUTOBAUD
+        if (!autobaudReported)
+        {
+            CanAutobaudStatus autobaud;
+
+            canAutobaudGetStatus(&autobaud);
+            if (autobaud.state == CAN_AUTOBAUD_DONE)
+            {
+                autobaudReported = true;
+                output_printf(printBuffer, sizeof(printBuffer),
+                        "# autobaud bitrate=%lu time=%lums tries=%lu errors=%lu\r\n",
+                        autobaud.bitrate, autobaud.elapsedUs / 1000,
+                        autobaud.tries, autobaud.errors);
+            }
+        }
+#endif
+
+#if LGCR_USE_COMMANDS
+        output_commands(printBuffer, sizeof(printBuffer));
+#endif
+#if LGCR_USE_HOST_TX
+        output_credit(printBuffer, sizeof(printBuffer), false);
+#endif
+
+#if LGCR_USE_BUS_EVENTS && !LGCR_USE_GSUSB
+        if (chVTTimeElapsedSinceX(busReportTime) >= S2ST(10))
+        {
+            busReportTime = chVTGetSystemTime();
+            busReported = output_bus_counters(printBuffer,
+                    sizeof(printBuffer), busReported, false);
+        }
+#endif
+
+#if LGCR_USE_GENERATOR
+        if (chVTTimeElapsedSinceX(genReportTime) >= MS2ST(GENERATOR_REPORT_MS))
+        {
+            genReportTime = chVTGetSystemTime();
+            output_generator(printBuffer, sizeof(printBuffer), &genReported,
+                    &genReportedUs);
+        }
+#endif
+
+#if LGCR_USE_BMS
+        uint32_t bmsPeriod = bmsMonitorGetPeriod();
+        if (bmsPeriod != 0 &&
+            chVTTimeElapsedSinceX(bmsReportTime) >= MS2ST(bmsPeriod))
+        {
+            bmsReportTime = chVTGetSystemTime();
+            output_bms(printBuffer, sizeof(printBuffer));
+        }
+#endif
+
+#if LGCR_USE_SNAPSHOT
+        // constant rate, independent of the bus load
+        systime_t elapsed = chVTTimeElapsedSinceX(snapshotTime);
+        if (elapsed < MS2ST(CAN_SNAPSHOT_PERIOD_MS))
+        {
+            chThdSleep(MS2ST(CAN_SNAPSHOT_PERIOD_MS) - elapsed);
+            snapshotTime += MS2ST(CAN_SNAPSHOT_PERIOD_MS);
+        }
+        else
+        {
+            // the host link is slower than the rate, skip the missed ones
+            snapshotTime = chVTGetSystemTime();
+        }
+        output_snapshot(snapshotSequence++, printBuffer, sizeof(printBuffer));
+#if LGCR_USE_UART_DMA
+        uart_stream_flush();
+#endif
+        continue;
+#endif
+
+        // a frame the host did not take is retried from the local copy
+        if (!entryPending)
+            entryPending = can_backlog_peek(&entry, MS2ST(100));
+        if (entryPending)
+        {
+            if (output_frame(&entry, printBuffer, sizeof(printBuffer)))
+            {
+                can_backlog_pop(&entry);
+                entryPending = false;
+#if LGCR_USE_ADAPTIVE && !LGCR_USE_GSUSB
+                window.drained++;
+#endif
+            }
+            else
+            {
+                // host is not reading, keep the frame
+                chThdSleepMilliseconds(1);
+            }
+        }
 
-            /* Process message.*/
-            int bytes = chsnprintf(printBuffer, sizeof(printBuffer),
-                    "%08lx: %08lx %08lx\r\n", (uint32_t) prxmsg->SID,
-                    (uint32_t)prxmsg->data32[0], (uint32_t)prxmsg->data32[1]);
+#if LGCR_USE_ADAPTIVE && !LGCR_USE_GSUSB
+        if (chVTTimeElapsedSinceX(window.start) >= MS2ST(OUTPUT_WINDOW_MS))
+            output_adapt(&window, printBuffer, sizeof(printBuffer));
+#endif
 
-            chPoolFree(&canRXMessagesPool, prxmsg);
+#if LGCR_USE_TRIGGER
+        can_trigger_get_status(&trigger);
+        if (trigger.state != CAN_TRIGGER_ARMED && !triggerReported)
+        {
+            triggerReported = true;
+#if !LGCR_USE_GSUSB
+            output_printf(printBuffer, sizeof(printBuffer),
+                    "# trigger fired @%lu pre=%u\r\n", trigger.triggerTime,
+                    trigger.preFrames);
+#endif
+        }
+        // the window is shipped once the backlog has drained
+        if (trigger.windows != triggerWindows && !entryPending &&
+            can_backlog_count() == 0)
+        {
+            triggerWindows = trigger.windows;
+            triggerReported = false;
+#if !LGCR_USE_GSUSB
+            output_printf(printBuffer, sizeof(printBuffer),
+                    "# trigger window post=%u ignored=%lu\r\n",
+                    trigger.postFrames, trigger.ignored);
+#endif
+            can_trigger_rearm();
+        }
+#endif
+
+#if LGCR_USE_UART_DMA
+        if (chVTTimeElapsedSinceX(lastReport) >= S2ST(10))
+        {
+            UartStreamStats stats;
 
-            // write buffer to usb stream
-            bytesWritten = chnWriteTimeout((BaseChannel* )&SERIALDRIVER, (uint8_t* )printBuffer, bytes,
-                    MS2ST(10));
+            lastReport = chVTGetSystemTime();
+            uart_stream_get_stats(&stats);
+            output_printf(printBuffer, sizeof(printBuffer),
+                    "# uart batches=%lu bytes=%lu underruns=%lu overruns=%lu dropped=%lu\r\n",
+                    stats.batches, stats.bytes, stats.underruns,
+                    stats.overruns, stats.droppedBytes);
         }
-        chThdSleepMilliseconds(100);
+        if (can_backlog_count() == 0)
+        {
+            uart_stream_flush();
+        }
+#endif
     }
 }
 
@@ -66,7 +1080,7 @@ static THD_FUNCTION(mailboxProcess, arg)
  * to show a received message.
  */
 static thread_t *tpRXNotification;
-static THD_WORKING_AREA(rx_notification_wa, 256);
+static LGCR_CCM_DATA THD_WORKING_AREA(rx_notification_wa, 256);
 static THD_FUNCTION(rx_notification, arg)
 {
 
@@ -88,44 +1102,267 @@ static THD_FUNCTION(rx_notification, arg)
     }
 }
 
+#if !LGCR_USE_SNAPSHOT
+#if !LGCR_USE_TRIGGER
+/* Backlog slots reserved for the message being captured.*/
+static size_t rxReserved;
+#endif
+
+#if LGCR_USE_ISOTP || LGCR_USE_J1939
+/*
+ * Makes room for the records of a decoded message, all of them or none.
+ * The trigger takes records one by one, there a message can straddle the
+ * edge of the window.
+ */
+static bool rx_reserve(size_t count)
+{
+#if LGCR_USE_TRIGGER
+    (void) count;
+    return true;
+#else
+    if (!can_backlog_reserve(count))
+        return false;
+    rxReserved = count;
+    return true;
+#endif
+}
+#endif
+
+/*
+ * Passes a record to the trigger or to the backlog.
+ */
+static void rx_capture(const CanRecord *record)
+{
+#if LGCR_USE_TRIGGER
+    can_trigger_frame(record);
+#else
+    if (rxReserved > 0)
+    {
+        rxReserved--;
+        can_backlog_push_reserved(record);
+    }
+    else
+        can_backlog_push(record);
+#endif
+}
+#endif
+
+/*
+ * Passes a received frame into the capture pipeline.
+ */
+static void rx_frame(const CANRxFrame *rxmsg, uint32_t timestamp)
+{
+    CanRecord record;
+
+    // the HAL frame is not kept, the pipeline carries records
+    canFrameToRecord(rxmsg, timestamp, &record);
+
+#if LGCR_USE_FLASH_LOG
+    flashLoggerFeed(&record);
+#endif
+
+    if (!bootFirstFrameSeen)
+    {
+        bootFirstFrameUs = timestamp;
+        bootFirstFrameSeen = true;
+    }
+
+    if (tpRXNotification != NULL)
+    {
+        chEvtSignal(tpRXNotification, (eventmask_t) 1);
+    }
+#if LGCR_USE_SNAPSHOT
+    can_snapshot_update(&record);
+#else
+#if LGCR_USE_ISOTP
+    // segmented messages leave complete, or not at all
+    if (isotpEngineFrame(&record, rx_reserve, rx_capture))
+        return;
+#endif
+#if LGCR_USE_BMS
+    // cell frames leave as the summaries and their alerts
+    if (bmsMonitorFrame(&record, rx_capture))
+        return;
+#endif
+#if LGCR_USE_SIGNALS
+    // with a table loaded the frame leaves as its changed signals
+    if (signalDecoderFrame(&record, rx_capture))
+        return;
+#endif
+#if LGCR_USE_J1939
+    // transport frames leave as their messages, other groups if passed
+    if (j1939DecoderFrame(&record, rx_reserve, rx_capture))
+        return;
+#endif
+    rx_capture(&record);
+#endif
+}
+
+#if LGCR_USE_BUS_EVENTS
+/*
+ * Takes the last error code of the controller and sets it back to the
+ * software value. The error code raises no interrupt, see
+ * board_drivers.c, all errors since the last call fold into the code of
+ * the latest one.
+ */
+static uint8_t rx_lec(void)
+{
+    uint32_t esr = CANDRIVER.can->ESR;
+    uint8_t lec = (uint8_t) ((esr & CAN_ESR_LEC) >> 4);
+
+    if (lec == CAN_LEC_UNSET)
+        return CAN_LEC_NONE;
+    CANDRIVER.can->ESR = CAN_LEC_UNSET << 4;
+
+    return lec;
+}
+#endif
+
+#if LGCR_USE_BUS_EVENTS || LGCR_USE_TRIGGER
+/*
+ * Passes a CAN driver error event into the capture pipeline. Flags of
+ * zero poll the error code and the bus state.
+ */
+static void rx_error(eventflags_t flags, uint32_t timestamp)
+{
+#if LGCR_USE_BUS_EVENTS
+    CanEvent event;
+    bool recorded;
+
+    // the flags of several interrupts are merged, only the overflow and
+    // the state are taken from the interrupt, the code from the controller
+    can_event_decode(&event, CANDRIVER.can->ESR, rx_lec(),
+            (flags & CAN_OVERFLOW_ERROR) != 0);
+    // a poll on a healthy bus that found no error
+    if (flags == 0 && event.lec == CAN_LEC_NONE &&
+            !CAN_EVENT_DEGRADED(&busEvents))
+        return;
+    chSysLock();
+    recorded = can_event_track(&busEvents, &event, timestamp);
+    chSysUnlock();
+
+#if LGCR_USE_SNAPSHOT
+    // the snapshot holds frames only, events show in the counters
+    (void) recorded;
+#else
+    if (recorded)
+    {
+        CanRecord record;
+
+        can_event_to_record(&event, timestamp, &record);
+#if LGCR_USE_TRIGGER
+        can_trigger_frame(&record);
+#else
+        can_backlog_push(&record);
+#endif
+    }
+#endif
+#endif
+
+#if LGCR_USE_TRIGGER
+#if LGCR_USE_BUS_EVENTS
+    // the bus error no longer comes with the interrupt flags
+    if (event.lec != CAN_LEC_NONE)
+        flags |= CAN_FRAMING_ERROR;
+#endif
+    if (flags != 0)
+        can_trigger_error(flags, timestamp);
+#endif
+}
+#endif
+
+#if LGCR_USE_ISOTP
+/*
+ * Passes the result of an ISO-TP message sent to the backlog, past the
+ * trigger like the echoes.
+ */
+static void isotp_result(const CanRecord *record)
+{
+    can_backlog_push(record);
+}
+#endif
+
+#if LGCR_USE_HOST_TX
+/*
+ * Passes the echo of a host frame to the backlog. It skips the trigger,
+ * the host waits for it in any capture mode.
+ */
+static void tx_echo(const CanRecord *record)
+{
+    can_backlog_push(record);
+}
+#endif
+
 /*
  * CAN receiver thread
  */
-static THD_WORKING_AREA(can_rx_wa, 256);
+// decoders and the ISO-TP engine run in the receiver, below rx_frame
+static LGCR_CCM_DATA THD_WORKING_AREA(can_rx_wa,
+        LGCR_USE_SIGNALS || LGCR_USE_BMS || LGCR_USE_ISOTP ||
+        LGCR_USE_J1939 ? 384 : 256);
 static THD_FUNCTION(can_rx, arg)
 {
     (void) arg;
     chRegSetThreadName("receiver");
 
+#if LGCR_USE_AUTOBAUD
+    // the controller stays silent until the bitrate is known
+    (void) canAutobaudRun(rx_frame);
+#endif
+
     event_listener_t el;
+#if LGCR_USE_BUS_EVENTS || LGCR_USE_TRIGGER
+    event_listener_t elError;
+
+    chEvtRegister(&CANDRIVER.error_event, &elError, 1);
+#endif
 
     chEvtRegister(&CANDRIVER.rxfull_event, &el, 0);
+    bootCaptureReadyUs = timestamp_now();
     while (!chThdShouldTerminateX())
     {
-        if (chEvtWaitAnyTimeout(ALL_EVENTS, MS2ST(100)) == 0)
+        eventmask_t events = chEvtWaitAnyTimeout(ALL_EVENTS, MS2ST(100));
+#if LGCR_USE_BUS_EVENTS || LGCR_USE_TRIGGER
+        // the interrupt wakes this thread, the frames behind it come later
+        if (events & EVENT_MASK(1))
+        {
+            rx_error(chEvtGetAndClearFlags(&elError), timestamp_now());
+        }
+#if LGCR_USE_BUS_EVENTS
+        // bus errors and the way back to error active raise no interrupt
+        else
+        {
+            rx_error(0, timestamp_now());
+        }
+#endif
+#endif
+        CANRxFrame rxmsg;
+#if LGCR_USE_FLASH_LOG
+        // frames the flash writer moved aside during an erase come first
+        uint32_t ageUs;
+        while (flashLoggerTakeHeld(&rxmsg, &ageUs))
+        {
+            rx_frame(&rxmsg, timestamp_now() - ageUs);
+        }
+#endif
+        if (events == 0)
             continue;
-        CANRxFrame* prxmsg = (CANRxFrame*) chPoolAlloc(&canRXMessagesPool);
-        while (canReceive(&CANDRIVER, CAN_ANY_MAILBOX, prxmsg, TIME_IMMEDIATE)
+        while (canReceive(&CANDRIVER, CAN_ANY_MAILBOX, &rxmsg, TIME_IMMEDIATE)
                 == MSG_OK )
         {
-            if (tpRXNotification != NULL)
-            {
-                chEvtSignal(tpRXNotification, (eventmask_t) 1);
-            }
-            if (chMBPost(&canRX, (msg_t) prxmsg, MS2ST(1)) == MSG_OK)
-            {
-                prxmsg = (CANRxFrame*) chPoolAlloc(&canRXMessagesPool);
-            }
+            rx_frame(&rxmsg, timestamp_now());
         }
-        chPoolFree(&canRXMessagesPool, prxmsg);
     }
     chEvtUnregister(&CANDRIVER.rxfull_event, &el);
+#if LGCR_USE_BUS_EVENTS || LGCR_USE_TRIGGER
+    chEvtUnregister(&CANDRIVER.error_event, &elError);
+#endif
 }
 
 /*
  * This is a periodic thread that sends a heartbeat to BMS
  */
-static THD_WORKING_AREA(can_tx_wa, 256);
+static LGCR_CCM_DATA THD_WORKING_AREA(can_tx_wa, 256);
 static THD_FUNCTION(can_tx, arg)
 {
     (void) arg;
@@ -143,7 +1380,8 @@ static THD_FUNCTION(can_tx, arg)
 
     while (!chThdShouldTerminateX())
     {
-        if (canTransmit(&CANDRIVER, CAN_ANY_MAILBOX, &txmsg, MS2ST(100)) == MSG_OK)
+        if (heartbeatPeriodMs != 0 &&
+            canTransmit(&CANDRIVER, CAN_ANY_MAILBOX, &txmsg, MS2ST(100)) == MSG_OK)
         {
             //signal transmit with LED
             mod_led_on(&LED_BMS_HEARTBEAT);
@@ -152,15 +1390,21 @@ static THD_FUNCTION(can_tx, arg)
             mod_led_off(&LED_BMS_HEARTBEAT);
 
         }
-        chThdSleepMilliseconds(20000);
 
+        // a new period or zero (off) takes effect within 100 ms
+        systime_t start = chVTGetSystemTime();
+        while (heartbeatPeriodMs == 0 ||
+               chVTTimeElapsedSinceX(start) < MS2ST(heartbeatPeriodMs))
+        {
+            chThdSleepMilliseconds(100);
+        }
    }
 }
 
 /*
  * This is a periodic thread that blinks a LED to show board activity
  */
-static THD_WORKING_AREA(board_heartbeat_wa, 256);
+static LGCR_CCM_DATA THD_WORKING_AREA(board_heartbeat_wa, 256);
 static THD_FUNCTION(board_heartbeat, arg)
 {
     (void) arg;
@@ -179,6 +1423,9 @@ static THD_FUNCTION(board_heartbeat, arg)
 
         ledOn = !ledOn;
 
+        // keeps the timestamp extension ahead of the cycle counter wrap
+        (void) timestamp_now();
+
         chThdSleepSeconds(1);
     }
 }
@@ -190,10 +1437,6 @@ static THD_FUNCTION(board_heartbeat, arg)
 
 int main(void)
 {
-    chPoolObjectInit(&canRXMessagesPool, sizeof(CANRxFrame), NULL);
-    chPoolLoadArray(&canRXMessagesPool, CANRxFrameBuffer, 10);
-    chMBObjectInit(&canRX, canRXMailboxQueue, 10);
-
     /*
      * System initializations.
      * - HAL initialization, this also initializes the configured device drivers
@@ -205,14 +1448,54 @@ int main(void)
 
     chSysInit();
 
+    timestamp_init();
 
-    BoardDriverInit();
+    can_backlog_init(&backlogPolicy);
+
+#if LGCR_USE_SNAPSHOT
+    can_snapshot_init();
+#endif
+
+#if LGCR_USE_TRIGGER
+    can_trigger_init(&triggerConfig);
+#endif
+
+#if LGCR_USE_BUS_EVENTS
+    can_event_tracker_init(&busEvents);
+#endif
+
+#if LGCR_USE_FLASH_LOG
+    flashLoggerStart(LOWPRIO + 1);
+#endif
 
-    BoardDriverStart();
+#if LGCR_USE_COMPRESS && !LGCR_USE_GSUSB
+    can_encoder_init(&outputEncoder);
+#endif
+
+#if LGCR_USE_ADAPTIVE && !LGCR_USE_GSUSB
+    can_degrade_init(&outputDegrade, CAN_BACKLOG_SIZE, true,
+            LGCR_USE_COMPRESS);
+#endif
+
+#if LGCR_USE_BMS
+    bmsMonitorInit(bmsFrames, sizeof(bmsFrames) / sizeof(bmsFrames[0]),
+            bmsLimits, BMS_SUMMARY_MS);
+#endif
+
+#if LGCR_USE_J1939 && defined(J1939_PASS_PGNS)
+    j1939DecoderInit(j1939Pass, sizeof(j1939Pass) / sizeof(j1939Pass[0]));
+#elif LGCR_USE_J1939
+    j1939DecoderInit(NULL, 0);
+#endif
+
+    BoardDriverInit();
 
     /*
-     * Creates threads.
+     * Capture comes first, frames are kept in the backlog while the host
+     * link is still coming up.
      */
+    BoardDriverStartCapture();
+
     chThdCreateStatic(rx_notification_wa, sizeof(rx_notification_wa),
             LOWPRIO + 1, rx_notification, NULL);
 
@@ -222,12 +1505,48 @@ int main(void)
     chThdCreateStatic(can_tx_wa, sizeof(can_tx_wa), NORMALPRIO + 7, can_tx,
             NULL);
 
-    chThdCreateStatic(mailboxProcessWa, sizeof(mailboxProcessWa), LOWPRIO,
-            mailboxProcess, NULL);
-
     chThdCreateStatic(board_heartbeat_wa, sizeof(board_heartbeat_wa), LOWPRIO,
             board_heartbeat, NULL);
 
+    /*
+     * The host link may take a while (USB reconnect delay, enumeration).
+     */
+    BoardDriverStartHostLink();
+
+#if LGCR_USE_HOST_TX
+    // above the receiver, echo times are taken when the mailbox empties
+    hostTxStart(NORMALPRIO + 8, tx_echo);
+#endif
+
+#if LGCR_USE_GENERATOR
+    // below the receiver, the timer interrupt keeps the gaps
+    trafficGenStart(NORMALPRIO + 6, &trafficGenConfig);
+#endif
+
+#if LGCR_USE_ISOTP
+    // below the receiver, flow control is sent from the receiver thread
+    isotpEngineStart(NORMALPRIO + 6, isotpRanges,
+            sizeof(isotpRanges) / sizeof(isotpRanges[0]), isotp_result);
+#endif
+
+#if LGCR_USE_COMMANDS
+    HostConfig config = {
+        CAN_BITRATE,
+        CAN_SAMPLE_POINT,
+        false,
+        LGCR_USE_COMPRESS && !LGCR_USE_ADAPTIVE,
+        HEARTBEAT_PERIOD_MS,
+        0,
+        {{0, 0, false}}
+    };
+
+    // below the receiver, parsing never delays capture
+    hostCommandStart((BaseChannel* )&SERIALDRIVER, &config, LOWPRIO);
+#endif
+
+    chThdCreateStatic(outputProcessWa, sizeof(outputProcessWa), LOWPRIO,
+            outputProcess, NULL);
+
     while (TRUE)
     {
         chThdSleepMilliseconds(500);
@@ -0,0 +1,142 @@
+/**
+ * @file    src/signal_decoder.c
+ * @brief   Signal output of received frames.
+ * @details With a table loaded the receiver turns each frame of a known
+ *          message into records of its changed signals, see
+ *          can_signal.c, the frame itself is not captured. Frames of
+ *          other messages are dropped. Without a table frames are
+ *          captured as they are.
+ *          The host writes the table in pieces, in order, then commits
+ *          it with its size and byte sum. The first piece drops the
+ *          table in use, the new one takes effect with the commit.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include <string.h>
+
+#include "signal_decoder.h"
+
+typedef struct {
+    const CanRecord *frame;
+    signalemitcb_t emit;
+} EmitContext;
+
+/* Words, the table is used in place.*/
+static uint32_t tableBuffer[SIGNAL_TABLE_SIZE / 4];
+static LGCR_CCM_DATA CanSignalState tableState[SIGNAL_TABLE_SIGNALS];
+static CanSignalTable table;
+static bool tableLoaded;
+static uint32_t tableSize;
+
+/* Bytes written since the first piece.*/
+static uint32_t loadSize;
+
+static MUTEX_DECL(tableMutex);
+
+static void emit_record(const CanSignalValue *value, void *arg)
+{
+    EmitContext *context = arg;
+    CanRecord record;
+
+    can_signal_to_record(value, context->frame->timestamp, &record);
+    context->emit(&record);
+}
+
+/*===========================================================================*/
+/* External functions.                                                       */
+/*===========================================================================*/
+
+/**
+ * @brief   Decodes a received frame.
+ *
+ * @param[in] emit      Takes the records of the changed signals.
+ * @return              False if no table is loaded, the frame is to be
+ *                      captured as it is.
+ */
+bool signalDecoderFrame(const CanRecord *record, signalemitcb_t emit)
+{
+    EmitContext context = {record, emit};
+    bool loaded;
+
+    chMtxLock(&tableMutex);
+    loaded = tableLoaded;
+    if (loaded)
+        (void)can_signal_decode(&table, record, emit_record, &context);
+    chMtxUnlock(&tableMutex);
+
+    return loaded;
+}
+
+/**
+ * @brief   Writes a piece of a new table.
+ *
+ * @param[in] offset    Bytes written before, zero starts a new table.
+ * @return              False if the piece is out of order or does not fit.
+ */
+bool signalDecoderLoad(uint32_t offset, const uint8_t *data, size_t n)
+{
+    bool ok;
+
+    chMtxLock(&tableMutex);
+    if (offset == 0)
+    {
+        /* The buffer is overwritten, frames are captured meanwhile.*/
+        tableLoaded = false;
+        tableSize = 0;
+        loadSize = 0;
+    }
+    ok = offset == loadSize && n <= sizeof(tableBuffer) - offset;
+    if (ok)
+    {
+        memcpy((uint8_t *)tableBuffer + offset, data, n);
+        loadSize += n;
+    }
+    chMtxUnlock(&tableMutex);
+
+    return ok;
+}
+
+/**
+ * @brief   Takes the table written into use.
+ *
+ * @param[in] size      Bytes of the table, zero leaves no table.
+ * @param[in] sum       Sum of its bytes, modulo 2^32.
+ * @return              False if the table is incomplete or malformed, no
+ *                      table is in use then.
+ */
+bool signalDecoderCommit(uint32_t size, uint32_t sum)
+{
+    const uint8_t *bytes = (const uint8_t *)tableBuffer;
+    uint32_t check = 0;
+    bool ok;
+
+    chMtxLock(&tableMutex);
+    for (uint32_t i = 0; i < loadSize; i++)
+        check += bytes[i];
+    ok = size == loadSize && sum == check &&
+         (size == 0 || can_signal_load(&table, tableBuffer, size, tableState,
+                                       SIGNAL_TABLE_SIGNALS));
+    tableLoaded = ok && size != 0;
+    tableSize = tableLoaded ? size : 0;
+    chMtxUnlock(&tableMutex);
+
+    return ok;
+}
+
+/**
+ * @brief   Returns the table in use and its totals.
+ */
+void signalDecoderGetStats(SignalDecoderStats *stats)
+{
+    chMtxLock(&tableMutex);
+    stats->loaded = tableLoaded;
+    stats->size = tableSize;
+    stats->messages = tableLoaded ? table.messageCount : 0;
+    stats->signals = tableLoaded ? table.signalCount : 0;
+    stats->totals = table.stats;
+    chMtxUnlock(&tableMutex);
+}
+
+/** @} */
@@ -0,0 +1,85 @@
+/**
+ * @file    src/signal_decoder.h
+ * @brief   Signal output of received frames.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _SIGNAL_DECODER_H_
+#define _SIGNAL_DECODER_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "targetconf.h"
+#include "can_signal.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Largest table in bytes, 8 per message and 20 per signal.
+ */
+#if !defined(SIGNAL_TABLE_SIZE) || defined(__DOXYGEN__)
+#define SIGNAL_TABLE_SIZE           2048
+#endif
+
+/**
+ * @brief   Most signals of a table, 8 bytes of state each.
+ */
+#if !defined(SIGNAL_TABLE_SIGNALS) || defined(__DOXYGEN__)
+#define SIGNAL_TABLE_SIGNALS        96
+#endif
+
+/*===========================================================================*/
+/* Derived constants and error checks.                                       */
+/*===========================================================================*/
+
+#if SIGNAL_TABLE_SIZE % 4 != 0
+#error "SIGNAL_TABLE_SIZE must be a multiple of 4"
+#endif
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Table in use and totals since it was loaded.
+ */
+typedef struct {
+    bool loaded;
+    uint32_t size;          /**< Bytes of the table.                       */
+    uint32_t messages;
+    uint32_t signals;
+    CanSignalStats totals;
+} SignalDecoderStats;
+
+/**
+ * @brief   Receives the signal records of a frame, in the receiver
+ *          thread.
+ */
+typedef void (*signalemitcb_t)(const CanRecord *record);
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  bool signalDecoderFrame(const CanRecord *record, signalemitcb_t emit);
+  bool signalDecoderLoad(uint32_t offset, const uint8_t *data, size_t n);
+  bool signalDecoderCommit(uint32_t size, uint32_t sum);
+  void signalDecoderGetStats(SignalDecoderStats *stats);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SIGNAL_DECODER_H_ */
+
+/** @} */
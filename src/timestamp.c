@@ -0,0 +1,73 @@
+/**
+ * @file    src/timestamp.c
+ * @brief   Free running microsecond timestamp.
+ * @details The timestamp is derived from the DWT cycle counter and extended
+ *          to 32 bit microseconds in software. The cycle counter wraps after
+ *          2^32 core clocks (25 s at 168 MHz), so the timestamp has to be
+ *          read at least once within that period. The board heartbeat
+ *          thread takes care of that.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include "timestamp.h"
+
+static rtcnt_t lastCycles;
+static uint32_t residueCycles;
+static uint32_t timestampUs;
+
+/**
+ * @brief   Sets the timestamp origin to now.
+ * @note    Must be called after @p chSysInit(), the cycle counter is
+ *          enabled by the port initialization.
+ */
+void timestamp_init(void)
+{
+    chSysLock();
+    lastCycles = chSysGetRealtimeCounterX();
+    residueCycles = 0;
+    timestampUs = 0;
+    chSysUnlock();
+}
+
+/**
+ * @brief   Returns the current timestamp in microseconds.
+ *
+ * @iclass
+ */
+uint32_t timestamp_nowI(void)
+{
+    rtcnt_t now = chSysGetRealtimeCounterX();
+    uint32_t delta = (uint32_t)(now - lastCycles);
+
+    lastCycles = now;
+
+    timestampUs += delta / TIMESTAMP_CYCLES_PER_US;
+    residueCycles += delta % TIMESTAMP_CYCLES_PER_US;
+    if (residueCycles >= TIMESTAMP_CYCLES_PER_US)
+    {
+        residueCycles -= TIMESTAMP_CYCLES_PER_US;
+        timestampUs++;
+    }
+
+    return timestampUs;
+}
+
+/**
+ * @brief   Returns the current timestamp in microseconds.
+ *
+ * @api
+ */
+uint32_t timestamp_now(void)
+{
+    uint32_t ts;
+
+    chSysLock();
+    ts = timestamp_nowI();
+    chSysUnlock();
+
+    return ts;
+}
+
+/** @} */
@@ -0,0 +1,60 @@
+/**
+ * @file    src/timestamp.h
+ * @brief   Free running microsecond timestamp.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _TIMESTAMP_H_
+#define _TIMESTAMP_H_
+
+#include "ch.h"
+#include "hal.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Derived constants and error checks.                                       */
+/*===========================================================================*/
+
+/**
+ * @brief   Core clock cycles per microsecond.
+ */
+#define TIMESTAMP_CYCLES_PER_US     (STM32_SYSCLK / 1000000U)
+
+#if (STM32_SYSCLK % 1000000U) != 0
+#error "timestamp requires an integer MHz system clock"
+#endif
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void timestamp_init(void);
+  uint32_t timestamp_nowI(void);
+  uint32_t timestamp_now(void);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _TIMESTAMP_H_ */
+
+/** @} */
@@ -0,0 +1,311 @@
+/**
+ * @file    src/traffic_gen.c
+ * @brief   Traffic generator.
+ * @details Sends the frames of can_gen.c at a target bus load. Below full
+ *          load a hardware timer spaces them: its interrupt hands the
+ *          next frame to a free mailbox at the end of each slot and sets
+ *          the length of the following one, the timer keeps counting in
+ *          between, so interrupt latency does not add up. The thread
+ *          prepares the next frame during the slot. A frame that finds no
+ *          free mailbox, the bus busy with other traffic, is counted late
+ *          and sent by the thread as soon as a mailbox empties, the
+ *          schedule continues from there.
+ *          At full load the thread fills every free mailbox whenever one
+ *          empties, the controller sends back to back.
+ *          The mailboxes are shared with the heartbeat and the host
+ *          frames, at full load the generator takes them first.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include "traffic_gen.h"
+#include "can_frame.h"
+#include "board_drivers.h"
+#include "timestamp.h"
+
+#define EVT_GEN_TX_EMPTY            EVENT_MASK(0)
+#define EVT_GEN_TIMER               EVENT_MASK(1)
+#define EVT_GEN_CONFIG              EVENT_MASK(2)
+
+/* Longest interval of the 16 bit timer.*/
+#define TIMER_MAX                   0xFFFFU
+
+static void gen_timer_cb(GPTDriver *gptp);
+
+static const GPTConfig genTimerConfig = {
+    TRAFFIC_GEN_TIMER_HZ,
+    gen_timer_cb,
+    0,
+    0
+};
+
+static thread_t *genThread;
+
+/* Settings and totals, under the system lock.*/
+static CanGenConfig genConfig;
+static bool genChanged;
+static TrafficGenStats genStats;
+
+/* Generator state, only used by the thread.*/
+static CanGen gen;
+static uint32_t genBitrate;
+
+/* The next frame, handed to the timer interrupt under the system lock.*/
+static CANTxFrame nextFrame;
+static uint32_t nextBits;
+static uint32_t nextSlot;
+static bool nextReady;
+static bool timerRunning;
+static uint32_t slotLeft;
+
+/*
+ * Next timer interval of the slot. A slot longer than the timer goes in
+ * parts, none of them short.
+ */
+static uint32_t slot_part(void)
+{
+    uint32_t part = slotLeft;
+
+    if (part > 2 * TIMER_MAX)
+        part = TIMER_MAX;
+    else if (part > TIMER_MAX)
+        part /= 2;
+    slotLeft -= part;
+
+    return part;
+}
+
+/*
+ * Hands the next frame to a free mailbox. Called under the system lock.
+ */
+static bool send_nextI(void)
+{
+    if (!nextReady || CANDRIVER.state != CAN_READY ||
+        !can_lld_is_tx_empty(&CANDRIVER, CAN_ANY_MAILBOX))
+        return false;
+
+    can_lld_transmit(&CANDRIVER, CAN_ANY_MAILBOX, &nextFrame);
+    nextReady = false;
+    slotLeft = nextSlot;
+    genStats.frames++;
+    genStats.bits += nextBits;
+
+    return true;
+}
+
+/*
+ * End of a slot or of a part of it, in the timer interrupt.
+ */
+static void gen_timer_cb(GPTDriver *gptp)
+{
+    chSysLockFromISR();
+    if (slotLeft != 0)
+        gptChangeIntervalI(gptp, slot_part());
+    else if (send_nextI())
+    {
+        /* The counter restarted at the end of the slot, the next one is
+           timed from there.*/
+        gptChangeIntervalI(gptp, slot_part());
+        chEvtSignalI(genThread, EVT_GEN_TIMER);
+    }
+    else
+    {
+        gptStopTimerI(gptp);
+        timerRunning = false;
+        genStats.late++;
+        chEvtSignalI(genThread, EVT_GEN_TIMER);
+    }
+    chSysUnlockFromISR();
+}
+
+static void gen_prepare(void)
+{
+    CanRecord record;
+    uint32_t bits = can_gen_next(&gen, &record);
+    uint32_t slot = can_gen_slot(&gen, bits);
+
+    chSysLock();
+    canFrameFromRecord(&record, &nextFrame);
+    nextBits = bits;
+    nextSlot = slot;
+    nextReady = true;
+    chSysUnlock();
+}
+
+static void gen_stop(void)
+{
+    chSysLock();
+    if (timerRunning)
+        gptStopTimerI(&TRAFFICGENTIMER);
+    timerRunning = false;
+    nextReady = false;
+    slotLeft = 0;
+    chSysUnlock();
+}
+
+/*
+ * Takes new settings, a load of zero stops and keeps the totals.
+ */
+static void gen_restart(void)
+{
+    CanGenConfig config;
+
+    gen_stop();
+
+    chSysLock();
+    config = genConfig;
+    genChanged = false;
+    genStats.running = config.load != 0;
+    if (genStats.running)
+    {
+        genStats.load = config.load;
+        genStats.frames = 0;
+        genStats.bits = 0;
+        genStats.late = 0;
+        genStats.start = timestamp_nowI();
+    }
+    chSysUnlock();
+
+    can_gen_init(&gen, &config);
+    genBitrate = BoardCanGetBitrate();
+    can_gen_set_clock(&gen, genBitrate, TRAFFIC_GEN_TIMER_HZ);
+}
+
+/*
+ * Full load, every free mailbox is filled.
+ */
+static void gen_fill(void)
+{
+    while (true)
+    {
+        if (!nextReady)
+            gen_prepare();
+
+        chSysLock();
+        bool sent = send_nextI();
+        chSysUnlock();
+        if (!sent)
+            return;
+    }
+}
+
+/*
+ * Below full load the timer sends, the thread keeps the next frame ready
+ * and starts the timer with the first frame or after a late one.
+ */
+static void gen_schedule(void)
+{
+    if (!nextReady)
+        gen_prepare();
+
+    chSysLock();
+    if (!timerRunning && send_nextI())
+    {
+        gptStartContinuousI(&TRAFFICGENTIMER, slot_part());
+        timerRunning = true;
+    }
+    chSysUnlock();
+
+    if (!nextReady)
+        gen_prepare();
+}
+
+static LGCR_CCM_DATA THD_WORKING_AREA(trafficGenWa, 256);
+static THD_FUNCTION(trafficGen, arg)
+{
+    event_listener_t el;
+
+    (void)arg;
+    chRegSetThreadName("generator");
+
+    chEvtRegister(&CANDRIVER.txempty_event, &el, 0);
+    while (!chThdShouldTerminateX())
+    {
+        if (genChanged)
+            gen_restart();
+
+        if (genStats.running && BoardCanGetBitrate() != genBitrate)
+        {
+            /* Slots of the old bitrate, the schedule starts over.*/
+            gen_stop();
+            genBitrate = BoardCanGetBitrate();
+            can_gen_set_clock(&gen, genBitrate, TRAFFIC_GEN_TIMER_HZ);
+        }
+
+        if (genStats.running && gen.config.load == CAN_GEN_LOAD_FULL)
+            gen_fill();
+        else if (genStats.running)
+            gen_schedule();
+
+        /* A mailbox taken by someone else may be free again.*/
+        eventmask_t events = chEvtWaitAnyTimeout(ALL_EVENTS,
+                genStats.running ? MS2ST(10) : TIME_INFINITE);
+        if ((events & EVT_GEN_TX_EMPTY) != 0)
+            (void)chEvtGetAndClearFlags(&el);
+    }
+    chEvtUnregister(&CANDRIVER.txempty_event, &el);
+}
+
+/*===========================================================================*/
+/* External functions.                                                       */
+/*===========================================================================*/
+
+/**
+ * @brief   Starts the generator thread and the gap timer.
+ *
+ * @param[in] prio      Thread priority, the timer keeps the gaps.
+ * @param[in] config    Settings to start with, a load of zero is off.
+ */
+void trafficGenStart(tprio_t prio, const CanGenConfig *config)
+{
+    if (can_gen_check(config))
+        genConfig = *config;
+    genChanged = true;
+
+    gptStart(&TRAFFICGENTIMER, &genTimerConfig);
+    genThread = chThdCreateStatic(trafficGenWa, sizeof(trafficGenWa), prio,
+                                  trafficGen, NULL);
+}
+
+/**
+ * @brief   Changes the settings, a running generator starts over.
+ *
+ * @return  False if the settings are invalid, nothing changed.
+ */
+bool trafficGenSet(const CanGenConfig *config)
+{
+    if (!can_gen_check(config))
+        return false;
+
+    chSysLock();
+    genConfig = *config;
+    genChanged = true;
+    chEvtSignalI(genThread, EVT_GEN_CONFIG);
+    chSchRescheduleS();
+    chSysUnlock();
+
+    return true;
+}
+
+/**
+ * @brief   Returns the settings.
+ */
+void trafficGenGetConfig(CanGenConfig *config)
+{
+    chSysLock();
+    *config = genConfig;
+    chSysUnlock();
+}
+
+/**
+ * @brief   Returns the totals of the current run.
+ */
+void trafficGenGetStats(TrafficGenStats *stats)
+{
+    chSysLock();
+    *stats = genStats;
+    chSysUnlock();
+}
+
+/** @} */
@@ -0,0 +1,66 @@
+/**
+ * @file    src/traffic_gen.h
+ * @brief   Traffic generator.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _TRAFFIC_GEN_H_
+#define _TRAFFIC_GEN_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "targetconf.h"
+#include "can_gen.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Counting rate of the gap timer, a divisor of the timer clocks
+ *          of all targets.
+ */
+#if !defined(TRAFFIC_GEN_TIMER_HZ) || defined(__DOXYGEN__)
+#define TRAFFIC_GEN_TIMER_HZ        4000000
+#endif
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Totals of the current run.
+ */
+typedef struct {
+    bool running;
+    uint16_t load;          /**< Target in permille.                       */
+    uint32_t frames;        /**< Frames handed to the controller.          */
+    uint64_t bits;          /**< Their bit times, stuff bits included.     */
+    uint32_t late;          /**< Frames without a free mailbox when due.   */
+    uint32_t start;         /**< Start of the run in microseconds.         */
+} TrafficGenStats;
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void trafficGenStart(tprio_t prio, const CanGenConfig *config);
+  bool trafficGenSet(const CanGenConfig *config);
+  void trafficGenGetConfig(CanGenConfig *config);
+  void trafficGenGetStats(TrafficGenStats *stats);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _TRAFFIC_GEN_H_ */
+
+/** @} */
@@ -0,0 +1,183 @@
+/**
+ * @file    src/uart_stream.c
+ * @brief   Double buffered DMA output over the UART driver.
+ * @details The writer fills one batch buffer while the DMA sends the other.
+ *          A filled buffer is handed over either directly, if the DMA is
+ *          idle, or marked pending and started from the end of transfer
+ *          callback. The CPU only touches the data once when it is copied
+ *          into the batch buffer.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include <string.h>
+
+#include "uart_stream.h"
+
+#if HAL_USE_UART || defined(__DOXYGEN__)
+
+static const UartStreamConfig *streamConfig;
+static UARTConfig uartConfig;
+
+static uint8_t batchBuffer[2][UART_STREAM_BUFFER_SIZE];
+static size_t batchLength[2];
+static uint8_t fillIndex;
+static bool dmaBusy;
+static bool handoverPending;
+static thread_reference_t writerThread;
+
+static UartStreamStats streamStats;
+
+static void start_fill_bufferI(void)
+{
+    uartStartSendI(streamConfig->uartp, batchLength[fillIndex],
+            batchBuffer[fillIndex]);
+    dmaBusy = true;
+    streamStats.batches++;
+    streamStats.bytes += batchLength[fillIndex];
+
+    fillIndex ^= 1;
+    batchLength[fillIndex] = 0;
+}
+
+/*
+ * The DMA has read the whole buffer, it can be reused.
+ */
+static void txend1(UARTDriver *uartp)
+{
+    (void)uartp;
+
+    osalSysLockFromISR();
+    dmaBusy = false;
+    if (handoverPending)
+    {
+        handoverPending = false;
+        start_fill_bufferI();
+        osalThreadResumeI(&writerThread, MSG_OK);
+    }
+    else if (batchLength[fillIndex] > 0)
+    {
+        streamStats.underruns++;
+    }
+    osalSysUnlockFromISR();
+}
+
+static void handover(void)
+{
+    chSysLock();
+    if (batchLength[fillIndex] > 0 && !handoverPending)
+    {
+        if (dmaBusy)
+            handoverPending = true;
+        else
+            start_fill_bufferI();
+    }
+    chSysUnlock();
+}
+
+/**
+ * @brief   Configures and starts the UART.
+ */
+void uart_stream_start(const UartStreamConfig *config)
+{
+    streamConfig = config;
+
+    memset(&uartConfig, 0, sizeof(uartConfig));
+    uartConfig.txend1_cb = txend1;
+    uartConfig.speed = config->speed;
+    uartConfig.cr2 = USART_CR2_STOP1_BITS;
+    if (config->flowControl)
+    {
+        uartConfig.cr3 = USART_CR3_RTSE | USART_CR3_CTSE;
+    }
+
+    fillIndex = 0;
+    batchLength[0] = 0;
+    batchLength[1] = 0;
+    dmaBusy = false;
+    handoverPending = false;
+
+    uartStart(config->uartp, &uartConfig);
+}
+
+/**
+ * @brief   Stops the UART, pending data is discarded.
+ */
+void uart_stream_stop(void)
+{
+    uartStopSend(streamConfig->uartp);
+    uartStop(streamConfig->uartp);
+
+    chSysLock();
+    dmaBusy = false;
+    handoverPending = false;
+    osalThreadResumeS(&writerThread, MSG_RESET);
+    chSchRescheduleS();
+    chSysUnlock();
+}
+
+/**
+ * @brief   Appends data to the current batch.
+ * @details Full batches are handed to the DMA. If both buffers are in use
+ *          the writer waits up to @p timeout for the DMA, after that the
+ *          remaining data is dropped and counted as an overrun.
+ *
+ * @return  Number of bytes accepted.
+ */
+size_t uart_stream_write(const uint8_t *buf, size_t n, systime_t timeout)
+{
+    size_t written = 0;
+
+    while (written < n)
+    {
+        chSysLock();
+        if (handoverPending &&
+            osalThreadSuspendTimeoutS(&writerThread, timeout) != MSG_OK)
+        {
+            streamStats.overruns++;
+            streamStats.droppedBytes += n - written;
+            chSysUnlock();
+            break;
+        }
+        chSysUnlock();
+
+        /* The fill buffer is owned by the writer until it is handed over.*/
+        size_t space = UART_STREAM_BUFFER_SIZE - batchLength[fillIndex];
+        size_t chunk = n - written < space ? n - written : space;
+
+        memcpy(&batchBuffer[fillIndex][batchLength[fillIndex]], &buf[written],
+                chunk);
+        batchLength[fillIndex] += chunk;
+        written += chunk;
+
+        if (batchLength[fillIndex] == UART_STREAM_BUFFER_SIZE)
+        {
+            handover();
+        }
+    }
+
+    return written;
+}
+
+/**
+ * @brief   Hands a partially filled batch to the DMA.
+ */
+void uart_stream_flush(void)
+{
+    handover();
+}
+
+/**
+ * @brief   Returns a snapshot of the statistics.
+ */
+void uart_stream_get_stats(UartStreamStats *stats)
+{
+    chSysLock();
+    *stats = streamStats;
+    chSysUnlock();
+}
+
+#endif /* HAL_USE_UART */
+
+/** @} */
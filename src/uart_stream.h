@@ -0,0 +1,84 @@
+/**
+ * @file    src/uart_stream.h
+ * @brief   Double buffered DMA output over the UART driver.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _UART_STREAM_H_
+#define _UART_STREAM_H_
+
+#include "ch.h"
+#include "hal.h"
+
+#if HAL_USE_UART || defined(__DOXYGEN__)
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Size of each of the two batch buffers.
+ */
+#if !defined(UART_STREAM_BUFFER_SIZE) || defined(__DOXYGEN__)
+#define UART_STREAM_BUFFER_SIZE     512
+#endif
+
+/*===========================================================================*/
+/* Derived constants and error checks.                                       */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   UART stream configuration.
+ */
+typedef struct {
+    UARTDriver *uartp;
+    uint32_t speed;
+    bool flowControl;
+} UartStreamConfig;
+
+/**
+ * @brief   UART stream statistics.
+ */
+typedef struct {
+    uint32_t batches;       /**< DMA transfers started.                    */
+    uint32_t bytes;         /**< Bytes handed to the DMA.                  */
+    uint32_t underruns;     /**< DMA went idle while data was pending.     */
+    uint32_t overruns;      /**< Writes that found both buffers in use.    */
+    uint32_t droppedBytes;  /**< Bytes lost to overruns.                   */
+} UartStreamStats;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void uart_stream_start(const UartStreamConfig *config);
+  void uart_stream_stop(void);
+  size_t uart_stream_write(const uint8_t *buf, size_t n, systime_t timeout);
+  void uart_stream_flush(void);
+  void uart_stream_get_stats(UartStreamStats *stats);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HAL_USE_UART */
+
+#endif /* _UART_STREAM_H_ */
+
+/** @} */
@@ -19,8 +19,8 @@
 #include "targetconf.h"
 
 
-/* Virtual serial port over USB.*/
-extern SerialUSBDriver SDU;
+/* Virtual serial port over USB, the name is mapped by targetconf.h.*/
+SerialUSBDriver SDU;
 /*
  * Endpoints to be used for USBD2.
  */
@@ -262,14 +262,33 @@ static const USBEndpointConfig ep2config = {
   NULL
 };
 
+/*
+ * DTR as last set by the host, a terminal program raises it when it opens
+ * the port.
+ */
+static bool dtrActive;
+
+/*
+ * Tracks SET_CONTROL_LINE_STATE, everything else is handled by the
+ * Serial over USB driver.
+ */
+static bool requests_hook(USBDriver *usbp) {
+
+  if ((usbp->setup[0] & USB_RTYPE_TYPE_MASK) == USB_RTYPE_TYPE_CLASS &&
+      usbp->setup[1] == CDC_SET_CONTROL_LINE_STATE) {
+    dtrActive = (usbp->setup[2] & 0x01) != 0;
+  }
+  return sduRequestsHook(usbp);
+}
+
 /*
  * Handles the USB driver global events.
  */
 static void usb_event(USBDriver *usbp, usbevent_t event) {
-  extern SerialUSBDriver SDU;
 
   switch (event) {
   case USB_EVENT_RESET:
+    dtrActive = false;
     return;
   case USB_EVENT_ADDRESS:
     return;
@@ -288,8 +307,10 @@ static void usb_event(USBDriver *usbp, usbevent_t event) {
     chSysUnlockFromISR();
     return;
   case USB_EVENT_UNCONFIGURED:
+    dtrActive = false;
     return;
   case USB_EVENT_SUSPEND:
+      dtrActive = false;
       chSysLockFromISR();
 
       /* Disconnection event on suspend.*/
@@ -323,7 +344,7 @@ static void sof_handler(USBDriver *usbp) {
 const USBConfig usbcfg = {
   usb_event,
   get_descriptor,
-  sduRequestsHook,
+  requests_hook,
   sof_handler
 };
 
@@ -336,3 +357,11 @@ const SerialUSBConfig serusbcfg = {
   USBD2_DATA_AVAILABLE_EP,
   USBD2_INTERRUPT_REQUEST_EP
 };
+
+/*
+ * Returns true while a host has the port open.
+ */
+bool usbcfgHostConnected(void) {
+
+  return serusbcfg.usbp->state == USB_ACTIVE && dtrActive;
+}
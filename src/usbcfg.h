@@ -18,7 +18,9 @@
 #define _USBCFG_H_
 
 extern const USBConfig usbcfg;
-extern SerialUSBConfig serusbcfg;
+extern const SerialUSBConfig serusbcfg;
+
+bool usbcfgHostConnected(void);
 
 #endif  /* _USBCFG_H_ */
 
@@ -0,0 +1,662 @@
+/**
+ * @file    src/usbcfg_gsusb.c
+ * @brief   gs_usb device binding for the ChibiOS USB and CAN drivers.
+ * @details Replaces the CDC configuration of usbcfg.c when the target is
+ *          built with USE_GSUSB=yes. The protocol itself lives in gs_usb.c,
+ *          this file only provides the endpoint layer and the controller
+ *          access. Controller restarts and transmissions can block, they
+ *          are deferred from the USB interrupt to the "gsusb" thread.
+ *          The thread keeps the transmit mailboxes filled and echoes a
+ *          frame when its mailbox empties, with the time of that wake-up
+ *          as for host_tx.c. A frame that failed or timed out is echoed
+ *          after an error frame, the host needs the echo to free its id.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#include <string.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "targetconf.h"
+
+#include "usbcfg_gsusb.h"
+#include "timestamp.h"
+#if LGCR_USE_BUS_EVENTS
+#include "can_event.h"
+#endif
+
+#define GSUSB_SW_VERSION            2
+#define GSUSB_HW_VERSION            1
+
+#define EVT_GSUSB_RESTART           EVENT_MASK(0)
+#define EVT_GSUSB_TX                EVENT_MASK(1)
+#define EVT_GSUSB_TX_DONE           EVENT_MASK(2)
+
+/* txempty_event flags, the low half marks mailboxes that sent their frame,
+   the high half those that failed.*/
+#define MAILBOX_SENT(m)             (1U << (m))
+#define MAILBOX_FAILED(m)           (1U << (16 + (m)))
+
+/* Mailbox state, only used by the gsusb thread.*/
+typedef struct {
+    bool busy;
+    bool aborted;
+    uint32_t order;         /* Request order, echoes follow it.            */
+    uint32_t loaded;        /* Time the frame entered the mailbox.         */
+    GsHostFrame frame;
+} GsusbMailbox;
+
+/*
+ * STM32 bxCAN bit timing limits, the CAN cell is clocked from APB1.
+ */
+static const GsDeviceBtConst gsusb_bt_const = {
+  STM32_PCLK1,
+  1, 16,                                /* tseg1.                           */
+  1, 8,                                 /* tseg2.                           */
+  4,                                    /* sjw.                             */
+  1, 1024, 1                            /* brp.                             */
+};
+
+GsUsb GSUSB1;
+
+static thread_t *gsusbThread;
+static CANConfig gsusbCanConfig;
+static bool gsusbCanRun;
+
+static GsHostFrame gsusbTxQueue[GSUSB_TX_QUEUE_SIZE];
+static uint16_t gsusbTxHead;
+static uint16_t gsusbTxCount;
+
+static GsusbMailbox gsusbMailboxes[CAN_TX_MAILBOXES];
+static uint32_t gsusbTxOrder;
+static eventflags_t gsusbTxFlags;
+
+/*
+ * Descriptors, generated by the protocol core at initialization.
+ */
+static uint8_t gsusb_device_descriptor_data[GS_USB_DEVICE_DESC_SIZE];
+static uint8_t gsusb_configuration_descriptor_data[GS_USB_CONFIG_DESC_SIZE];
+static uint8_t gsusb_string0[4] = {4, USB_DESCRIPTOR_STRING, 0x09, 0x04};
+static uint8_t gsusb_string1[2 + 2 * 8];
+static uint8_t gsusb_string2[2 + 2 * 16];
+static uint8_t gsusb_string3[2 + 2 * 8];
+
+static USBDescriptor gsusb_device_descriptor;
+static USBDescriptor gsusb_configuration_descriptor;
+static USBDescriptor gsusb_strings[4];
+
+/*
+ * Handles the GET_DESCRIPTOR callback. All required descriptors must be
+ * handled here.
+ */
+static const USBDescriptor *get_descriptor(USBDriver *usbp,
+                                           uint8_t dtype,
+                                           uint8_t dindex,
+                                           uint16_t lang) {
+
+  (void)usbp;
+  (void)lang;
+  switch (dtype) {
+  case USB_DESCRIPTOR_DEVICE:
+    return &gsusb_device_descriptor;
+  case USB_DESCRIPTOR_CONFIGURATION:
+    return &gsusb_configuration_descriptor;
+  case USB_DESCRIPTOR_STRING:
+    if (dindex < 4)
+      return &gsusb_strings[dindex];
+  }
+  return NULL;
+}
+
+/**
+ * @brief   IN EP1 state.
+ */
+static USBInEndpointState ep1instate;
+
+/**
+ * @brief   OUT EP2 state.
+ */
+static USBOutEndpointState ep2outstate;
+
+static void gsusb_in_cb(USBDriver *usbp, usbep_t ep)
+{
+    (void)usbp;
+    (void)ep;
+
+    osalSysLockFromISR();
+    gs_usb_in_completeI(&GSUSB1);
+    osalSysUnlockFromISR();
+}
+
+static void gsusb_out_cb(USBDriver *usbp, usbep_t ep)
+{
+    osalSysLockFromISR();
+    gs_usb_out_completeI(&GSUSB1, usbGetReceiveTransactionSizeI(usbp, ep));
+    osalSysUnlockFromISR();
+}
+
+/**
+ * @brief   EP1 initialization structure (IN only).
+ */
+static const USBEndpointConfig ep1config = {
+  USB_EP_MODE_TYPE_BULK,
+  NULL,
+  gsusb_in_cb,
+  NULL,
+  GS_USB_EP_SIZE,
+  0x0000,
+  &ep1instate,
+  NULL,
+  1,
+  NULL
+};
+
+/**
+ * @brief   EP2 initialization structure (OUT only).
+ */
+static const USBEndpointConfig ep2config = {
+  USB_EP_MODE_TYPE_BULK,
+  NULL,
+  NULL,
+  gsusb_out_cb,
+  0x0000,
+  GS_USB_EP_SIZE,
+  NULL,
+  &ep2outstate,
+  1,
+  NULL
+};
+
+/*
+ * Endpoint layer of the protocol core.
+ */
+static void gsusb_ep_start_in(void *arg, const uint8_t *buf, size_t n)
+{
+    USBDriver *usbp = (USBDriver *)arg;
+
+    usbPrepareTransmit(usbp, GS_USB_EP_IN, buf, n);
+    (void)usbStartTransmitI(usbp, GS_USB_EP_IN);
+}
+
+static void gsusb_ep_start_out(void *arg, uint8_t *buf, size_t n)
+{
+    USBDriver *usbp = (USBDriver *)arg;
+
+    usbPrepareReceive(usbp, GS_USB_EP_OUT, buf, n);
+    (void)usbStartReceiveI(usbp, GS_USB_EP_OUT);
+}
+
+/*
+ * Controller access of the protocol core.
+ */
+static bool gsusb_can_start(void *arg, const GsDeviceBittiming *bt,
+                            uint32_t flags)
+{
+    (void)arg;
+
+    uint32_t tseg1 = bt->prop_seg + bt->phase_seg1;
+
+    if (tseg1 < gsusb_bt_const.tseg1_min || tseg1 > gsusb_bt_const.tseg1_max ||
+        bt->phase_seg2 < gsusb_bt_const.tseg2_min ||
+        bt->phase_seg2 > gsusb_bt_const.tseg2_max ||
+        bt->sjw < 1 || bt->sjw > gsusb_bt_const.sjw_max ||
+        bt->brp < gsusb_bt_const.brp_min || bt->brp > gsusb_bt_const.brp_max)
+    {
+        return false;
+    }
+
+    gsusbCanConfig.mcr = CAN_MCR_ABOM | CAN_MCR_AWUM | CAN_MCR_TXFP;
+    if ((flags & GS_CAN_MODE_ONE_SHOT) != 0)
+    {
+        gsusbCanConfig.mcr |= CAN_MCR_NART;
+    }
+
+    gsusbCanConfig.btr = CAN_BTR_SJW(bt->sjw - 1) |
+            CAN_BTR_TS2(bt->phase_seg2 - 1) | CAN_BTR_TS1(tseg1 - 1) |
+            CAN_BTR_BRP(bt->brp - 1);
+    if ((flags & GS_CAN_MODE_LISTEN_ONLY) != 0)
+    {
+        gsusbCanConfig.btr |= CAN_BTR_SILM;
+    }
+    if ((flags & GS_CAN_MODE_LOOP_BACK) != 0)
+    {
+        gsusbCanConfig.btr |= CAN_BTR_LBKM;
+    }
+
+    gsusbCanRun = true;
+    gsusbTxHead = 0;
+    gsusbTxCount = 0;
+    chEvtSignalI(gsusbThread, EVT_GSUSB_RESTART);
+
+    return true;
+}
+
+static void gsusb_can_reset(void *arg)
+{
+    (void)arg;
+
+    gsusbCanRun = false;
+    gsusbTxHead = 0;
+    gsusbTxCount = 0;
+    chEvtSignalI(gsusbThread, EVT_GSUSB_RESTART);
+}
+
+static bool gsusb_can_transmit(void *arg, const GsHostFrame *frame)
+{
+    (void)arg;
+
+    if (gsusbTxCount >= GSUSB_TX_QUEUE_SIZE)
+    {
+        return false;
+    }
+
+    gsusbTxQueue[(gsusbTxHead + gsusbTxCount) % GSUSB_TX_QUEUE_SIZE] = *frame;
+    gsusbTxCount++;
+    chEvtSignalI(gsusbThread, EVT_GSUSB_TX);
+
+    return true;
+}
+
+static uint32_t gsusb_timestamp(void *arg)
+{
+    (void)arg;
+
+    return timestamp_nowI();
+}
+
+static void gsusb_get_state(void *arg, uint32_t *state, uint32_t *rxerr,
+                            uint32_t *txerr)
+{
+    (void)arg;
+
+    uint32_t esr = CANDRIVER.can->ESR;
+
+    if ((esr & CAN_ESR_BOFF) != 0)
+        *state = 3;
+    else if ((esr & CAN_ESR_EPVF) != 0)
+        *state = 2;
+    else if ((esr & CAN_ESR_EWGF) != 0)
+        *state = 1;
+    else
+        *state = 0;
+
+    *rxerr = (esr & CAN_ESR_REC) >> 24;
+    *txerr = (esr & CAN_ESR_TEC) >> 16;
+}
+
+static const GsUsbConfig gsusb_config = {
+  &USBD1,
+  gsusb_ep_start_in,
+  gsusb_ep_start_out,
+  gsusb_can_start,
+  gsusb_can_reset,
+  gsusb_can_transmit,
+  gsusb_timestamp,
+  NULL,
+  gsusb_get_state,
+  &gsusb_bt_const,
+  GSUSB_SW_VERSION,
+  GSUSB_HW_VERSION
+};
+
+/*
+ * Handles the vendor requests of the gs_usb protocol.
+ */
+static void control_complete(USBDriver *usbp)
+{
+    (void)usbp;
+
+    osalSysLockFromISR();
+    gs_usb_control_completeI(&GSUSB1);
+    osalSysUnlockFromISR();
+}
+
+static bool requests_hook(USBDriver *usbp)
+{
+    uint8_t *buf;
+    size_t n;
+    gsusbctrl_t ctrl;
+
+    osalSysLockFromISR();
+    ctrl = gs_usb_control_setupI(&GSUSB1, usbp->setup, &buf, &n);
+    osalSysUnlockFromISR();
+
+    switch (ctrl)
+    {
+    case GS_USB_CTRL_IN:
+        usbSetupTransfer(usbp, buf, n, NULL);
+        return true;
+    case GS_USB_CTRL_OUT:
+        usbSetupTransfer(usbp, buf, n, control_complete);
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Handles the USB driver global events.
+ */
+static void usb_event(USBDriver *usbp, usbevent_t event) {
+
+  switch (event) {
+  case USB_EVENT_CONFIGURED:
+    chSysLockFromISR();
+
+    /* Enables the endpoints specified into the configuration.
+       Note, this callback is invoked from an ISR so I-Class functions
+       must be used.*/
+    usbInitEndpointI(usbp, GS_USB_EP_IN, &ep1config);
+    usbInitEndpointI(usbp, GS_USB_EP_OUT, &ep2config);
+
+    gs_usb_configuredI(&GSUSB1);
+
+    chSysUnlockFromISR();
+    return;
+  case USB_EVENT_RESET:
+  case USB_EVENT_UNCONFIGURED:
+  case USB_EVENT_SUSPEND:
+    chSysLockFromISR();
+    gs_usb_disconnectedI(&GSUSB1);
+    chSysUnlockFromISR();
+    return;
+  case USB_EVENT_ADDRESS:
+  case USB_EVENT_WAKEUP:
+  case USB_EVENT_STALLED:
+    return;
+  }
+  return;
+}
+
+/*
+ * USB driver configuration.
+ */
+const USBConfig gsusbcfg = {
+  usb_event,
+  get_descriptor,
+  requests_hook,
+  NULL
+};
+
+static void frame_to_tx(CANTxFrame *txf, const GsHostFrame *frame)
+{
+    if ((frame->can_id & GS_CAN_EFF_FLAG) != 0)
+    {
+        txf->IDE = CAN_IDE_EXT;
+        txf->EID = frame->can_id & GS_CAN_EFF_MASK;
+    }
+    else
+    {
+        txf->IDE = CAN_IDE_STD;
+        txf->SID = frame->can_id & GS_CAN_SFF_MASK;
+    }
+    txf->RTR = (frame->can_id & GS_CAN_RTR_FLAG) != 0 ?
+            CAN_RTR_REMOTE : CAN_RTR_DATA;
+    txf->DLC = frame->can_dlc;
+    memcpy(txf->data8, frame->data, 8);
+}
+
+/*
+ * Echoes the frames of the mailboxes that emptied, oldest request first.
+ * Flags are kept until their mailbox is seen empty, a mailbox may empty
+ * after the status register was read.
+ */
+static void tx_complete(uint32_t now)
+{
+    uint32_t tsr = CANDRIVER.can->TSR;
+    uint32_t esr = CANDRIVER.can->ESR;
+
+    while (true)
+    {
+        GsusbMailbox *done = NULL;
+        size_t m = 0;
+
+        for (size_t i = 0; i < CAN_TX_MAILBOXES; i++)
+        {
+            GsusbMailbox *mbp = &gsusbMailboxes[i];
+
+            if (mbp->busy && (tsr & (CAN_TSR_TME0 << i)) != 0 &&
+                (done == NULL || mbp->order - done->order > 0x80000000U))
+            {
+                done = mbp;
+                m = i;
+            }
+        }
+        if (done == NULL)
+            return;
+
+        /* An abort ends like a success in the flags.*/
+        uint32_t error = 0;
+        if (done->aborted)
+            error = GS_CAN_ERR_TX_TIMEOUT;
+        else if ((gsusbTxFlags & MAILBOX_FAILED(m)) != 0 ||
+                 (gsusbTxFlags & MAILBOX_SENT(m)) == 0)
+            error = GS_CAN_ERR_PROT;
+        if (error != 0 && (esr & CAN_ESR_BOFF) != 0)
+            error |= GS_CAN_ERR_BUSOFF;
+        gsusbTxFlags &= ~(MAILBOX_SENT(m) | MAILBOX_FAILED(m));
+        done->busy = false;
+
+        chSysLock();
+        (void)gs_usb_post_echoI(&GSUSB1, &done->frame, now, error);
+        chSysUnlock();
+    }
+}
+
+/*
+ * Aborts mailboxes holding a frame past its time, the abort shows as an
+ * empty mailbox.
+ */
+static void tx_expire(uint32_t now)
+{
+    for (size_t i = 0; i < CAN_TX_MAILBOXES; i++)
+    {
+        GsusbMailbox *mbp = &gsusbMailboxes[i];
+
+        if (mbp->busy && !mbp->aborted &&
+            now - mbp->loaded >= GSUSB_TX_TIMEOUT_US)
+        {
+            mbp->aborted = true;
+            CANDRIVER.can->TSR = CAN_TSR_ABRQ0 << (8 * i);
+        }
+    }
+}
+
+/*
+ * Moves queued host frames into the free mailboxes, each frame freed
+ * from the queue lets the core take the next one from the host.
+ */
+static void tx_fill(uint32_t now)
+{
+    for (size_t i = 0; i < CAN_TX_MAILBOXES; i++)
+    {
+        GsusbMailbox *mbp = &gsusbMailboxes[i];
+        GsHostFrame frame;
+        CANTxFrame txf;
+
+        if (mbp->busy)
+            continue;
+
+        chSysLock();
+        if (!gsusbCanRun || gsusbTxCount == 0)
+        {
+            chSysUnlock();
+            return;
+        }
+        frame = gsusbTxQueue[gsusbTxHead];
+        chSysUnlock();
+
+        frame_to_tx(&txf, &frame);
+        if (canTransmit(&CANDRIVER, (canmbx_t)(i + 1), &txf,
+                        TIME_IMMEDIATE) != MSG_OK)
+            continue;
+
+        mbp->busy = true;
+        mbp->aborted = false;
+        mbp->order = gsusbTxOrder++;
+        mbp->loaded = now;
+        mbp->frame = frame;
+
+        /* A reset meanwhile emptied the queue, the restart clears the
+           mailbox.*/
+        chSysLock();
+        if (gsusbTxCount > 0)
+        {
+            gsusbTxHead = (uint16_t)((gsusbTxHead + 1) % GSUSB_TX_QUEUE_SIZE);
+            gsusbTxCount--;
+            gs_usb_tx_resumeI(&GSUSB1);
+            chSchRescheduleS();
+        }
+        chSysUnlock();
+    }
+}
+
+static bool tx_busy(void)
+{
+    for (size_t i = 0; i < CAN_TX_MAILBOXES; i++)
+    {
+        if (gsusbMailboxes[i].busy)
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * Restarts the controller on behalf of the host and transmits the host
+ * frames. Every frame taken is echoed once its mailbox empties.
+ */
+static LGCR_CCM_DATA THD_WORKING_AREA(gsusb_wa, 256);
+static THD_FUNCTION(gsusb, arg)
+{
+    event_listener_t el;
+
+    (void) arg;
+    chRegSetThreadName("gsusb");
+
+    chEvtRegister(&CANDRIVER.txempty_event, &el, 2);
+    while (!chThdShouldTerminateX())
+    {
+        /* Frames in a mailbox are checked for their time.*/
+        eventmask_t evt = chEvtWaitAnyTimeout(ALL_EVENTS,
+                tx_busy() ? MS2ST(10) : MS2ST(100));
+        uint32_t now = timestamp_now();
+
+        if ((evt & EVT_GSUSB_TX_DONE) != 0)
+            gsusbTxFlags |= chEvtGetAndClearFlags(&el);
+
+        if ((evt & EVT_GSUSB_RESTART) != 0)
+        {
+            /* The host dropped its echo ids with the reset.*/
+            canStop(&CANDRIVER);
+            for (size_t i = 0; i < CAN_TX_MAILBOXES; i++)
+                gsusbMailboxes[i].busy = false;
+            gsusbTxFlags = 0;
+            (void)chEvtGetAndClearFlags(&el);
+            if (gsusbCanRun)
+            {
+                canStart(&CANDRIVER, &gsusbCanConfig);
+#if LGCR_USE_BUS_EVENTS
+                /* The receiver reads the error code, see main.c.*/
+                CANDRIVER.can->IER &= ~CAN_IER_LECIE;
+                CANDRIVER.can->ESR = CAN_LEC_UNSET << 4;
+#endif
+            }
+        }
+
+        tx_complete(now);
+        tx_expire(now);
+        tx_fill(now);
+    }
+    chEvtUnregister(&CANDRIVER.txempty_event, &el);
+}
+
+/**
+ * @brief   Initializes the protocol state and builds the descriptors.
+ */
+void gsusbObjectInit(void)
+{
+    gs_usb_init(&GSUSB1, &gsusb_config);
+
+    gsusb_device_descriptor.ud_size = gs_usb_device_descriptor(
+            gsusb_device_descriptor_data,
+            sizeof(gsusb_device_descriptor_data));
+    gsusb_device_descriptor.ud_string = gsusb_device_descriptor_data;
+
+    gsusb_configuration_descriptor.ud_size = gs_usb_config_descriptor(
+            gsusb_configuration_descriptor_data,
+            sizeof(gsusb_configuration_descriptor_data));
+    gsusb_configuration_descriptor.ud_string =
+            gsusb_configuration_descriptor_data;
+
+    gsusb_strings[0].ud_size = sizeof(gsusb_string0);
+    gsusb_strings[0].ud_string = gsusb_string0;
+    gsusb_strings[1].ud_size = gs_usb_string_descriptor(gsusb_string1,
+            sizeof(gsusb_string1), "lgcr_ex");
+    gsusb_strings[1].ud_string = gsusb_string1;
+    gsusb_strings[2].ud_size = gs_usb_string_descriptor(gsusb_string2,
+            sizeof(gsusb_string2), "lgcr_ex gs_usb");
+    gsusb_strings[2].ud_string = gsusb_string2;
+    gsusb_strings[3].ud_size = gs_usb_string_descriptor(gsusb_string3,
+            sizeof(gsusb_string3), "0001");
+    gsusb_strings[3].ud_string = gsusb_string3;
+}
+
+/**
+ * @brief   Starts the thread serving controller restarts and transmissions.
+ */
+void gsusbStart(tprio_t prio)
+{
+    gsusbThread = chThdCreateStatic(gsusb_wa, sizeof(gsusb_wa), prio, gsusb,
+            NULL);
+}
+
+/**
+ * @brief   Forwards a received frame to the host.
+ * @details @p overflow marks frames lost before this one.
+ *
+ * @return  false if the channel is stopped or the host is not keeping up.
+ */
+bool gsusbPostRx(const CanRecord *record, bool overflow)
+{
+    uint32_t can_id = CAN_RECORD_GET_ID(record);
+    uint8_t data[8];
+    uint8_t dlc = can_record_get_data(record, data);
+    bool ok;
+
+    if (CAN_RECORD_IS_EXT(record))
+        can_id |= GS_CAN_EFF_FLAG;
+    if (CAN_RECORD_IS_RTR(record))
+        can_id |= GS_CAN_RTR_FLAG;
+
+#if LGCR_USE_BUS_EVENTS
+    CanEvent event;
+
+    // bus events become SocketCAN error frames
+    if (can_event_from_record(record, &event))
+    {
+        can_id = can_event_socketcan(&event, data);
+        dlc = 8;
+    }
+#endif
+
+    chSysLock();
+    if (overflow)
+        GSUSB1.overflow_pending = true;
+    ok = gs_usb_post_rxI(&GSUSB1, can_id, dlc, data, record->timestamp);
+    chSysUnlock();
+
+    return ok;
+}
+
+/**
+ * @brief   Returns true while the host has the interface up.
+ */
+bool gsusbHostConnected(void)
+{
+    return GSUSB1.state == GS_USB_STARTED;
+}
+
+/** @} */
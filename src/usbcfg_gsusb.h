@@ -0,0 +1,57 @@
+/**
+ * @file    src/usbcfg_gsusb.h
+ * @brief   gs_usb device binding for the ChibiOS USB and CAN drivers.
+ *
+ * @addtogroup
+ * @{
+ */
+
+#ifndef _USBCFG_GSUSB_H_
+#define _USBCFG_GSUSB_H_
+
+#include "ch.h"
+#include "hal.h"
+
+#include "gs_usb.h"
+#include "can_record.h"
+
+/*===========================================================================*/
+/* Module pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Host frames waiting for a CAN transmit mailbox.
+ */
+#if !defined(GSUSB_TX_QUEUE_SIZE) || defined(__DOXYGEN__)
+#define GSUSB_TX_QUEUE_SIZE         8
+#endif
+
+/**
+ * @brief   A host frame not sent within this time is aborted and reported
+ *          as an error frame.
+ */
+#if !defined(GSUSB_TX_TIMEOUT_US) || defined(__DOXYGEN__)
+#define GSUSB_TX_TIMEOUT_US         100000
+#endif
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+extern const USBConfig gsusbcfg;
+extern GsUsb GSUSB1;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void gsusbObjectInit(void);
+  void gsusbStart(tprio_t prio);
+  bool gsusbPostRx(const CanRecord *record, bool overflow);
+  bool gsusbHostConnected(void);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _USBCFG_GSUSB_H_ */
+
+/** @} */
@@ -8,9 +8,32 @@
 #ifndef _BOARD_DRIVERS_H_
 #define _BOARD_DRIVERS_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Filter banks of CAN1, the others belong to CAN2 where there is one.
+ */
+#define BOARD_CAN_FILTERS 7
+
+/*
+ * Acceptance filter, identifier bits set in mask must match.
+ */
+typedef struct {
+    uint32_t id;
+    uint32_t mask;
+    bool extended;
+} BoardCanFilter;
+
 void BoardDriverInit(void);
-void BoardDriverStart(void);
+void BoardDriverStartCapture(void);
+void BoardDriverStartHostLink(void);
 void BoardDriverShutdown(void);
+bool BoardHostConnected(void);
+bool BoardCanSetBitrate(uint32_t bitrate, uint16_t samplePoint, bool silent);
+uint32_t BoardCanGetBitrate(void);
+bool BoardCanConfigure(uint32_t bitrate, uint16_t samplePoint, bool loopback,
+                       const BoardCanFilter *filters, uint32_t count);
 
 #endif /* _LEDCONF_H_ */
 
@@ -19,6 +19,21 @@
 
 #define STM32F103_MCUCONF
 
+/*
+ * USART2 carries the capture output, either through the serial driver or,
+ * with LGCR_USE_UART_DMA, through the DMA based UART driver.
+ */
+#if !defined(LGCR_USE_UART_DMA)
+#define LGCR_USE_UART_DMA                   FALSE
+#endif
+
+/*
+ * The traffic generator times its gaps with TIM4, TIM3 is the system tick.
+ */
+#if !defined(LGCR_USE_GENERATOR)
+#define LGCR_USE_GENERATOR                  FALSE
+#endif
+
 /*
  * STM32F103 drivers configuration.
  * The following settings override the default settings present in
@@ -90,7 +105,7 @@
 #define STM32_GPT_USE_TIM1                  FALSE
 #define STM32_GPT_USE_TIM2                  FALSE
 #define STM32_GPT_USE_TIM3                  FALSE
-#define STM32_GPT_USE_TIM4                  FALSE
+#define STM32_GPT_USE_TIM4                  LGCR_USE_GENERATOR
 #define STM32_GPT_USE_TIM5                  FALSE
 #define STM32_GPT_USE_TIM8                  FALSE
 #define STM32_GPT_TIM1_IRQ_PRIORITY         7
@@ -154,7 +169,7 @@
  * SERIAL driver system settings.
  */
 #define STM32_SERIAL_USE_USART1             FALSE
-#define STM32_SERIAL_USE_USART2             TRUE
+#define STM32_SERIAL_USE_USART2             !LGCR_USE_UART_DMA
 #define STM32_SERIAL_USE_USART3             FALSE
 #define STM32_SERIAL_USE_UART4              FALSE
 #define STM32_SERIAL_USE_UART5              FALSE
@@ -188,7 +203,7 @@
  * UART driver system settings.
  */
 #define STM32_UART_USE_USART1               FALSE
-#define STM32_UART_USE_USART2               FALSE
+#define STM32_UART_USE_USART2               LGCR_USE_UART_DMA
 #define STM32_UART_USE_USART3               FALSE
 #define STM32_UART_USART1_IRQ_PRIORITY      12
 #define STM32_UART_USART2_IRQ_PRIORITY      12
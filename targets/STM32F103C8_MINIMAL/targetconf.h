@@ -3,8 +3,279 @@
 #define _TARGETCONF_H_
 
 #define CANDRIVER CAND1
+
+/*
+ * Bitrate after reset and sample point in permille, the bit timing is
+ * solved from PCLK1 (24 MHz).
+ */
+#if !defined(CAN_BITRATE)
+#define CAN_BITRATE 500000
+#endif
+
+#if !defined(CAN_SAMPLE_POINT)
+#define CAN_SAMPLE_POINT 875
+#endif
+
+/*
+ * Detect the bitrate at startup in silent mode, see CAN_AUTOBAUD_RATES in
+ * can_autobaud.h.
+ */
+#if !defined(LGCR_USE_AUTOBAUD)
+#define LGCR_USE_AUTOBAUD FALSE
+#endif
+
+/*
+ * Record bus errors, bus state changes and receive overruns in the frame
+ * stream, see CAN_EVENT_HOLDOFF_US in can_event.h.
+ */
+#if !defined(LGCR_USE_BUS_EVENTS)
+#define LGCR_USE_BUS_EVENTS FALSE
+#endif
+
+/*
+ * Accept commands on the input side of the serial link: bitrate,
+ * acceptance filters, output format and heartbeat period.
+ */
+#if !defined(LGCR_USE_COMMANDS)
+#define LGCR_USE_COMMANDS FALSE
+#endif
+
+/*
+ * Send frames for the host, each answered by an echo in the stream, see
+ * HOST_TX_* in host_tx.h.
+ */
+#if !defined(LGCR_USE_HOST_TX)
+#define LGCR_USE_HOST_TX FALSE
+#endif
+
+/*
+ * Traffic generator, LGCR_USE_GENERATOR is set in mcuconf.h. The gaps
+ * are timed by TIM4. Settings at start, {load permille, id mode,
+ * extended, id, id count, dlc min, dlc max, data mode, {data}}, a load
+ * of zero is off until the gen command.
+ */
+#if LGCR_USE_GENERATOR
+#define TRAFFICGENTIMER GPTD4
+
+#if !defined(TRAFFIC_GEN_CONFIG)
+#define TRAFFIC_GEN_CONFIG {0, CAN_GEN_ID_FIXED, false, 0x7FF, 1, 8, 8, \
+        CAN_GEN_DATA_COUNTER, {0}}
+#endif
+#endif
+
+/*
+ * Stream decoded signals instead of frames once the host loaded a table
+ * with the sigload and sigcommit commands, see tools/candbc. The table
+ * takes up to SIGNAL_TABLE_SIZE bytes and SIGNAL_TABLE_SIGNALS signals.
+ */
+#if !defined(LGCR_USE_SIGNALS)
+#define LGCR_USE_SIGNALS FALSE
+#endif
+
+#define SIGNAL_TABLE_SIZE 1024
+#define SIGNAL_TABLE_SIGNALS 48
+
+/*
+ * Aggregate battery cell frames into pack and module summaries sent
+ * every BMS_SUMMARY_MS, with alerts at once when a cell crosses a limit,
+ * see can_bms.h. Cell frames are {id of module 0, extended, quantity,
+ * modules, mux byte, first byte, bytes per value, values, big endian,
+ * signed, factor, offset}, limits {low, high, spread, hysteresis} of
+ * voltage in mV and temperature in 0.1 degC.
+ */
+#if !defined(LGCR_USE_BMS)
+#define LGCR_USE_BMS FALSE
+#endif
+
+#if !defined(BMS_SUMMARY_MS)
+#define BMS_SUMMARY_MS 1000
+#endif
+
+#if !defined(BMS_CELL_FRAMES)
+#define BMS_CELL_FRAMES \
+        {0x6B0, false, CAN_BMS_VOLTAGE, 8, 0, 1, 2, 3, false, false, 1, 0}, \
+        {0x6C0, false, CAN_BMS_TEMPERATURE, 8, 0, 1, 1, 7, false, false, \
+         10, -400}
+#endif
+
+#if !defined(BMS_LIMITS)
+#define BMS_LIMITS {{2800, 4200, 100, 20}, {-200, 600, 150, 20}}
+#endif
+
+/*
+ * Reassemble ISO-TP messages on the device, see can_isotp.h. Frames on
+ * the identifiers of ISOTP_RANGES, {first, last} with CAN_RECORD_EXT for
+ * extended ones, are sniffed, the host opens active channels with the
+ * tpchan command. Each of ISOTP_SESSIONS sessions takes messages of up
+ * to ISOTP_PDU_SIZE bytes.
+ */
+#if !defined(LGCR_USE_ISOTP)
+#define LGCR_USE_ISOTP FALSE
+#endif
+
+#define ISOTP_SESSIONS 4
+#define ISOTP_PDU_SIZE 256
+
+#if !defined(ISOTP_RANGES)
+#define ISOTP_RANGES {0x7DF, 0x7EF}, \
+        {0x18DA0000 | CAN_RECORD_EXT, 0x18DBFFFF | CAN_RECORD_EXT}
+#endif
+
+/*
+ * Reassemble J1939 transport transfers (BAM and RTS/CTS) on the device
+ * and pass extended frames by parameter group, see can_j1939.h. Each of
+ * J1939_SESSIONS sessions takes 1785 bytes. J1939_PASS_PGNS, if defined,
+ * is the pass list at start, the host changes it with the pgnpass and
+ * pgnall commands.
+ */
+#if !defined(LGCR_USE_J1939)
+#define LGCR_USE_J1939 FALSE
+#endif
+
+#define J1939_SESSIONS 2
+
+/*
+ * Capture output goes to USART2. The USB peripheral of the F103 shares its
+ * packet SRAM with bxCAN, the two cannot be used at the same time, so
+ * Serial-over-USB is not available on this target.
+ */
 #define SERIALDRIVER SD2
 
+/*
+ * DMA UART output, LGCR_USE_UART_DMA is set in mcuconf.h.
+ */
+#if LGCR_USE_UART_DMA
+#define UARTSTREAMDRIVER UARTD2
+
+#if !defined(LGCR_UART_DMA_SPEED)
+#define LGCR_UART_DMA_SPEED 1500000
+#endif
+
+#if !defined(LGCR_UART_DMA_FLOW)
+#define LGCR_UART_DMA_FLOW FALSE
+#endif
+#endif
+
+/*
+ * Enumerate as a gs_usb (candleLight) device instead of a CDC serial port.
+ */
+#if !defined(LGCR_USE_GSUSB)
+#define LGCR_USE_GSUSB FALSE
+#endif
+
+/*
+ * No core coupled memory on the F103, everything stays in SRAM.
+ */
+#define LGCR_CCM_DATA
+
+/*
+ * Frames kept while no host is connected, 26 bytes each with the links
+ * of the eviction lists, 10 KB.
+ */
+#define CAN_BACKLOG_SIZE 400
+
+/*
+ * Backlog overload policy: CAN_DROP_NEWEST, CAN_DROP_OLDEST or
+ * CAN_DROP_PRIORITY. Protected identifiers are never dropped, given as
+ * {first, last, extended} ranges, e.g. {0x100, 0x10F, false}.
+ */
+#if !defined(CAN_BACKLOG_POLICY)
+#define CAN_BACKLOG_POLICY CAN_DROP_NEWEST
+#endif
+/* #define CAN_BACKLOG_PROTECTED_IDS {0x305, 0x305, false} */
+
+/*
+ * Pre/post trigger capture. The default fires on bus-off and error
+ * passive, keeping {pre, post} frames around the event. Fields follow
+ * CanTriggerConfig in can_trigger.h. The window sizes are given as
+ * CAN_TRIGGER_PRE_FRAMES and CAN_TRIGGER_POST_FRAMES so the build checks
+ * that the window fits the backlog.
+ */
+#if !defined(LGCR_USE_TRIGGER)
+#define LGCR_USE_TRIGGER FALSE
+#endif
+
+#define CAN_TRIGGER_HISTORY_SIZE 128
+
+#if !defined(CAN_TRIGGER_PRE_FRAMES)
+#define CAN_TRIGGER_PRE_FRAMES 128
+#endif
+#if !defined(CAN_TRIGGER_POST_FRAMES)
+#define CAN_TRIGGER_POST_FRAMES 256
+#endif
+
+#if !defined(CAN_TRIGGER_CONFIG)
+#define CAN_TRIGGER_CONFIG { CAN_TRIGGER_ON_ERROR, false, 0, 0, {0}, {0}, \
+        CAN_LIMIT_ERROR | CAN_BUS_OFF_ERROR, CAN_TRIGGER_PRE_FRAMES, \
+        CAN_TRIGGER_POST_FRAMES }
+#endif
+
+/*
+ * Flash log in the last 8 KB of the 64 KB flash, 1 KB pages. With
+ * USE_FLASH_LOG=yes the firmware is linked with STM32F103x8_flashlog.ld,
+ * which ends the flash at 0x0800E000. Keep both in step.
+ */
+#if !defined(LGCR_USE_FLASH_LOG)
+#define LGCR_USE_FLASH_LOG FALSE
+#endif
+
+#define FLASH_LOG_BASE 0x0800E000
+#define FLASH_LOG_SIZE 0x2000
+#define FLASH_LOG_SECTOR_SIZE 0x400
+#define FLASH_LOG_FIRST_SECTOR 0
+
+/*
+ * A page erase takes up to 40 ms, frames arriving meanwhile are held in
+ * RAM. Pages are only erased below 800 frames/s.
+ */
+#define FLASH_LOG_ERASE_US 40000
+#define FLASH_STM32_HOLD_FRAMES 32
+
+/*
+ * Frames written to the flash log, {id, mask, extended, intervalUs}. A
+ * non-zero interval logs each identifier at most once per interval.
+ */
+#if !defined(FLASH_LOG_FILTERS)
+#define FLASH_LOG_FILTERS {0, 0, false, 0}, {0, 0, true, 0}
+#endif
+
+/*
+ * Erase the flash log once the host has received all of it.
+ */
+#if !defined(FLASH_LOG_CLEAR_ON_DUMP)
+#define FLASH_LOG_CLEAR_ON_DUMP TRUE
+#endif
+
+/*
+ * Compressed binary output on the serial link.
+ */
+#if !defined(LGCR_USE_COMPRESS)
+#define LGCR_USE_COMPRESS FALSE
+#endif
+
+/*
+ * Adaptive output degradation, identifiers tracked while decimating.
+ */
+#if !defined(LGCR_USE_ADAPTIVE)
+#define LGCR_USE_ADAPTIVE FALSE
+#endif
+
+#define CAN_DEGRADE_SLOTS 64
+
+/*
+ * Snapshot output: the latest frame of up to CAN_SNAPSHOT_SIZE
+ * identifiers every CAN_SNAPSHOT_PERIOD_MS. Every n-th snapshot holds
+ * the full table, n = CAN_SNAPSHOT_FULL_EVERY (1: always, 0: never), the
+ * others only the updated entries.
+ */
+#if !defined(LGCR_USE_SNAPSHOT)
+#define LGCR_USE_SNAPSHOT FALSE
+#endif
+
+#define CAN_SNAPSHOT_SIZE 64
+#define CAN_SNAPSHOT_PERIOD_MS 50
+#define CAN_SNAPSHOT_FULL_EVERY 20
+
 #define GPIOTYPE GPIO_TypeDef
 
 #endif /* _TARGETCONF_H_ */
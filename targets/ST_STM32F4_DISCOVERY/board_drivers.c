@@ -10,8 +10,15 @@
 #include "ch.h"
 #include "hal.h"
 
+#include "targetconf.h"
+#if LGCR_USE_GSUSB
+#include "usbcfg_gsusb.h"
+#else
 #include "usbcfg.h"
+#endif
 #include "mod_led.h"
+#include "can_bittime.h"
+#include "can_event.h"
 
 extern SerialUSBDriver SDU1;
 
@@ -25,17 +32,46 @@ static ModLEDConfig ledCfg2 = {GPIOD, GPIOD_LED4, false};
 static ModLEDConfig ledCfg3 = {GPIOD, GPIOD_LED5, false};
 static ModLEDConfig ledCfg4 = {GPIOD, GPIOD_LED6, false};
 
+#if CAN_BITTIME_QUANTA(STM32_PCLK1, CAN_BITRATE, CAN_SAMPLE_POINT) == 0
+#error "CAN_BITRATE cannot be derived exactly from PCLK1"
+#endif
+
 /*
- * 500KBaud, automatic wakeup, automatic recover
- * from abort mode.
+ * CAN_BITRATE, automatic wakeup, automatic recover
+ * from abort mode. The bit timing is solved from PCLK1 at compile time.
  * See section 22.7.7 on the STM32 reference manual.
  */
-static const CANConfig cancfg = {
+static CANConfig cancfg = {
   CAN_MCR_ABOM | CAN_MCR_AWUM | CAN_MCR_TXFP,
-  CAN_BTR_SJW(0) | CAN_BTR_TS2(1) |
-  CAN_BTR_TS1(8) | CAN_BTR_BRP(6)
+  CAN_BITTIME_BTR(STM32_PCLK1, CAN_BITRATE, CAN_SAMPLE_POINT)
+#if LGCR_USE_AUTOBAUD
+  | CAN_BTR_SILM            /* until the bitrate is detected */
+#endif
   //| CAN_BTR_LBKM
 };
+static uint32_t canBitrate = CAN_BITRATE;
+
+/*
+ * The receiver (bitrate detection) and the output thread (host commands)
+ * both restart the controller, the configuration and the restart are
+ * done under this mutex.
+ */
+static MUTEX_DECL(canRestartMutex);
+
+/*
+ * Starts the controller with the current configuration. With bus events
+ * the receiver reads the last error code itself, the error code
+ * interrupt is turned off: the driver would clear the code and merge the
+ * codes of several interrupts into one event.
+ */
+static void start_controller(void)
+{
+    canStart(&CAND1, &cancfg);
+#if LGCR_USE_BUS_EVENTS
+    CAND1.can->IER &= ~CAN_IER_LECIE;
+    CAND1.can->ESR = CAN_LEC_UNSET << 4;
+#endif
+}
 
 void BoardDriverInit(void)
 {
@@ -44,15 +80,120 @@ void BoardDriverInit(void)
     mod_led_init(&LED_RED, &ledCfg3);
     mod_led_init(&LED_BOARDHEARTBEAT, &ledCfg4);
 
+#if LGCR_USE_GSUSB
+    gsusbObjectInit();
+#else
     sduObjectInit(&SDU1);
+#endif
 }
 
-void BoardDriverStart(void)
+/*
+ * Brings up the CAN controller, capture runs from here on.
+ */
+void BoardDriverStartCapture(void)
 {
-	canStart(&CAND1, &cancfg);
+	start_controller();
 
 	palSetPadMode(GPIOD, 0, PAL_MODE_ALTERNATE(9));
 	palSetPadMode(GPIOD, 1, PAL_STM32_OSPEED_HIGHEST | PAL_MODE_ALTERNATE(9));
+}
+
+/*
+ * Switches the bitrate. Only the controller is restarted, frames already
+ * captured stay in the pipeline. A silent controller neither acknowledges
+ * nor sends error frames.
+ */
+bool BoardCanSetBitrate(uint32_t bitrate, uint16_t samplePoint, bool silent)
+{
+    CanBitTiming bt;
+
+    if (!can_bittime_solve(STM32_PCLK1, bitrate, samplePoint, &bt))
+        return false;
+
+    chMtxLock(&canRestartMutex);
+    cancfg.btr = (cancfg.btr & CAN_BTR_LBKM) | can_bittime_btr(&bt);
+    if (silent)
+        cancfg.btr |= CAN_BTR_SILM;
+    canBitrate = bt.bitrate;
+
+    canStop(&CAND1);
+    start_controller();
+    chMtxUnlock(&canRestartMutex);
+
+    return true;
+}
+
+uint32_t BoardCanGetBitrate(void)
+{
+    return canBitrate;
+}
+
+/*
+ * Switches bitrate and acceptance filters in one controller restart, no
+ * filter accepts every frame. Each filter takes a bank in 32 bit mask
+ * mode. Silent mode is kept, in loopback mode the controller receives
+ * its own frames and still sends them on the bus.
+ */
+bool BoardCanConfigure(uint32_t bitrate, uint16_t samplePoint, bool loopback,
+                       const BoardCanFilter *filters, uint32_t count)
+{
+    CANFilter banks[BOARD_CAN_FILTERS];
+    CanBitTiming bt;
+
+    if (count > BOARD_CAN_FILTERS ||
+        !can_bittime_solve(STM32_PCLK1, bitrate, samplePoint, &bt))
+        return false;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        banks[i].filter = i;
+        banks[i].mode = 0;
+        banks[i].scale = 1;
+        banks[i].assignment = 0;
+        if (filters[i].extended)
+        {
+            banks[i].register1 = (filters[i].id << 3) | CAN_RI0R_IDE;
+            banks[i].register2 = (filters[i].mask << 3) | CAN_RI0R_IDE;
+        }
+        else
+        {
+            banks[i].register1 = filters[i].id << 21;
+            banks[i].register2 = (filters[i].mask << 21) | CAN_RI0R_IDE;
+        }
+    }
+
+    chMtxLock(&canRestartMutex);
+    cancfg.btr = (cancfg.btr & CAN_BTR_SILM) | can_bittime_btr(&bt);
+    if (loopback)
+        cancfg.btr |= CAN_BTR_LBKM;
+    canBitrate = bt.bitrate;
+
+    canStop(&CAND1);
+    canSTM32SetFilters(STM32_CAN_MAX_FILTERS / 2, count, banks);
+    start_controller();
+    chMtxUnlock(&canRestartMutex);
+
+    return true;
+}
+
+/*
+ * Brings up the host link. This blocks the caller for the USB reconnect
+ * delay, capture is already running at that point.
+ */
+void BoardDriverStartHostLink(void)
+{
+#if LGCR_USE_GSUSB
+    /*
+     * The gs_usb thread restarts the controller with the bit timing chosen
+     * by the host.
+     */
+    gsusbStart(NORMALPRIO + 6);
+
+    usbDisconnectBus(&USBD1);
+    chThdSleepMilliseconds(1000);
+    usbStart(&USBD1, &gsusbcfg);
+    usbConnectBus(&USBD1);
+#else
     /*
      * Initializes a serial-over-USB CDC driver.
      */
@@ -67,12 +208,29 @@ void BoardDriverStart(void)
     chThdSleepMilliseconds(1000);
     usbStart(serusbcfg.usbp, &usbcfg);
     usbConnectBus(serusbcfg.usbp);
+#endif
 }
 
 void BoardDriverShutdown(void)
 {
+#if LGCR_USE_GSUSB
+    usbStop(&USBD1);
+#else
     sduStop(&SDU1);
+#endif
     canStop(&CAND1);
 }
 
+/*
+ * True while a host consumes the capture stream.
+ */
+bool BoardHostConnected(void)
+{
+#if LGCR_USE_GSUSB
+    return gsusbHostConnected();
+#else
+    return usbcfgHostConnected();
+#endif
+}
+
 /** @} */
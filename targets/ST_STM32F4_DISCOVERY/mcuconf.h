@@ -17,6 +17,13 @@
 #ifndef _MCUCONF_H_
 #define _MCUCONF_H_
 
+/*
+ * The traffic generator times its gaps with TIM4, TIM5 is the system tick.
+ */
+#if !defined(LGCR_USE_GENERATOR)
+#define LGCR_USE_GENERATOR                  FALSE
+#endif
+
 /*
  * STM32F4xx drivers configuration.
  * The following settings override the default settings present in
@@ -126,7 +133,7 @@
 #define STM32_GPT_USE_TIM1                  FALSE
 #define STM32_GPT_USE_TIM2                  FALSE
 #define STM32_GPT_USE_TIM3                  FALSE
-#define STM32_GPT_USE_TIM4                  FALSE
+#define STM32_GPT_USE_TIM4                  LGCR_USE_GENERATOR
 #define STM32_GPT_USE_TIM5                  FALSE
 #define STM32_GPT_USE_TIM6                  FALSE
 #define STM32_GPT_USE_TIM7                  FALSE
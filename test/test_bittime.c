@@ -0,0 +1,157 @@
+/*
+ * Bit timing solver and its constant expression twin at the APB1 clocks of
+ * the F103 (24 MHz) and F4 (42 MHz) targets.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "can_bittime.h"
+
+#define SAMPLE_POINT    875
+
+/* Known timings at the common bitrates, 0 where the clock has none.*/
+typedef struct {
+    uint32_t clock;
+    uint32_t bitrate;
+    uint32_t btr;
+    uint16_t samplePoint;
+} Expected;
+
+static const Expected expected[] = {
+    {24000000,   10000, 0x011C0095, 875},
+    {24000000,   20000, 0x011C004A, 875},
+    {24000000,   50000, 0x011C001D, 875},
+    {24000000,   83333, 0x011E000F, 888},
+    {24000000,  100000, 0x011C000E, 875},
+    {24000000,  125000, 0x011C000B, 875},
+    {24000000,  250000, 0x011C0005, 875},
+    {24000000,  500000, 0x011C0002, 875},
+    {24000000,  800000, 0x011B0001, 866},
+    {24000000, 1000000, 0x00050002, 875},
+    {42000000,   10000, 0x011B0117, 866},
+    {42000000,   20000, 0x011B008B, 866},
+    {42000000,   50000, 0x011B0037, 866},
+    {42000000,   83333, 0x011E001B, 888},
+    {42000000,  100000, 0x011B001B, 866},
+    {42000000,  125000, 0x011C0014, 875},
+    {42000000,  250000, 0x011A000B, 857},
+    {42000000,  500000, 0x011A0005, 857},
+    {42000000,  800000, 0,          0},
+    {42000000, 1000000, 0x011A0002, 857},
+};
+
+/* Bitrate and sample point the register value gives.*/
+static void decode(uint32_t clock, uint32_t btr, uint32_t *bitrate,
+                   uint32_t *samplePoint)
+{
+    uint32_t brp = (btr & 0x3FF) + 1;
+    uint32_t tseg1 = ((btr >> 16) & 0xF) + 1;
+    uint32_t tseg2 = ((btr >> 20) & 0x7) + 1;
+    uint32_t sjw = ((btr >> 24) & 0x3) + 1;
+    uint32_t n = 1 + tseg1 + tseg2;
+
+    assert(sjw <= tseg2);
+    assert(n >= CAN_BITTIME_QUANTA_MIN && n <= CAN_BITTIME_QUANTA_MAX);
+    *bitrate = clock / (brp * n);
+    *samplePoint = (1 + tseg1) * 1000 / n;
+}
+
+static uint32_t ppm(uint32_t actual, uint32_t wanted)
+{
+    uint32_t diff = actual > wanted ? actual - wanted : wanted - actual;
+
+    return (uint32_t)((uint64_t)diff * 1000000U / wanted);
+}
+
+static void test_expected(void)
+{
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++)
+    {
+        const Expected *ep = &expected[i];
+        CanBitTiming bt;
+        bool ok = can_bittime_solve(ep->clock, ep->bitrate, SAMPLE_POINT,
+                                    &bt);
+
+        if (ep->btr == 0)
+        {
+            assert(!ok);
+            assert(CAN_BITTIME_QUANTA(ep->clock, ep->bitrate,
+                                      SAMPLE_POINT) == 0);
+            continue;
+        }
+        assert(ok);
+        assert(can_bittime_btr(&bt) == ep->btr);
+        assert(bt.samplePoint == ep->samplePoint);
+    }
+}
+
+/* 83.3 kbit/s divides neither clock, it is solved to the nearest bitrate
+   at run time and has no constant expression.*/
+static void test_inexact(void)
+{
+    CanBitTiming bt;
+
+    assert(can_bittime_solve(24000000, 83333, SAMPLE_POINT, &bt));
+    assert(24000000 % (bt.brp * (1U + bt.tseg1 + bt.tseg2)) != 0);
+    assert(ppm(bt.bitrate, 83333) == 0);
+    assert(CAN_BITTIME_QUANTA(24000000, 83333, SAMPLE_POINT) == 0);
+
+    /* 800 kbit/s at 42 MHz would be 52.5 cycles, the nearest fit is
+       further off than the limit.*/
+    assert(!can_bittime_solve(42000000, 800000, SAMPLE_POINT, &bt));
+
+    assert(!can_bittime_solve(24000000, 0, SAMPLE_POINT, &bt));
+    assert(!can_bittime_solve(24000000, 500000, 1000, &bt));
+}
+
+/* Every bitrate from 10k to 1M: the register value gives what the solver
+   reports, and matches the macros wherever they have a solution.*/
+static void test_sweep(uint32_t clock)
+{
+    uint32_t solved = 0;
+
+    for (uint32_t rate = 10000; rate <= 1000000; rate += 500)
+    {
+        CanBitTiming bt;
+        uint32_t btr;
+        uint32_t bitrate;
+        uint32_t samplePoint;
+        uint32_t n = CAN_BITTIME_QUANTA(clock, rate, SAMPLE_POINT);
+
+        if (!can_bittime_solve(clock, rate, SAMPLE_POINT, &bt))
+        {
+            assert(n == 0);
+            continue;
+        }
+        solved++;
+
+        btr = can_bittime_btr(&bt);
+        decode(clock, btr, &bitrate, &samplePoint);
+        assert(bitrate == bt.bitrate);
+        assert(samplePoint == bt.samplePoint);
+        assert(ppm(bitrate, rate) <= CAN_BITTIME_MAX_ERROR_PPM);
+
+        if (n != 0)
+        {
+            assert(btr == CAN_BITTIME_BTR(clock, rate, SAMPLE_POINT));
+            assert(bitrate == rate);
+            /* Exact solutions keep the sample point within a quantum.*/
+            assert(samplePoint + 1000 / n >= SAMPLE_POINT &&
+                   samplePoint <= SAMPLE_POINT + 1000 / n);
+        }
+    }
+    assert(solved > 0);
+}
+
+int main(void)
+{
+    test_expected();
+    test_inexact();
+    test_sweep(24000000);
+    test_sweep(42000000);
+
+    printf("test_bittime: ok\n");
+
+    return 0;
+}
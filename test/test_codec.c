@@ -0,0 +1,219 @@
+/*
+ * Frame stream codec: encode and decode random and cyclic traffic, with
+ * dictionary eviction, unchanged payloads, the wrap of the clock and
+ * the lost and text tokens in between.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "can_codec.h"
+
+static CanEncoder encoder;
+static CanDecoder decoder;
+static uint32_t seed;
+static size_t streamBytes;
+
+static uint32_t next_random(void)
+{
+    /* xorshift32, the same sequence on every run.*/
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+
+    return seed;
+}
+
+static void reset(void)
+{
+    can_encoder_init(&encoder);
+    can_decoder_init(&decoder);
+    seed = 0x2545F491U;
+    streamBytes = 0;
+}
+
+/*
+ * Feeds a token, only its last byte completes an event and a sync may
+ * come first.
+ */
+static cancodecevent_t feed(const uint8_t *out, size_t n)
+{
+    cancodecevent_t event = CAN_CODEC_NONE;
+
+    streamBytes += n;
+    for (size_t i = 0; i < n; i++)
+    {
+        event = can_decoder_feed(&decoder, out[i]);
+        if (i + 1 < n)
+            assert(event == CAN_CODEC_NONE || event == CAN_CODEC_SYNC);
+    }
+
+    return event;
+}
+
+/*
+ * Encodes and decodes a frame, returns the tag of its token.
+ */
+static uint8_t round_trip(const CanRecord *rp)
+{
+    uint8_t out[CAN_CODEC_MAX_FRAME];
+    size_t n = can_encoder_frame(&encoder, rp, out);
+    size_t tag = out[0] == CAN_CODEC_TAG_SYNC ? 8 : 0;
+
+    assert(n > tag && n <= CAN_CODEC_MAX_FRAME);
+    assert(feed(out, n) == CAN_CODEC_FRAME);
+    assert(decoder.record.timestamp == rp->timestamp);
+    assert(decoder.record.id == rp->id);
+    assert(memcmp(decoder.record.data, rp->data, 8) == 0);
+
+    return out[tag];
+}
+
+static void test_random(void)
+{
+    uint32_t now = 0xFFFFFF00U;
+    uint8_t data[8];
+
+    /* More identifiers than the dictionary holds, random gaps and
+       payloads, across several sync intervals and the clock wrap.*/
+    reset();
+    for (unsigned i = 0; i < 4 * CAN_CODEC_SYNC_INTERVAL; i++)
+    {
+        uint32_t r = next_random();
+        bool extended = (r & 1U) != 0;
+        bool remote = (r & 0x30U) == 0x30U;
+        uint8_t dlc = (uint8_t)((r >> 8) % 9U);
+        uint32_t id = (next_random() % (3U * CAN_CODEC_DICT_SIZE)) *
+                      (extended ? 0x10001U : 7U);
+        CanRecord record;
+
+        for (unsigned j = 0; j < 8; j++)
+            data[j] = (uint8_t)next_random();
+        now += (r >> 16) % 8U == 0 ? next_random() : (r >> 16) % 2000U;
+        can_record_set(&record, id, extended, remote, dlc, data, now);
+        (void)round_trip(&record);
+    }
+    assert(decoder.errors == 0);
+}
+
+static void test_cyclic(void)
+{
+    uint32_t now = 0xFFF00000U;
+    uint8_t data[CAN_CODEC_DICT_SIZE / 2][8];
+    unsigned frames = 0;
+
+    /* Half the dictionary sent every millisecond, a counter and a slow
+       signal change, the rest of the payload stays.*/
+    reset();
+    memset(data, 0x5A, sizeof(data));
+    for (unsigned cycle = 0; cycle < 2000; cycle++)
+    {
+        for (unsigned i = 0; i < CAN_CODEC_DICT_SIZE / 2; i++)
+        {
+            CanRecord record;
+
+            data[i][0] = (uint8_t)cycle;
+            if (cycle % 50U == 0)
+                data[i][3]++;
+            can_record_set(&record, 0x100U + i, false, false, 8, data[i],
+                           now + i * 20U);
+            (void)round_trip(&record);
+            frames++;
+        }
+        now += 1000;
+    }
+    assert(decoder.errors == 0);
+    /* Tag, time, index, mask and one changed byte.*/
+    assert(streamBytes < frames * 6U);
+}
+
+static void test_dictionary(void)
+{
+    uint8_t data[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    uint8_t out[CAN_CODEC_MAX_FRAME];
+    CanRecord record;
+
+    /* Known identifiers with an unchanged payload: tag, time, index and
+       an empty mask.*/
+    reset();
+    can_record_set(&record, 0x7FF, false, false, 8, data, 100);
+    assert((round_trip(&record) & CAN_CODEC_TAG_LITERAL) != 0);
+    record.timestamp = 200;
+    assert(can_encoder_frame(&encoder, &record, out) == 4);
+    assert(out[0] == 8 && out[1] == 100 && out[2] == 0 && out[3] == 0);
+    assert(feed(out, 4) == CAN_CODEC_FRAME);
+    assert(memcmp(decoder.record.data, data, 8) == 0);
+
+    /* The identifier after a full dictionary evicts the oldest, which
+       comes back as a literal starting from a zero payload.*/
+    for (uint32_t id = 1; id < CAN_CODEC_DICT_SIZE; id++)
+    {
+        can_record_set(&record, id, true, false, 8, data, 300 + id);
+        assert((round_trip(&record) & CAN_CODEC_TAG_LITERAL) != 0);
+    }
+    can_record_set(&record, 0x7FF, false, false, 8, data, 1000);
+    assert((round_trip(&record) & CAN_CODEC_TAG_LITERAL) == 0);
+    can_record_set(&record, CAN_CODEC_DICT_SIZE, true, false, 8, data, 1001);
+    assert((round_trip(&record) & CAN_CODEC_TAG_LITERAL) != 0);
+    can_record_set(&record, 0x7FF, false, false, 8, data, 1002);
+    assert((round_trip(&record) & CAN_CODEC_TAG_LITERAL) != 0);
+    can_record_set(&record, 1, true, false, 8, data, 1003);
+    assert((round_trip(&record) & CAN_CODEC_TAG_LITERAL) != 0);
+
+    /* Remote frames and empty payloads have no mask.*/
+    can_record_set(&record, 0x7FF, false, true, 4, data, 1004);
+    assert(round_trip(&record) == (CAN_CODEC_TAG_RTR | 4));
+    can_record_set(&record, 0x7FF, false, false, 0, data, 1005);
+    assert(round_trip(&record) == 0);
+    assert(decoder.errors == 0);
+}
+
+static void test_tokens(void)
+{
+    uint8_t out[CAN_CODEC_MAX_TOKEN + CAN_CODEC_TEXT_OFFSET];
+    uint8_t data[8] = {0};
+    CanRecord record;
+    cancodecevent_t event = CAN_CODEC_NONE;
+    size_t n;
+
+    /* A pending sync goes ahead of lost counts and markers.*/
+    reset();
+    n = can_encoder_lost(&encoder, 300, out);
+    assert(out[0] == CAN_CODEC_TAG_SYNC);
+    assert(feed(out, n) == CAN_CODEC_LOST && decoder.lost == 300);
+    can_record_set(&record, 0x123, false, false, 2, data, 50);
+    (void)round_trip(&record);
+    n = can_encoder_text(&encoder, "mark", 4, out);
+    assert(feed(out, n) == CAN_CODEC_TEXT);
+    assert(strcmp(decoder.text, "mark") == 0);
+
+    /* After lost output the encoder starts over with a sync, a decoder
+       that missed bytes finds it.*/
+    can_record_set(&record, 0x124, false, false, 2, data, 60);
+    n = can_encoder_frame(&encoder, &record, out);
+    can_encoder_reset(&encoder);
+    assert(feed(out, n - 2) == CAN_CODEC_NONE);
+    record.timestamp = 70;
+    n = can_encoder_frame(&encoder, &record, out);
+    assert(out[0] == CAN_CODEC_TAG_SYNC);
+    for (size_t i = 0; i < n; i++)
+        event = can_decoder_feed(&decoder, out[i]);
+    assert(event == CAN_CODEC_FRAME && decoder.record.timestamp == 70);
+    assert(decoder.errors == 1);
+    data[1] = 9;
+    can_record_set(&record, 0x124, false, false, 2, data, 80);
+    (void)round_trip(&record);
+}
+
+int main(void)
+{
+    test_random();
+    test_cyclic();
+    test_dictionary();
+    test_tokens();
+
+    printf("test_codec: ok\n");
+
+    return 0;
+}
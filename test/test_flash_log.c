@@ -0,0 +1,295 @@
+/*
+ * Flash log core on the RAM flash emulation: wrap-around, wear levelling,
+ * sealing, clearing and recovery after a reset during programming.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "flash_log.h"
+#include "flash_ram.h"
+
+#define SECTOR_SIZE     (2 * FLASH_LOG_PAGE_SIZE)
+#define SECTORS         4
+#define REGION_SIZE     (SECTORS * SECTOR_SIZE)
+#define PAGES           (REGION_SIZE / FLASH_LOG_PAGE_SIZE)
+
+/* Emulated flash behind a shim that counts erases per sector and can cut
+   the power in the middle of a program call.*/
+static uint8_t memory[REGION_SIZE];
+static FlashRam ram;
+static FlashDevice device;
+static uint32_t sectorErases[SECTORS];
+static long programBudget = -1;
+
+static bool shim_erase(const FlashDevice *fdp, uint32_t offset)
+{
+    (void)fdp;
+    sectorErases[offset / SECTOR_SIZE]++;
+    return flashErase(&ram.dev, offset);
+}
+
+static bool shim_program(const FlashDevice *fdp, uint32_t offset,
+                         const void *data, size_t n)
+{
+    (void)fdp;
+    if (programBudget >= 0 && (long)n > programBudget)
+    {
+        /* Power lost: only the words within the budget are programmed.*/
+        size_t done = (size_t)programBudget & ~(size_t)3;
+
+        if (done > 0)
+            (void)flashProgram(&ram.dev, offset, data, done);
+        programBudget = 0;
+        return false;
+    }
+    if (programBudget >= 0)
+        programBudget -= (long)n;
+    return flashProgram(&ram.dev, offset, data, n);
+}
+
+static void shim_read(const FlashDevice *fdp, uint32_t offset, void *data,
+                      size_t n)
+{
+    (void)fdp;
+    flashRead(&ram.dev, offset, data, n);
+}
+
+static void device_reset(uint8_t fill)
+{
+    memset(memory, fill, sizeof(memory));
+    flash_ram_init(&ram, memory, REGION_SIZE, SECTOR_SIZE);
+    device = ram.dev;
+    device.erase = shim_erase;
+    device.program = shim_program;
+    device.read = shim_read;
+    memset(sectorErases, 0, sizeof(sectorErases));
+    programBudget = -1;
+}
+
+static CanRecord record_make(uint32_t n)
+{
+    CanRecord record;
+
+    memset(&record, 0, sizeof(record));
+    record.timestamp = n;
+    record.id = n & CAN_RECORD_ID_MASK;
+    memcpy(record.data, &n, sizeof(n));
+
+    return record;
+}
+
+/* Writes everything ready, erasing when a page waits for it.*/
+static void writer_run(FlashLog *flp)
+{
+    for (;;)
+    {
+        if (flash_log_write(flp))
+            continue;
+        if (flp->state[flp->write] != FLASH_LOG_READY ||
+            !flash_log_erase(flp))
+            break;
+    }
+}
+
+/* Appends @p count records numbered from @p first.*/
+static void log_records(FlashLog *flp, uint32_t first, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        CanRecord record = record_make(first + i);
+
+        if (flash_log_append(flp, &record))
+            writer_run(flp);
+    }
+}
+
+/* Reads the log back, it must hold consecutive records up to @p last.*/
+static uint32_t check_records(const FlashLog *flp, uint32_t last)
+{
+    FlashLogCursor cursor;
+    CanRecord record;
+    uint32_t count = 0;
+    uint32_t expected = 0;
+
+    flash_log_cursor_init(flp, &cursor);
+    while (flash_log_read(flp, &cursor, &record))
+    {
+        if (count == 0)
+            expected = record.timestamp;
+        assert(record.timestamp == expected);
+        assert(memcmp(&record.data, &expected, sizeof(expected)) == 0);
+        expected++;
+        count++;
+    }
+    assert(count == flp->records);
+    if (count > 0)
+        assert(expected == last + 1);
+
+    return count;
+}
+
+static void test_fresh(void)
+{
+    FlashLog log;
+
+    /* A fresh part holds anything, the first sector is erased before the
+       first page and nothing is programmed until then.*/
+    device_reset(0xA5);
+    flash_log_init(&log, &device);
+    assert(log.records == 0);
+    assert(flash_log_erase_pending(&log));
+
+    log_records(&log, 0, FLASH_LOG_PAGE_RECORDS);
+    assert(sectorErases[0] == 1);
+    assert(log.pagesWritten == 1);
+    assert(check_records(&log, FLASH_LOG_PAGE_RECORDS - 1) ==
+           FLASH_LOG_PAGE_RECORDS);
+}
+
+static void test_erase_deferred(void)
+{
+    FlashLog log;
+    CanRecord record = record_make(1);
+
+    device_reset(0xFF);
+    flash_log_init(&log, &device);
+
+    /* A full page waits for the erase, the second buffer keeps filling and
+       further records are dropped.*/
+    for (uint32_t i = 0; i < 3 * FLASH_LOG_PAGE_RECORDS; i++)
+        (void)flash_log_append(&log, &record);
+    assert(!flash_log_write(&log));
+    assert(log.dropped == FLASH_LOG_PAGE_RECORDS);
+    assert(log.pagesWritten == 0);
+
+    assert(flash_log_erase(&log));
+    assert(!flash_log_erase(&log));
+    assert(flash_log_write(&log));
+    assert(flash_log_write(&log));
+    assert(log.pagesWritten == 2);
+    assert(log.records == 2 * FLASH_LOG_PAGE_RECORDS);
+}
+
+static void test_wrap(void)
+{
+    FlashLog log;
+    uint32_t rounds = 5;
+    uint32_t total = rounds * PAGES * FLASH_LOG_PAGE_RECORDS;
+
+    device_reset(0xFF);
+    flash_log_init(&log, &device);
+    log_records(&log, 0, total);
+
+    /* The ring is full of the newest pages, the oldest sector is only
+       erased when the next page needs it.*/
+    assert(log.pagesWritten == rounds * PAGES);
+    assert(log.head == 0);
+    assert(flash_log_erase_pending(&log));
+    assert(check_records(&log, total - 1) == PAGES * FLASH_LOG_PAGE_RECORDS);
+
+    /* Every sector wore the same.*/
+    for (uint32_t i = 0; i < SECTORS; i++)
+        assert(sectorErases[i] == rounds);
+
+    /* After a reset writing continues behind the newest page.*/
+    flash_log_init(&log, &device);
+    log_records(&log, total, FLASH_LOG_PAGE_RECORDS);
+    check_records(&log, total + FLASH_LOG_PAGE_RECORDS - 1);
+}
+
+static void test_seal(void)
+{
+    FlashLog log;
+
+    device_reset(0xFF);
+    flash_log_init(&log, &device);
+
+    assert(!flash_log_seal(&log));
+    log_records(&log, 0, 3);
+    assert(log.records == 0);
+    assert(flash_log_seal(&log));
+    writer_run(&log);
+    assert(log.records == 3);
+
+    /* A sealed page takes a whole page of the ring.*/
+    log_records(&log, 3, 2);
+    assert(flash_log_seal(&log));
+    writer_run(&log);
+    assert(log.head == 2);
+    assert(check_records(&log, 4) == 5);
+
+    flash_log_init(&log, &device);
+    assert(log.head == 2);
+    assert(check_records(&log, 4) == 5);
+}
+
+static void test_clear(void)
+{
+    FlashLog log;
+    uint32_t erases;
+
+    device_reset(0xFF);
+    flash_log_init(&log, &device);
+    log_records(&log, 0, 3 * FLASH_LOG_PAGE_RECORDS);
+    erases = ram.erases;
+
+    /* Clearing programs markers, it erases nothing.*/
+    flash_log_clear(&log);
+    assert(ram.erases == erases);
+    assert(log.records == 0);
+    assert(check_records(&log, 0) == 0);
+
+    /* The ring goes on after the discarded pages, also after a reset.*/
+    log_records(&log, 100, FLASH_LOG_PAGE_RECORDS);
+    assert(check_records(&log, 100 + FLASH_LOG_PAGE_RECORDS - 1) ==
+           FLASH_LOG_PAGE_RECORDS);
+    flash_log_init(&log, &device);
+    assert(log.head == 4);
+    assert(check_records(&log, 100 + FLASH_LOG_PAGE_RECORDS - 1) ==
+           FLASH_LOG_PAGE_RECORDS);
+}
+
+static void test_power_loss(void)
+{
+    FlashLog log;
+
+    device_reset(0xFF);
+    flash_log_init(&log, &device);
+    log_records(&log, 0, FLASH_LOG_PAGE_RECORDS);
+
+    /* The reset hits while the second page is programmed: its records are
+       partly written, the magic that validates the page is not.*/
+    programBudget = 100;
+    log_records(&log, FLASH_LOG_PAGE_RECORDS, FLASH_LOG_PAGE_RECORDS);
+    assert(log.errors == 1);
+    programBudget = -1;
+
+    /* After the reset only the first page counts. The damaged page is
+       neither valid nor erased, writing resumes in the next sector.*/
+    flash_log_init(&log, &device);
+    assert(log.records == FLASH_LOG_PAGE_RECORDS);
+    assert(check_records(&log, FLASH_LOG_PAGE_RECORDS - 1) ==
+           FLASH_LOG_PAGE_RECORDS);
+    assert(log.head == SECTOR_SIZE / FLASH_LOG_PAGE_SIZE);
+    assert(flash_log_erase_pending(&log));
+
+    log_records(&log, 1000, FLASH_LOG_PAGE_RECORDS);
+    assert(log.records == 2 * FLASH_LOG_PAGE_RECORDS);
+    assert(sectorErases[1] == 1);
+}
+
+int main(void)
+{
+    test_fresh();
+    test_erase_deferred();
+    test_wrap();
+    test_seal();
+    test_clear();
+    test_power_loss();
+
+    printf("test_flash_log: ok\n");
+
+    return 0;
+}
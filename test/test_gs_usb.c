@@ -0,0 +1,276 @@
+/*
+ * gs_usb protocol core against a simulated endpoint layer and controller.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gs_usb.h"
+
+/* Simulated endpoints: the last IN transfer and the OUT buffer armed.*/
+static uint8_t inData[GS_HOST_FRAME_SIZE_TS];
+static size_t inSize;
+static int inStarts;
+static uint8_t *outBuf;
+static int outStarts;
+
+/* Simulated controller.*/
+static bool canRunning;
+static GsHostFrame txFrames[64];
+static size_t txCount;
+static size_t txLimit;
+
+static void ep_start_in(void *arg, const uint8_t *buf, size_t n)
+{
+    (void)arg;
+    memcpy(inData, buf, n);
+    inSize = n;
+    inStarts++;
+}
+
+static void ep_start_out(void *arg, uint8_t *buf, size_t n)
+{
+    (void)arg;
+    (void)n;
+    outBuf = buf;
+    outStarts++;
+}
+
+static bool can_start(void *arg, const GsDeviceBittiming *bt, uint32_t flags)
+{
+    (void)arg;
+    (void)flags;
+    canRunning = bt->brp != 0;
+    return canRunning;
+}
+
+static void can_reset(void *arg)
+{
+    (void)arg;
+    canRunning = false;
+    txCount = 0;
+}
+
+static bool can_transmit(void *arg, const GsHostFrame *frame)
+{
+    (void)arg;
+    if (txCount >= txLimit)
+        return false;
+    txFrames[txCount++] = *frame;
+    return true;
+}
+
+static uint32_t now(void *arg)
+{
+    (void)arg;
+    return 1234;
+}
+
+static const GsDeviceBtConst btConst = {42000000, 1, 16, 1, 8, 4, 1, 1024, 1};
+
+static const GsUsbConfig config = {
+    NULL, ep_start_in, ep_start_out, can_start, can_reset, can_transmit,
+    now, NULL, NULL, &btConst, 2, 1
+};
+
+static GsUsb gs;
+
+static void control_out(uint8_t request, const uint8_t *data, size_t n)
+{
+    uint8_t setup[8] = {0x41, request, 0, 0, 0, 0, (uint8_t)n, 0};
+    uint8_t *buf;
+    size_t len;
+
+    assert(gs_usb_control_setupI(&gs, setup, &buf, &len) == GS_USB_CTRL_OUT);
+    assert(len == n);
+    memcpy(buf, data, n);
+    gs_usb_control_completeI(&gs);
+}
+
+static void start(uint32_t flags)
+{
+    uint8_t bt[20] = {0};
+    uint8_t mode[8] = {GS_CAN_MODE_START, 0, 0, 0, (uint8_t)flags, 0, 0, 0};
+
+    bt[0] = 1;      /* prop_seg.*/
+    bt[4] = 12;     /* phase_seg1.*/
+    bt[8] = 2;      /* phase_seg2.*/
+    bt[12] = 1;     /* sjw.*/
+    bt[16] = 3;     /* brp.*/
+    control_out(GS_USB_BREQ_BITTIMING, bt, sizeof(bt));
+    control_out(GS_USB_BREQ_MODE, mode, sizeof(mode));
+}
+
+/* The host writes a frame to the OUT endpoint.*/
+static void host_send(uint32_t echoId, uint32_t canId)
+{
+    GsHostFrame frame = {echoId, canId, 8, 0, 0, 0, {1, 2, 3, 4, 5, 6, 7, 8},
+                         0};
+
+    assert(outBuf != NULL);
+    outBuf = NULL;
+    gs_usb_out_completeI(&gs, gs_usb_frame_pack(gs.out_buf, &frame, false));
+}
+
+static void in_frame(GsHostFrame *frame)
+{
+    assert(gs_usb_frame_unpack(frame, inData, inSize));
+}
+
+static void test_descriptors(void)
+{
+    uint8_t buf[GS_USB_CONFIG_DESC_SIZE];
+    uint8_t setup[8] = {0xC1, GS_USB_BREQ_BT_CONST, 0, 0, 0, 0, 40, 0};
+    uint8_t *data;
+    size_t n;
+
+    assert(gs_usb_device_descriptor(buf, sizeof(buf)) ==
+           GS_USB_DEVICE_DESC_SIZE);
+    assert(buf[8] == 0x50 && buf[9] == 0x1D && buf[10] == 0x6F);
+    assert(gs_usb_config_descriptor(buf, sizeof(buf)) ==
+           GS_USB_CONFIG_DESC_SIZE);
+    assert(gs_usb_string_descriptor(buf, 4, "long") == 0);
+
+    gs_usb_init(&gs, &config);
+    assert(gs_usb_control_setupI(&gs, setup, &data, &n) == GS_USB_CTRL_IN);
+    assert(n == 40 && data[4] == (uint8_t)42000000);
+}
+
+static void test_echo(void)
+{
+    GsHostFrame frame;
+
+    gs_usb_init(&gs, &config);
+    gs_usb_configuredI(&gs);
+    assert(outStarts == 1);
+    start(GS_CAN_MODE_HW_TIMESTAMP);
+    assert(gs.state == GS_USB_STARTED && canRunning);
+
+    txLimit = 64;
+    txCount = 0;
+    host_send(7, 0x123);
+    assert(txCount == 1 && txFrames[0].echo_id == 7 && outBuf != NULL);
+
+    /* Sent, echoed with the completion time.*/
+    assert(gs_usb_post_echoI(&gs, &txFrames[0], 5000, 0));
+    in_frame(&frame);
+    assert(inSize == GS_HOST_FRAME_SIZE_TS);
+    assert(frame.echo_id == 7 && frame.timestamp_us == 5000);
+    gs_usb_in_completeI(&gs);
+    assert(gs.tx_held == 0);
+
+    /* Failed, an error frame goes ahead of the echo.*/
+    host_send(8, 0x124);
+    assert(gs_usb_post_echoI(&gs, &txFrames[1], 6000, GS_CAN_ERR_TX_TIMEOUT));
+    in_frame(&frame);
+    assert(frame.echo_id == GS_HOST_FRAME_ECHO_RX);
+    assert(frame.can_id == (GS_CAN_ERR_FLAG | GS_CAN_ERR_TX_TIMEOUT));
+    gs_usb_in_completeI(&gs);
+    in_frame(&frame);
+    assert(frame.echo_id == 8);
+    gs_usb_in_completeI(&gs);
+    assert(gs.tx_errors == 1 && gs.in_count == 0);
+}
+
+/*
+ * Received frames fill their part of the queue while the IN endpoint is
+ * stalled, the echoes of all frames taken still fit.
+ */
+static void test_echo_reserve(void)
+{
+    uint8_t data[8] = {0};
+    GsHostFrame frame;
+    int held;
+
+    gs_usb_init(&gs, &config);
+    gs_usb_configuredI(&gs);
+    start(0);
+    txLimit = 64;
+    txCount = 0;
+
+    /* The first received frame keeps the IN endpoint busy.*/
+    while (gs_usb_post_rxI(&gs, 0x100, 8, data, 0))
+        ;
+    assert(gs.in_count == GS_USB_IN_QUEUE_SIZE - GS_USB_ECHO_RESERVE);
+    assert(gs.rx_overflows == 1);
+
+    for (held = 0; outBuf != NULL; held++)
+        host_send((uint32_t)held, 0x200);
+    assert(held == GS_USB_ECHO_RESERVE + 1);
+    assert(txCount == GS_USB_ECHO_RESERVE && gs.tx_pending);
+
+    for (size_t i = 0; i < txCount; i++)
+        assert(gs_usb_post_echoI(&gs, &txFrames[i], 0, 0));
+    assert(gs.in_count == GS_USB_IN_QUEUE_SIZE);
+
+    /* Draining the echoes frees their slots, the pending frame goes.*/
+    while (gs.in_count != 0)
+        gs_usb_in_completeI(&gs);
+    in_frame(&frame);
+    assert(frame.echo_id == GS_USB_ECHO_RESERVE - 1);
+    assert(!gs.tx_pending && txCount == GS_USB_ECHO_RESERVE + 1);
+    assert(outBuf != NULL);
+}
+
+static void test_reset(void)
+{
+    uint8_t mode[8] = {GS_CAN_MODE_RESET};
+
+    gs_usb_init(&gs, &config);
+    gs_usb_configuredI(&gs);
+    start(0);
+    txLimit = 0;
+    host_send(1, 0x300);
+    assert(gs.tx_pending && outBuf == NULL);
+
+    /* The host drops its echo ids with the reset.*/
+    control_out(GS_USB_BREQ_MODE, mode, sizeof(mode));
+    assert(gs.state == GS_USB_RESET && !canRunning);
+    assert(!gs.tx_pending && gs.tx_held == 0 && outBuf != NULL);
+    assert(!gs_usb_post_echoI(&gs, &txFrames[0], 0, 0));
+}
+
+static void test_kernel_setup(void)
+{
+    /* As sent by the Linux driver at probe, wValue 1.*/
+    uint8_t hostFormat[8] = {0x41, GS_USB_BREQ_HOST_FORMAT, 1, 0, 0, 0, 4, 0};
+    uint8_t deviceConfig[8] = {0xC1, GS_USB_BREQ_DEVICE_CONFIG, 1, 0, 0, 0,
+                               12, 0};
+    /* Per channel, wValue is the channel.*/
+    uint8_t btConst0[8] = {0xC1, GS_USB_BREQ_BT_CONST, 0, 0, 0, 0, 40, 0};
+    uint8_t btConst1[8] = {0xC1, GS_USB_BREQ_BT_CONST, 1, 0, 0, 0, 40, 0};
+    uint8_t mode1[8] = {0x41, GS_USB_BREQ_MODE, 1, 0, 0, 0, 8, 0};
+    uint8_t *data;
+    size_t n;
+
+    gs_usb_init(&gs, &config);
+    assert(gs_usb_control_setupI(&gs, hostFormat, &data, &n) ==
+           GS_USB_CTRL_OUT);
+    assert(n == 4);
+    memcpy(data, "\xEF\xBE\x00\x00", 4);
+    gs_usb_control_completeI(&gs);
+
+    assert(gs_usb_control_setupI(&gs, deviceConfig, &data, &n) ==
+           GS_USB_CTRL_IN);
+    assert(n == 12 && data[3] == 0 && data[4] == 2 && data[8] == 1);
+
+    assert(gs_usb_control_setupI(&gs, btConst0, &data, &n) ==
+           GS_USB_CTRL_IN);
+    assert(gs_usb_control_setupI(&gs, btConst1, &data, &n) ==
+           GS_USB_CTRL_UNHANDLED);
+    assert(gs_usb_control_setupI(&gs, mode1, &data, &n) ==
+           GS_USB_CTRL_UNHANDLED);
+}
+
+int main(void)
+{
+    test_descriptors();
+    test_kernel_setup();
+    test_echo();
+    test_echo_reserve();
+    test_reset();
+    printf("test_gs_usb: ok\n");
+
+    return 0;
+}
@@ -0,0 +1,432 @@
+/*
+ * ISO-TP core on a simulated bus: single, first and consecutive frames,
+ * sequence wrap, flow control of an active channel in both directions,
+ * wait and overflow, timeouts and the records of a message.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "can_isotp.h"
+
+#define SESSIONS        2
+#define BUFFER_SIZE     256
+#define RX_KEY          0x7E8U
+#define TX_KEY          0x7E0U
+#define SNIFFED_KEY     (0x18DAF110U | CAN_RECORD_EXT)
+
+static const CanIsoTpRange ranges[] = {
+    {0x7E8U, 0x7EFU},
+    {SNIFFED_KEY, SNIFFED_KEY}
+};
+
+static CanIsoTp engine;
+static CanIsoTpSession sessions[SESSIONS];
+static uint8_t buffers[SESSIONS * BUFFER_SIZE];
+
+/* Frames sent, messages and results taken, the last of each kept.*/
+static unsigned sent;
+static uint32_t sentKey;
+static uint8_t sentData[8];
+static int mailboxes = -1;
+static unsigned pdus;
+static CanIsoTpPdu pdu;
+static uint8_t pduData[CAN_ISOTP_MAX_LENGTH];
+static unsigned results;
+static CanIsoTpResult result;
+
+static void take_pdu(const CanIsoTpPdu *pp, void *arg)
+{
+    (void)arg;
+    pdus++;
+    pdu = *pp;
+    memcpy(pduData, pp->data, pp->length);
+    pdu.data = pduData;
+}
+
+static void take_result(const CanIsoTpResult *rp, void *arg)
+{
+    (void)arg;
+    results++;
+    result = *rp;
+}
+
+static bool send_frame(uint32_t key, const uint8_t *data, void *arg)
+{
+    (void)arg;
+    if (mailboxes == 0)
+        return false;
+    if (mailboxes > 0)
+        mailboxes--;
+    sent++;
+    sentKey = key;
+    memcpy(sentData, data, 8);
+    return true;
+}
+
+static const CanIsoTpOps ops = {take_pdu, take_result, send_frame};
+
+static void reset(uint8_t blockSize, uint8_t stmin)
+{
+    can_isotp_init(&engine, ranges, sizeof(ranges) / sizeof(ranges[0]),
+                   sessions, SESSIONS, buffers, BUFFER_SIZE);
+    engine.blockSize = blockSize;
+    engine.stmin = stmin;
+    sent = pdus = results = 0;
+    mailboxes = -1;
+}
+
+static bool frame(uint32_t key, const uint8_t *data, uint8_t dlc,
+                  uint32_t now)
+{
+    CanRecord record;
+
+    can_record_set(&record, key & CAN_RECORD_ID_MASK,
+                   (key & CAN_RECORD_EXT) != 0, false, dlc, data, now);
+    return can_isotp_frame(&engine, &record, &ops, NULL);
+}
+
+static void flow(uint8_t status, uint8_t blockSize, uint8_t stmin,
+                 uint32_t now)
+{
+    uint8_t data[3] = {(uint8_t)(0x30U | status), blockSize, stmin};
+
+    assert(frame(RX_KEY, data, 3, now));
+}
+
+static void pattern(uint8_t *data, size_t n, uint8_t seed)
+{
+    for (size_t i = 0; i < n; i++)
+        data[i] = (uint8_t)(seed + i * 7U);
+}
+
+/*
+ * Sends a message as a first frame and its consecutive frames.
+ */
+static void segment(uint32_t key, const uint8_t *message, uint16_t length,
+                    uint32_t now)
+{
+    uint8_t data[8];
+    uint8_t sequence = 1;
+
+    data[0] = (uint8_t)(0x10U | length >> 8);
+    data[1] = (uint8_t)length;
+    memcpy(&data[2], message, 6);
+    assert(frame(key, data, 8, now));
+    for (uint16_t offset = 6; offset < length; offset += 7)
+    {
+        uint8_t n = length - offset < 7 ? (uint8_t)(length - offset) : 7;
+
+        data[0] = (uint8_t)(0x20U | sequence);
+        memcpy(&data[1], &message[offset], n);
+        assert(frame(key, data, (uint8_t)(n + 1), now + offset));
+        sequence = (sequence + 1U) & 0x0FU;
+    }
+}
+
+static void test_single(void)
+{
+    uint8_t data[8] = {0x05, 1, 2, 3, 4, 5};
+
+    reset(0, 0);
+    assert(frame(SNIFFED_KEY, data, 6, 100));
+    assert(pdus == 1 && sent == 0);
+    assert(pdu.key == SNIFFED_KEY && pdu.length == 5);
+    assert(pdu.channel == CAN_ISOTP_PASSIVE && pdu.timestamp == 100);
+    assert(memcmp(pduData, &data[1], 5) == 0);
+
+    /* Identifiers outside the ranges are left alone.*/
+    assert(!frame(0x7E0U, data, 6, 100));
+    assert(!frame(RX_KEY | CAN_RECORD_EXT, data, 6, 100));
+
+    /* Zero length and lengths beyond the frame are malformed.*/
+    data[0] = 0x00;
+    assert(frame(RX_KEY, data, 8, 100));
+    data[0] = 0x07;
+    assert(frame(RX_KEY, data, 6, 100));
+    assert(engine.stats.invalid == 2 && pdus == 1);
+}
+
+static void test_segmented(void)
+{
+    uint8_t message[200];
+    uint8_t data[8] = {0x10, 20, 0, 1, 2, 3, 4, 5};
+
+    /* More than fifteen consecutive frames wrap the sequence to zero.*/
+    reset(0, 0);
+    pattern(message, sizeof(message), 3);
+    segment(SNIFFED_KEY, message, sizeof(message), 1000);
+    assert(pdus == 1 && sent == 0);
+    assert(pdu.length == sizeof(message) && pdu.timestamp == 1000);
+    assert(memcmp(pduData, message, sizeof(message)) == 0);
+    assert(can_isotp_active(&engine) == 0);
+
+    /* A gap in the sequence drops the message.*/
+    assert(frame(RX_KEY, data, 8, 2000));
+    assert(can_isotp_active(&engine) == 1);
+    data[0] = 0x22;
+    assert(frame(RX_KEY, data, 8, 2001));
+    assert(engine.stats.sequence == 1 && pdus == 1);
+    assert(can_isotp_active(&engine) == 0);
+
+    /* Consecutive frames without a first frame are ignored.*/
+    data[0] = 0x21;
+    assert(frame(RX_KEY, data, 8, 2002));
+    assert(pdus == 1 && engine.stats.invalid == 0);
+
+    /* First frames must be full and longer than a single frame.*/
+    data[0] = 0x10;
+    data[1] = 7;
+    assert(frame(RX_KEY, data, 8, 2003));
+    data[1] = 20;
+    assert(frame(RX_KEY, data, 7, 2003));
+    assert(engine.stats.invalid == 2 && can_isotp_active(&engine) == 0);
+}
+
+static void test_receive_flow(void)
+{
+    uint8_t message[60];
+    uint8_t data[8] = {0x11, 0x01, 0, 0, 0, 0, 0, 0};
+    unsigned before;
+
+    /* Flow control after the first frame and after each block of four.*/
+    reset(4, 10);
+    assert(can_isotp_open(&engine, 0, RX_KEY, TX_KEY));
+    pattern(message, sizeof(message), 9);
+    segment(RX_KEY, message, sizeof(message), 0);
+    /* 60 bytes are a first frame and eight consecutive frames.*/
+    assert(sent == 2 && sentKey == TX_KEY);
+    assert(sentData[0] == 0x30 && sentData[1] == 4 && sentData[2] == 10);
+    assert(sentData[3] == CAN_ISOTP_PADDING);
+    assert(pdus == 1 && pdu.channel == 0 && pdu.length == sizeof(message));
+    assert(memcmp(pduData, message, sizeof(message)) == 0);
+
+    /* Longer than a session, the sender is told to give up.*/
+    before = sent;
+    assert(frame(RX_KEY, data, 8, 0));
+    assert(sent == before + 1 && sentData[0] == 0x32);
+    assert(engine.stats.overflows == 1);
+
+    /* A lost flow control is counted, the reception goes on.*/
+    mailboxes = 0;
+    data[0] = 0x10;
+    data[1] = 20;
+    assert(frame(RX_KEY, data, 8, 0));
+    assert(engine.stats.flowLost == 1 && can_isotp_active(&engine) == 1);
+
+    /* Sniffed messages get no flow control.*/
+    reset(4, 10);
+    segment(0x7E9U, message, sizeof(message), 0);
+    assert(sent == 0 && pdus == 1);
+}
+
+static void test_send_flow(void)
+{
+    uint8_t message[40];
+
+    reset(0, 0);
+    assert(can_isotp_open(&engine, 1, RX_KEY, TX_KEY));
+    pattern(message, sizeof(message), 1);
+
+    /* The first frame goes out at once, then the sender waits.*/
+    assert(can_isotp_send(&engine, 1, 77, message, sizeof(message), 0, &ops,
+                          NULL));
+    assert(sent == 1 && sentKey == TX_KEY && results == 0);
+    assert(sentData[0] == 0x10 && sentData[1] == 40);
+    assert(memcmp(&sentData[2], message, 6) == 0);
+    assert(can_isotp_poll(&engine, 10, &ops, NULL) ==
+           CAN_ISOTP_TIMEOUT_US - 10);
+    assert(sent == 1);
+
+    /* Blocks of two, five milliseconds apart.*/
+    flow(0, 2, 5, 1000);
+    assert(engine.wake);
+    assert(can_isotp_poll(&engine, 1000, &ops, NULL) == 5000);
+    assert(sent == 2 && sentData[0] == 0x21);
+    assert(memcmp(&sentData[1], &message[6], 7) == 0);
+    assert(can_isotp_poll(&engine, 5999, &ops, NULL) == 1);
+    assert(sent == 2);
+    assert(can_isotp_poll(&engine, 6000, &ops, NULL) ==
+           CAN_ISOTP_TIMEOUT_US);
+    assert(sent == 3 && sentData[0] == 0x22);
+
+    /* Waiting for the next flow control, nothing is sent.*/
+    assert(can_isotp_poll(&engine, 20000, &ops, NULL) != 0);
+    assert(sent == 3);
+
+    /* Then no more blocks, 100 microseconds apart. A full mailbox holds
+       the frame back until it empties.*/
+    flow(0, 0, 0xF1, 30000);
+    mailboxes = 0;
+    assert(can_isotp_poll(&engine, 30000, &ops, NULL) == 0);
+    assert(sent == 3);
+    mailboxes = -1;
+    assert(can_isotp_poll(&engine, 30000, &ops, NULL) == 100);
+    assert(sent == 4 && sentData[0] == 0x23);
+    assert(can_isotp_poll(&engine, 30100, &ops, NULL) == 100);
+    assert(can_isotp_poll(&engine, 30200, &ops, NULL) ==
+           CAN_ISOTP_NO_DEADLINE);
+    assert(sent == 6 && sentData[0] == 0x25);
+    assert(memcmp(&sentData[1], &message[34], 6) == 0);
+    assert(sentData[7] == CAN_ISOTP_PADDING);
+    assert(results == 1 && result.result == CAN_ISOTP_DONE);
+    assert(result.cookie == 77 && result.channel == 1);
+    assert(engine.stats.sent == 1);
+
+    /* Single frames end at once.*/
+    assert(!can_isotp_send(&engine, 1, 78, message, 7, 0, &ops, NULL));
+    assert(sent == 7 && sentData[0] == 0x07 && results == 2);
+    assert(result.result == CAN_ISOTP_DONE && result.cookie == 78);
+    mailboxes = 0;
+    assert(!can_isotp_send(&engine, 1, 79, message, 7, 0, &ops, NULL));
+    assert(result.result == CAN_ISOTP_FAILED);
+}
+
+static void test_wait_overflow(void)
+{
+    uint8_t message[20];
+
+    reset(0, 0);
+    assert(can_isotp_open(&engine, 0, RX_KEY, TX_KEY));
+    pattern(message, sizeof(message), 5);
+
+    /* Each wait restarts the timeout, too many abort.*/
+    assert(can_isotp_send(&engine, 0, 1, message, sizeof(message), 0, &ops,
+                          NULL));
+    for (unsigned i = 1; i <= CAN_ISOTP_MAX_WAITS; i++)
+    {
+        flow(1, 0, 0, i * 500000U);
+        assert(can_isotp_poll(&engine, i * 500000U, &ops, NULL) ==
+               CAN_ISOTP_TIMEOUT_US);
+    }
+    assert(results == 0 && sent == 1);
+    flow(1, 0, 0, 6000000);
+    assert(results == 1 && result.result == CAN_ISOTP_ABORTED);
+
+    /* The receiver cannot take the message.*/
+    assert(can_isotp_send(&engine, 0, 2, message, sizeof(message), 0, &ops,
+                          NULL));
+    flow(2, 0, 0, 10);
+    assert(results == 2 && result.result == CAN_ISOTP_OVERFLOW);
+    assert(result.cookie == 2);
+
+    /* Reserved flow status.*/
+    assert(can_isotp_send(&engine, 0, 3, message, sizeof(message), 0, &ops,
+                          NULL));
+    flow(5, 0, 0, 10);
+    assert(results == 3 && result.result == CAN_ISOTP_ABORTED);
+
+    /* One transmission per channel, none on a closed channel.*/
+    assert(can_isotp_send(&engine, 0, 4, message, sizeof(message), 0, &ops,
+                          NULL));
+    assert(!can_isotp_send(&engine, 0, 5, message, sizeof(message), 0, &ops,
+                           NULL));
+    assert(results == 4 && result.result == CAN_ISOTP_BUSY);
+    assert(!can_isotp_send(&engine, 2, 6, message, sizeof(message), 0, &ops,
+                           NULL));
+    assert(results == 5 && result.result == CAN_ISOTP_INVALID);
+    can_isotp_close(&engine, 0, &ops, NULL);
+    assert(results == 6 && result.result == CAN_ISOTP_ABORTED);
+    assert(result.cookie == 4 && can_isotp_active(&engine) == 0);
+}
+
+static void test_timeouts(void)
+{
+    uint8_t message[20];
+    uint8_t data[8] = {0x10, 20, 0, 1, 2, 3, 4, 5};
+    uint32_t start = 0xFFFFFF00U;
+
+    reset(0, 0);
+    assert(can_isotp_open(&engine, 0, RX_KEY, TX_KEY));
+    pattern(message, sizeof(message), 5);
+
+    /* No flow control, across the wrap of the clock.*/
+    assert(can_isotp_send(&engine, 0, 9, message, sizeof(message), start,
+                          &ops, NULL));
+    assert(can_isotp_poll(&engine, start + CAN_ISOTP_TIMEOUT_US - 1, &ops,
+                          NULL) == 1);
+    assert(results == 0);
+    assert(can_isotp_poll(&engine, start + CAN_ISOTP_TIMEOUT_US, &ops,
+                          NULL) == CAN_ISOTP_NO_DEADLINE);
+    assert(results == 1 && result.result == CAN_ISOTP_TIMEOUT);
+
+    /* No consecutive frame.*/
+    assert(frame(SNIFFED_KEY, data, 8, start));
+    assert(can_isotp_active(&engine) == 1);
+    data[0] = 0x21;
+    assert(frame(SNIFFED_KEY, data, 8, start + 1000));
+    (void)can_isotp_poll(&engine, start + 1000 + CAN_ISOTP_TIMEOUT_US - 1,
+                         &ops, NULL);
+    assert(can_isotp_active(&engine) == 1);
+    (void)can_isotp_poll(&engine, start + 1000 + CAN_ISOTP_TIMEOUT_US, &ops,
+                         NULL);
+    assert(can_isotp_active(&engine) == 0);
+    assert(engine.stats.timeouts == 1 && pdus == 0);
+}
+
+/* Records emitted, restored as they come.*/
+static CanRecord records[CAN_ISOTP_RECORDS(BUFFER_SIZE)];
+static unsigned recordCount;
+
+static void emit(const CanRecord *rp, void *arg)
+{
+    (void)arg;
+    assert(recordCount < sizeof(records) / sizeof(records[0]));
+    records[recordCount++] = *rp;
+}
+
+static void test_records(void)
+{
+    uint8_t message[45];
+    uint8_t restored[sizeof(message) + 7];
+    CanIsoTpPdu pp = {SNIFFED_KEY, 1234, sizeof(message), CAN_ISOTP_PASSIVE,
+                      0x2A, message};
+    CanIsoTpResult rr = {0xA1B2C3D4U, 3, CAN_ISOTP_OVERFLOW};
+    CanIsoTpRecord out;
+    CanRecord record;
+
+    pattern(message, sizeof(message), 11);
+    recordCount = 0;
+    can_isotp_pdu_to_records(&pp, emit, NULL);
+    assert(recordCount == CAN_ISOTP_RECORDS(sizeof(message)));
+
+    assert(can_isotp_from_record(&records[0], &out));
+    assert(records[0].timestamp == 1234);
+    assert(out.type == CAN_ISOTP_RECORD_START && out.counter == 0x2A);
+    assert(out.key == SNIFFED_KEY && out.length == sizeof(message));
+    assert(out.channel == CAN_ISOTP_PASSIVE);
+    for (unsigned i = 1; i < recordCount; i++)
+    {
+        assert(can_isotp_from_record(&records[i], &out));
+        assert(out.type == CAN_ISOTP_RECORD_DATA && out.counter == 0x2A);
+        memcpy(&restored[(i - 1) * 7], out.data, 7);
+    }
+    assert(memcmp(restored, message, sizeof(message)) == 0);
+
+    can_isotp_result_to_record(&rr, 99, &record);
+    assert(can_isotp_from_record(&record, &out));
+    assert(record.timestamp == 99 && out.type == CAN_ISOTP_RECORD_RESULT);
+    assert(out.result.cookie == rr.cookie && out.result.channel == 3);
+    assert(out.result.result == CAN_ISOTP_OVERFLOW);
+    assert(strcmp(can_isotp_result_name(out.result.result), "overflow") == 0);
+
+    /* Frames are no records.*/
+    can_record_set(&record, CAN_RECORD_ISOTP, true, false, 8, message, 0);
+    assert(!can_isotp_from_record(&record, &out));
+}
+
+int main(void)
+{
+    test_single();
+    test_segmented();
+    test_receive_flow();
+    test_send_flow();
+    test_wait_overflow();
+    test_timeouts();
+    test_records();
+
+    printf("test_isotp: ok\n");
+
+    return 0;
+}
@@ -0,0 +1,359 @@
+/*
+ * J1939 decoder: identifier fields, BAM and RTS/CTS reassembly with
+ * resent and reordered packets, aborts, timeouts and the pass list.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "can_j1939.h"
+
+#define SESSIONS        2
+#define SOURCE          0x17U
+#define DESTINATION     0x2AU
+
+static CanJ1939 decoder;
+static CanJ1939Session sessions[SESSIONS];
+static uint8_t buffers[SESSIONS * CAN_J1939_MAX_LENGTH];
+
+/* Records of the messages, restored as they come.*/
+static unsigned messages;
+static CanJ1939Record start;
+static uint32_t startTime;
+static uint8_t message[CAN_J1939_MAX_LENGTH + 7];
+static unsigned dataRecords;
+
+static void emit(const CanRecord *rp, void *arg)
+{
+    CanJ1939Record record;
+
+    (void)arg;
+    assert(can_j1939_from_record(rp, &record));
+    if (record.type == CAN_J1939_RECORD_START)
+    {
+        messages++;
+        start = record;
+        startTime = rp->timestamp;
+        dataRecords = 0;
+        return;
+    }
+    assert(record.type == CAN_J1939_RECORD_DATA);
+    assert(record.counter == start.counter);
+    assert(dataRecords < CAN_J1939_RECORDS(start.length) - 1U);
+    memcpy(&message[dataRecords++ * 7U], record.data, 7);
+}
+
+static void reset(void)
+{
+    can_j1939_init(&decoder, sessions, SESSIONS, buffers);
+    messages = 0;
+}
+
+static uint32_t identifier(uint8_t priority, uint32_t pgn, uint8_t da,
+                           uint8_t sa)
+{
+    if (((pgn >> 8) & 0xFFU) < 240U)
+        pgn |= da;
+
+    return (uint32_t)priority << 26 | pgn << 8 | sa;
+}
+
+static bool frame(uint32_t id, const uint8_t *data, uint8_t dlc,
+                  uint32_t now)
+{
+    CanRecord record;
+
+    can_record_set(&record, id, true, false, dlc, data, now);
+    return can_j1939_frame(&decoder, &record, emit, NULL);
+}
+
+static void cm(uint8_t sa, uint8_t da, uint8_t control, uint16_t length,
+               uint32_t pgn, uint32_t now)
+{
+    uint8_t data[8] = {control, (uint8_t)length, (uint8_t)(length >> 8),
+                       (uint8_t)((length + 6U) / 7U), 0xFF, (uint8_t)pgn,
+                       (uint8_t)(pgn >> 8), (uint8_t)(pgn >> 16)};
+
+    assert(frame(identifier(7, CAN_J1939_PGN_TP_CM, da, sa), data, 8, now));
+}
+
+/*
+ * Packet @p sequence of @p payload.
+ */
+static void dt(uint8_t sa, uint8_t da, const uint8_t *payload,
+               uint16_t length, uint8_t sequence, uint32_t now)
+{
+    uint8_t data[8];
+    size_t offset = (sequence - 1U) * 7U;
+    size_t n = length - offset < 7U ? length - offset : 7U;
+
+    memset(data, 0xFF, sizeof(data));
+    data[0] = sequence;
+    memcpy(&data[1], &payload[offset], n);
+    assert(frame(identifier(7, CAN_J1939_PGN_TP_DT, da, sa), data, 8, now));
+}
+
+static void pattern(uint8_t *data, size_t n, uint8_t seed)
+{
+    for (size_t i = 0; i < n; i++)
+        data[i] = (uint8_t)(seed + i * 13U);
+}
+
+static void test_parse(void)
+{
+    CanJ1939Id id;
+
+    /* PDU1, the destination is taken out of the group.*/
+    can_j1939_parse(0x18EF2A17U, &id);
+    assert(id.priority == 6 && id.pgn == 0xEF00U);
+    assert(id.da == DESTINATION && id.sa == SOURCE);
+    can_j1939_parse(0x1DEA0017U, &id);
+    assert(id.priority == 7 && id.pgn == 0x1EA00U && id.da == 0x00);
+
+    /* PDU2 is broadcast, the group extension stays in the group.*/
+    can_j1939_parse(0x0CF00401U, &id);
+    assert(id.priority == 3 && id.pgn == 0xF004U);
+    assert(id.da == CAN_J1939_GLOBAL && id.sa == 0x01);
+    can_j1939_parse(0x19FEF100U, &id);
+    assert(id.priority == 6 && id.pgn == 0x1FEF1U && id.sa == 0x00);
+    assert(id.da == CAN_J1939_GLOBAL);
+
+    assert(identifier(6, 0xEF00U, DESTINATION, SOURCE) == 0x18EF2A17U);
+    assert(identifier(3, 0xF004U, DESTINATION, 0x01) == 0x0CF00401U);
+}
+
+static void test_bam(void)
+{
+    uint8_t payload[20];
+    uint8_t data[8] = {0};
+
+    reset();
+    pattern(payload, sizeof(payload), 1);
+    cm(SOURCE, CAN_J1939_GLOBAL, 32, sizeof(payload), 0xFEE3U, 5000);
+    assert(can_j1939_active(&decoder) == 1);
+    for (uint8_t i = 1; i <= 3; i++)
+        dt(SOURCE, CAN_J1939_GLOBAL, payload, sizeof(payload), i,
+           5000 + i * 50000U);
+    assert(can_j1939_active(&decoder) == 0);
+    assert(messages == 1 && dataRecords == 3);
+    assert(start.pgn == 0xFEE3U && start.priority == 7);
+    assert(start.sa == SOURCE && start.da == CAN_J1939_GLOBAL);
+    assert(start.length == sizeof(payload) && startTime == 5000);
+    assert(memcmp(message, payload, sizeof(payload)) == 0);
+    assert(decoder.stats.packets == 4 && decoder.stats.messages == 1);
+
+    /* BAM is broadcast only.*/
+    cm(SOURCE, DESTINATION, 32, sizeof(payload), 0xFEE3U, 6000);
+    assert(decoder.stats.invalid == 1 && can_j1939_active(&decoder) == 0);
+
+    /* Other extended frames are captured as they are, standard frames
+       are none of the decoder's business.*/
+    assert(!frame(0x0CF00401U, data, 8, 7000));
+    assert(decoder.stats.frames == 6 && decoder.stats.filtered == 0);
+    {
+        CanRecord record;
+
+        can_record_set(&record, 0x123, false, false, 8, data, 7000);
+        assert(!can_j1939_frame(&decoder, &record, emit, NULL));
+    }
+    assert(decoder.stats.frames == 6);
+}
+
+static void test_rts_cts(void)
+{
+    uint8_t payload[30];
+    static uint8_t longest[CAN_J1939_MAX_LENGTH];
+    uint32_t now = 0;
+
+    reset();
+    pattern(payload, sizeof(payload), 2);
+    cm(SOURCE, DESTINATION, 16, sizeof(payload), 0xEF00U, now);
+
+    /* Clear to send keeps the transfer alive while the sender waits.*/
+    cm(DESTINATION, SOURCE, 17, 0, 0xEF00U, now += 1200000);
+    dt(SOURCE, DESTINATION, payload, sizeof(payload), 2, now += 1200000);
+    dt(SOURCE, DESTINATION, payload, sizeof(payload), 1, now += 1000);
+
+    /* Resent packets count once, packets out of range not at all.*/
+    dt(SOURCE, DESTINATION, payload, sizeof(payload), 2, now += 1000);
+    dt(SOURCE, DESTINATION, payload, sizeof(payload), 5, now += 1000);
+    dt(SOURCE, DESTINATION, payload, sizeof(payload), 5, now += 1000);
+    {
+        uint8_t data[8] = {6, 0, 0, 0, 0, 0, 0, 0};
+
+        assert(frame(identifier(7, CAN_J1939_PGN_TP_DT, DESTINATION,
+                                SOURCE), data, 8, now));
+        data[0] = 0;
+        assert(frame(identifier(7, CAN_J1939_PGN_TP_DT, DESTINATION,
+                                SOURCE), data, 8, now));
+    }
+    assert(decoder.stats.invalid == 2 && messages == 0);
+    dt(SOURCE, DESTINATION, payload, sizeof(payload), 4, now += 1000);
+    assert(messages == 0 && can_j1939_active(&decoder) == 1);
+    dt(SOURCE, DESTINATION, payload, sizeof(payload), 3, now += 1000);
+    assert(messages == 1 && can_j1939_active(&decoder) == 0);
+    assert(start.pgn == 0xEF00U && start.sa == SOURCE);
+    assert(start.da == DESTINATION && start.length == sizeof(payload));
+    assert(memcmp(message, payload, sizeof(payload)) == 0);
+    cm(DESTINATION, SOURCE, 19, sizeof(payload), 0xEF00U, now);
+
+    /* Packets after the end belong to no transfer.*/
+    dt(SOURCE, DESTINATION, payload, sizeof(payload), 3, now += 1000);
+    assert(messages == 1 && decoder.stats.invalid == 2);
+
+    /* The longest transfer, every packet sent twice, backwards.*/
+    pattern(longest, sizeof(longest), 3);
+    cm(SOURCE, DESTINATION, 16, sizeof(longest), 0xEF00U, now);
+    for (unsigned i = 255; i >= 1; i--)
+    {
+        dt(SOURCE, DESTINATION, longest, sizeof(longest), (uint8_t)i, now);
+        if (i > 1)
+            dt(SOURCE, DESTINATION, longest, sizeof(longest), (uint8_t)i,
+               now);
+    }
+    assert(messages == 2 && dataRecords == 255);
+    assert(start.length == CAN_J1939_MAX_LENGTH);
+    assert(memcmp(message, longest, sizeof(longest)) == 0);
+}
+
+static void test_abort_timeout(void)
+{
+    uint8_t payload[30];
+    uint32_t now = 0xFFFFF000U;
+
+    reset();
+    pattern(payload, sizeof(payload), 4);
+
+    /* Either end aborts.*/
+    cm(SOURCE, DESTINATION, 16, sizeof(payload), 0xEF00U, now);
+    cm(DESTINATION, SOURCE, 255, 0, 0xEF00U, now);
+    assert(decoder.stats.aborted == 1 && can_j1939_active(&decoder) == 0);
+    cm(SOURCE, DESTINATION, 16, sizeof(payload), 0xEF00U, now);
+    cm(SOURCE, DESTINATION, 255, 0, 0xEF00U, now);
+    assert(decoder.stats.aborted == 2 && can_j1939_active(&decoder) == 0);
+
+    /* A new announcement replaces the transfer of the pair.*/
+    cm(SOURCE, DESTINATION, 16, sizeof(payload), 0xEF00U, now);
+    dt(SOURCE, DESTINATION, payload, sizeof(payload), 1, now);
+    cm(SOURCE, DESTINATION, 16, 9, 0xEF00U, now);
+    assert(can_j1939_active(&decoder) == 1);
+    dt(SOURCE, DESTINATION, payload, 9, 2, now);
+    assert(messages == 0);
+    dt(SOURCE, DESTINATION, payload, 9, 1, now);
+    assert(messages == 1 && start.length == 9);
+
+    /* No session free.*/
+    cm(SOURCE, DESTINATION, 16, sizeof(payload), 0xEF00U, now);
+    cm(SOURCE, CAN_J1939_GLOBAL, 32, sizeof(payload), 0xFEE3U, now);
+    cm(0x30, CAN_J1939_GLOBAL, 32, sizeof(payload), 0xFEE3U, now);
+    assert(decoder.stats.noSession == 1);
+    assert(can_j1939_active(&decoder) == 2);
+
+    /* Transport frames expire quiet transfers, across the clock wrap.*/
+    dt(SOURCE, DESTINATION, payload, sizeof(payload), 1,
+       now + CAN_J1939_TIMEOUT_US);
+    assert(decoder.stats.timeouts == 0);
+    dt(0x30, CAN_J1939_GLOBAL, payload, sizeof(payload), 1,
+       now + CAN_J1939_TIMEOUT_US + 1);
+    assert(decoder.stats.timeouts == 1 && can_j1939_active(&decoder) == 1);
+    dt(SOURCE, DESTINATION, payload, sizeof(payload), 2,
+       now + 2 * CAN_J1939_TIMEOUT_US);
+    assert(decoder.stats.timeouts == 1);
+    dt(0x30, CAN_J1939_GLOBAL, payload, sizeof(payload), 1,
+       now + 3 * CAN_J1939_TIMEOUT_US + 2);
+    assert(decoder.stats.timeouts == 2 && can_j1939_active(&decoder) == 0);
+
+    /* Lengths a single frame carries and packet counts that disagree.*/
+    cm(SOURCE, DESTINATION, 16, 8, 0xEF00U, now);
+    {
+        uint8_t data[8] = {16, 30, 0, 4, 0xFF, 0x00, 0xEF, 0x00};
+
+        assert(frame(identifier(7, CAN_J1939_PGN_TP_CM, DESTINATION, SOURCE),
+                     data, 8, now));
+        data[0] = 18;
+        assert(frame(identifier(7, CAN_J1939_PGN_TP_CM, DESTINATION, SOURCE),
+                     data, 8, now));
+        assert(frame(identifier(7, CAN_J1939_PGN_TP_CM, DESTINATION, SOURCE),
+                     data, 7, now));
+    }
+    assert(decoder.stats.invalid == 4 && can_j1939_active(&decoder) == 0);
+}
+
+static void test_pass(void)
+{
+    uint8_t payload[20];
+    uint8_t data[8] = {0};
+
+    reset();
+    pattern(payload, sizeof(payload), 5);
+    assert(can_j1939_passes(&decoder, 0xF004U));
+
+    assert(can_j1939_pass(&decoder, 0xFEE3U));
+    assert(can_j1939_pass(&decoder, 0xFEE3U));
+    assert(decoder.passCount == 1);
+    assert(!can_j1939_pass(&decoder, CAN_J1939_PGN_MASK + 1U));
+    assert(can_j1939_passes(&decoder, 0xFEE3U));
+    assert(!can_j1939_passes(&decoder, 0xF004U));
+
+    /* Groups not passed are dropped, transport frames always taken.*/
+    assert(frame(0x0CF00401U, data, 8, 0));
+    assert(!frame(0x18FEE300U, data, 8, 0));
+    assert(decoder.stats.filtered == 1);
+
+    /* So are the transfers of groups not passed, once complete.*/
+    cm(SOURCE, CAN_J1939_GLOBAL, 32, sizeof(payload), 0xFECAU, 0);
+    for (uint8_t i = 1; i <= 3; i++)
+        dt(SOURCE, CAN_J1939_GLOBAL, payload, sizeof(payload), i, 0);
+    assert(messages == 0 && decoder.stats.filtered == 2);
+    assert(can_j1939_active(&decoder) == 0);
+    cm(SOURCE, CAN_J1939_GLOBAL, 32, sizeof(payload), 0xFEE3U, 0);
+    for (uint8_t i = 1; i <= 3; i++)
+        dt(SOURCE, CAN_J1939_GLOBAL, payload, sizeof(payload), i, 0);
+    assert(messages == 1 && start.pgn == 0xFEE3U);
+
+    /* The list fills up, then passes everything once emptied.*/
+    for (uint32_t pgn = 1; decoder.passCount < CAN_J1939_FILTERS; pgn++)
+        assert(can_j1939_pass(&decoder, pgn));
+    assert(!can_j1939_pass(&decoder, 0xF004U));
+    assert(can_j1939_pass(&decoder, 0xFEE3U));
+    can_j1939_pass_all(&decoder);
+    assert(can_j1939_passes(&decoder, 0xF004U));
+    assert(!frame(0x0CF00401U, data, 8, 0));
+}
+
+static void test_records(void)
+{
+    CanJ1939Message mp = {0x1FEF1U, 42, 9, 6, SOURCE, CAN_J1939_GLOBAL,
+                          0x3F, NULL};
+    uint8_t payload[9];
+    CanJ1939Record record;
+    CanRecord raw;
+
+    pattern(payload, sizeof(payload), 6);
+    mp.data = payload;
+    messages = 0;
+    can_j1939_message_to_records(&mp, emit, NULL);
+    assert(messages == 1 && dataRecords == CAN_J1939_RECORDS(9) - 1U);
+    assert(start.pgn == 0x1FEF1U && start.priority == 6);
+    assert(start.counter == 0x3F && startTime == 42);
+    assert(memcmp(message, payload, sizeof(payload)) == 0);
+
+    /* Frames are no records.*/
+    can_record_set(&raw, CAN_RECORD_J1939, true, false, 8, payload, 0);
+    assert(!can_j1939_from_record(&raw, &record));
+}
+
+int main(void)
+{
+    test_parse();
+    test_bam();
+    test_rts_cts();
+    test_abort_timeout();
+    test_pass();
+    test_records();
+
+    printf("test_j1939: ok\n");
+
+    return 0;
+}
@@ -0,0 +1,592 @@
+/**
+ * @file    tools/canbench/canbench.c
+ * @brief   Round trip latency benchmark for the host link.
+ * @details Sends frames in batches at a set of frame rates and batch
+ *          sizes and times them against what comes back:
+ *          - echo: the transmit echo of each frame,
+ *          - rx: the frame received back, in loopback mode or from a
+ *            second node that answers with the same data.
+ *          The cookie is in data bytes 0..3, so received frames are
+ *          matched to the frames sent. Credits from the device limit the
+ *          frames in flight, the times the sender waits are counted as
+ *          stalls. Per run it prints percentiles, mean and jitter of the
+ *          round trip and of the delay the device reports, optionally a
+ *          histogram. The device is the firmware on a serial port or
+ *          cansim on a pseudo terminal.
+ *
+ *          Usage: canbench [-r rates] [-b batch sizes] [-n frames]
+ *                          [-i id] [-e] [-m echo|rx] [-a answer id] [-l]
+ *                          [-o text|compressed] [-H] device
+ *
+ *          Rates are frames per second, 0 sends as fast as credits allow.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "can_codec.h"
+#include "can_echo.h"
+#include "host_batch.h"
+
+#define MODE_FULL_MARKER    "# mode full"
+#define LIST_MAX            16
+#define HISTOGRAM_BUCKETS   24
+#define HISTOGRAM_WIDTH     50
+#define DRAIN_MS            200
+#define TIMEOUT_NS          2000000000U
+
+typedef struct {
+    uint64_t sent;          /* Host time the batch was written.            */
+    uint64_t back;          /* Host time the echo or frame was read.       */
+    uint32_t delay;         /* Reported by the device.                     */
+    uint8_t status;
+    bool echoed;
+    bool received;
+} Sample;
+
+/* Settings.*/
+static unsigned long rates[LIST_MAX] = {100, 1000, 0};
+static size_t rateCount = 3;
+static unsigned long batches[LIST_MAX] = {1, 8, 16};
+static size_t batchCount = 3;
+static size_t frames = 1000;
+static uint32_t frameId = 0x123;
+static bool extended;
+static bool rxMode;
+static long answerId = -1;
+static bool setLoopback;
+static bool compressed;
+static bool histogram;
+
+/* Host link.*/
+static int fd;
+static bool text = true;
+static CanDecoder decoder;
+static char line[256];
+static size_t lineLength;
+static uint8_t sequence;
+
+/* Flow control.*/
+static uint32_t returned;
+static uint32_t submitted;
+static uint32_t window;
+
+/* Current run.*/
+static Sample *samples;
+static uint32_t firstCookie;
+static size_t sentCount;
+static size_t echoed;
+static size_t received;
+static size_t failed;
+static unsigned long stalls;
+static unsigned long packetErrors;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000U + (uint64_t) ts.tv_nsec;
+}
+
+static void send_text(const char *command)
+{
+    char buf[64];
+    int n = snprintf(buf, sizeof(buf), "%s\r", command);
+
+    if (write(fd, buf, (size_t) n) != n)
+        perror("canbench: write");
+}
+
+/*===========================================================================*/
+/* Stream.                                                                   */
+/*===========================================================================*/
+
+static Sample *sample_of(uint32_t cookie)
+{
+    uint32_t index = cookie - firstCookie;
+
+    return samples != NULL && index < sentCount ? &samples[index] : NULL;
+}
+
+static void on_echo(uint32_t cookie, uint8_t status, uint32_t delay)
+{
+    Sample *sp = sample_of(cookie);
+
+    if (sp == NULL || sp->echoed)
+        return;
+    sp->echoed = true;
+    sp->back = rxMode ? sp->back : now_ns();
+    sp->status = status;
+    sp->delay = delay;
+    echoed++;
+    if (status != CAN_ECHO_SENT)
+        failed++;
+}
+
+static void on_frame(uint32_t id, bool ext, const uint8_t *data, uint8_t dlc)
+{
+    uint32_t expected = answerId >= 0 ? (uint32_t) answerId : frameId;
+
+    if (!rxMode || id != expected || dlc < 4 ||
+        (answerId < 0 && ext != extended))
+        return;
+
+    Sample *sp = sample_of((uint32_t) data[0] | (uint32_t) data[1] << 8 |
+                           (uint32_t) data[2] << 16 | (uint32_t) data[3] << 24);
+    if (sp == NULL || sp->received)
+        return;
+    sp->received = true;
+    sp->back = now_ns();
+    received++;
+}
+
+static void on_line(const char *s)
+{
+    unsigned long cookie, timestamp, delay, value;
+    unsigned long word0, word1, id;
+    char status[16];
+
+    if (sscanf(s, "# echo %lu @%lu %15s delay=%luus", &cookie, &timestamp,
+               status, &delay) == 4)
+    {
+        uint8_t code = CAN_ECHO_ERROR;
+
+        for (uint8_t i = CAN_ECHO_SENT; i <= CAN_ECHO_ERROR; i++)
+        {
+            if (strcmp(status, can_echo_status_name(i)) == 0)
+                code = i;
+        }
+        on_echo((uint32_t) cookie, code, (uint32_t) delay);
+    }
+    else if (sscanf(s, "# credit returned=%lu", &value) == 1)
+    {
+        returned = (uint32_t) value;
+    }
+    else if (sscanf(s, "# tx queued=%*u sent=%lu failed=%lu rejected=%lu "
+                    "pending=%*u window=%lu", &word0, &word1, &id,
+                    &value) == 4)
+    {
+        /* Counted like the credits.*/
+        returned = (uint32_t) (word0 + word1 + id);
+        window = (uint32_t) value;
+    }
+    else if (strncmp(s, "# ack - - error", 15) == 0)
+    {
+        packetErrors++;
+    }
+    else if (sscanf(s, "%8lx: %8lx %8lx @%lu", &id, &word0, &word1,
+                    &timestamp) == 4)
+    {
+        uint8_t data[8];
+
+        for (unsigned i = 0; i < 4; i++)
+        {
+            data[i] = (uint8_t) (word0 >> (8 * i));
+            data[i + 4] = (uint8_t) (word1 >> (8 * i));
+        }
+        /* The text output has neither the format nor the DLC.*/
+        on_frame((uint32_t) id, extended, data, 8);
+    }
+}
+
+static void on_byte(uint8_t c)
+{
+    if (text && c != CAN_CODEC_TAG_SYNC)
+    {
+        if (c == '\n' || lineLength == sizeof(line) - 1)
+        {
+            line[lineLength] = '\0';
+            on_line(line);
+            lineLength = 0;
+        }
+        else if (c != '\r')
+        {
+            line[lineLength++] = (char) c;
+        }
+        return;
+    }
+    text = false;
+
+    switch (can_decoder_feed(&decoder, c))
+    {
+    case CAN_CODEC_FRAME:
+    {
+        const CanRecord *record = &decoder.record;
+        uint8_t data[8];
+        uint8_t dlc = can_record_get_data(record, data);
+        CanEcho echo;
+
+        if (can_echo_from_record(record, &echo))
+            on_echo(echo.cookie, echo.status, echo.delay);
+        else if (!CAN_RECORD_IS_DEVICE(record))
+            on_frame(CAN_RECORD_GET_ID(record), CAN_RECORD_IS_EXT(record),
+                     data, dlc);
+        break;
+    }
+    case CAN_CODEC_TEXT:
+        on_line(decoder.text);
+        if (strncmp(decoder.text, MODE_FULL_MARKER,
+                    strlen(MODE_FULL_MARKER)) == 0)
+        {
+            text = true;
+            can_decoder_init(&decoder);
+        }
+        break;
+    case CAN_CODEC_ERROR:
+        fprintf(stderr, "canbench: stream corrupt, waiting for sync\n");
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * Reads what arrives until the deadline.
+ */
+static void poll_until(uint64_t deadline)
+{
+    while (true)
+    {
+        uint64_t now = now_ns();
+        int timeout = deadline > now ?
+                      (int) ((deadline - now + 999999U) / 1000000U) : 0;
+        struct pollfd pfd = {fd, POLLIN, 0};
+
+        if (poll(&pfd, 1, timeout) <= 0)
+            return;
+
+        uint8_t buf[4096];
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0)
+            return;
+        for (ssize_t i = 0; i < n; i++)
+            on_byte(buf[i]);
+        if (now_ns() >= deadline)
+            return;
+    }
+}
+
+/*===========================================================================*/
+/* Runs.                                                                     */
+/*===========================================================================*/
+
+static int compare(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(const double *sorted, size_t n, double p)
+{
+    size_t index = (size_t) ceil(p / 100.0 * (double) n);
+
+    return sorted[index > 0 ? index - 1 : 0];
+}
+
+static void print_stats(const char *name, double *values, size_t n)
+{
+    double sum = 0.0, squares = 0.0;
+
+    if (n == 0)
+    {
+        printf("  %-8s none\n", name);
+        return;
+    }
+    qsort(values, n, sizeof(values[0]), compare);
+    for (size_t i = 0; i < n; i++)
+        sum += values[i];
+    double mean = sum / (double) n;
+    for (size_t i = 0; i < n; i++)
+        squares += (values[i] - mean) * (values[i] - mean);
+
+    printf("  %-8s min=%.0f p50=%.0f p90=%.0f p99=%.0f p99.9=%.0f max=%.0f "
+           "mean=%.1f jitter=%.1f us\n", name, values[0],
+           percentile(values, n, 50.0), percentile(values, n, 90.0),
+           percentile(values, n, 99.0), percentile(values, n, 99.9),
+           values[n - 1], mean, sqrt(squares / (double) n));
+}
+
+/* Buckets double in width: below 1 us, 1..2 us, 2..4 us and so on.*/
+static void print_histogram(const double *values, size_t n)
+{
+    size_t counts[HISTOGRAM_BUCKETS] = {0};
+    size_t highest = 0, first = HISTOGRAM_BUCKETS, last = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t bucket = 0;
+
+        for (double limit = 1.0; values[i] >= limit &&
+             bucket < HISTOGRAM_BUCKETS - 1; limit *= 2.0)
+            bucket++;
+        counts[bucket]++;
+    }
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        if (counts[i] == 0)
+            continue;
+        if (counts[i] > highest)
+            highest = counts[i];
+        if (i < first)
+            first = i;
+        last = i;
+    }
+    for (size_t i = first; i <= last && highest != 0; i++)
+    {
+        printf("  %8lu us %7zu |", i == 0 ? 0UL : 1UL << (i - 1), counts[i]);
+        for (size_t j = 0; j < counts[i] * HISTOGRAM_WIDTH / highest; j++)
+            putchar('#');
+        putchar('\n');
+    }
+}
+
+static void run(unsigned long rate, size_t batchSize)
+{
+    HostBatchFrame batch[HOST_BATCH_FRAMES];
+    uint8_t packet[HOST_BATCH_MAX_SIZE];
+    uint64_t start = now_ns(), last = start;
+    size_t done = 0;
+
+    samples = calloc(frames, sizeof(Sample));
+    if (samples == NULL)
+    {
+        perror("canbench");
+        exit(1);
+    }
+    sentCount = echoed = received = failed = 0;
+    stalls = 0;
+    firstCookie = (uint32_t) (start / 1000U);
+
+    while (sentCount < frames)
+    {
+        uint64_t now = now_ns();
+        size_t due = rate == 0 ? frames :
+                     (size_t) ((now - start) * rate / 1000000000U) + 1;
+        size_t count = (due < frames ? due : frames) - sentCount;
+        size_t credit = window - (submitted - returned);
+
+        if (count > batchSize)
+            count = batchSize;
+        /* A smaller batch waits for its frames to be due, unless last.*/
+        if (count < batchSize && sentCount + count < frames && rate != 0)
+            count = 0;
+        if (count > credit)
+        {
+            if (credit == 0)
+                stalls++;
+            count = credit;
+        }
+        if (count == 0)
+        {
+            uint64_t next = rate == 0 ? now + 1000000U :
+                            start + (sentCount + batchSize) * 1000000000U / rate;
+
+            poll_until(credit == 0 || next > now + 1000000U ? now + 1000000U : next);
+            continue;
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            uint32_t cookie = firstCookie + (uint32_t) (sentCount + i);
+
+            batch[i].cookie = cookie;
+            batch[i].id = frameId | (extended ? CAN_RECORD_EXT : 0);
+            batch[i].dlc = 8;
+            memcpy(batch[i].data, &cookie, 4);
+            memset(&batch[i].data[4], 0, 4);
+        }
+        size_t n = host_batch_encode(sequence++, batch, count, packet);
+        now = now_ns();
+        if (write(fd, packet, n) != (ssize_t) n)
+        {
+            perror("canbench: write");
+            exit(1);
+        }
+        for (size_t i = 0; i < count; i++)
+            samples[sentCount + i].sent = now;
+        sentCount += count;
+        submitted += (uint32_t) count;
+        last = now;
+        poll_until(now);
+    }
+
+    /* Waits for the stragglers.*/
+    while (now_ns() - last < TIMEOUT_NS)
+    {
+        done = rxMode ? received : echoed;
+        if (done == frames)
+            break;
+        poll_until(now_ns() + 10000000U);
+    }
+    done = rxMode ? received : echoed;
+
+    double *rtt = malloc(frames * sizeof(double));
+    double *delay = malloc(frames * sizeof(double));
+    size_t rttCount = 0, delayCount = 0;
+    uint64_t first = UINT64_MAX, end = 0;
+
+    for (size_t i = 0; i < frames; i++)
+    {
+        const Sample *sp = &samples[i];
+        bool ok = rxMode ? sp->received : sp->echoed && sp->status == CAN_ECHO_SENT;
+
+        if (sp->echoed && sp->status == CAN_ECHO_SENT)
+            delay[delayCount++] = (double) sp->delay;
+        if (!ok)
+            continue;
+        rtt[rttCount++] = (double) (sp->back - sp->sent) / 1000.0;
+        if (sp->sent < first)
+            first = sp->sent;
+        if (sp->back > end)
+            end = sp->back;
+    }
+
+    char rateName[16];
+    snprintf(rateName, sizeof(rateName), rate == 0 ? "max" : "%lu", rate);
+    printf("rate=%s batch=%zu mode=%s output=%s frames=%zu ok=%zu "
+           "failed=%zu lost=%zu stalls=%lu fps=%.0f\n", rateName, batchSize,
+           rxMode ? "rx" : "echo", compressed ? "compressed" : "text",
+           frames, rttCount, failed, frames - done, stalls,
+           end > first ? (double) rttCount * 1e9 / (double) (end - first) : 0.0);
+    print_stats("rtt", rtt, rttCount);
+    print_stats("device", delay, delayCount);
+    if (histogram)
+        print_histogram(rtt, rttCount);
+    fflush(stdout);
+
+    free(rtt);
+    free(delay);
+    free(samples);
+    samples = NULL;
+    poll_until(now_ns() + DRAIN_MS * 1000000U);
+}
+
+/*===========================================================================*/
+/* Main.                                                                     */
+/*===========================================================================*/
+
+static size_t parse_list(char *s, unsigned long *list)
+{
+    size_t n = 0;
+
+    for (char *p = strtok(s, ","); p != NULL && n < LIST_MAX;
+         p = strtok(NULL, ","))
+        list[n++] = strtoul(p, NULL, 0);
+
+    return n;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: canbench [-r rates] [-b batch sizes] [-n frames] "
+            "[-i id] [-e] [-m echo|rx] [-a answer id] [-l] "
+            "[-o text|compressed] [-H] device\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:b:n:i:em:a:lo:H")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            rateCount = parse_list(optarg, rates);
+            break;
+        case 'b':
+            batchCount = parse_list(optarg, batches);
+            break;
+        case 'n':
+            frames = strtoul(optarg, NULL, 0);
+            break;
+        case 'i':
+            frameId = (uint32_t) strtoul(optarg, NULL, 0);
+            break;
+        case 'e':
+            extended = true;
+            break;
+        case 'm':
+            rxMode = strcmp(optarg, "rx") == 0;
+            break;
+        case 'a':
+            answerId = strtol(optarg, NULL, 0);
+            break;
+        case 'l':
+            setLoopback = true;
+            break;
+        case 'o':
+            compressed = strcmp(optarg, "compressed") == 0;
+            break;
+        case 'H':
+            histogram = true;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind != argc - 1 || frames == 0 || rateCount == 0 ||
+        batchCount == 0)
+        usage();
+    for (size_t i = 0; i < batchCount; i++)
+    {
+        if (batches[i] == 0 || batches[i] > HOST_BATCH_FRAMES)
+            usage();
+    }
+
+    fd = open(argv[optind], O_RDWR | O_NOCTTY);
+    if (fd < 0)
+    {
+        perror(argv[optind]);
+        return 1;
+    }
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0)
+    {
+        cfmakeraw(&tio);
+        (void) tcsetattr(fd, TCSANOW, &tio);
+        (void) tcflush(fd, TCIOFLUSH);
+    }
+    can_decoder_init(&decoder);
+
+    send_text(compressed ? "output compressed" : "output text");
+    send_text(setLoopback ? "loopback on" : "loopback off");
+    send_text("status");
+    for (int i = 0; i < 20 && window == 0; i++)
+        poll_until(now_ns() + 100000000U);
+    if (window == 0)
+    {
+        fprintf(stderr, "canbench: no transmit status from the device, "
+                "USE_HOST_TX missing?\n");
+        return 1;
+    }
+    /* Frames the device still had in flight are done by now.*/
+    submitted = returned;
+
+    for (size_t i = 0; i < rateCount; i++)
+    {
+        for (size_t j = 0; j < batchCount; j++)
+            run(rates[i], batches[j]);
+    }
+    if (packetErrors != 0)
+        fprintf(stderr, "canbench: %lu batches rejected as malformed\n",
+                packetErrors);
+    if (setLoopback)
+        send_text("loopback off");
+
+    return 0;
+}
@@ -0,0 +1,658 @@
+/**
+ * @file    tools/canbench/cansim.c
+ * @brief   Simulated device for canbench.
+ * @details Speaks the protocol of the serial host link on a pseudo
+ *          terminal: text commands, frame batches, echoes, credits and
+ *          the text or compressed stream. Command arguments, batches, the
+ *          transmit queue with its credits, records, echoes and the codec
+ *          are the firmware modules, the bus is simulated with
+ *          the exact length of each frame at the configured bitrate.
+ *          Frames sent are received back in loopback mode, a second node
+ *          can answer each frame with the same data, background frames
+ *          compete in arbitration.
+ *          The ChibiOS firmware itself has no host port, the command set
+ *          is the part canbench uses: send, output, loopback, bitrate,
+ *          status.
+ *
+ *          Usage: cansim [-b bitrate] [-w window] [-a answer id]
+ *                        [-t answer us] [-L background load %]
+ *                        [-u link latency us]
+ */
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "can_bits.h"
+#include "can_codec.h"
+#include "can_echo.h"
+#include "host_args.h"
+#include "host_batch.h"
+#include "host_tx_queue.h"
+
+/* The Makefile raises HOST_TX_QUEUE_SIZE, the window is set with -w.*/
+#define WINDOW_MAX          HOST_TX_QUEUE_SIZE
+#define LINK_CHUNKS         4096
+#define LINE_SIZE           128
+#define BACKGROUND_ID       0x100U
+
+enum { SOURCE_HOST, SOURCE_ANSWER, SOURCE_BACKGROUND };
+
+typedef struct {
+    uint64_t due;
+    size_t n;
+    uint8_t data[CAN_CODEC_MAX_TOKEN + CAN_CODEC_TEXT_OFFSET];
+} LinkChunk;
+
+/* Settings.*/
+static uint32_t bitrate = 500000;
+static uint32_t window = 32;
+static long answerId = -1;
+static uint64_t answerNs = 200000;
+static unsigned backgroundLoad;
+static uint64_t linkNs;
+
+/* Host link.*/
+static int master;
+static bool compressed;
+static bool loopback;
+static CanEncoder encoder;
+static LinkChunk linkQueue[LINK_CHUNKS];
+static size_t linkHead;
+static size_t linkCount;
+static unsigned long linkDropped;
+
+/* Transmit queue, the head is on the bus or next to go.*/
+static HostTxQueue txQueue;
+static uint32_t textSequence;
+
+/* Bus.*/
+static bool busy;
+static int busSource;
+static CanRecord busFrame;
+static uint64_t busEnd;
+static CanRecord answers[WINDOW_MAX];
+static uint64_t answerDue[WINDOW_MAX];
+static size_t answerHead;
+static size_t answerCount;
+static uint64_t backgroundDue;
+static uint32_t backgroundCount;
+
+static uint64_t start;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000U + (uint64_t) ts.tv_nsec - start;
+}
+
+static uint32_t device_us(uint64_t ns)
+{
+    return (uint32_t) (ns / 1000U);
+}
+
+/*===========================================================================*/
+/* Host link output.                                                         */
+/*===========================================================================*/
+
+static void link_write(const uint8_t *data, size_t n)
+{
+    while (n > 0)
+    {
+        ssize_t written = write(master, data, n);
+
+        if (written < 0)
+        {
+            /* Nobody reads the terminal.*/
+            linkDropped += n;
+            if (compressed)
+                can_encoder_reset(&encoder);
+            return;
+        }
+        data += written;
+        n -= (size_t) written;
+    }
+}
+
+static void link_flush(uint64_t now)
+{
+    while (linkCount > 0 && linkQueue[linkHead].due <= now)
+    {
+        link_write(linkQueue[linkHead].data, linkQueue[linkHead].n);
+        linkHead = (linkHead + 1) % LINK_CHUNKS;
+        linkCount--;
+    }
+}
+
+static void link_send(const uint8_t *data, size_t n)
+{
+    if (linkNs == 0)
+    {
+        link_write(data, n);
+        return;
+    }
+    if (linkCount == LINK_CHUNKS)
+    {
+        linkDropped += n;
+        return;
+    }
+
+    LinkChunk *chunk = &linkQueue[(linkHead + linkCount++) % LINK_CHUNKS];
+    chunk->due = now_ns() + linkNs;
+    chunk->n = n;
+    memcpy(chunk->data, data, n);
+}
+
+static void emit_line(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static void emit_line(const char *fmt, ...)
+{
+    uint8_t buf[CAN_CODEC_MAX_TOKEN + CAN_CODEC_TEXT_OFFSET];
+    char *text = (char *) &buf[CAN_CODEC_TEXT_OFFSET];
+    va_list ap;
+
+    va_start(ap, fmt);
+    int n = vsnprintf(text, 250, fmt, ap);
+    va_end(ap);
+    if (n > 249)
+        n = 249;
+
+    if (compressed)
+    {
+        link_send(buf, can_encoder_text(&encoder, text, (size_t) n, buf));
+        return;
+    }
+    text[n++] = '\r';
+    text[n++] = '\n';
+    link_send((uint8_t *) text, (size_t) n);
+}
+
+static void emit_record(const CanRecord *record)
+{
+    CanEcho echo;
+
+    if (compressed)
+    {
+        uint8_t buf[CAN_CODEC_MAX_FRAME];
+
+        link_send(buf, can_encoder_frame(&encoder, record, buf));
+        return;
+    }
+
+    if (can_echo_from_record(record, &echo))
+    {
+        emit_line("# echo %lu @%lu %s delay=%luus", (unsigned long) echo.cookie,
+                  (unsigned long) record->timestamp,
+                  can_echo_status_name(echo.status),
+                  (unsigned long) echo.delay);
+        return;
+    }
+
+    uint8_t data[8];
+    (void) can_record_get_data(record, data);
+    emit_line("%08lx: %08lx %08lx @%lu",
+              (unsigned long) CAN_RECORD_GET_ID(record),
+              (unsigned long) (data[0] | data[1] << 8 | data[2] << 16 |
+                              (uint32_t) data[3] << 24),
+              (unsigned long) (data[4] | data[5] << 8 | data[6] << 16 |
+                              (uint32_t) data[7] << 24),
+              (unsigned long) record->timestamp);
+}
+
+static void emit_echo(uint32_t cookie, canechostatus_t status,
+                      uint32_t queuedUs, uint32_t nowUs)
+{
+    CanEcho echo = {cookie, (uint8_t) status, nowUs - queuedUs};
+    CanRecord record;
+
+    can_echo_to_record(&echo, nowUs, &record);
+    emit_record(&record);
+    host_tx_queue_done(&txQueue, status);
+}
+
+static void emit_credit(bool always)
+{
+    HostTxCredit credit;
+
+    if (!host_tx_queue_credit(&txQueue, &credit, always))
+        return;
+
+    emit_line("# credit returned=%lu free=%lu window=%lu",
+              (unsigned long) credit.returned, (unsigned long) credit.free,
+              (unsigned long) window);
+}
+
+/*===========================================================================*/
+/* Bus.                                                                      */
+/*===========================================================================*/
+
+static uint64_t frame_ns(const CanRecord *record)
+{
+    return (uint64_t) can_bits_frame(record) * 1000000000U / bitrate;
+}
+
+/*
+ * Queues a frame like hostTxSubmit(), false if it was refused.
+ */
+static bool submit(uint32_t cookie, uint32_t id, uint8_t dlc,
+                   const uint8_t *data)
+{
+    uint32_t nowUs = device_us(now_ns());
+    canechostatus_t status;
+
+    if (!host_tx_queue_push(&txQueue, cookie, id, dlc, data, nowUs, &status))
+    {
+        emit_echo(cookie, status, nowUs, nowUs);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Starts the frame that wins arbitration, if any is waiting.
+ */
+static void bus_start(uint64_t now)
+{
+    const HostTxEntry *head = host_tx_queue_peek(&txQueue);
+    const CanRecord *winner = NULL;
+    int source = SOURCE_HOST;
+    CanRecord background;
+
+    if (head != NULL)
+        winner = &head->frame;
+    if (answerCount > 0 && answerDue[answerHead] <= now &&
+        (winner == NULL ||
+         can_record_priority(&answers[answerHead]) < can_record_priority(winner)))
+    {
+        winner = &answers[answerHead];
+        source = SOURCE_ANSWER;
+    }
+    if (backgroundLoad != 0 && backgroundDue <= now)
+    {
+        uint8_t data[8];
+
+        memcpy(data, &backgroundCount, 4);
+        memset(&data[4], 0x55, 4);
+        can_record_set(&background, BACKGROUND_ID, false, false, 8, data, 0);
+        if (winner == NULL ||
+            can_record_priority(&background) < can_record_priority(winner))
+        {
+            winner = &background;
+            source = SOURCE_BACKGROUND;
+        }
+    }
+    if (winner == NULL)
+        return;
+
+    busy = true;
+    busSource = source;
+    busFrame = *winner;
+    busEnd = now + frame_ns(winner);
+    if (source == SOURCE_ANSWER)
+    {
+        answerHead = (answerHead + 1) % WINDOW_MAX;
+        answerCount--;
+    }
+    else if (source == SOURCE_BACKGROUND)
+    {
+        /* Spaced for the load, counted from the start of the frame.*/
+        backgroundDue = now + frame_ns(winner) * 100U / backgroundLoad;
+        backgroundCount++;
+    }
+}
+
+static void bus_end(void)
+{
+    CanRecord received = busFrame;
+    uint32_t endUs = device_us(busEnd);
+
+    busy = false;
+    received.timestamp = endUs;
+    if (busSource != SOURCE_HOST)
+    {
+        emit_record(&received);
+        return;
+    }
+
+    HostTxEntry entry = *host_tx_queue_peek(&txQueue);
+    host_tx_queue_pop(&txQueue);
+    emit_echo(entry.cookie, CAN_ECHO_SENT, entry.frame.timestamp, endUs);
+    if (loopback)
+        emit_record(&received);
+    if (answerId >= 0 && answerCount < WINDOW_MAX)
+    {
+        uint8_t data[8];
+        uint8_t dlc = can_record_get_data(&busFrame, data);
+
+        size_t tail = (answerHead + answerCount++) % WINDOW_MAX;
+
+        can_record_set(&answers[tail], (uint32_t) answerId, answerId > 0x7FF,
+                       false, dlc, data, 0);
+        answerDue[tail] = busEnd + answerNs;
+    }
+    emit_credit(false);
+}
+
+/*
+ * Runs the bus up to now, returns the time of the next event.
+ */
+static uint64_t bus_run(uint64_t now)
+{
+    while (true)
+    {
+        if (busy && busEnd <= now)
+            bus_end();
+        if (!busy)
+            bus_start(now);
+        if (busy && busEnd <= now)
+            continue;
+
+        uint64_t next = busy ? busEnd : UINT64_MAX;
+        if (!busy && answerCount > 0 && answerDue[answerHead] < next)
+            next = answerDue[answerHead];
+        if (!busy && backgroundLoad != 0 && backgroundDue < next)
+            next = backgroundDue;
+
+        return next;
+    }
+}
+
+/*===========================================================================*/
+/* Commands.                                                                 */
+/*===========================================================================*/
+
+/* Argument rules of the firmware commands, see host_command.c.*/
+static const char *cmd_send(int argc, char *argv[])
+{
+    uint32_t cookie;
+    uint32_t id;
+    uint8_t data[8];
+    uint8_t dlc;
+
+    if (!host_args_send(argc, argv, &cookie, &id, data, &dlc))
+        return "usage";
+
+    return submit(cookie, id, dlc, data) ? NULL : "rejected";
+}
+
+static const char *cmd_output(int argc, char *argv[])
+{
+    uint32_t value = 0;
+
+    if (argc != 1 || (strcmp(argv[0], "text") != 0 &&
+                      strcmp(argv[0], "compressed") != 0 &&
+                      !host_args_u32(argv[0], &value)))
+        return "usage";
+
+    bool next = value != 0 || strcmp(argv[0], "compressed") == 0;
+    if (next != compressed)
+    {
+        /* The marker goes out in the old format.*/
+        emit_line("# mode %s", next ? "compressed" : "full");
+        compressed = next;
+        can_encoder_reset(&encoder);
+    }
+
+    return NULL;
+}
+
+static void run_command(char *line)
+{
+    char *argv[8];
+    int argc = host_args_split(line, argv, 8);
+    const char *error = NULL;
+
+    if (argc == 0)
+        return;
+
+    uint32_t sequence = textSequence++;
+    if (argc < 0)
+        error = "usage";
+    else if (strcmp(argv[0], "send") == 0)
+        error = cmd_send(argc - 1, &argv[1]);
+    else if (strcmp(argv[0], "output") == 0)
+        error = cmd_output(argc - 1, &argv[1]);
+    else if (strcmp(argv[0], "loopback") == 0)
+    {
+        if (argc != 2 || !host_args_switch(argv[1], &loopback))
+            error = "usage";
+    }
+    else if (strcmp(argv[0], "bitrate") == 0)
+    {
+        uint32_t value;
+
+        if (argc < 2 || argc > 3 || !host_args_u32(argv[1], &value) ||
+            value == 0)
+            error = "usage";
+        else
+            bitrate = value;
+    }
+    else if (strcmp(argv[0], "status") == 0)
+    {
+        HostTxStats stats;
+
+        host_tx_queue_stats(&txQueue, &stats);
+        emit_line("# config bitrate=%lu sp=875 loopback=%s output=%s heartbeat=0ms filters=0",
+                  (unsigned long) bitrate, loopback ? "on" : "off",
+                  compressed ? "compressed" : "text");
+        emit_line("# tx queued=%lu sent=%lu failed=%lu rejected=%lu pending=%lu window=%lu",
+                  (unsigned long) stats.queued, (unsigned long) stats.sent,
+                  (unsigned long) stats.failed,
+                  (unsigned long) stats.rejected,
+                  (unsigned long) stats.pending, (unsigned long) window);
+    }
+    else
+        error = "unknown";
+
+    if (error != NULL)
+        emit_line("# ack %lu %s error %s", (unsigned long) sequence, argv[0],
+                  error);
+    else
+        emit_line("# ack %lu %s ok apply=0us", (unsigned long) sequence,
+                  argv[0]);
+}
+
+/*===========================================================================*/
+/* Host link input.                                                          */
+/*===========================================================================*/
+
+enum { INPUT_TEXT, INPUT_BATCH, INPUT_PACKET };
+
+static int inputState = INPUT_TEXT;
+static char line[LINE_SIZE];
+static size_t lineLength;
+static HostBatch batch;
+static uint8_t packet[32];
+static size_t packetLength;
+
+static void input_byte(uint8_t c)
+{
+    switch (inputState)
+    {
+    case INPUT_BATCH:
+        switch (host_batch_feed(&batch, c))
+        {
+        case HOST_BATCH_DONE:
+        {
+            unsigned queued = 0;
+
+            for (size_t i = 0; i < batch.count; i++)
+            {
+                if (submit(batch.frames[i].cookie, batch.frames[i].id,
+                           batch.frames[i].dlc, batch.frames[i].data))
+                    queued++;
+            }
+            emit_line("# ack %u send ok frames=%u queued=%u",
+                      batch.sequence, (unsigned) batch.count, queued);
+            inputState = INPUT_TEXT;
+            break;
+        }
+        case HOST_BATCH_ERROR:
+            emit_line("# ack - - error packet");
+            inputState = INPUT_TEXT;
+            break;
+        default:
+            break;
+        }
+        return;
+    case INPUT_PACKET:
+        /* Binary commands are not simulated, only skipped.*/
+        packet[packetLength++] = c;
+        if (packetLength > 1 && packetLength == (size_t) packet[0] + 2)
+        {
+            emit_line("# ack %u op%u error unsupported", packet[1],
+                      packet[0] >= 2 ? packet[2] : 0);
+            inputState = INPUT_TEXT;
+        }
+        else if (packetLength == sizeof(packet))
+        {
+            emit_line("# ack - - error packet");
+            inputState = INPUT_TEXT;
+        }
+        return;
+    default:
+        break;
+    }
+
+    if (lineLength == 0 && c == HOST_BATCH_START)
+    {
+        host_batch_init(&batch);
+        inputState = INPUT_BATCH;
+    }
+    else if (lineLength == 0 && c == 0x01)
+    {
+        packetLength = 0;
+        inputState = INPUT_PACKET;
+    }
+    else if (c == '\r' || c == '\n')
+    {
+        line[lineLength] = '\0';
+        lineLength = 0;
+        run_command(line);
+    }
+    else if (c >= 0x20 && lineLength < sizeof(line) - 1)
+    {
+        line[lineLength++] = (char) c;
+    }
+}
+
+/*===========================================================================*/
+/* Main.                                                                     */
+/*===========================================================================*/
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: cansim [-b bitrate] [-w window] [-a answer id] "
+            "[-t answer us] [-L background load %%] [-u link latency us]\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:w:a:t:L:u:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            bitrate = (uint32_t) strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            window = (uint32_t) strtoul(optarg, NULL, 0);
+            break;
+        case 'a':
+            answerId = strtol(optarg, NULL, 0);
+            break;
+        case 't':
+            answerNs = strtoull(optarg, NULL, 0) * 1000U;
+            break;
+        case 'L':
+            backgroundLoad = (unsigned) strtoul(optarg, NULL, 0);
+            break;
+        case 'u':
+            linkNs = strtoull(optarg, NULL, 0) * 1000U;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (bitrate == 0 || window == 0 || window > WINDOW_MAX ||
+        backgroundLoad > 100)
+        usage();
+
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+    {
+        perror("cansim: pty");
+        return 1;
+    }
+
+    /* Kept open, the master does not see a hangup between clients.*/
+    int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    struct termios tio;
+    if (slave < 0 || tcgetattr(slave, &tio) != 0)
+    {
+        perror("cansim: pty");
+        return 1;
+    }
+    cfmakeraw(&tio);
+    (void) tcsetattr(slave, TCSANOW, &tio);
+    (void) fcntl(master, F_SETFL, O_NONBLOCK);
+
+    start = 0;
+    start = now_ns();
+    host_tx_queue_init(&txQueue, window, window / 4);
+    can_encoder_init(&encoder);
+    printf("%s\n", ptsname(master));
+    fflush(stdout);
+
+    emit_line("# connected backlog=0 stored=0 lost=0");
+    emit_line("# can bitrate=%lu", (unsigned long) bitrate);
+    emit_credit(true);
+
+    while (true)
+    {
+        uint64_t now = now_ns();
+        uint64_t next = bus_run(now);
+
+        link_flush(now);
+        if (linkCount > 0 && linkQueue[linkHead].due < next)
+            next = linkQueue[linkHead].due;
+
+        /* poll() has millisecond resolution, the last stretch spins.*/
+        int timeout = -1;
+        if (next != UINT64_MAX)
+            timeout = next > now + 2000000U ?
+                      (int) ((next - now) / 1000000U) - 1 : 0;
+
+        struct pollfd pfd = {master, POLLIN, 0};
+        if (poll(&pfd, 1, timeout) > 0 && (pfd.revents & POLLIN) != 0)
+        {
+            uint8_t buf[512];
+            ssize_t n = read(master, buf, sizeof(buf));
+
+            for (ssize_t i = 0; i < n; i++)
+                input_byte(buf[i]);
+        }
+        if (linkDropped != 0)
+        {
+            fprintf(stderr, "cansim: %lu bytes dropped, no reader\n",
+                    linkDropped);
+            linkDropped = 0;
+        }
+    }
+}
@@ -0,0 +1,663 @@
+/**
+ * @file    tools/candbc/candbc.c
+ * @brief   Signal table compiler for on-device decoding.
+ * @details Reads the messages and signals of a DBC file and compiles the
+ *          selected signals into the table of can_signal.h: bit positions
+ *          become a shift of the little or big endian payload word,
+ *          factor and offset become integers in units of 10^-decimals,
+ *          the deadband a raw step. The table is written to a file and
+ *          or loaded into the device with the sigload and sigcommit
+ *          commands, in text output. The signal list printed maps the
+ *          indices of the "# sig" lines to names.
+ *
+ *          Usage: candbc [-s signal[=deadband],...] [-m id,...]
+ *                        [-d deadband] [-o table] [-w device] file.dbc
+ *
+ *          Without -s and -m every signal is taken. A deadband is in
+ *          physical units, changes smaller than it are not reported.
+ *          Multiplexed signals take their multiplexer along, it is
+ *          decoded but not reported unless selected itself.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "can_signal.h"
+
+#define NAME_SIZE           64
+#define UNIT_SIZE           16
+#define LIST_MAX            256
+#define ACK_TIMEOUT_MS      2000
+
+typedef struct {
+    char name[NAME_SIZE];
+    char unit[UNIT_SIZE];
+    unsigned start;
+    unsigned length;
+    bool bigEndian;
+    bool isSigned;
+    double factor;
+    double offset;
+    bool isMux;             /* The multiplexer of its message.             */
+    long muxValue;          /* -1 if not multiplexed.                      */
+    bool selected;
+    double deadband;
+} Signal;
+
+typedef struct {
+    uint32_t key;
+    char name[NAME_SIZE];
+    Signal *signals;
+    size_t count;
+} Message;
+
+static Message *messages;
+static size_t messageCount;
+
+/* Settings.*/
+static char *selectNames[LIST_MAX];
+static double selectDeadbands[LIST_MAX];
+static bool selectUsed[LIST_MAX];
+static size_t selectCount;
+static uint32_t selectIds[LIST_MAX];
+static size_t selectIdCount;
+static double deadband;
+
+static void *grow(void *p, size_t count, size_t size)
+{
+    p = realloc(p, count * size);
+    if (p == NULL)
+    {
+        perror("candbc");
+        exit(1);
+    }
+
+    return p;
+}
+
+/*===========================================================================*/
+/* DBC file.                                                                 */
+/*===========================================================================*/
+
+/*
+ * BO_ <id> <name>: <dlc> <sender>, bit 31 of the id marks an extended
+ * identifier.
+ */
+static bool parse_message(const char *s)
+{
+    unsigned long id;
+    char name[NAME_SIZE];
+
+    if (sscanf(s, " BO_ %lu %63[^: ]", &id, name) != 2)
+        return false;
+
+    messages = grow(messages, messageCount + 1, sizeof(Message));
+    Message *mp = &messages[messageCount++];
+    memset(mp, 0, sizeof(*mp));
+    if ((id & 0x80000000UL) != 0)
+        mp->key = (uint32_t) (id & CAN_RECORD_ID_MASK) | CAN_RECORD_EXT;
+    else
+        mp->key = (uint32_t) id;
+    strcpy(mp->name, name);
+
+    return true;
+}
+
+/*
+ * SG_ <name> [M|m<n>] : <start>|<length>@<order><sign> (<factor>,<offset>)
+ *     [<min>|<max>] "<unit>" <receivers>
+ */
+static bool parse_signal(const char *s, unsigned lineNumber)
+{
+    Signal sg;
+    char name[NAME_SIZE];
+    char mux[16] = "";
+    char order;
+    char sign;
+    int n = 0;
+
+    if (messageCount == 0)
+        return false;
+    memset(&sg, 0, sizeof(sg));
+    sg.muxValue = -1;
+
+    if (sscanf(s, " SG_ %63s %n", name, &n) != 1)
+        return false;
+    s += n;
+    if (*s != ':')
+    {
+        if (sscanf(s, "%15s %n", mux, &n) != 1)
+            return false;
+        s += n;
+    }
+    if (sscanf(s, ": %u|%u@%c%c (%lf,%lf) %n", &sg.start, &sg.length,
+               &order, &sign, &sg.factor, &sg.offset, &n) != 6)
+    {
+        fprintf(stderr, "candbc: line %u: signal %s not understood\n",
+                lineNumber, name);
+        return false;
+    }
+    s += n;
+    const char *unit = strchr(s, '"');
+    if (unit != NULL)
+        (void) sscanf(unit, "\"%15[^\"]", sg.unit);
+
+    strcpy(sg.name, name);
+    sg.bigEndian = order == '0';
+    sg.isSigned = sign == '-';
+    if (strcmp(mux, "M") == 0)
+        sg.isMux = true;
+    else if (mux[0] == 'm')
+    {
+        char *end;
+
+        sg.muxValue = strtol(mux + 1, &end, 10);
+        if (*end != '\0')
+        {
+            /* m<n>M, a multiplexer multiplexed itself.*/
+            fprintf(stderr, "candbc: line %u: %s: nested multiplexing is "
+                    "not supported, skipped\n", lineNumber, name);
+            return true;
+        }
+    }
+
+    Message *mp = &messages[messageCount - 1];
+    mp->signals = grow(mp->signals, mp->count + 1, sizeof(Signal));
+    mp->signals[mp->count++] = sg;
+
+    return true;
+}
+
+static void read_dbc(const char *path)
+{
+    char buf[1024];
+    unsigned lineNumber = 0;
+    FILE *in = fopen(path, "r");
+
+    if (in == NULL)
+    {
+        perror(path);
+        exit(1);
+    }
+    while (fgets(buf, sizeof(buf), in) != NULL)
+    {
+        const char *s = buf;
+
+        lineNumber++;
+        while (isspace((unsigned char) *s))
+            s++;
+        if (strncmp(s, "BO_ ", 4) == 0)
+            (void) parse_message(s);
+        else if (strncmp(s, "SG_ ", 4) == 0)
+            (void) parse_signal(s, lineNumber);
+    }
+    fclose(in);
+}
+
+/*===========================================================================*/
+/* Selection.                                                                */
+/*===========================================================================*/
+
+static bool id_selected(uint32_t key)
+{
+    for (size_t i = 0; i < selectIdCount; i++)
+    {
+        if (selectIds[i] == (key & CAN_RECORD_ID_MASK))
+            return true;
+    }
+
+    return false;
+}
+
+static void select_signals(void)
+{
+    bool all = selectCount == 0 && selectIdCount == 0;
+
+    for (size_t i = 0; i < messageCount; i++)
+    {
+        Message *mp = &messages[i];
+
+        for (size_t j = 0; j < mp->count; j++)
+        {
+            Signal *sg = &mp->signals[j];
+
+            sg->deadband = deadband;
+            sg->selected = all || id_selected(mp->key);
+            for (size_t k = 0; k < selectCount; k++)
+            {
+                if (strcmp(selectNames[k], sg->name) == 0)
+                {
+                    sg->selected = true;
+                    sg->deadband = selectDeadbands[k];
+                    selectUsed[k] = true;
+                }
+            }
+        }
+    }
+    for (size_t k = 0; k < selectCount; k++)
+    {
+        if (!selectUsed[k])
+            fprintf(stderr, "candbc: no signal %s\n", selectNames[k]);
+    }
+}
+
+/*===========================================================================*/
+/* Table.                                                                    */
+/*===========================================================================*/
+
+static int compare_messages(const void *a, const void *b)
+{
+    const Message *ma = a;
+    const Message *mb = b;
+
+    return ma->key < mb->key ? -1 : ma->key > mb->key;
+}
+
+static bool fits(double value)
+{
+    return fabs(value) <= 2147483647.0;
+}
+
+static bool exact(double value)
+{
+    return fabs(value - round(value)) <= 1e-9 * fmax(1.0, fabs(value));
+}
+
+/*
+ * Fewest decimals that make factor and offset integers, or the most that
+ * fit if none does.
+ */
+static unsigned pick_decimals(const Signal *sg)
+{
+    unsigned best = 0;
+
+    for (unsigned d = 0; d <= 9; d++)
+    {
+        double scale = pow(10.0, d);
+        double factor = sg->factor * scale;
+        double offset = sg->offset * scale;
+
+        if (!fits(factor) || !fits(offset))
+            break;
+        best = d;
+        if (exact(factor) && exact(offset))
+            return d;
+    }
+    fprintf(stderr, "candbc: %s: factor %g offset %g rounded to %u "
+            "decimals\n", sg->name, sg->factor, sg->offset, best);
+
+    return best;
+}
+
+static bool compile_signal(const Signal *sg, bool hidden, CanSignalDef *dp)
+{
+    unsigned shift = sg->start;
+
+    if (sg->length == 0 || sg->length > 32)
+    {
+        fprintf(stderr, "candbc: %s: %u bits, at most 32 are supported\n",
+                sg->name, sg->length);
+        return false;
+    }
+    if (sg->bigEndian)
+    {
+        /* Start bit is the most significant, bit 7 of byte 0 is the top
+           of the big endian word.*/
+        unsigned top = (7U - sg->start / 8U) * 8U + sg->start % 8U;
+
+        if (top + 1U < sg->length)
+        {
+            fprintf(stderr, "candbc: %s: beyond the payload\n", sg->name);
+            return false;
+        }
+        shift = top + 1U - sg->length;
+    }
+    if (shift + sg->length > 64)
+    {
+        fprintf(stderr, "candbc: %s: beyond the payload\n", sg->name);
+        return false;
+    }
+
+    unsigned decimals = pick_decimals(sg);
+    double scale = pow(10.0, decimals);
+
+    memset(dp, 0, sizeof(*dp));
+    dp->shift = (uint8_t) shift;
+    dp->length = (uint8_t) sg->length;
+    dp->flags = (sg->bigEndian ? CAN_SIGNAL_BIG_ENDIAN : 0) |
+                (sg->isSigned ? CAN_SIGNAL_SIGNED : 0) |
+                (hidden ? CAN_SIGNAL_HIDDEN : 0);
+    dp->decimals = (uint8_t) decimals;
+    dp->factor = (int32_t) lround(sg->factor * scale);
+    dp->offset = (int32_t) lround(sg->offset * scale);
+    if (sg->factor != 0 && sg->deadband > 0)
+        dp->deadband = (uint32_t) ceil(sg->deadband / fabs(sg->factor)
+                                       - 1e-9);
+    dp->mux = sg->muxValue < 0 ? CAN_SIGNAL_NO_MUX16 :
+              (uint16_t) sg->muxValue;
+
+    return true;
+}
+
+/*
+ * Builds the table and prints the signal list. Returns its size.
+ */
+static size_t compile(uint32_t *table, size_t size)
+{
+    CanSignalHeader *hp = (CanSignalHeader *) table;
+    CanSignalMessage *out = (CanSignalMessage *) (hp + 1);
+    size_t outCount = 0;
+    size_t signalCount = 0;
+
+    qsort(messages, messageCount, sizeof(Message), compare_messages);
+    for (size_t i = 0; i < messageCount; i++)
+    {
+        const Message *mp = &messages[i];
+
+        for (size_t j = 0; j < mp->count; j++)
+        {
+            if (mp->signals[j].selected)
+            {
+                outCount++;
+                break;
+            }
+        }
+    }
+    if (outCount > 255)
+    {
+        fprintf(stderr, "candbc: more than 255 messages\n");
+        exit(1);
+    }
+    CanSignalDef *defs = (CanSignalDef *) (out + outCount);
+
+    outCount = 0;
+    for (size_t i = 0; i < messageCount; i++)
+    {
+        const Message *mp = &messages[i];
+        bool any = false;
+        bool muxed = false;
+
+        for (size_t j = 0; j < mp->count; j++)
+        {
+            any |= mp->signals[j].selected;
+            muxed |= mp->signals[j].selected &&
+                     mp->signals[j].muxValue >= 0;
+        }
+        if (!any)
+            continue;
+        if (i > 0 && mp->key == messages[i - 1].key)
+        {
+            fprintf(stderr, "candbc: %s: identifier defined twice\n",
+                    mp->name);
+            exit(1);
+        }
+
+        CanSignalMessage *op = &out[outCount++];
+        op->key = mp->key;
+        op->first = (uint16_t) signalCount;
+        op->count = 0;
+        op->mux = CAN_SIGNAL_NO_MUX8;
+        for (size_t j = 0; j < mp->count; j++)
+        {
+            const Signal *sg = &mp->signals[j];
+            bool take = sg->selected || (muxed && sg->isMux);
+
+            if (!take)
+                continue;
+            if (op->count == CAN_SIGNAL_PER_MESSAGE)
+            {
+                fprintf(stderr, "candbc: %s: more than %u signals\n",
+                        mp->name, CAN_SIGNAL_PER_MESSAGE);
+                exit(1);
+            }
+            if ((uint8_t *) &defs[signalCount + 1] > (uint8_t *) table + size)
+            {
+                fprintf(stderr, "candbc: table larger than %zu bytes\n",
+                        size);
+                exit(1);
+            }
+            if (!compile_signal(sg, !sg->selected, &defs[signalCount]))
+                exit(1);
+            if (sg->isMux)
+                op->mux = op->count;
+            if (sg->selected)
+                printf("%zu %0*lX %s.%s%s%s\n", signalCount,
+                       (mp->key & CAN_RECORD_EXT) != 0 ? 8 : 3,
+                       (unsigned long) (mp->key & CAN_RECORD_ID_MASK),
+                       mp->name, sg->name, sg->unit[0] != '\0' ? " " : "",
+                       sg->unit);
+            op->count++;
+            signalCount++;
+        }
+        if (muxed && op->mux == CAN_SIGNAL_NO_MUX8)
+        {
+            fprintf(stderr, "candbc: %s: multiplexed signals without a "
+                    "multiplexer\n", mp->name);
+            exit(1);
+        }
+    }
+
+    hp->magic[0] = CAN_SIGNAL_MAGIC0;
+    hp->magic[1] = CAN_SIGNAL_MAGIC1;
+    hp->version = CAN_SIGNAL_VERSION;
+    hp->messages = (uint8_t) outCount;
+    hp->signals = (uint16_t) signalCount;
+    hp->reserved = 0;
+
+    return (uint8_t *) (defs + signalCount) - (uint8_t *) table;
+}
+
+/*===========================================================================*/
+/* Device.                                                                   */
+/*===========================================================================*/
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000U + (uint64_t) ts.tv_nsec / 1000000U;
+}
+
+/*
+ * Sends a command and waits for its acknowledge, other lines are skipped.
+ */
+static bool command(int fd, const char *text, const char *name)
+{
+    char buf[128];
+    char line[256];
+    size_t length = 0;
+    int n = snprintf(buf, sizeof(buf), "%s\r", text);
+    uint64_t deadline = now_ms() + ACK_TIMEOUT_MS;
+
+    if (write(fd, buf, (size_t) n) != n)
+    {
+        perror("candbc: write");
+        return false;
+    }
+    while (now_ms() < deadline)
+    {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        char c;
+
+        if (poll(&pfd, 1, 100) <= 0 || read(fd, &c, 1) != 1)
+            continue;
+        if (c != '\n')
+        {
+            if (c != '\r' && length < sizeof(line) - 1)
+                line[length++] = c;
+            continue;
+        }
+        line[length] = '\0';
+        length = 0;
+
+        char ackName[32];
+        char result[16];
+        if (sscanf(line, "# ack %*s %31s %15s", ackName, result) != 2 ||
+            strcmp(ackName, name) != 0)
+            continue;
+        if (strcmp(result, "ok") == 0)
+            return true;
+        fprintf(stderr, "candbc: %s: %s\n", text, line);
+        return false;
+    }
+    fprintf(stderr, "candbc: %s: no acknowledge\n", text);
+
+    return false;
+}
+
+static bool load(const char *device, const uint32_t *table, size_t size)
+{
+    const uint8_t *bytes = (const uint8_t *) table;
+    char text[128];
+    uint32_t sum = 0;
+    int fd = open(device, O_RDWR | O_NOCTTY);
+
+    if (fd < 0)
+    {
+        perror(device);
+        return false;
+    }
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0)
+    {
+        cfmakeraw(&tio);
+        (void) tcsetattr(fd, TCSANOW, &tio);
+        (void) tcflush(fd, TCIOFLUSH);
+    }
+
+    /* Acknowledges are read as lines.*/
+    (void) command(fd, "output text", "output");
+    for (size_t i = 0; i < size; i++)
+        sum += bytes[i];
+    for (size_t offset = 0; offset < size; offset += 12)
+    {
+        int n = snprintf(text, sizeof(text), "sigload %zu", offset);
+
+        for (size_t i = offset; i < offset + 12 && i < size; i += 4)
+            n += snprintf(text + n, sizeof(text) - n, " %lu",
+                          (unsigned long) table[i / 4]);
+        if (!command(fd, text, "sigload"))
+        {
+            close(fd);
+            return false;
+        }
+    }
+    snprintf(text, sizeof(text), "sigcommit %zu %lu", size,
+             (unsigned long) sum);
+    bool ok = command(fd, text, "sigcommit");
+    close(fd);
+
+    return ok;
+}
+
+/*===========================================================================*/
+/* Main.                                                                     */
+/*===========================================================================*/
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: candbc [-s signal[=deadband],...] [-m id,...] "
+            "[-d deadband] [-o table] [-w device] file.dbc\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *output = NULL;
+    const char *device = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:m:d:o:w:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            for (char *p = strtok(optarg, ","); p != NULL &&
+                 selectCount < LIST_MAX; p = strtok(NULL, ","))
+            {
+                char *value = strchr(p, '=');
+
+                selectDeadbands[selectCount] = -1;
+                if (value != NULL)
+                {
+                    *value++ = '\0';
+                    selectDeadbands[selectCount] = strtod(value, NULL);
+                }
+                selectNames[selectCount++] = p;
+            }
+            break;
+        case 'm':
+            for (char *p = strtok(optarg, ","); p != NULL &&
+                 selectIdCount < LIST_MAX; p = strtok(NULL, ","))
+                selectIds[selectIdCount++] = (uint32_t) strtoul(p, NULL, 0);
+            break;
+        case 'd':
+            deadband = strtod(optarg, NULL);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'w':
+            device = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind != argc - 1)
+        usage();
+    /* A signal without its own deadband takes the one of -d.*/
+    for (size_t k = 0; k < selectCount; k++)
+    {
+        if (selectDeadbands[k] < 0)
+            selectDeadbands[k] = deadband;
+    }
+
+    read_dbc(argv[optind]);
+    select_signals();
+
+    static uint32_t table[65536 / 4];
+    const CanSignalHeader *header = (const void *) table;
+    size_t size = compile(table, sizeof(table));
+    fprintf(stderr, "candbc: %u messages, %u signals, %zu bytes\n",
+            header->messages, header->signals, size);
+
+    /* The decoder checks the table as the device will.*/
+    CanSignalTable check;
+    CanSignalState *state = grow(NULL, CAN_SIGNAL_NO_MUX16,
+                                 sizeof(CanSignalState));
+    if (!can_signal_load(&check, table, size, state, CAN_SIGNAL_NO_MUX16))
+    {
+        fprintf(stderr, "candbc: table rejected by the decoder\n");
+        return 1;
+    }
+    free(state);
+
+    if (output != NULL)
+    {
+        FILE *out = fopen(output, "wb");
+
+        if (out == NULL || fwrite(table, 1, size, out) != size)
+        {
+            perror(output);
+            return 1;
+        }
+        fclose(out);
+    }
+    if (device != NULL && !load(device, table, size))
+        return 1;
+
+    return 0;
+}
@@ -0,0 +1,217 @@
+/**
+ * @file    tools/candecode/candecode.c
+ * @brief   Host decoder for the compressed output stream.
+ * @details Reads the stream from a file or stdin and prints the frames in
+ *          candump log format, marker lines as sent by the device.
+ *          With adaptive output the device switches between text and
+ *          compressed output. Text is passed through until a sync byte
+ *          shows up, a "# mode full" marker switches back to text.
+ *          Bus events are printed as SocketCAN error frames, like candump
+ *          does, transmit echoes, decoded signals, cell alerts and ISO-TP
+ *          messages as the marker lines of the text output.
+ *
+ *          Usage: candecode [file] [interface]
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "can_codec.h"
+#include "can_event.h"
+#include "can_echo.h"
+#include "can_signal.h"
+#include "can_bms.h"
+#include "can_isotp.h"
+#include "can_j1939.h"
+
+#define MODE_FULL_MARKER "# mode full"
+
+static CanDecoder decoder;
+static char line[256];
+static size_t lineLength;
+
+static void print_isotp(const CanIsoTpRecord *isotp, uint32_t timestamp)
+{
+    if (isotp->type == CAN_ISOTP_RECORD_START)
+    {
+        printf("# isotp %u %lx %s len=%u ", isotp->counter,
+                (unsigned long) (isotp->key & CAN_RECORD_ID_MASK),
+                (isotp->key & CAN_RECORD_EXT) != 0 ? "ext" : "std",
+                isotp->length);
+        if (isotp->channel == CAN_ISOTP_PASSIVE)
+            printf("sniffed");
+        else
+            printf("ch=%u", isotp->channel);
+        printf(" @%lu\n", (unsigned long) timestamp);
+    }
+    else if (isotp->type == CAN_ISOTP_RECORD_DATA)
+    {
+        printf("# isotp %u data ", isotp->counter);
+        for (unsigned i = 0; i < 7; i++)
+            printf("%02x", isotp->data[i]);
+        printf("\n");
+    }
+    else
+        printf("# isotp sent %lu ch=%u %s @%lu\n",
+                (unsigned long) isotp->result.cookie, isotp->result.channel,
+                can_isotp_result_name(isotp->result.result),
+                (unsigned long) timestamp);
+}
+
+static void print_j1939(const CanJ1939Record *j1939, uint32_t timestamp)
+{
+    if (j1939->type == CAN_J1939_RECORD_START)
+        printf("# j1939 %u pgn=%05lx pri=%u sa=%02x da=%02x len=%u @%lu\n",
+                j1939->counter, (unsigned long) j1939->pgn, j1939->priority,
+                j1939->sa, j1939->da, j1939->length,
+                (unsigned long) timestamp);
+    else
+    {
+        printf("# j1939 %u data ", j1939->counter);
+        for (unsigned i = 0; i < 7; i++)
+            printf("%02x", j1939->data[i]);
+        printf("\n");
+    }
+}
+
+static void print_frame(const char *ifname, const CanRecord *record)
+{
+    uint8_t data[8];
+    uint8_t dlc = can_record_get_data(record, data);
+    CanEvent event;
+    CanEcho echo;
+    CanSignalValue value;
+    CanBmsAlert alert;
+    CanIsoTpRecord isotp;
+    CanJ1939Record j1939;
+    char text[CAN_SIGNAL_TEXT_SIZE];
+
+    if (can_signal_from_record(record, &value))
+    {
+        (void) can_signal_format(&value, text);
+        printf("# sig %u %s @%lu\n", value.index, text,
+                (unsigned long) record->timestamp);
+        return;
+    }
+    if (can_bms_alert_from_record(record, &alert))
+    {
+        if (alert.module == CAN_BMS_PACK)
+            snprintf(text, sizeof(text), "pack");
+        else if (alert.cell == CAN_BMS_NO_CELL)
+            snprintf(text, sizeof(text), "m%u", alert.module);
+        else
+            snprintf(text, sizeof(text), "m%uc%u", alert.module, alert.cell);
+        printf("# bms %s %s %s %s %d limit=%d @%lu\n",
+                alert.cleared ? "clear" : "alert",
+                can_bms_kind_name(alert.kind),
+                can_bms_condition_name(alert.condition), text, alert.value,
+                alert.limit, (unsigned long) record->timestamp);
+        return;
+    }
+    if (can_isotp_from_record(record, &isotp))
+    {
+        print_isotp(&isotp, record->timestamp);
+        return;
+    }
+    if (can_j1939_from_record(record, &j1939))
+    {
+        print_j1939(&j1939, record->timestamp);
+        return;
+    }
+    if (can_echo_from_record(record, &echo))
+    {
+        printf("# echo %lu @%lu %s delay=%luus\n", (unsigned long) echo.cookie,
+                (unsigned long) record->timestamp,
+                can_echo_status_name(echo.status), (unsigned long) echo.delay);
+        return;
+    }
+
+    printf("(%lu.%06lu) %s ", (unsigned long) (record->timestamp / 1000000),
+            (unsigned long) (record->timestamp % 1000000), ifname);
+    if (can_event_from_record(record, &event))
+    {
+        printf("%08lX#", (unsigned long) can_event_socketcan(&event, data));
+        dlc = 8;
+    }
+    else if (CAN_RECORD_IS_EXT(record))
+        printf("%08lX#", (unsigned long) CAN_RECORD_GET_ID(record));
+    else
+        printf("%03lX#", (unsigned long) CAN_RECORD_GET_ID(record));
+
+    if (CAN_RECORD_IS_RTR(record))
+    {
+        printf("R\n");
+        return;
+    }
+    for (uint8_t i = 0; i < dlc; i++)
+        printf("%02X", data[i]);
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *in = stdin;
+    const char *ifname = argc > 2 ? argv[2] : "can0";
+    bool text = true;
+    int c;
+
+    if (argc > 1 && strcmp(argv[1], "-") != 0)
+    {
+        in = fopen(argv[1], "rb");
+        if (in == NULL)
+        {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+
+    can_decoder_init(&decoder);
+    while ((c = getc(in)) != EOF)
+    {
+        if (text && c != CAN_CODEC_TAG_SYNC)
+        {
+            if (c == '\n' || lineLength == sizeof(line) - 1)
+            {
+                line[lineLength] = '\0';
+                printf("%s\n", line);
+                lineLength = 0;
+            }
+            else if (c != '\r')
+            {
+                line[lineLength++] = (char) c;
+            }
+            continue;
+        }
+        text = false;
+
+        switch (can_decoder_feed(&decoder, (uint8_t) c))
+        {
+        case CAN_CODEC_FRAME:
+            print_frame(ifname, &decoder.record);
+            break;
+        case CAN_CODEC_LOST:
+            printf("# lost %lu\n", (unsigned long) decoder.lost);
+            break;
+        case CAN_CODEC_TEXT:
+            printf("%s\n", decoder.text);
+            if (strncmp(decoder.text, MODE_FULL_MARKER,
+                    strlen(MODE_FULL_MARKER)) == 0)
+            {
+                text = true;
+                can_decoder_init(&decoder);
+            }
+            break;
+        case CAN_CODEC_ERROR:
+            fprintf(stderr, "candecode: stream corrupt, waiting for sync\n");
+            break;
+        default:
+            break;
+        }
+        fflush(stdout);
+    }
+
+    if (in != stdin)
+        fclose(in);
+
+    return decoder.errors != 0 ? 2 : 0;
+}